@@ -0,0 +1,82 @@
+#include "arena.h"
+#include "log.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCRATCH_ARENA_CAPACITY (4 << 20)
+
+bool arena_init(arena *a, usize capacity) {
+  a->base = malloc(capacity);
+  if (!a->base) {
+    LOG_ERROR("unable to allocate arena backing memory of %zu bytes",
+              capacity);
+    return false;
+  }
+
+  a->size = 0;
+  a->capacity = capacity;
+  return true;
+}
+
+void arena_free(arena *a) {
+  free(a->base);
+  a->base = NULL;
+  a->size = a->capacity = 0;
+}
+
+void *arena_push(arena *a, usize size, usize align) {
+  assert(align > 0 && (align & (align - 1)) == 0);
+  usize offset = (a->size + align - 1) & ~(align - 1);
+  if (offset > a->capacity || size > a->capacity - offset) {
+    LOG_ERROR("arena out of memory (requested %zu bytes, %zu/%zu used)", size,
+              a->size, a->capacity);
+    return NULL;
+  }
+
+  a->size = offset + size;
+  return &a->base[offset];
+}
+
+void *arena_push_zero(arena *a, usize size, usize align) {
+  void *p = arena_push(a, size, align);
+  if (p) {
+    memset(p, 0, size);
+  }
+
+  return p;
+}
+
+char *arena_strdup(arena *a, const char *str) {
+  usize len = strlen(str);
+  char *p = arena_push(a, len + 1, 1);
+  if (p) {
+    memcpy(p, str, len + 1);
+  }
+
+  return p;
+}
+
+arena_marker arena_mark(const arena *a) { return a->size; }
+
+void arena_pop(arena *a, arena_marker marker) {
+  assert(marker <= a->size);
+  a->size = marker;
+}
+
+void arena_reset(arena *a) { a->size = 0; }
+
+static _Thread_local arena scratch;
+
+arena *scratch_arena(void) {
+  if (!scratch.base && !arena_init(&scratch, SCRATCH_ARENA_CAPACITY)) {
+    return NULL;
+  }
+
+  return &scratch;
+}
+
+void scratch_arena_free(void) {
+  assert(scratch.size == 0 && "scratch arena freed with live allocations");
+  arena_free(&scratch);
+}
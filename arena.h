@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types.h"
+#include <stdalign.h>
+
+// linear allocator backed by a single fixed-capacity block, allocations are
+// released in bulk by popping back to a marker or resetting the arena
+typedef struct {
+  u8 *base;
+  usize size;
+  usize capacity;
+} arena;
+
+typedef usize arena_marker;
+
+bool arena_init(arena *a, usize capacity);
+void arena_free(arena *a);
+
+void *arena_push(arena *a, usize size, usize align);
+void *arena_push_zero(arena *a, usize size, usize align);
+char *arena_strdup(arena *a, const char *str);
+arena_marker arena_mark(const arena *a);
+void arena_pop(arena *a, arena_marker marker);
+void arena_reset(arena *a);
+
+#define arena_push_array(a, type, count)                                       \
+  ((type *)arena_push((a), sizeof(type) * (count), alignof(type)))
+
+// per-thread scratch arena for short-lived temporaries, the caller is
+// responsible for restoring the marker it took before returning
+arena *scratch_arena(void);
+void scratch_arena_free(void);
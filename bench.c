@@ -0,0 +1,266 @@
+#include "bench.h"
+#include "log.h"
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// differences this small are noise, even if large relative to the baseline
+#define BENCH_MIN_REGRESSION_MS 0.05
+
+const char *frame_stage_names[frame_stage_count] = {
+    "frame",  "fence_wait", "reload",  "acquire",
+    "upload", "record",     "submit",  "present",
+};
+
+const double bench_histogram_le_ms[BENCH_HISTOGRAM_BUCKETS - 1] = {
+    0.0625, 0.125, 0.25, 0.5, 1.0, 2.0, 4.0, 8.0, 16.0, 33.0, 66.0,
+};
+
+bool bench_init(u32 warmup_frames, u32 measured_frames, bench *b) {
+  b->warmup_frames = warmup_frames;
+  b->measured_frames = measured_frames;
+  b->num_recorded = 0;
+  b->num_metrics = 0;
+  b->samples = malloc(sizeof(*b->samples) * frame_stage_count *
+                      (measured_frames > 0 ? measured_frames : 1));
+  if (!b->samples) {
+    LOG_ERROR("unable to allocate benchmark samples");
+    return false;
+  }
+
+  return true;
+}
+
+void bench_free(bench *b) { free(b->samples); }
+
+static int compare_u64(const void *lhs, const void *rhs) {
+  u64 l = *(const u64 *)lhs, r = *(const u64 *)rhs;
+  return (l > r) - (l < r);
+}
+
+void bench_record(bench *b, u64 frame, const frame_timings *t) {
+  if (frame < b->warmup_frames || bench_complete(b)) {
+    return;
+  }
+
+  for (i32 i = 0; i < frame_stage_count; ++i) {
+    b->samples[i * b->measured_frames + b->num_recorded] = t->ns[i];
+  }
+  ++b->num_recorded;
+
+  // the order of the samples is not needed once the run is complete
+  for (i32 i = 0; bench_complete(b) && i < frame_stage_count; ++i) {
+    qsort(&b->samples[i * b->measured_frames], b->num_recorded,
+          sizeof(*b->samples), compare_u64);
+  }
+}
+
+bool bench_complete(const bench *b) {
+  return b->num_recorded == b->measured_frames;
+}
+
+// nearest rank on sorted samples
+static double percentile_ms(const u64 *sorted, u32 n, double p) {
+  if (n == 0) {
+    return 0.0;
+  }
+
+  u32 rank = (u32)ceil(p / 100.0 * n);
+  return sorted[rank > 0 ? rank - 1 : 0] / 1e6;
+}
+
+bench_percentiles bench_stage_percentiles(const bench *b, frame_stage stage) {
+  const u64 *samples = &b->samples[stage * b->measured_frames];
+  u32 n = b->num_recorded;
+  return (bench_percentiles){
+      .p50_ms = percentile_ms(samples, n, 50),
+      .p90_ms = percentile_ms(samples, n, 90),
+      .p99_ms = percentile_ms(samples, n, 99),
+      .max_ms = n > 0 ? samples[n - 1] / 1e6 : 0.0,
+  };
+}
+
+void bench_stage_histogram(const bench *b, frame_stage stage,
+                           u32 counts[BENCH_HISTOGRAM_BUCKETS]) {
+  const u64 *samples = &b->samples[stage * b->measured_frames];
+  i32 bucket = 0;
+  memset(counts, 0, sizeof(*counts) * BENCH_HISTOGRAM_BUCKETS);
+  for (u32 i = 0; i < b->num_recorded; ++i) {
+    while (bucket < BENCH_HISTOGRAM_BUCKETS - 1 &&
+           samples[i] / 1e6 > bench_histogram_le_ms[bucket]) {
+      ++bucket;
+    }
+    ++counts[bucket];
+  }
+}
+
+void bench_set_metric(bench *b, const char *name, double value) {
+  u32 i = 0;
+  while (i < b->num_metrics && strcmp(b->metrics[i].name, name) != 0) {
+    ++i;
+  }
+  if (i == BENCH_MAX_METRICS) {
+    LOG_WARN("too many benchmark metrics, '%s' dropped", name);
+    return;
+  }
+
+  snprintf(b->metrics[i].name, sizeof(b->metrics[i].name), "%s", name);
+  b->metrics[i].value = value;
+  if (i == b->num_metrics) {
+    ++b->num_metrics;
+  }
+}
+
+void bench_log(const bench *b) {
+  LOG_INFO("benchmark: %" PRIu32 " frames after %" PRIu32 " warmup frames",
+           b->num_recorded, b->warmup_frames);
+  for (i32 i = 0; i < frame_stage_count; ++i) {
+    bench_percentiles p = bench_stage_percentiles(b, i);
+    LOG_INFO("  %-10s p50 %8.3fms  p90 %8.3fms  p99 %8.3fms  max %8.3fms",
+             frame_stage_names[i], p.p50_ms, p.p90_ms, p.p99_ms, p.max_ms);
+  }
+}
+
+bool bench_write_json(const bench *b, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    LOG_ERROR("unable to open '%s' for writing: %s", path, strerror(errno));
+    return false;
+  }
+
+  fprintf(file, "{\n  \"warmup_frames\": %" PRIu32 ",\n", b->warmup_frames);
+  fprintf(file, "  \"measured_frames\": %" PRIu32 ",\n", b->num_recorded);
+  // each stage's histogram has one more count than there are bounds, for
+  // the samples above the last one
+  fprintf(file, "  \"histogram_le_ms\": [");
+  for (i32 i = 0; i < BENCH_HISTOGRAM_BUCKETS - 1; ++i) {
+    fprintf(file, "%s%g", i > 0 ? ", " : "", bench_histogram_le_ms[i]);
+  }
+  fprintf(file, "],\n  \"stages\": {\n");
+  for (i32 i = 0; i < frame_stage_count; ++i) {
+    bench_percentiles p = bench_stage_percentiles(b, i);
+    u32 counts[BENCH_HISTOGRAM_BUCKETS];
+    bench_stage_histogram(b, i, counts);
+    fprintf(file,
+            "    \"%s\": {\"p50_ms\": %.6f, \"p90_ms\": %.6f, "
+            "\"p99_ms\": %.6f, \"max_ms\": %.6f, \"histogram\": [",
+            frame_stage_names[i], p.p50_ms, p.p90_ms, p.p99_ms, p.max_ms);
+    for (i32 j = 0; j < BENCH_HISTOGRAM_BUCKETS; ++j) {
+      fprintf(file, "%s%" PRIu32, j > 0 ? ", " : "", counts[j]);
+    }
+    fprintf(file, "]}%s\n", i + 1 < frame_stage_count ? "," : "");
+  }
+  fprintf(file, "  },\n  \"metrics\": {\n");
+  for (u32 i = 0; i < b->num_metrics; ++i) {
+    fprintf(file, "    \"%s\": %.6f%s\n", b->metrics[i].name,
+            b->metrics[i].value, i + 1 < b->num_metrics ? "," : "");
+  }
+  fprintf(file, "  }\n}\n");
+
+  if (fclose(file) != 0) {
+    LOG_ERROR("unable to write '%s': %s", path, strerror(errno));
+    return false;
+  }
+
+  LOG_INFO("benchmark results written to '%s'", path);
+  return true;
+}
+
+// only understands the layout written by bench_write_json: finds the stage's
+// key, then each field after it
+static bool parse_stage(const char *json, const char *stage,
+                        bench_percentiles *p) {
+  char key[64];
+  snprintf(key, sizeof(key), "\"%s\":", stage);
+  const char *s = strstr(json, key);
+  if (!s) {
+    return false;
+  }
+
+  struct {
+    const char *name;
+    double *value;
+  } fields[] = {
+      {"\"p50_ms\":", &p->p50_ms},
+      {"\"p90_ms\":", &p->p90_ms},
+      {"\"p99_ms\":", &p->p99_ms},
+      {"\"max_ms\":", &p->max_ms},
+  };
+  const char *end = strchr(s, '}');
+  for (usize i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+    const char *f = strstr(s, fields[i].name);
+    if (!f || !end || f > end) {
+      return false;
+    }
+    *fields[i].value = strtod(f + strlen(fields[i].name), NULL);
+  }
+
+  return true;
+}
+
+static bool check_regression(const char *stage, const char *name,
+                             double current, double baseline,
+                             double tolerance) {
+  if (current <= baseline * (1.0 + tolerance) ||
+      current - baseline < BENCH_MIN_REGRESSION_MS) {
+    return false;
+  }
+
+  LOG_WARN("benchmark regression: %s %s %.3fms, baseline %.3fms (%+.1f%%)",
+           stage, name, current, baseline,
+           baseline > 0.0 ? (current / baseline - 1.0) * 100.0 : 100.0);
+  return true;
+}
+
+bool bench_compare(const bench *b, const char *baseline_path,
+                   double tolerance) {
+  FILE *file = fopen(baseline_path, "rb");
+  if (!file) {
+    LOG_ERROR("unable to open benchmark baseline '%s': %s", baseline_path,
+              strerror(errno));
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long len = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *json = len >= 0 ? malloc(len + 1) : NULL;
+  bool read = json && fread(json, 1, len, file) == (usize)len;
+  fclose(file);
+  if (!read) {
+    LOG_ERROR("unable to read benchmark baseline '%s'", baseline_path);
+    free(json);
+    return false;
+  }
+  json[len] = '\0';
+
+  i32 num_regressions = 0;
+  for (i32 i = 0; i < frame_stage_count; ++i) {
+    // baselines from before a stage was added are still usable
+    bench_percentiles baseline;
+    if (!parse_stage(json, frame_stage_names[i], &baseline)) {
+      LOG_WARN("benchmark baseline '%s' has no stage '%s'", baseline_path,
+               frame_stage_names[i]);
+      continue;
+    }
+
+    bench_percentiles p = bench_stage_percentiles(b, i);
+    const char *stage = frame_stage_names[i];
+    num_regressions +=
+        check_regression(stage, "p50", p.p50_ms, baseline.p50_ms, tolerance);
+    num_regressions +=
+        check_regression(stage, "p90", p.p90_ms, baseline.p90_ms, tolerance);
+    num_regressions +=
+        check_regression(stage, "p99", p.p99_ms, baseline.p99_ms, tolerance);
+  }
+  free(json);
+
+  if (num_regressions == 0) {
+    LOG_INFO("benchmark within %.0f%% of baseline '%s'", tolerance * 100.0,
+             baseline_path);
+  }
+  return num_regressions == 0;
+}
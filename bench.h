@@ -0,0 +1,79 @@
+#pragma once
+
+#include "types.h"
+
+// stages of a frame on the render thread, each timed separately
+typedef enum {
+  frame_stage_total,
+  frame_stage_fence_wait,
+  // file watch poll, swapping in hot reloaded pipelines and assets and
+  // swapchain recreation
+  frame_stage_reload,
+  frame_stage_acquire,
+  // uniform buffer writes
+  frame_stage_upload,
+  frame_stage_record,
+  frame_stage_submit,
+  frame_stage_present,
+  frame_stage_count,
+} frame_stage;
+
+extern const char *frame_stage_names[frame_stage_count];
+
+typedef struct {
+  u64 ns[frame_stage_count];
+} frame_timings;
+
+#define BENCH_MAX_METRICS 64
+#define BENCH_METRIC_NAME_LEN 64
+
+// other results of the run written along with the frame times
+typedef struct {
+  char name[BENCH_METRIC_NAME_LEN];
+  double value;
+} bench_metric;
+
+// the last bucket of the stage histograms has no upper bound
+#define BENCH_HISTOGRAM_BUCKETS 12
+extern const double bench_histogram_le_ms[BENCH_HISTOGRAM_BUCKETS - 1];
+
+typedef struct {
+  double p50_ms;
+  double p90_ms;
+  double p99_ms;
+  double max_ms;
+} bench_percentiles;
+
+// collects the timings of a fixed number of frames after a warmup
+typedef struct {
+  u32 warmup_frames;
+  u32 measured_frames;
+  u32 num_recorded;
+  // measured_frames samples per stage, sorted once the run is complete
+  u64 *samples;
+  bench_metric metrics[BENCH_MAX_METRICS];
+  u32 num_metrics;
+} bench;
+
+bool bench_init(u32 warmup_frames, u32 measured_frames, bench *b);
+void bench_free(bench *b);
+
+// frame counts from 0 at the first frame, the warmup frames are dropped
+void bench_record(bench *b, u64 frame, const frame_timings *t);
+bool bench_complete(const bench *b);
+// the results are only valid once the run is complete
+bench_percentiles bench_stage_percentiles(const bench *b, frame_stage stage);
+// counts the samples of stage per bucket, not cumulatively
+void bench_stage_histogram(const bench *b, frame_stage stage,
+                           u32 counts[BENCH_HISTOGRAM_BUCKETS]);
+// adds or replaces a metric, which is only written, not compared
+void bench_set_metric(bench *b, const char *name, double value);
+
+// logs the percentiles of every stage
+void bench_log(const bench *b);
+bool bench_write_json(const bench *b, const char *path);
+// compares with a file written by bench_write_json, a p50, p90 or p99 more
+// than tolerance (relative) above the baseline's is a regression; returns
+// false if there are any or the baseline cannot be read
+bool bench_compare(const bench *b, const char *baseline_path,
+                   double tolerance);
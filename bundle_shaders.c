@@ -0,0 +1,149 @@
+// compiles shaders ahead of time into a bundle which SHADER_BUNDLE builds load
+// instead of linking shaderc, usage:
+//   bundle_shaders <output> <file>[:KEYWORD,KEYWORD=VALUE...]...
+#include "arena.h"
+#include "file.h"
+#include "log.h"
+#include "shader.h"
+#include "shader_bundle.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BUNDLE_ARENA_CAPACITY (64 << 20)
+
+typedef struct {
+  shader_bundle_entry entry;
+  const u32 *code;
+} bundle_item;
+
+static int bundle_item_compare(const void *a, const void *b) {
+  u64 key_a = ((const bundle_item *)a)->entry.key;
+  u64 key_b = ((const bundle_item *)b)->entry.key;
+  return (key_a > key_b) - (key_a < key_b);
+}
+
+// splits "file:KW1,KW2" in place into the filename and its variant
+static const char *parse_variant(char *arg, shader_variant *variant) {
+  *variant = (shader_variant){0};
+  char *keywords = strchr(arg, ':');
+  if (!keywords) {
+    return arg;
+  }
+
+  *keywords++ = '\0';
+  for (char *kw = strtok(keywords, ","); kw; kw = strtok(NULL, ",")) {
+    if (variant->num_keywords == SHADER_MAX_KEYWORDS) {
+      LOG_ERROR("too many keywords for shader '%s'", arg);
+      return NULL;
+    }
+    variant->keywords[variant->num_keywords++] = kw;
+  }
+  return arg;
+}
+
+static bool bundle_write(const char *path, i32 num_items, bundle_item *items,
+                         arena *scratch) {
+  qsort(items, num_items, sizeof(*items), bundle_item_compare);
+  usize offset =
+      sizeof(shader_bundle_header) + num_items * sizeof(shader_bundle_entry);
+  for (i32 i = 0; i < num_items; ++i) {
+    if (i > 0 && items[i - 1].entry.key == items[i].entry.key) {
+      LOG_ERROR("shader variant listed twice");
+      return false;
+    }
+    items[i].entry.offset = offset;
+    offset += (items[i].entry.len + 3) & ~3u;
+  }
+
+  usize data_len = offset - sizeof(shader_bundle_header);
+  u8 *data = arena_push_zero(scratch, data_len, alignof(u64));
+  if (!data) {
+    return false;
+  }
+
+  for (i32 i = 0; i < num_items; ++i) {
+    memcpy(&data[i * sizeof(shader_bundle_entry)], &items[i].entry,
+           sizeof(shader_bundle_entry));
+    memcpy(&data[items[i].entry.offset - sizeof(shader_bundle_header)],
+           items[i].code, items[i].entry.len);
+  }
+
+  shader_bundle_header header = {
+      .magic = SHADER_BUNDLE_MAGIC,
+      .version = SHADER_BUNDLE_VERSION,
+      .num_entries = num_items,
+  };
+  if (!file_write_atomic(path, &header, sizeof(header), data, data_len)) {
+    return false;
+  }
+
+  LOG_INFO("bundled %" PRIi32 " shader(s), %zu bytes into '%s'", num_items,
+           offset, path);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  logger_initConsoleLogger(stderr);
+  logger_setLevel(LogLevel_INFO);
+
+  if (argc < 3) {
+    LOG_ERROR("usage: %s <output> <file>[:KEYWORD,...]...", argv[0]);
+    return 1;
+  }
+
+  int status = 1;
+  arena a;
+  if (!arena_init(&a, BUNDLE_ARENA_CAPACITY)) {
+    goto fail_arena;
+  }
+
+  shader_compiler compiler;
+  if (!shader_compiler_init(&compiler, NULL)) {
+    goto fail_compiler;
+  }
+
+  i32 num_items = argc - 2;
+  bundle_item *items = arena_push_array(&a, bundle_item, num_items);
+  if (!items) {
+    goto fail_items;
+  }
+
+  for (i32 i = 0; i < num_items; ++i) {
+    shader_variant variant;
+    char *arg = arena_strdup(&a, argv[i + 2]);
+    const char *filename = arg ? parse_variant(arg, &variant) : NULL;
+    if (!filename) {
+      goto fail_items;
+    }
+
+    // without a cache directory this always compiles onto the arena
+    shader_binary binary;
+    if (!shader_load_binary(&compiler, filename, &variant, &a, &binary)) {
+      LOG_ERROR("unable to compile shader '%s'", filename);
+      goto fail_items;
+    }
+
+    const char *keywords[SHADER_MAX_KEYWORDS];
+    i32 num_keywords = shader_variant_sorted_keywords(&variant, keywords);
+    items[i] = (bundle_item){
+        .entry =
+            {
+                .key = shader_bundle_key(filename, keywords, num_keywords),
+                .len = binary.len,
+            },
+        .code = binary.code,
+    };
+  }
+
+  if (bundle_write(argv[1], num_items, items, &a)) {
+    status = 0;
+  }
+
+fail_items:
+  shader_compiler_free(&compiler);
+fail_compiler:
+  arena_free(&a);
+fail_arena:
+  scratch_arena_free();
+  return status;
+}
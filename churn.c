@@ -0,0 +1,344 @@
+// RTLD_NEXT
+#define _GNU_SOURCE
+#include "churn.h"
+#include "log.h"
+#include <stdlib.h>
+
+const char *churn_object_names[churn_object_count] = {
+    "buffer",          "image",           "image view",
+    "sampler",         "framebuffer",     "render pass",
+    "pipeline",        "shader module",   "command pool",
+    "command buffer",  "descriptor pool", "descriptor set",
+    "fence",           "semaphore",       "query pool",
+    "swapchain",       "device memory",
+};
+
+const char *churn_call_names[churn_call_count] = {
+    "draws", "binds", "barriers", "submits", "presents",
+};
+
+static _Thread_local churn_counts counts;
+
+#if CHURN_ENABLED
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <vulkan/vulkan_core.h>
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+// glibc's allocator under its internal names, so the definitions below
+// replace malloc for the whole process, drivers included
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t num, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+
+void *malloc(size_t size) {
+  ++counts.allocs;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size) {
+  ++counts.allocs;
+  return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  ++counts.allocs;
+  return __libc_realloc(ptr, size);
+}
+
+// vma and drivers allocate aligned memory, which is released through free
+// and would otherwise only show up as frees
+void *aligned_alloc(size_t alignment, size_t size) {
+  ++counts.allocs;
+  return __libc_memalign(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  ++counts.allocs;
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+  if (alignment % sizeof(void *) != 0 ||
+      (alignment & (alignment - 1)) != 0 || alignment == 0) {
+    return EINVAL;
+  }
+
+  ++counts.allocs;
+  void *p = __libc_memalign(alignment, size);
+  if (!p) {
+    return ENOMEM;
+  }
+  *ptr = p;
+  return 0;
+}
+
+void *valloc(size_t size) {
+  ++counts.allocs;
+  return __libc_valloc(size);
+}
+
+void *pvalloc(size_t size) {
+  ++counts.allocs;
+  return __libc_pvalloc(size);
+}
+
+void free(void *ptr) {
+  if (ptr) {
+    ++counts.frees;
+  }
+  __libc_free(ptr);
+}
+#endif
+
+// the vulkan entry points below likewise replace the loader's, each forwards
+// to the loader's definition, resolved on first use
+static void *next_symbol(void *_Atomic *slot, const char *name) {
+  void *fn = atomic_load_explicit(slot, memory_order_relaxed);
+  if (!fn) {
+    fn = dlsym(RTLD_NEXT, name);
+    atomic_store_explicit(slot, fn, memory_order_relaxed);
+  }
+  return fn;
+}
+
+#define NEXT(name) ((PFN_##name)next_symbol(&next_##name, #name))
+
+#define CREATE(name, object, count, params, args)                              \
+  static void *_Atomic next_##name;                                            \
+  VKAPI_ATTR VkResult VKAPI_CALL name params {                                 \
+    VkResult result = NEXT(name) args;                                         \
+    if (result == VK_SUCCESS) {                                                \
+      counts.created[object] += count;                                         \
+    }                                                                          \
+    return result;                                                             \
+  }
+
+#define DESTROY(name, object, count, params, args)                             \
+  static void *_Atomic next_##name;                                            \
+  VKAPI_ATTR void VKAPI_CALL name params {                                     \
+    counts.destroyed[object] += count;                                         \
+    NEXT(name) args;                                                           \
+  }
+
+#define CALL(name, call, params, args)                                         \
+  static void *_Atomic next_##name;                                            \
+  VKAPI_ATTR void VKAPI_CALL name params {                                     \
+    ++counts.calls[call];                                                      \
+    NEXT(name) args;                                                           \
+  }
+
+#define CALL_RESULT(name, call, params, args)                                  \
+  static void *_Atomic next_##name;                                            \
+  VKAPI_ATTR VkResult VKAPI_CALL name params {                                 \
+    ++counts.calls[call];                                                      \
+    return NEXT(name) args;                                                    \
+  }
+
+#define CREATE_OBJECT(name, object, info_type, handle_type)                    \
+  CREATE(name, object, 1,                                                      \
+         (VkDevice device, const info_type *info,                              \
+          const VkAllocationCallbacks *allocator, handle_type *handle),        \
+         (device, info, allocator, handle))
+
+#define DESTROY_OBJECT(name, object, handle_type)                              \
+  DESTROY(name, object, handle != VK_NULL_HANDLE,                              \
+          (VkDevice device, handle_type handle,                                \
+           const VkAllocationCallbacks *allocator),                            \
+          (device, handle, allocator))
+
+CREATE_OBJECT(vkCreateBuffer, churn_object_buffer, VkBufferCreateInfo, VkBuffer)
+DESTROY_OBJECT(vkDestroyBuffer, churn_object_buffer, VkBuffer)
+CREATE_OBJECT(vkCreateImage, churn_object_image, VkImageCreateInfo, VkImage)
+DESTROY_OBJECT(vkDestroyImage, churn_object_image, VkImage)
+CREATE_OBJECT(vkCreateImageView, churn_object_image_view,
+              VkImageViewCreateInfo, VkImageView)
+DESTROY_OBJECT(vkDestroyImageView, churn_object_image_view, VkImageView)
+CREATE_OBJECT(vkCreateSampler, churn_object_sampler, VkSamplerCreateInfo,
+              VkSampler)
+DESTROY_OBJECT(vkDestroySampler, churn_object_sampler, VkSampler)
+CREATE_OBJECT(vkCreateFramebuffer, churn_object_framebuffer,
+              VkFramebufferCreateInfo, VkFramebuffer)
+DESTROY_OBJECT(vkDestroyFramebuffer, churn_object_framebuffer, VkFramebuffer)
+CREATE_OBJECT(vkCreateRenderPass, churn_object_render_pass,
+              VkRenderPassCreateInfo, VkRenderPass)
+DESTROY_OBJECT(vkDestroyRenderPass, churn_object_render_pass, VkRenderPass)
+CREATE(vkCreateGraphicsPipelines, churn_object_pipeline, num_infos,
+       (VkDevice device, VkPipelineCache cache, uint32_t num_infos,
+        const VkGraphicsPipelineCreateInfo *infos,
+        const VkAllocationCallbacks *allocator, VkPipeline *pipelines),
+       (device, cache, num_infos, infos, allocator, pipelines))
+DESTROY_OBJECT(vkDestroyPipeline, churn_object_pipeline, VkPipeline)
+CREATE_OBJECT(vkCreateShaderModule, churn_object_shader_module,
+              VkShaderModuleCreateInfo, VkShaderModule)
+DESTROY_OBJECT(vkDestroyShaderModule, churn_object_shader_module,
+               VkShaderModule)
+CREATE_OBJECT(vkCreateCommandPool, churn_object_command_pool,
+              VkCommandPoolCreateInfo, VkCommandPool)
+DESTROY_OBJECT(vkDestroyCommandPool, churn_object_command_pool, VkCommandPool)
+CREATE(vkAllocateCommandBuffers, churn_object_command_buffer,
+       info->commandBufferCount,
+       (VkDevice device, const VkCommandBufferAllocateInfo *info,
+        VkCommandBuffer *buffers),
+       (device, info, buffers))
+DESTROY(vkFreeCommandBuffers, churn_object_command_buffer, num_buffers,
+        (VkDevice device, VkCommandPool pool, uint32_t num_buffers,
+         const VkCommandBuffer *buffers),
+        (device, pool, num_buffers, buffers))
+CREATE_OBJECT(vkCreateDescriptorPool, churn_object_descriptor_pool,
+              VkDescriptorPoolCreateInfo, VkDescriptorPool)
+DESTROY_OBJECT(vkDestroyDescriptorPool, churn_object_descriptor_pool,
+               VkDescriptorPool)
+CREATE(vkAllocateDescriptorSets, churn_object_descriptor_set,
+       info->descriptorSetCount,
+       (VkDevice device, const VkDescriptorSetAllocateInfo *info,
+        VkDescriptorSet *sets),
+       (device, info, sets))
+CREATE_OBJECT(vkCreateFence, churn_object_fence, VkFenceCreateInfo, VkFence)
+DESTROY_OBJECT(vkDestroyFence, churn_object_fence, VkFence)
+CREATE_OBJECT(vkCreateSemaphore, churn_object_semaphore,
+              VkSemaphoreCreateInfo, VkSemaphore)
+DESTROY_OBJECT(vkDestroySemaphore, churn_object_semaphore, VkSemaphore)
+CREATE_OBJECT(vkCreateQueryPool, churn_object_query_pool,
+              VkQueryPoolCreateInfo, VkQueryPool)
+DESTROY_OBJECT(vkDestroyQueryPool, churn_object_query_pool, VkQueryPool)
+CREATE_OBJECT(vkCreateSwapchainKHR, churn_object_swapchain,
+              VkSwapchainCreateInfoKHR, VkSwapchainKHR)
+DESTROY_OBJECT(vkDestroySwapchainKHR, churn_object_swapchain, VkSwapchainKHR)
+CREATE_OBJECT(vkAllocateMemory, churn_object_memory, VkMemoryAllocateInfo,
+              VkDeviceMemory)
+DESTROY_OBJECT(vkFreeMemory, churn_object_memory, VkDeviceMemory)
+
+CALL(vkCmdDraw, churn_call_draw,
+     (VkCommandBuffer cmd, uint32_t num_vertices, uint32_t num_instances,
+      uint32_t first_vertex, uint32_t first_instance),
+     (cmd, num_vertices, num_instances, first_vertex, first_instance))
+CALL(vkCmdDrawIndexed, churn_call_draw,
+     (VkCommandBuffer cmd, uint32_t num_indices, uint32_t num_instances,
+      uint32_t first_index, int32_t vertex_offset, uint32_t first_instance),
+     (cmd, num_indices, num_instances, first_index, vertex_offset,
+      first_instance))
+CALL(vkCmdBindPipeline, churn_call_bind,
+     (VkCommandBuffer cmd, VkPipelineBindPoint bind_point,
+      VkPipeline pipeline),
+     (cmd, bind_point, pipeline))
+CALL(vkCmdBindVertexBuffers, churn_call_bind,
+     (VkCommandBuffer cmd, uint32_t first_binding, uint32_t num_bindings,
+      const VkBuffer *buffers, const VkDeviceSize *offsets),
+     (cmd, first_binding, num_bindings, buffers, offsets))
+CALL(vkCmdBindIndexBuffer, churn_call_bind,
+     (VkCommandBuffer cmd, VkBuffer buffer, VkDeviceSize offset,
+      VkIndexType index_type),
+     (cmd, buffer, offset, index_type))
+CALL(vkCmdBindDescriptorSets, churn_call_bind,
+     (VkCommandBuffer cmd, VkPipelineBindPoint bind_point,
+      VkPipelineLayout layout, uint32_t first_set, uint32_t num_sets,
+      const VkDescriptorSet *sets, uint32_t num_dynamic_offsets,
+      const uint32_t *dynamic_offsets),
+     (cmd, bind_point, layout, first_set, num_sets, sets, num_dynamic_offsets,
+      dynamic_offsets))
+CALL(vkCmdPipelineBarrier, churn_call_barrier,
+     (VkCommandBuffer cmd, VkPipelineStageFlags src_stages,
+      VkPipelineStageFlags dst_stages, VkDependencyFlags dependencies,
+      uint32_t num_memory_barriers, const VkMemoryBarrier *memory_barriers,
+      uint32_t num_buffer_barriers,
+      const VkBufferMemoryBarrier *buffer_barriers,
+      uint32_t num_image_barriers, const VkImageMemoryBarrier *image_barriers),
+     (cmd, src_stages, dst_stages, dependencies, num_memory_barriers,
+      memory_barriers, num_buffer_barriers, buffer_barriers,
+      num_image_barriers, image_barriers))
+CALL_RESULT(vkQueueSubmit, churn_call_submit,
+            (VkQueue queue, uint32_t num_submits, const VkSubmitInfo *submits,
+             VkFence fence),
+            (queue, num_submits, submits, fence))
+CALL_RESULT(vkQueuePresentKHR, churn_call_present,
+            (VkQueue queue, const VkPresentInfoKHR *info), (queue, info))
+#endif
+
+void churn_init(churn_mode mode, churn_detector *d) {
+  *d = (churn_detector){.mode = mode};
+  if (mode != churn_mode_off && !CHURN_ENABLED) {
+    LOG_WARN("churn detection is compiled out of release builds");
+  }
+}
+
+void churn_log(const churn_detector *d) {
+  if (d->num_steady_frames == 0) {
+    return;
+  }
+
+  LOG_INFO("per steady frame: %.1f draws, %.1f binds, %.1f barriers, %.1f "
+           "submits, %.1f presents",
+           churn_calls_per_frame(d, churn_call_draw),
+           churn_calls_per_frame(d, churn_call_bind),
+           churn_calls_per_frame(d, churn_call_barrier),
+           churn_calls_per_frame(d, churn_call_submit),
+           churn_calls_per_frame(d, churn_call_present));
+  if (d->mode != churn_mode_off) {
+    LOG_INFO("%" PRIu64 " of %" PRIu64 " steady frame(s) allocated or "
+             "created vulkan objects",
+             d->num_churn_frames, d->num_steady_frames);
+  }
+}
+
+void churn_frame_begin(churn_detector *d) { d->frame_start = counts; }
+
+// logs what the frame allocated, created or destroyed, false if nothing
+static bool report(u64 frame, const churn_counts *start,
+                   const churn_counts *end) {
+  bool churned = false;
+  if (end->allocs != start->allocs || end->frees != start->frees) {
+    LOG_WARN("frame %" PRIu64 ": %" PRIu64 " heap allocation(s), %" PRIu64
+             " free(s)",
+             frame, end->allocs - start->allocs, end->frees - start->frees);
+    churned = true;
+  }
+  for (i32 i = 0; i < churn_object_count; ++i) {
+    u64 created = end->created[i] - start->created[i];
+    u64 destroyed = end->destroyed[i] - start->destroyed[i];
+    if (created > 0 || destroyed > 0) {
+      LOG_WARN("frame %" PRIu64 ": %" PRIu64 " %s(s) created, %" PRIu64
+               " destroyed",
+               frame, created, churn_object_names[i], destroyed);
+      churned = true;
+    }
+  }
+  return churned;
+}
+
+void churn_frame_end(churn_detector *d, u64 frame, bool steady) {
+  if (!steady) {
+    return;
+  }
+
+  // read before reporting, which may allocate itself
+  churn_counts end = counts;
+  ++d->num_steady_frames;
+  for (i32 i = 0; i < churn_call_count; ++i) {
+    d->call_totals[i] += end.calls[i] - d->frame_start.calls[i];
+  }
+
+  if (d->mode == churn_mode_off || !report(frame, &d->frame_start, &end)) {
+    return;
+  }
+
+  ++d->num_churn_frames;
+  if (d->mode == churn_mode_assert) {
+    LOG_ERROR("steady state frame %" PRIu64 " allocated, aborting", frame);
+    log_flush();
+    abort();
+  }
+}
+
+double churn_calls_per_frame(const churn_detector *d, churn_call call) {
+  return d->num_steady_frames > 0
+             ? (double)d->call_totals[call] / d->num_steady_frames
+             : 0.0;
+}
+
+u64 churn_num_allocs(void) { return counts.allocs; }
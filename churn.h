@@ -0,0 +1,88 @@
+#pragma once
+
+#include "types.h"
+
+// counting is compiled out of release builds, heap allocations are only
+// counted with glibc and without address sanitizer, which interposes malloc
+// itself
+#ifdef NDEBUG
+#define CHURN_ENABLED 0
+#else
+#define CHURN_ENABLED 1
+#endif
+
+typedef enum {
+  churn_object_buffer,
+  churn_object_image,
+  churn_object_image_view,
+  churn_object_sampler,
+  churn_object_framebuffer,
+  churn_object_render_pass,
+  churn_object_pipeline,
+  churn_object_shader_module,
+  churn_object_command_pool,
+  churn_object_command_buffer,
+  churn_object_descriptor_pool,
+  churn_object_descriptor_set,
+  churn_object_fence,
+  churn_object_semaphore,
+  churn_object_query_pool,
+  churn_object_swapchain,
+  churn_object_memory,
+  churn_object_count,
+} churn_object;
+
+typedef enum {
+  churn_call_draw,
+  churn_call_bind,
+  churn_call_barrier,
+  churn_call_submit,
+  churn_call_present,
+  churn_call_count,
+} churn_call;
+
+extern const char *churn_object_names[churn_object_count];
+extern const char *churn_call_names[churn_call_count];
+
+// counts of the calling thread
+typedef struct {
+  u64 allocs;
+  u64 frees;
+  u64 created[churn_object_count];
+  u64 destroyed[churn_object_count];
+  u64 calls[churn_call_count];
+} churn_counts;
+
+typedef enum {
+  churn_mode_off,
+  // logs steady state frames that allocate or create objects
+  churn_mode_report,
+  // and aborts on the first one
+  churn_mode_assert,
+} churn_mode;
+
+// checks that steady state frames of one thread allocate no heap memory and
+// create or destroy no vulkan objects, and tracks their api calls
+typedef struct {
+  churn_mode mode;
+  churn_counts frame_start;
+  u64 num_steady_frames;
+  u64 num_churn_frames;
+  // over steady frames, for the per frame averages
+  u64 call_totals[churn_call_count];
+} churn_detector;
+
+void churn_init(churn_mode mode, churn_detector *d);
+// logs the per frame averages and the number of frames that churned
+void churn_log(const churn_detector *d);
+
+// both on the thread whose frames are checked
+void churn_frame_begin(churn_detector *d);
+// steady is false for frames expected to allocate, like the first ones or
+// those swapping in reloaded resources; their counts are ignored
+void churn_frame_end(churn_detector *d, u64 frame, bool steady);
+
+double churn_calls_per_frame(const churn_detector *d, churn_call call);
+// heap allocations made by the calling thread so far, always 0 where they are
+// not counted
+u64 churn_num_allocs(void);
@@ -1,6 +1,6 @@
 #include "command.h"
+#include "log.h"
 #include "vk_utils.h"
-#include <logger.h>
 #include <vulkan/vulkan_core.h>
 
 bool command_pool_create(VkDevice device, u32 queue_index,
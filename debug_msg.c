@@ -1,15 +1,122 @@
 #include "debug_msg.h"
+#include "log.h"
 #include "vk_utils.h"
-#include <logger.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <vulkan/vulkan_core.h>
 
+#define PERF_CONTEXT_LEN 512
+
+typedef struct {
+  debug_msg_perf_count c;
+  // frame of the first occurrence and what was logged for it
+  u64 first_frame;
+  char context[PERF_CONTEXT_LEN];
+  u64 frame_count;
+  // count at the last periodic summary
+  u64 summarized_count;
+} perf_message;
+
+// shared by the instance creation messenger and the debug messenger, either
+// may report from any thread
+static struct {
+  pthread_mutex_t mutex;
+  u64 frame;
+  perf_message messages[DEBUG_MSG_MAX_PERF_IDS];
+  i32 num_messages;
+  // occurrences of ids that did not fit into messages
+  u64 num_untracked;
+} perf = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static bool is_perf_message(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+                            VkDebugUtilsMessageTypeFlagsEXT types,
+                            const VkDebugUtilsMessengerCallbackDataEXT *data) {
+  if (severity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+    return false;
+  }
+
+  // best practices warnings are mostly reported as validation messages
+  return (types & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) ||
+         (data->pMessageIdName &&
+          strncmp(data->pMessageIdName, "BestPractices-", 14) == 0);
+}
+
+// the message followed by the objects and command buffer label it refers to
+static void perf_context(const VkDebugUtilsMessengerCallbackDataEXT *data,
+                         char *context) {
+  i32 n = snprintf(context, PERF_CONTEXT_LEN, "%s", data->pMessage);
+  for (u32 i = 0; i < data->objectCount && n < PERF_CONTEXT_LEN; ++i) {
+    const VkDebugUtilsObjectNameInfoEXT *o = &data->pObjects[i];
+    n += snprintf(context + n, PERF_CONTEXT_LEN - n, " [%s 0x%" PRIx64 "%s%s]",
+                  string_VkObjectType(o->objectType), o->objectHandle,
+                  o->pObjectName ? " " : "",
+                  o->pObjectName ? o->pObjectName : "");
+  }
+  if (data->cmdBufLabelCount > 0 && n < PERF_CONTEXT_LEN) {
+    snprintf(context + n, PERF_CONTEXT_LEN - n, " in '%s'",
+             data->pCmdBufLabels[data->cmdBufLabelCount - 1].pLabelName);
+  }
+}
+
+// counts the message, true if it was not seen before and must be logged
+static bool perf_count(const VkDebugUtilsMessengerCallbackDataEXT *data) {
+  const char *name = data->pMessageIdName ? data->pMessageIdName : "";
+  pthread_mutex_lock(&perf.mutex);
+  for (i32 i = 0; i < perf.num_messages; ++i) {
+    perf_message *m = &perf.messages[i];
+    if (m->c.id == data->messageIdNumber &&
+        (name[0] == '\0' ||
+         strncmp(m->c.name, name, sizeof(m->c.name) - 1) == 0)) {
+      ++m->c.count;
+      ++m->frame_count;
+      pthread_mutex_unlock(&perf.mutex);
+      return false;
+    }
+  }
+
+  if (perf.num_messages == DEBUG_MSG_MAX_PERF_IDS) {
+    bool first = perf.num_untracked++ == 0;
+    pthread_mutex_unlock(&perf.mutex);
+    if (first) {
+      LOG_WARN("too many distinct performance messages, further ones are "
+               "counted together");
+    }
+    return false;
+  }
+
+  perf_message *m = &perf.messages[perf.num_messages++];
+  // some messages only come with an id number
+  if (name[0] == '\0') {
+    snprintf(m->c.name, sizeof(m->c.name), "0x%08" PRIx32,
+             (u32)data->messageIdNumber);
+  } else {
+    snprintf(m->c.name, sizeof(m->c.name), "%s", name);
+  }
+  m->c.id = data->messageIdNumber;
+  m->c.count = 1;
+  m->c.max_per_frame = 0;
+  m->first_frame = perf.frame;
+  m->frame_count = 1;
+  m->summarized_count = 0;
+  perf_context(data, m->context);
+  pthread_mutex_unlock(&perf.mutex);
+  return true;
+}
+
 static VKAPI_ATTR VkBool32 VKAPI_CALL
 debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
                VkDebugUtilsMessageTypeFlagsEXT messageTypes,
                const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData,
                void *pUserData) {
-  (void)messageTypes;
   (void)pUserData;
+  if (is_perf_message(messageSeverity, messageTypes, pCallbackData)) {
+    if (perf_count(pCallbackData)) {
+      LOG_WARN("%s (further occurrences are counted)",
+               pCallbackData->pMessage);
+    }
+    return VK_FALSE;
+  }
+
   LogLevel level;
   switch (messageSeverity) {
   case VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT:
@@ -29,7 +136,7 @@ debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
     level = LogLevel_ERROR;
   }
 
-  logger_log(level, __FILENAME__, __LINE__, "%s", pCallbackData->pMessage);
+  log_write(level, __FILENAME__, __LINE__, "%s", pCallbackData->pMessage);
   return VK_FALSE;
 }
 
@@ -93,7 +200,75 @@ bool debug_msg_init(VkInstance inst, debug_messenger *msg) {
   return false;
 }
 
+// mutex must be held; only messages that occurred since the last periodic
+// summary are logged unless all is set
+static void perf_log(bool all) {
+  u64 total = perf.num_untracked;
+  i32 num_logged = 0;
+  for (i32 i = 0; i < perf.num_messages; ++i) {
+    total += perf.messages[i].c.count;
+    if (all || perf.messages[i].c.count > perf.messages[i].summarized_count) {
+      ++num_logged;
+    }
+  }
+  if (num_logged == 0) {
+    return;
+  }
+
+  LOG_INFO("performance messages %s frame %" PRIu64 ": %" PRIu64
+           " in total, %d distinct",
+           all ? "at" : "up to", perf.frame, total, perf.num_messages);
+  for (i32 i = 0; i < perf.num_messages; ++i) {
+    perf_message *m = &perf.messages[i];
+    if (!all && m->c.count == m->summarized_count) {
+      continue;
+    }
+
+    LOG_INFO("\t%s (0x%08" PRIx32 "): %" PRIu64 " time(s), %" PRIu64
+             " since the last summary, at most %" PRIu64 " per frame",
+             m->c.name, (u32)m->c.id, m->c.count,
+             m->c.count - m->summarized_count, m->c.max_per_frame);
+    LOG_INFO("\t\tfirst in frame %" PRIu64 ": %s", m->first_frame,
+             m->context);
+    m->summarized_count = m->c.count;
+  }
+  if (perf.num_untracked > 0) {
+    LOG_INFO("\t%" PRIu64 " time(s) other messages", perf.num_untracked);
+  }
+}
+
+void debug_msg_frame_end(u64 frame) {
+  pthread_mutex_lock(&perf.mutex);
+  for (i32 i = 0; i < perf.num_messages; ++i) {
+    perf_message *m = &perf.messages[i];
+    if (m->frame_count > m->c.max_per_frame) {
+      m->c.max_per_frame = m->frame_count;
+    }
+    m->frame_count = 0;
+  }
+
+  perf.frame = frame + 1;
+  if (perf.frame % DEBUG_MSG_SUMMARY_INTERVAL == 0) {
+    perf_log(false);
+  }
+  pthread_mutex_unlock(&perf.mutex);
+}
+
+i32 debug_msg_perf_counts(debug_msg_perf_count *out, i32 max) {
+  pthread_mutex_lock(&perf.mutex);
+  i32 n = perf.num_messages;
+  for (i32 i = 0; i < n && i < max; ++i) {
+    out[i] = perf.messages[i].c;
+  }
+  pthread_mutex_unlock(&perf.mutex);
+  return n;
+}
+
 void debug_msg_free(VkInstance inst, debug_messenger msg) {
+  pthread_mutex_lock(&perf.mutex);
+  perf_log(true);
+  pthread_mutex_unlock(&perf.mutex);
+
   if (msg.debug_messenger == VK_NULL_HANDLE) {
     return;
   }
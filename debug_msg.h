@@ -3,10 +3,33 @@
 #include "types.h"
 #include <vulkan/vulkan_core.h>
 
+// performance messages, and best practices ones when enabled, are logged on
+// their first occurrence only and counted by message id after that
+#define DEBUG_MSG_MAX_PERF_IDS 32
+#define DEBUG_MSG_PERF_NAME_LEN 64
+// frames between summaries of the performance messages seen since the last
+// one
+#define DEBUG_MSG_SUMMARY_INTERVAL 1000
+
 typedef struct {
   VkDebugUtilsMessengerEXT debug_messenger;
 } debug_messenger;
 
+typedef struct {
+  char name[DEBUG_MSG_PERF_NAME_LEN];
+  i32 id;
+  u64 count;
+  u64 max_per_frame;
+} debug_msg_perf_count;
+
 void debug_msg_create_info(VkDebugUtilsMessengerCreateInfoEXT *info);
 bool debug_msg_init(VkInstance inst, debug_messenger *msg);
+// logs the summary of every performance message seen
 void debug_msg_free(VkInstance inst, debug_messenger msg);
+
+// ends the per frame counts of the frame, every DEBUG_MSG_SUMMARY_INTERVAL
+// frames the messages that occurred since the last summary are logged
+void debug_msg_frame_end(u64 frame);
+// copies at most max counts into out, returns the number of distinct message
+// ids seen
+i32 debug_msg_perf_counts(debug_msg_perf_count *out, i32 max);
@@ -0,0 +1,80 @@
+#include "debug_utils.h"
+#include "log.h"
+#include "vk_utils.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+// longest object name, longer ones are truncated
+#define DEBUG_UTILS_MAX_NAME 128
+
+// written once by debug_utils_init, before any other thread uses them
+static PFN_vkSetDebugUtilsObjectNameEXT set_object_name;
+static PFN_vkCmdBeginDebugUtilsLabelEXT cmd_begin_label;
+static PFN_vkCmdEndDebugUtilsLabelEXT cmd_end_label;
+
+void debug_utils_init(VkInstance inst) {
+  if (!debug) {
+    return;
+  }
+
+  set_object_name = (PFN_vkSetDebugUtilsObjectNameEXT)vkGetInstanceProcAddr(
+      inst, "vkSetDebugUtilsObjectNameEXT");
+  cmd_begin_label = (PFN_vkCmdBeginDebugUtilsLabelEXT)vkGetInstanceProcAddr(
+      inst, "vkCmdBeginDebugUtilsLabelEXT");
+  cmd_end_label = (PFN_vkCmdEndDebugUtilsLabelEXT)vkGetInstanceProcAddr(
+      inst, "vkCmdEndDebugUtilsLabelEXT");
+  if (!set_object_name || !cmd_begin_label || !cmd_end_label) {
+    LOG_WARN("extension VK_EXT_debug_utils not supported, objects are not "
+             "named");
+    set_object_name = NULL;
+    cmd_begin_label = NULL;
+    cmd_end_label = NULL;
+  }
+}
+
+void debug_utils_name(VkDevice device, VkObjectType type, u64 handle,
+                      const char *fmt, ...) {
+  if (!set_object_name || handle == 0) {
+    return;
+  }
+
+  char name[DEBUG_UTILS_MAX_NAME];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(name, sizeof(name), fmt, args);
+  va_end(args);
+
+  VkResult result;
+  if ((result = set_object_name(
+           device, &(VkDebugUtilsObjectNameInfoEXT){
+                       .sType =
+                           VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT,
+                       .objectType = type,
+                       .objectHandle = handle,
+                       .pObjectName = name,
+                   })) != VK_SUCCESS) {
+    LOG_WARN("unable to name %s '%s': %s", string_VkObjectType(type), name,
+             vk_error_to_string(result));
+  }
+}
+
+void debug_utils_label_begin(VkCommandBuffer command_buffer,
+                             const char *name) {
+  if (!cmd_begin_label) {
+    return;
+  }
+
+  cmd_begin_label(command_buffer,
+                  &(VkDebugUtilsLabelEXT){
+                      .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT,
+                      .pLabelName = name,
+                  });
+}
+
+void debug_utils_label_end(VkCommandBuffer command_buffer) {
+  if (!cmd_end_label) {
+    return;
+  }
+
+  cmd_end_label(command_buffer);
+}
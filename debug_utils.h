@@ -0,0 +1,36 @@
+#pragma once
+
+#include "types.h"
+#include <vulkan/vulkan_core.h>
+
+// object names and command buffer labels show up in capture tools such as
+// renderdoc, they are compiled out of release builds entirely
+#ifdef NDEBUG
+#define DEBUG_UTILS_ENABLED 0
+#else
+#define DEBUG_UTILS_ENABLED 1
+#endif
+
+#if DEBUG_UTILS_ENABLED
+#define DEBUG_NAME(device, type, handle, fmt, ...)                             \
+  debug_utils_name(device, type, (u64)(handle), fmt, ##__VA_ARGS__)
+// name must be a string literal; labels nest and are ended in the command
+// buffer that began them
+#define DEBUG_LABEL_BEGIN(command_buffer, name)                                \
+  debug_utils_label_begin(command_buffer, name)
+#define DEBUG_LABEL_END(command_buffer) debug_utils_label_end(command_buffer)
+#else
+#define DEBUG_NAME(device, type, handle, fmt, ...) ((void)0)
+#define DEBUG_LABEL_BEGIN(command_buffer, name) ((void)0)
+#define DEBUG_LABEL_END(command_buffer) ((void)0)
+#endif
+
+// loads the VK_EXT_debug_utils functions, names and labels are silently
+// ignored if the extension is missing or before this is called
+void debug_utils_init(VkInstance inst);
+
+void debug_utils_name(VkDevice device, VkObjectType type, u64 handle,
+                      const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+void debug_utils_label_begin(VkCommandBuffer command_buffer, const char *name);
+void debug_utils_label_end(VkCommandBuffer command_buffer);
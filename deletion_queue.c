@@ -0,0 +1,137 @@
+#include "deletion_queue.h"
+#include "log.h"
+
+void deletion_queue_init(VkDevice device, pthread_mutex_t *queue_mutex,
+                         u32 frames_in_flight, deletion_queue *q) {
+  q->device = device;
+  q->queue_mutex = queue_mutex;
+  q->frames_in_flight = frames_in_flight;
+  q->first_entry = 0;
+  q->num_entries = 0;
+}
+
+static void deletion_entry_destroy(VkDevice device, const deletion_entry *e) {
+  switch (e->type) {
+  case deletion_pipeline:
+    vkDestroyPipeline(device, e->pipeline, NULL);
+    break;
+  case deletion_buffer:
+    vmaDestroyBuffer(e->buffer.vma, e->buffer.buffer, e->buffer.allocation);
+    break;
+  case deletion_image:
+    if (e->image.sampler != VK_NULL_HANDLE) {
+      vkDestroySampler(device, e->image.sampler, NULL);
+    }
+    if (e->image.view != VK_NULL_HANDLE) {
+      vkDestroyImageView(device, e->image.view, NULL);
+    }
+    vmaDestroyImage(e->image.vma, e->image.image, e->image.allocation);
+    break;
+  case deletion_image_view:
+    vkDestroyImageView(device, e->image_view, NULL);
+    break;
+  case deletion_framebuffer:
+    vkDestroyFramebuffer(device, e->framebuffer, NULL);
+    break;
+  case deletion_swapchain:
+    vkDestroySwapchainKHR(device, e->swapchain, NULL);
+    break;
+  }
+}
+
+static void deletion_queue_destroy_all(deletion_queue *q) {
+  while (q->num_entries > 0) {
+    deletion_entry_destroy(q->device, &q->entries[q->first_entry]);
+    q->first_entry = (q->first_entry + 1) % DELETION_QUEUE_CAPACITY;
+    --q->num_entries;
+  }
+}
+
+void deletion_queue_free(deletion_queue *q) { deletion_queue_destroy_all(q); }
+
+void deletion_queue_push(deletion_queue *q, const deletion_entry *entry) {
+  if (q->num_entries == DELETION_QUEUE_CAPACITY) {
+    LOG_WARN("deletion queue full, waiting for device idle");
+    if (q->queue_mutex) {
+      pthread_mutex_lock(q->queue_mutex);
+    }
+    vkDeviceWaitIdle(q->device);
+    if (q->queue_mutex) {
+      pthread_mutex_unlock(q->queue_mutex);
+    }
+    deletion_queue_destroy_all(q);
+  }
+
+  i32 i = (q->first_entry + q->num_entries) % DELETION_QUEUE_CAPACITY;
+  q->entries[i] = *entry;
+  ++q->num_entries;
+}
+
+void deletion_queue_push_pipeline(deletion_queue *q, u64 frame,
+                                  VkPipeline pipeline) {
+  deletion_queue_push(q, &(deletion_entry){
+                             .type = deletion_pipeline,
+                             .frame = frame,
+                             .pipeline = pipeline,
+                         });
+}
+
+void deletion_queue_push_buffer(deletion_queue *q, u64 frame, VmaAllocator vma,
+                                VkBuffer buffer, VmaAllocation allocation) {
+  deletion_queue_push(q, &(deletion_entry){
+                             .type = deletion_buffer,
+                             .frame = frame,
+                             .buffer = {vma, buffer, allocation},
+                         });
+}
+
+void deletion_queue_push_image(deletion_queue *q, u64 frame, VmaAllocator vma,
+                               VkImage image, VmaAllocation allocation,
+                               VkImageView view, VkSampler sampler) {
+  deletion_queue_push(q, &(deletion_entry){
+                             .type = deletion_image,
+                             .frame = frame,
+                             .image = {vma, image, allocation, view, sampler},
+                         });
+}
+
+void deletion_queue_push_image_view(deletion_queue *q, u64 frame,
+                                    VkImageView view) {
+  deletion_queue_push(q, &(deletion_entry){
+                             .type = deletion_image_view,
+                             .frame = frame,
+                             .image_view = view,
+                         });
+}
+
+void deletion_queue_push_framebuffer(deletion_queue *q, u64 frame,
+                                     VkFramebuffer framebuffer) {
+  deletion_queue_push(q, &(deletion_entry){
+                             .type = deletion_framebuffer,
+                             .frame = frame,
+                             .framebuffer = framebuffer,
+                         });
+}
+
+void deletion_queue_push_swapchain(deletion_queue *q, u64 frame,
+                                   VkSwapchainKHR swapchain) {
+  deletion_queue_push(q, &(deletion_entry){
+                             .type = deletion_swapchain,
+                             .frame = frame,
+                             .swapchain = swapchain,
+                         });
+}
+
+void deletion_queue_collect(deletion_queue *q, u64 current_frame) {
+  // entries are pushed in frame order, so the oldest one is always first
+  while (q->num_entries > 0) {
+    const deletion_entry *e = &q->entries[q->first_entry];
+    if (e->frame + q->frames_in_flight > current_frame) {
+      break;
+    }
+
+    deletion_entry_destroy(q->device, e);
+    q->first_entry = (q->first_entry + 1) % DELETION_QUEUE_CAPACITY;
+    --q->num_entries;
+  }
+}
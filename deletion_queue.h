@@ -0,0 +1,77 @@
+#pragma once
+
+#include "types.h"
+#include <pthread.h>
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan_core.h>
+
+#define DELETION_QUEUE_CAPACITY 128
+
+typedef enum {
+  deletion_pipeline,
+  deletion_buffer,
+  deletion_image,
+  deletion_image_view,
+  deletion_framebuffer,
+  deletion_swapchain,
+} deletion_type;
+
+typedef struct {
+  deletion_type type;
+  // frame number during which the object was retired
+  u64 frame;
+  union {
+    VkPipeline pipeline;
+    struct {
+      VmaAllocator vma;
+      VkBuffer buffer;
+      VmaAllocation allocation;
+    } buffer;
+    // view and sampler may be VK_NULL_HANDLE
+    struct {
+      VmaAllocator vma;
+      VkImage image;
+      VmaAllocation allocation;
+      VkImageView view;
+      VkSampler sampler;
+    } image;
+    VkImageView image_view;
+    VkFramebuffer framebuffer;
+    VkSwapchainKHR swapchain;
+  };
+} deletion_entry;
+
+// defers destruction of vulkan objects until every frame that may still
+// reference them has completed on the gpu
+typedef struct {
+  VkDevice device;
+  // held while waiting for the device to go idle, may be NULL
+  pthread_mutex_t *queue_mutex;
+  u32 frames_in_flight;
+  deletion_entry entries[DELETION_QUEUE_CAPACITY];
+  i32 first_entry;
+  i32 num_entries;
+} deletion_queue;
+
+void deletion_queue_init(VkDevice device, pthread_mutex_t *queue_mutex,
+                         u32 frames_in_flight, deletion_queue *q);
+// the device must be idle
+void deletion_queue_free(deletion_queue *q);
+
+// a full queue waits for the device to go idle and destroys everything
+void deletion_queue_push(deletion_queue *q, const deletion_entry *entry);
+void deletion_queue_push_pipeline(deletion_queue *q, u64 frame,
+                                  VkPipeline pipeline);
+void deletion_queue_push_buffer(deletion_queue *q, u64 frame, VmaAllocator vma,
+                                VkBuffer buffer, VmaAllocation allocation);
+void deletion_queue_push_image(deletion_queue *q, u64 frame, VmaAllocator vma,
+                               VkImage image, VmaAllocation allocation,
+                               VkImageView view, VkSampler sampler);
+void deletion_queue_push_image_view(deletion_queue *q, u64 frame,
+                                    VkImageView view);
+void deletion_queue_push_framebuffer(deletion_queue *q, u64 frame,
+                                     VkFramebuffer framebuffer);
+void deletion_queue_push_swapchain(deletion_queue *q, u64 frame,
+                                   VkSwapchainKHR swapchain);
+// call once the fence of current_frame's slot has been waited on
+void deletion_queue_collect(deletion_queue *q, u64 current_frame);
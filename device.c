@@ -1,9 +1,10 @@
 #include "device.h"
 #include "vk_utils.h"
 
+#include "arena.h"
 #include "instance.h"
+#include "log.h"
 #include <assert.h>
-#include <logger.h>
 #include <stdlib.h>
 #include <vulkan/vulkan_core.h>
 
@@ -19,9 +20,34 @@ static const char *required_device_extensions[] = {
 static const u32 num_required_device_extensions =
     sizeof(required_device_extensions) / sizeof(required_device_extensions[0]);
 
+static const char *graphics_pipeline_library_extensions[] = {
+    VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME,
+    VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME,
+};
+
+static const char *extended_dynamic_state_extensions[] = {
+    VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME,
+};
+
+// core in vulkan 1.3, the instance targets 1.1 so the extensions are used
+static const char *dynamic_rendering_extensions[] = {
+    VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+    VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+    VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+#define MAX_DEVICE_EXTENSIONS 16
+
 static bool physical_device_supports_extensions(VkPhysicalDevice device,
                                                 const char **extensions,
                                                 u32 num_extensions) {
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return false;
+  }
+
+  arena_marker marker = arena_mark(scratch);
   VkResult result;
   u32 num_supported_extensions;
   result = vkEnumerateDeviceExtensionProperties(
@@ -30,8 +56,8 @@ static bool physical_device_supports_extensions(VkPhysicalDevice device,
     LOG_ERROR("unable to enumerate device extensions");
     return false;
   }
-  VkExtensionProperties *supported_extensions =
-      malloc(num_supported_extensions * sizeof(*supported_extensions));
+  VkExtensionProperties *supported_extensions = arena_push_array(
+      scratch, VkExtensionProperties, num_supported_extensions);
   if (!supported_extensions) {
     LOG_ERROR("unable to allocate extension properties structs");
     return false;
@@ -41,10 +67,12 @@ static bool physical_device_supports_extensions(VkPhysicalDevice device,
       device, NULL, &num_supported_extensions, supported_extensions);
   if (result != VK_SUCCESS) {
     LOG_ERROR("unable to enumerate device extensions");
+    arena_pop(scratch, marker);
     return false;
   }
 
-  for (u32 i = 0; i < num_extensions; ++i) {
+  bool supported = true;
+  for (u32 i = 0; i < num_extensions && supported; ++i) {
     bool found = false;
     for (u32 j = 0; j < num_supported_extensions; ++j) {
       if (strcmp(extensions[i], supported_extensions[j].extensionName) == 0) {
@@ -53,14 +81,11 @@ static bool physical_device_supports_extensions(VkPhysicalDevice device,
       }
     }
 
-    if (!found) {
-      free(supported_extensions);
-      return false;
-    }
+    supported = found;
   }
 
-  free(supported_extensions);
-  return true;
+  arena_pop(scratch, marker);
+  return supported;
 }
 
 static bool swap_chain_adaquate(const swap_chain_support_details *details) {
@@ -123,26 +148,38 @@ static i32 rate_physical_device(VkPhysicalDevice device, VkSurfaceKHR surface) {
     FAIL("physical device not having support for necessary queue families");
   }
 
+  if (!features.samplerAnisotropy) {
+    FAIL("anisotropy not supported");
+  }
+
+  if (surface == VK_NULL_HANDLE) {
+    goto score;
+  }
+
   if (!physical_device_supports_extensions(device, required_device_extensions,
                                            num_required_device_extensions)) {
     FAIL("physical device not having support for required extensions");
   }
 
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    FAIL("unable to acquire scratch memory");
+  }
+
+  arena_marker marker = arena_mark(scratch);
   swap_chain_support_details swap_chain_support = {};
-  if (!query_swap_chain_support(device, surface, &swap_chain_support)) {
+  if (!query_swap_chain_support(device, surface, scratch,
+                                &swap_chain_support)) {
     FAIL("unable to query swap chain support details");
   }
 
-  if (!swap_chain_adaquate(&swap_chain_support)) {
-    swap_chain_support_details_free(&swap_chain_support);
+  bool adaquate = swap_chain_adaquate(&swap_chain_support);
+  arena_pop(scratch, marker);
+  if (!adaquate) {
     FAIL("swap chain support not adaquate");
   }
 
-  if (!features.samplerAnisotropy) {
-    swap_chain_support_details_free(&swap_chain_support);
-    FAIL("anisotropy not supported");
-  }
-
+score:
   if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
     INCREASE("physical device is discrete GPU", 1000);
   }
@@ -153,12 +190,17 @@ static i32 rate_physical_device(VkPhysicalDevice device, VkSurfaceKHR surface) {
   INCREASE("increase score by maximum MSAA support",
            best_msaa_sample_count(device) * 10);
 
-  swap_chain_support_details_free(&swap_chain_support);
   return score;
 }
 
 VkPhysicalDevice physical_device_pick(VkInstance instance,
                                       VkSurfaceKHR surface) {
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return VK_NULL_HANDLE;
+  }
+
+  arena_marker marker = arena_mark(scratch);
   VkResult result;
   u32 num_physical_devices;
   result = vkEnumeratePhysicalDevices(instance, &num_physical_devices, NULL);
@@ -169,7 +211,7 @@ VkPhysicalDevice physical_device_pick(VkInstance instance,
   }
 
   VkPhysicalDevice *devices =
-      malloc(num_physical_devices * sizeof(VkPhysicalDevice));
+      arena_push_array(scratch, VkPhysicalDevice, num_physical_devices);
   if (!devices) {
     LOG_ERROR("unable to allocate memory for physical device array");
     return VK_NULL_HANDLE;
@@ -179,7 +221,7 @@ VkPhysicalDevice physical_device_pick(VkInstance instance,
   if (result != VK_SUCCESS) {
     LOG_ERROR("unable to query physical devices: %s",
               vk_error_to_string(result));
-    free(devices);
+    arena_pop(scratch, marker);
     return VK_NULL_HANDLE;
   }
 
@@ -204,7 +246,7 @@ VkPhysicalDevice physical_device_pick(VkInstance instance,
              properties.deviceName, properties.deviceID, best_score);
   }
 
-  free(devices);
+  arena_pop(scratch, marker);
   return current_best;
 }
 
@@ -214,10 +256,16 @@ bool find_queue_families(VkPhysicalDevice device, VkSurfaceKHR surface,
   indices->graphics = VK_QUEUE_FAMILY_IGNORED;
   indices->transfer = VK_QUEUE_FAMILY_IGNORED;
 
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return false;
+  }
+
+  arena_marker marker = arena_mark(scratch);
   u32 num_families;
   vkGetPhysicalDeviceQueueFamilyProperties(device, &num_families, NULL);
   VkQueueFamilyProperties *families =
-      malloc(num_families * sizeof(families[0]));
+      arena_push_array(scratch, VkQueueFamilyProperties, num_families);
   if (!families) {
     LOG_ERROR("unable to allocate memory for queue family properties structs");
     return false;
@@ -231,6 +279,10 @@ bool find_queue_families(VkPhysicalDevice device, VkSurfaceKHR surface,
       indices->transfer = i;
     }
 
+    if (surface == VK_NULL_HANDLE) {
+      continue;
+    }
+
     VkBool32 present_supported;
     vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
                                          &present_supported);
@@ -238,8 +290,11 @@ bool find_queue_families(VkPhysicalDevice device, VkSurfaceKHR surface,
       indices->present = i;
     }
   }
+  if (surface == VK_NULL_HANDLE) {
+    indices->present = indices->graphics;
+  }
 
-  free(families);
+  arena_pop(scratch, marker);
   return true;
 }
 
@@ -278,14 +333,133 @@ u32 *remove_duplicate_and_invalid_indices(u32 *indices, i32 num_indices,
   return indices;
 }
 
+// fills features and chains the feature structs to enable onto create_info,
+// appending the extensions they need to extensions
+static void query_optional_features(
+    VkPhysicalDevice physical_device, device_features *features,
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT *library,
+    VkPhysicalDeviceExtendedDynamicStateFeaturesEXT *dynamic_state,
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR *rendering,
+    VkDeviceCreateInfo *create_info, const char **extensions,
+    u32 *num_extensions) {
+  *features = (device_features){};
+  *library = (VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT){
+      .sType =
+          VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT,
+  };
+  *dynamic_state = (VkPhysicalDeviceExtendedDynamicStateFeaturesEXT){
+      .sType =
+          VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT,
+  };
+  *rendering = (VkPhysicalDeviceDynamicRenderingFeaturesKHR){
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+  };
+
+  // the feature and property queries below are core since vulkan 1.1
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  if (properties.apiVersion < VK_API_VERSION_1_1) {
+    LOG_INFO("vulkan " PRIvkVer " device, optional features disabled",
+             PRIvkVerArg(properties.apiVersion));
+    return;
+  }
+
+  bool has_library = physical_device_supports_extensions(
+      physical_device, graphics_pipeline_library_extensions,
+      ARRAY_LEN(graphics_pipeline_library_extensions));
+  bool has_dynamic_state = physical_device_supports_extensions(
+      physical_device, extended_dynamic_state_extensions,
+      ARRAY_LEN(extended_dynamic_state_extensions));
+  bool has_rendering = physical_device_supports_extensions(
+      physical_device, dynamic_rendering_extensions,
+      ARRAY_LEN(dynamic_rendering_extensions));
+  void *chain = NULL;
+  if (has_rendering) {
+    rendering->pNext = chain;
+    chain = rendering;
+  }
+  if (has_dynamic_state) {
+    dynamic_state->pNext = chain;
+    chain = dynamic_state;
+  }
+  if (has_library) {
+    library->pNext = chain;
+    chain = library;
+  }
+  vkGetPhysicalDeviceFeatures2(
+      physical_device, &(VkPhysicalDeviceFeatures2){
+                           .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                           .pNext = chain,
+                       });
+
+  VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT library_properties = {
+      .sType =
+          VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT,
+  };
+  if (has_library) {
+    vkGetPhysicalDeviceProperties2(
+        physical_device,
+        &(VkPhysicalDeviceProperties2){
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &library_properties,
+        });
+  }
+
+  // without fast linking a linked pipeline costs as much as a monolithic one,
+  // which defeats the point of splitting it up
+  features->graphics_pipeline_library =
+      has_library && library->graphicsPipelineLibrary &&
+      library_properties.graphicsPipelineLibraryFastLinking;
+  features->extended_dynamic_state =
+      has_dynamic_state && dynamic_state->extendedDynamicState;
+  features->dynamic_rendering = has_rendering && rendering->dynamicRendering;
+
+  // only the features actually enabled may be chained onto the create info
+  chain = NULL;
+  if (features->dynamic_rendering) {
+    rendering->pNext = chain;
+    chain = rendering;
+    for (u32 i = 0; i < ARRAY_LEN(dynamic_rendering_extensions); ++i) {
+      extensions[(*num_extensions)++] = dynamic_rendering_extensions[i];
+    }
+  }
+  if (features->extended_dynamic_state) {
+    dynamic_state->pNext = chain;
+    chain = dynamic_state;
+    for (u32 i = 0; i < ARRAY_LEN(extended_dynamic_state_extensions); ++i) {
+      extensions[(*num_extensions)++] = extended_dynamic_state_extensions[i];
+    }
+  }
+  if (features->graphics_pipeline_library) {
+    library->pNext = chain;
+    chain = library;
+    for (u32 i = 0; i < ARRAY_LEN(graphics_pipeline_library_extensions); ++i) {
+      extensions[(*num_extensions)++] = graphics_pipeline_library_extensions[i];
+    }
+  }
+  create_info->pNext = chain;
+
+  LOG_INFO("graphics pipeline library %s, extended dynamic state %s, "
+           "dynamic rendering %s",
+           features->graphics_pipeline_library ? "enabled" : "unavailable",
+           features->extended_dynamic_state ? "enabled" : "unavailable",
+           features->dynamic_rendering ? "enabled" : "unavailable");
+}
+
 bool device_init(VkPhysicalDevice physical_device, VkSurfaceKHR surface,
-                 VkDevice *device) {
+                 device_features *features, VkDevice *device) {
   queue_family_indices indices;
   find_queue_families(physical_device, surface, &indices);
   assert(queue_family_indices_complete(&indices));
 
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return false;
+  }
+
+  arena_marker marker = arena_mark(scratch);
   u32 num_layers = 0;
-  const char **layers = get_validation_layers(&num_layers);
+  const char **layers = get_validation_layers(scratch, &num_layers);
   if (!layers) {
     num_layers = 0;
   }
@@ -308,35 +482,56 @@ bool device_init(VkPhysicalDevice physical_device, VkSurfaceKHR surface,
     };
   }
 
+  const char *extensions[MAX_DEVICE_EXTENSIONS];
+  u32 num_extensions = 0;
+  // headless rendering does not present, so it needs no swapchain
+  if (surface != VK_NULL_HANDLE) {
+    for (u32 i = 0; i < num_required_device_extensions; ++i) {
+      extensions[num_extensions++] = required_device_extensions[i];
+    }
+  }
+
+  VkPhysicalDeviceFeatures supported_features;
+  vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+  VkPhysicalDeviceFeatures enabled_features = {
+      .samplerAnisotropy = VK_TRUE,
+      .pipelineStatisticsQuery = supported_features.pipelineStatisticsQuery,
+  };
+  VkDeviceCreateInfo create_info = {
+      .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+      .pEnabledFeatures = &enabled_features,
+      .ppEnabledLayerNames = layers,
+      .enabledLayerCount = num_layers,
+      .ppEnabledExtensionNames = extensions,
+      .pQueueCreateInfos = queue_info,
+      .queueCreateInfoCount = num_unique_indices,
+  };
+  VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT library_features;
+  VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamic_state_features;
+  VkPhysicalDeviceDynamicRenderingFeaturesKHR rendering_features;
+  query_optional_features(physical_device, features, &library_features,
+                          &dynamic_state_features, &rendering_features,
+                          &create_info, extensions, &num_extensions);
+  create_info.enabledExtensionCount = num_extensions;
+  features->pipeline_statistics_query =
+      enabled_features.pipelineStatisticsQuery;
+
   VkResult result;
-  if ((result = vkCreateDevice(
-           physical_device,
-           &(VkDeviceCreateInfo){
-               .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-               .pEnabledFeatures =
-                   &(VkPhysicalDeviceFeatures){
-                       .samplerAnisotropy = VK_TRUE,
-                   },
-               .ppEnabledLayerNames = layers,
-               .enabledLayerCount = num_layers,
-               .ppEnabledExtensionNames = required_device_extensions,
-               .enabledExtensionCount = num_required_device_extensions,
-               .pQueueCreateInfos = queue_info,
-               .queueCreateInfoCount = num_unique_indices},
-           NULL, device)) != VK_SUCCESS) {
+  if ((result = vkCreateDevice(physical_device, &create_info, NULL, device)) !=
+      VK_SUCCESS) {
     LOG_ERROR("unable to create device: %s", vk_error_to_string(result));
-    free(layers);
+    arena_pop(scratch, marker);
     return false;
   }
 
-  free(layers);
+  arena_pop(scratch, marker);
   return true;
 }
 
 void device_free(VkDevice device) { vkDestroyDevice(device, NULL); }
 
 bool query_swap_chain_support(VkPhysicalDevice device, VkSurfaceKHR surface,
-                              swap_chain_support_details *details) {
+                              arena *out, swap_chain_support_details *details) {
   VkResult result;
   result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
                                                      &details->caps);
@@ -346,6 +541,7 @@ bool query_swap_chain_support(VkPhysicalDevice device, VkSurfaceKHR surface,
     return false;
   }
 
+  arena_marker marker = arena_mark(out);
   details->formats = NULL;
   details->present_modes = NULL;
   result = vkGetPhysicalDeviceSurfaceFormatsKHR(
@@ -355,10 +551,10 @@ bool query_swap_chain_support(VkPhysicalDevice device, VkSurfaceKHR surface,
               vk_error_to_string(result));
     goto fail;
   }
-  details->formats = malloc(details->num_formats * sizeof(*details->formats));
+  details->formats =
+      arena_push_array(out, VkSurfaceFormatKHR, details->num_formats);
   if (!details->formats) {
-    LOG_ERROR("unable to allocate memory for surface formats: %s",
-              vk_error_to_string(result));
+    LOG_ERROR("unable to allocate memory for surface formats");
     goto fail;
   }
 
@@ -378,10 +574,9 @@ bool query_swap_chain_support(VkPhysicalDevice device, VkSurfaceKHR surface,
     goto fail;
   }
   details->present_modes =
-      malloc(details->num_present_modes * sizeof(*details->present_modes));
+      arena_push_array(out, VkPresentModeKHR, details->num_present_modes);
   if (!details->present_modes) {
-    LOG_ERROR("unable to allocate memory for surface present modes: %s",
-              vk_error_to_string(result));
+    LOG_ERROR("unable to allocate memory for surface present modes");
     goto fail;
   }
 
@@ -394,12 +589,6 @@ bool query_swap_chain_support(VkPhysicalDevice device, VkSurfaceKHR surface,
   }
   return true;
 fail:
-  free(details->formats);
-  free(details->present_modes);
+  arena_pop(out, marker);
   return false;
 }
-
-void swap_chain_support_details_free(swap_chain_support_details *details) {
-  free(details->formats);
-  free(details->present_modes);
-}
@@ -1,10 +1,14 @@
 #pragma once
 
+#include "arena.h"
 #include "types.h"
 #include <vulkan/vulkan_core.h>
 
 VkSampleCountFlagBits best_msaa_sample_count(VkPhysicalDevice physical_device);
 
+// surface may be VK_NULL_HANDLE for headless rendering, which neither needs
+// present support nor VK_KHR_swapchain; the present queue family is then the
+// graphics one
 VkPhysicalDevice physical_device_pick(VkInstance instance,
                                       VkSurfaceKHR surface);
 
@@ -23,8 +27,20 @@ u32 *remove_duplicate_and_invalid_indices(u32 *indices, i32 num_indices,
                                           i32 *num_unique_indices,
                                           VkSharingMode *sharing_mode);
 
+// optional features, enabled whenever the physical device supports them
+typedef struct {
+  // VK_EXT_graphics_pipeline_library with fast linking
+  bool graphics_pipeline_library;
+  // VK_EXT_extended_dynamic_state
+  bool extended_dynamic_state;
+  // VK_KHR_dynamic_rendering, replaces render pass and framebuffer objects
+  bool dynamic_rendering;
+  // pipelineStatisticsQuery, for the gpu profiler
+  bool pipeline_statistics_query;
+} device_features;
+
 bool device_init(VkPhysicalDevice physical_device, VkSurfaceKHR surface,
-                 VkDevice *device);
+                 device_features *features, VkDevice *device);
 void device_free(VkDevice device);
 
 typedef struct {
@@ -35,6 +51,6 @@ typedef struct {
   u32 num_present_modes;
 } swap_chain_support_details;
 
+// formats and present modes are pushed onto out
 bool query_swap_chain_support(VkPhysicalDevice device, VkSurfaceKHR surface,
-                              swap_chain_support_details *details);
-void swap_chain_support_details_free(swap_chain_support_details *details);
+                              arena *out, swap_chain_support_details *details);
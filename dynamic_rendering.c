@@ -0,0 +1,152 @@
+#include "dynamic_rendering.h"
+#include "log.h"
+
+bool dynamic_rendering_load(VkDevice device, dynamic_rendering *r) {
+  r->begin_rendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(
+      device, "vkCmdBeginRenderingKHR");
+  r->end_rendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(
+      device, "vkCmdEndRenderingKHR");
+  if (!r->begin_rendering || !r->end_rendering) {
+    LOG_ERROR("unable to load VK_KHR_dynamic_rendering functions");
+    return false;
+  }
+
+  return true;
+}
+
+static VkImageAspectFlags depth_aspect(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_D16_UNORM_S8_UINT:
+  case VK_FORMAT_D24_UNORM_S8_UINT:
+  case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+  default:
+    return VK_IMAGE_ASPECT_DEPTH_BIT;
+  }
+}
+
+static VkImageMemoryBarrier color_barrier(VkImage image,
+                                          VkAccessFlags src_access) {
+  return (VkImageMemoryBarrier){
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = src_access,
+      .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = image,
+      .subresourceRange =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .levelCount = 1,
+              .layerCount = 1,
+          },
+  };
+}
+
+void dynamic_rendering_cmd_begin(const dynamic_rendering *r,
+                                 VkCommandBuffer command_buffer,
+                                 const dynamic_rendering_targets *t) {
+  bool resolve = t->samples != VK_SAMPLE_COUNT_1_BIT;
+
+  // the present image becomes available at color attachment output, where
+  // the acquire semaphore is waited on; the multisampled color and depth
+  // images are shared by the frames in flight so their previous writes are
+  // waited on too
+  VkImageMemoryBarrier barriers[3];
+  u32 num_barriers = 0;
+  barriers[num_barriers++] = color_barrier(t->present_image, 0);
+  if (resolve) {
+    barriers[num_barriers++] =
+        color_barrier(t->color_image, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+  }
+  barriers[num_barriers++] = (VkImageMemoryBarrier){
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                       VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = t->depth_image,
+      .subresourceRange =
+          {
+              .aspectMask = depth_aspect(t->depth_format),
+              .levelCount = 1,
+              .layerCount = 1,
+          },
+  };
+  vkCmdPipelineBarrier(command_buffer,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                           VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                           VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                           VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                       0, 0, NULL, 0, NULL, num_barriers, barriers);
+
+  // the multisampled contents are only needed until they are resolved
+  VkRenderingAttachmentInfoKHR color = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+      .imageView = resolve ? t->color_view : t->present_view,
+      .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .resolveMode =
+          resolve ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE,
+      .resolveImageView = resolve ? t->present_view : VK_NULL_HANDLE,
+      .resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = resolve ? VK_ATTACHMENT_STORE_OP_DONT_CARE
+                         : VK_ATTACHMENT_STORE_OP_STORE,
+      .clearValue = {.color = t->clear_color},
+  };
+  VkRenderingAttachmentInfoKHR depth = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+      .imageView = t->depth_view,
+      .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      .resolveMode = VK_RESOLVE_MODE_NONE,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .clearValue = {.depthStencil = {1.0, 0}},
+  };
+  r->begin_rendering(command_buffer,
+                     &(VkRenderingInfoKHR){
+                         .sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR,
+                         .renderArea = {.offset = {0, 0}, .extent = t->extent},
+                         .layerCount = 1,
+                         .colorAttachmentCount = 1,
+                         .pColorAttachments = &color,
+                         .pDepthAttachment = &depth,
+                     });
+}
+
+void dynamic_rendering_cmd_end(const dynamic_rendering *r,
+                               VkCommandBuffer command_buffer,
+                               const dynamic_rendering_targets *t) {
+  r->end_rendering(command_buffer);
+  if (t->present_layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL) {
+    return;
+  }
+
+  // presentation is ordered by the render finished semaphore, no access to
+  // make the writes available to
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1,
+      &(VkImageMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+          .dstAccessMask = 0,
+          .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+          .newLayout = t->present_layout,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = t->present_image,
+          .subresourceRange =
+              {
+                  .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                  .levelCount = 1,
+                  .layerCount = 1,
+              },
+      });
+}
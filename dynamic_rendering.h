@@ -0,0 +1,41 @@
+#pragma once
+
+#include "types.h"
+#include <vulkan/vulkan_core.h>
+
+typedef struct {
+  PFN_vkCmdBeginRenderingKHR begin_rendering;
+  PFN_vkCmdEndRenderingKHR end_rendering;
+} dynamic_rendering;
+
+// the device must have VK_KHR_dynamic_rendering enabled
+bool dynamic_rendering_load(VkDevice device, dynamic_rendering *r);
+
+// the attachments of a frame, the multisampled color image is resolved into
+// the present image at the end of rendering
+typedef struct {
+  VkExtent2D extent;
+  VkSampleCountFlagBits samples;
+  // unused without multisampling, the present image is rendered to directly
+  VkImage color_image;
+  VkImageView color_view;
+  VkImage depth_image;
+  VkImageView depth_view;
+  VkFormat depth_format;
+  VkImage present_image;
+  VkImageView present_view;
+  // left in this layout at the end, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR unless
+  // the image is not presented
+  VkImageLayout present_layout;
+  VkClearColorValue clear_color;
+} dynamic_rendering_targets;
+
+// transitions the attachments into their attachment layouts, discarding
+// their contents, and begins rendering with all of them cleared
+void dynamic_rendering_cmd_begin(const dynamic_rendering *r,
+                                 VkCommandBuffer command_buffer,
+                                 const dynamic_rendering_targets *t);
+// ends rendering and transitions the present image to its present layout
+void dynamic_rendering_cmd_end(const dynamic_rendering *r,
+                               VkCommandBuffer command_buffer,
+                               const dynamic_rendering_targets *t);
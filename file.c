@@ -0,0 +1,66 @@
+#include "file.h"
+#include "log.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+char *file_read(arena *out, const char *path, i32 *len) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    goto fail_fopen;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long s_len = ftell(file);
+  assert(s_len >= 0);
+  *len = s_len;
+  fseek(file, 0, SEEK_SET);
+
+  char *buf = arena_push(out, *len, 1);
+  if (!buf) {
+    LOG_ERROR("unable to allocate buffer for file");
+    goto fail_malloc;
+  }
+
+  fread(buf, *len, 1, file);
+  assert(!ferror(file));
+  assert(fgetc(file) == EOF && feof(file));
+
+  fclose(file);
+  return buf;
+
+fail_malloc:
+  fclose(file);
+fail_fopen:
+  return NULL;
+}
+
+bool file_write_atomic(const char *path, const void *header, usize header_len,
+                       const void *data, usize data_len) {
+  // unique per writer, so that threads racing on the same path do not
+  // clobber each other's temporary file
+  static atomic_uint counter = 0;
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.%u.tmp", path, (long)getpid(),
+           atomic_fetch_add(&counter, 1));
+  FILE *file = fopen(tmp_path, "wb");
+  if (!file) {
+    LOG_WARN("unable to open '%s' for writing: %s", tmp_path, strerror(errno));
+    return false;
+  }
+
+  bool success =
+      (header_len == 0 || fwrite(header, header_len, 1, file) == 1) &&
+      (data_len == 0 || fwrite(data, data_len, 1, file) == 1);
+  success = fclose(file) == 0 && success;
+  if (!success || rename(tmp_path, path) == -1) {
+    LOG_WARN("unable to write '%s': %s", path, strerror(errno));
+    unlink(tmp_path);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "arena.h"
+#include "types.h"
+#include <linux/limits.h>
+
+// reads the whole file into out, returns NULL if it cannot be opened
+char *file_read(arena *out, const char *path, i32 *len);
+
+// writes header followed by data to a temporary file and renames it over
+// path, so that concurrent readers never observe a partially written file
+bool file_write_atomic(const char *path, const void *header, usize header_len,
+                       const void *data, usize data_len);
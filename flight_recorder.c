@@ -0,0 +1,168 @@
+#include "flight_recorder.h"
+#include "log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// frames between two updates of the rolling median
+#define MEDIAN_INTERVAL 32
+
+void flight_recorder_init(thread_pool *pool, const char *dir,
+                          double threshold_ms, double median_factor,
+                          flight_recorder *r) {
+  r->pool = pool;
+  r->dir = dir;
+  r->threshold_ns = threshold_ms > 0.0 ? threshold_ms * 1e6 : 0;
+  r->median_factor = median_factor > 0.0 ? median_factor : 0.0;
+  r->num_records = 0;
+  r->median_ns = 0;
+  r->spike_pending = false;
+  r->num_spikes = 0;
+  atomic_init(&r->dumping, false);
+}
+
+static const flight_record *record_at(const flight_recorder *r, u64 i) {
+  return &r->records[i % FLIGHT_RECORDER_CAPACITY];
+}
+
+static int compare_u64(const void *lhs, const void *rhs) {
+  u64 l = *(const u64 *)lhs, r = *(const u64 *)rhs;
+  return (l > r) - (l < r);
+}
+
+static void update_median(flight_recorder *r) {
+  u64 n = FLIGHT_RECORDER_MEDIAN_WINDOW;
+  for (u64 i = 0; i < n; ++i) {
+    r->median_scratch[i] =
+        record_at(r, r->num_records - n + i)->timings.ns[frame_stage_total];
+  }
+  qsort(r->median_scratch, n, sizeof(r->median_scratch[0]), compare_u64);
+  r->median_ns = r->median_scratch[n / 2];
+}
+
+static bool is_spike(const flight_recorder *r, u64 frame_ns) {
+  return (r->threshold_ns > 0 && frame_ns > r->threshold_ns) ||
+         (r->median_factor > 0.0 && r->median_ns > 0 &&
+          frame_ns > r->median_ns * r->median_factor);
+}
+
+static void write_dump(const flight_recorder *r) {
+  char timestamp[32];
+  time_t now = time(NULL);
+  struct tm tm;
+  strftime(timestamp, sizeof(timestamp), "%Y%m%d_%H%M%S",
+           localtime_r(&now, &tm));
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/frame_spike_%s_%" PRIu64 ".csv", r->dir,
+           timestamp, r->dump_spike_frame);
+
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    LOG_ERROR("unable to open '%s' for writing: %s", path, strerror(errno));
+    return;
+  }
+
+  fprintf(file, "# spike at frame %" PRIu64 ", rolling median %.3fms\n",
+          r->dump_spike_frame, r->dump_median_ns / 1e6);
+  fprintf(file, "frame,start_ms,spike");
+  for (i32 i = 0; i < frame_stage_count; ++i) {
+    fprintf(file, ",%s_ms", frame_stage_names[i]);
+  }
+  fprintf(file, "\n");
+
+  u64 first_ns = r->dump_len > 0 ? r->dump[0].start_ns : 0;
+  for (u32 i = 0; i < r->dump_len; ++i) {
+    const flight_record *rec = &r->dump[i];
+    fprintf(file, "%" PRIu64 ",%.3f,%d", rec->frame,
+            (rec->start_ns - first_ns) / 1e6, rec->spike);
+    for (i32 j = 0; j < frame_stage_count; ++j) {
+      fprintf(file, ",%.3f", rec->timings.ns[j] / 1e6);
+    }
+    fprintf(file, "\n");
+  }
+
+  if (fclose(file) != 0) {
+    LOG_ERROR("unable to write '%s': %s", path, strerror(errno));
+    return;
+  }
+  LOG_INFO("frame spike window written to '%s'", path);
+}
+
+static void dump_job(void *user_data) {
+  flight_recorder *r = user_data;
+  write_dump(r);
+  atomic_store(&r->dumping, false);
+}
+
+// copies the window around the pending spike for the worker, it is skipped
+// if the previous dump is still being written
+static void dump(flight_recorder *r, bool async) {
+  r->spike_pending = false;
+  if (atomic_exchange(&r->dumping, true)) {
+    LOG_WARN("frame spike at frame %" PRIu64 " not written, still writing "
+             "the previous one",
+             r->spike_frame);
+    return;
+  }
+
+  u64 len = r->num_records < FLIGHT_RECORDER_CAPACITY
+                ? r->num_records
+                : FLIGHT_RECORDER_CAPACITY;
+  for (u64 i = 0; i < len; ++i) {
+    r->dump[i] = *record_at(r, r->num_records - len + i);
+  }
+  r->dump_len = len;
+  r->dump_spike_frame = r->spike_frame;
+  r->dump_median_ns = r->median_ns;
+
+  if (async && thread_pool_submit(r->pool, dump_job, r)) {
+    return;
+  }
+  dump_job(r);
+}
+
+void flight_recorder_record(flight_recorder *r, u64 frame, u64 start_ns,
+                            const frame_timings *t) {
+  u64 frame_ns = t->ns[frame_stage_total];
+  bool spike = is_spike(r, frame_ns);
+  r->records[r->num_records % FLIGHT_RECORDER_CAPACITY] = (flight_record){
+      .frame = frame,
+      .start_ns = start_ns,
+      .timings = *t,
+      .spike = spike,
+  };
+  ++r->num_records;
+
+  if (spike) {
+    ++r->num_spikes;
+    LOG_WARN("frame %" PRIu64 " took %.3fms, rolling median %.3fms", frame,
+             frame_ns / 1e6, r->median_ns / 1e6);
+    // later spikes within the window are part of the same dump
+    if (!r->spike_pending) {
+      r->spike_pending = true;
+      r->spike_frame = frame;
+    }
+  }
+
+  if (r->spike_pending &&
+      frame >= r->spike_frame + FLIGHT_RECORDER_FRAMES_AFTER) {
+    dump(r, true);
+  }
+
+  if (r->num_records >= FLIGHT_RECORDER_MEDIAN_WINDOW &&
+      r->num_records % MEDIAN_INTERVAL == 0) {
+    update_median(r);
+  }
+}
+
+void flight_recorder_free(flight_recorder *r) {
+  if (r->spike_pending) {
+    dump(r, false);
+  }
+  if (r->num_spikes > 0) {
+    LOG_INFO("%" PRIu64 " frame spike(s) over %" PRIu64 " frames",
+             r->num_spikes, r->num_records);
+  }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "bench.h"
+#include "thread_pool.h"
+#include "types.h"
+#include <stdatomic.h>
+
+// frames kept, a spike is dumped with the frames before it that still fit
+#define FLIGHT_RECORDER_CAPACITY 512
+// frames recorded after a spike before it is dumped
+#define FLIGHT_RECORDER_FRAMES_AFTER 32
+// frames the rolling median is taken over
+#define FLIGHT_RECORDER_MEDIAN_WINDOW 128
+
+typedef struct {
+  u64 frame;
+  u64 start_ns;
+  frame_timings timings;
+  // the frame exceeded the threshold or median multiple
+  bool spike;
+} flight_record;
+
+// always-on ring of the latest frame timings; a frame slower than the
+// threshold or a multiple of the rolling median is written to a file together
+// with the frames around it, on a worker so the dump does not add a spike of
+// its own
+typedef struct {
+  thread_pool *pool;
+  const char *dir;
+  // 0 disables either criterion
+  u64 threshold_ns;
+  double median_factor;
+
+  flight_record records[FLIGHT_RECORDER_CAPACITY];
+  u64 num_records;
+  u64 median_ns;
+  u64 median_scratch[FLIGHT_RECORDER_MEDIAN_WINDOW];
+
+  // first spike still waiting for the frames after it
+  bool spike_pending;
+  u64 spike_frame;
+  u64 num_spikes;
+
+  // window handed to the worker, only touched by it while dumping is set
+  atomic_bool dumping;
+  flight_record dump[FLIGHT_RECORDER_CAPACITY];
+  u32 dump_len;
+  u64 dump_spike_frame;
+  u64 dump_median_ns;
+} flight_recorder;
+
+void flight_recorder_init(thread_pool *pool, const char *dir,
+                          double threshold_ms, double median_factor,
+                          flight_recorder *r);
+// writes a pending spike without waiting for the frames after it; the pool
+// must have been drained
+void flight_recorder_free(flight_recorder *r);
+
+void flight_recorder_record(flight_recorder *r, u64 frame, u64 start_ns,
+                            const frame_timings *t);
@@ -0,0 +1,223 @@
+#include "gpu_profiler.h"
+#include "log.h"
+#include "vk_utils.h"
+#include <assert.h>
+#include <stdio.h>
+
+// samples after which the averages turn from cumulative into exponential
+// moving ones
+#define GPU_PROFILER_WINDOW 128
+// frames between two logs of the averages
+#define GPU_PROFILER_LOG_INTERVAL 1000
+#define MAX_QUEUE_FAMILIES 32
+
+const char *gpu_stat_names[gpu_stat_count] = {
+    "input vertices",         "input primitives",    "vertex invocations",
+    "clipping invocations",   "clipping primitives", "fragment invocations",
+};
+
+static const VkQueryPipelineStatisticFlags statistic_flags =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+static bool query_pool_create(VkDevice device, VkQueryType type,
+                              VkQueryPipelineStatisticFlags statistics,
+                              u32 num_queries, VkQueryPool *pool) {
+  VkResult result;
+  if ((result = vkCreateQueryPool(
+           device,
+           &(VkQueryPoolCreateInfo){
+               .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+               .queryType = type,
+               .queryCount = num_queries,
+               .pipelineStatistics = statistics,
+           },
+           NULL, pool)) != VK_SUCCESS) {
+    LOG_ERROR("unable to create query pool: %s", vk_error_to_string(result));
+    return false;
+  }
+
+  return true;
+}
+
+bool gpu_profiler_init(VkPhysicalDevice physical_device, VkDevice device,
+                       u32 queue_family, u32 num_frames,
+                       const char *const *scope_names, u32 num_scopes,
+                       bool pipeline_statistics, gpu_profiler *p) {
+  assert(num_frames <= GPU_PROFILER_MAX_FRAMES);
+  assert(num_scopes <= GPU_PROFILER_MAX_SCOPES);
+  *p = (gpu_profiler){
+      .device = device,
+      .timestamps = VK_NULL_HANDLE,
+      .statistics = VK_NULL_HANDLE,
+      .num_frames = num_frames,
+      .scope_names = scope_names,
+      .num_scopes = num_scopes,
+  };
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  VkQueueFamilyProperties families[MAX_QUEUE_FAMILIES];
+  u32 num_families = MAX_QUEUE_FAMILIES;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &num_families,
+                                           families);
+  u32 valid_bits =
+      queue_family < num_families ? families[queue_family].timestampValidBits
+                                  : 0;
+  p->timestamp_period_ns = properties.limits.timestampPeriod;
+  p->timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+  if (valid_bits == 0) {
+    LOG_INFO("gpu timestamps unsupported on the graphics queue");
+  } else if (!query_pool_create(device, VK_QUERY_TYPE_TIMESTAMP, 0,
+                                num_frames * num_scopes * 2,
+                                &p->timestamps)) {
+    return false;
+  }
+
+  if (!pipeline_statistics) {
+    LOG_INFO("gpu pipeline statistics unsupported");
+  } else if (!query_pool_create(device, VK_QUERY_TYPE_PIPELINE_STATISTICS,
+                                statistic_flags, num_frames,
+                                &p->statistics)) {
+    vkDestroyQueryPool(device, p->timestamps, NULL);
+    return false;
+  }
+
+  return true;
+}
+
+void gpu_profiler_free(const gpu_profiler *p) {
+  vkDestroyQueryPool(p->device, p->statistics, NULL);
+  vkDestroyQueryPool(p->device, p->timestamps, NULL);
+}
+
+// num_samples includes the new value; a cumulative mean until the window is
+// full, then an exponential moving average, which needs no sample history
+static void rolling_average(double *average, u64 num_samples, double value) {
+  u64 n = num_samples < GPU_PROFILER_WINDOW ? num_samples : GPU_PROFILER_WINDOW;
+  *average += (value - *average) / n;
+}
+
+void gpu_profiler_collect(gpu_profiler *p, u32 frame) {
+  if (!p->pending[frame]) {
+    return;
+  }
+  p->pending[frame] = false;
+
+  // each value is followed by its availability, scopes that were not
+  // recorded this frame are simply unavailable
+  const VkQueryResultFlags flags =
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT;
+  VkResult result;
+  if (p->timestamps != VK_NULL_HANDLE) {
+    u64 values[GPU_PROFILER_MAX_SCOPES * 2][2];
+    u32 num_queries = p->num_scopes * 2;
+    result = vkGetQueryPoolResults(p->device, p->timestamps,
+                                   frame * num_queries, num_queries,
+                                   sizeof(values), values, sizeof(values[0]),
+                                   flags);
+    if (result != VK_SUCCESS && result != VK_NOT_READY) {
+      LOG_WARN("unable to read back gpu timestamps: %s",
+               vk_error_to_string(result));
+    } else {
+      for (u32 i = 0; i < p->num_scopes; ++i) {
+        const u64 *begin = values[i * 2], *end = values[i * 2 + 1];
+        if (!begin[1] || !end[1]) {
+          continue;
+        }
+        u64 ticks = (end[0] - begin[0]) & p->timestamp_mask;
+        rolling_average(&p->scope_ms[i], ++p->scope_samples[i],
+                        ticks * p->timestamp_period_ns / 1e6);
+      }
+    }
+  }
+
+  if (p->statistics != VK_NULL_HANDLE) {
+    u64 values[gpu_stat_count + 1];
+    result = vkGetQueryPoolResults(p->device, p->statistics, frame, 1,
+                                   sizeof(values), values, sizeof(values),
+                                   flags);
+    if (result != VK_SUCCESS && result != VK_NOT_READY) {
+      LOG_WARN("unable to read back gpu pipeline statistics: %s",
+               vk_error_to_string(result));
+    } else if (values[gpu_stat_count]) {
+      ++p->stat_samples;
+      for (i32 i = 0; i < gpu_stat_count; ++i) {
+        rolling_average(&p->stats[i], p->stat_samples, values[i]);
+      }
+    }
+  }
+
+  if (++p->num_frames_collected % GPU_PROFILER_LOG_INTERVAL == 0) {
+    gpu_profiler_log(p);
+  }
+}
+
+void gpu_profiler_log(const gpu_profiler *p) {
+  char line[512];
+  i32 len = 0;
+  for (u32 i = 0; i < p->num_scopes; ++i) {
+    if (p->scope_samples[i] > 0 && len < (i32)sizeof(line)) {
+      len += snprintf(line + len, sizeof(line) - len, "%s%s %.3fms",
+                      len > 0 ? ", " : "", p->scope_names[i], p->scope_ms[i]);
+    }
+  }
+  if (len > 0) {
+    LOG_INFO("gpu time (average): %s", line);
+  }
+
+  if (p->stat_samples > 0) {
+    len = 0;
+    for (i32 i = 0; i < gpu_stat_count && len < (i32)sizeof(line); ++i) {
+      len += snprintf(line + len, sizeof(line) - len, "%s%.0f %s",
+                      i > 0 ? ", " : "", p->stats[i], gpu_stat_names[i]);
+    }
+    LOG_INFO("gpu statistics per frame (average): %s", line);
+  }
+}
+
+void gpu_profiler_cmd_reset(gpu_profiler *p, VkCommandBuffer cmd, u32 frame) {
+  if (p->timestamps != VK_NULL_HANDLE) {
+    u32 num_queries = p->num_scopes * 2;
+    vkCmdResetQueryPool(cmd, p->timestamps, frame * num_queries, num_queries);
+  }
+  if (p->statistics != VK_NULL_HANDLE) {
+    vkCmdResetQueryPool(cmd, p->statistics, frame, 1);
+  }
+  p->pending[frame] = true;
+}
+
+void gpu_profiler_cmd_begin_scope(const gpu_profiler *p, VkCommandBuffer cmd,
+                                  u32 frame, u32 scope) {
+  if (p->timestamps != VK_NULL_HANDLE) {
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, p->timestamps,
+                        (frame * p->num_scopes + scope) * 2);
+  }
+}
+
+void gpu_profiler_cmd_end_scope(const gpu_profiler *p, VkCommandBuffer cmd,
+                                u32 frame, u32 scope) {
+  if (p->timestamps != VK_NULL_HANDLE) {
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        p->timestamps, (frame * p->num_scopes + scope) * 2 + 1);
+  }
+}
+
+void gpu_profiler_cmd_begin_statistics(const gpu_profiler *p,
+                                       VkCommandBuffer cmd, u32 frame) {
+  if (p->statistics != VK_NULL_HANDLE) {
+    vkCmdBeginQuery(cmd, p->statistics, frame, 0);
+  }
+}
+
+void gpu_profiler_cmd_end_statistics(const gpu_profiler *p,
+                                     VkCommandBuffer cmd, u32 frame) {
+  if (p->statistics != VK_NULL_HANDLE) {
+    vkCmdEndQuery(cmd, p->statistics, frame);
+  }
+}
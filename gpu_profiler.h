@@ -0,0 +1,71 @@
+#pragma once
+
+#include "types.h"
+#include <vulkan/vulkan_core.h>
+
+#define GPU_PROFILER_MAX_FRAMES 4
+#define GPU_PROFILER_MAX_SCOPES 8
+
+// pipeline statistics counted per frame, in the order vulkan writes them
+typedef enum {
+  gpu_stat_input_vertices,
+  gpu_stat_input_primitives,
+  gpu_stat_vertex_invocations,
+  gpu_stat_clipping_invocations,
+  gpu_stat_clipping_primitives,
+  gpu_stat_fragment_invocations,
+  gpu_stat_count,
+} gpu_stat;
+
+extern const char *gpu_stat_names[gpu_stat_count];
+
+// timestamp pairs around named scopes and pipeline statistics, each frame in
+// flight has its own range of queries which is only read back once the fence
+// of that frame has been waited on, so reading never stalls
+typedef struct {
+  VkDevice device;
+  // VK_NULL_HANDLE if the queue has no timestamps or the device no pipeline
+  // statistics
+  VkQueryPool timestamps;
+  VkQueryPool statistics;
+  double timestamp_period_ns;
+  u64 timestamp_mask;
+  u32 num_frames;
+  const char *const *scope_names;
+  u32 num_scopes;
+  // queries of the frame slot were recorded and not read back yet
+  bool pending[GPU_PROFILER_MAX_FRAMES];
+  u64 num_frames_collected;
+  // cumulative means over the first GPU_PROFILER_WINDOW samples, exponential
+  // moving averages with a weight of 1 / GPU_PROFILER_WINDOW after that
+  u64 scope_samples[GPU_PROFILER_MAX_SCOPES];
+  double scope_ms[GPU_PROFILER_MAX_SCOPES];
+  u64 stat_samples;
+  double stats[gpu_stat_count];
+} gpu_profiler;
+
+// scope_names must outlive the profiler; neither query type being supported
+// is not an error, the profiler then records nothing
+bool gpu_profiler_init(VkPhysicalDevice physical_device, VkDevice device,
+                       u32 queue_family, u32 num_frames,
+                       const char *const *scope_names, u32 num_scopes,
+                       bool pipeline_statistics, gpu_profiler *p);
+void gpu_profiler_free(const gpu_profiler *p);
+
+// reads back the frame slot's queries, the fence of its last submission must
+// have been waited on
+void gpu_profiler_collect(gpu_profiler *p, u32 frame);
+void gpu_profiler_log(const gpu_profiler *p);
+
+// must be recorded before any other query command of the frame, outside of a
+// render pass
+void gpu_profiler_cmd_reset(gpu_profiler *p, VkCommandBuffer cmd, u32 frame);
+void gpu_profiler_cmd_begin_scope(const gpu_profiler *p, VkCommandBuffer cmd,
+                                  u32 frame, u32 scope);
+void gpu_profiler_cmd_end_scope(const gpu_profiler *p, VkCommandBuffer cmd,
+                                u32 frame, u32 scope);
+// statistics cover the commands in between, at most once per frame
+void gpu_profiler_cmd_begin_statistics(const gpu_profiler *p,
+                                       VkCommandBuffer cmd, u32 frame);
+void gpu_profiler_cmd_end_statistics(const gpu_profiler *p,
+                                     VkCommandBuffer cmd, u32 frame);
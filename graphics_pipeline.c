@@ -0,0 +1,204 @@
+#include "graphics_pipeline.h"
+#include "log.h"
+#include "vk_utils.h"
+#include <vulkan/vulkan_core.h>
+
+static const VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+static const VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT;
+static const VkFrontFace front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+static const VkBool32 depth_test = VK_TRUE;
+static const VkBool32 depth_write = VK_TRUE;
+static const VkCompareOp depth_compare_op = VK_COMPARE_OP_LESS;
+
+// the first NUM_BASE_DYNAMIC_STATES are dynamic in every pipeline
+#define NUM_BASE_DYNAMIC_STATES 2
+static const VkDynamicState dynamic_states[] = {
+    VK_DYNAMIC_STATE_VIEWPORT,
+    VK_DYNAMIC_STATE_SCISSOR,
+    VK_DYNAMIC_STATE_CULL_MODE_EXT,
+    VK_DYNAMIC_STATE_FRONT_FACE_EXT,
+    VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT,
+    VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT,
+    VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT,
+    VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT,
+};
+
+void graphics_pipeline_state_init(const graphics_pipeline_desc *desc,
+                                  bool dynamic_state,
+                                  graphics_pipeline_state *s) {
+  s->vertex_input = (VkPipelineVertexInputStateCreateInfo){
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+      .vertexBindingDescriptionCount = desc->interface->num_attributes,
+      .pVertexBindingDescriptions = desc->interface->vertex_bindings,
+      .vertexAttributeDescriptionCount = desc->interface->num_attributes,
+      .pVertexAttributeDescriptions = desc->interface->attributes,
+  };
+  s->input_assembly = (VkPipelineInputAssemblyStateCreateInfo){
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+      .topology = topology,
+      .primitiveRestartEnable = VK_FALSE,
+  };
+  s->viewport_state = (VkPipelineViewportStateCreateInfo){
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+      .scissorCount = 1,
+      .viewportCount = 1,
+  };
+  s->rasterization = (VkPipelineRasterizationStateCreateInfo){
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+      .cullMode = cull_mode,
+      .frontFace = front_face,
+      .lineWidth = 1.0,
+      .polygonMode = VK_POLYGON_MODE_FILL,
+      .depthBiasEnable = VK_FALSE,
+      .depthClampEnable = VK_FALSE,
+      .depthBiasClamp = 0.0,
+      .depthBiasSlopeFactor = 0.0,
+      .depthBiasConstantFactor = 0.0,
+      .rasterizerDiscardEnable = VK_FALSE,
+  };
+  s->multisample = (VkPipelineMultisampleStateCreateInfo){
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+      .pSampleMask = NULL,
+      .minSampleShading = 1.0,
+      .alphaToOneEnable = VK_FALSE,
+      .alphaToCoverageEnable = VK_FALSE,
+      .sampleShadingEnable = VK_FALSE,
+      .rasterizationSamples = desc->samples,
+  };
+  s->depth_stencil = (VkPipelineDepthStencilStateCreateInfo){
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+      .depthTestEnable = depth_test,
+      .depthWriteEnable = depth_write,
+      .depthCompareOp = depth_compare_op,
+      .depthBoundsTestEnable = VK_FALSE,
+      .minDepthBounds = 0.0,
+      .maxDepthBounds = 1.0,
+      .stencilTestEnable = VK_FALSE,
+  };
+  s->blend_attachment = (VkPipelineColorBlendAttachmentState){
+      .blendEnable = VK_TRUE,
+      .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+      .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+      .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+      .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+      .colorBlendOp = VK_BLEND_OP_ADD,
+      .alphaBlendOp = VK_BLEND_OP_ADD,
+      .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+  };
+  s->color_blend = (VkPipelineColorBlendStateCreateInfo){
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+      .logicOp = VK_LOGIC_OP_COPY,
+      .attachmentCount = 1,
+      .pAttachments = &s->blend_attachment,
+      .logicOpEnable = VK_FALSE,
+      .blendConstants = {},
+  };
+  s->dynamic = (VkPipelineDynamicStateCreateInfo){
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+      .dynamicStateCount =
+          dynamic_state ? sizeof(dynamic_states) / sizeof(dynamic_states[0])
+                        : NUM_BASE_DYNAMIC_STATES,
+      .pDynamicStates = dynamic_states,
+  };
+  s->color_format = desc->color_format;
+  s->rendering = (VkPipelineRenderingCreateInfoKHR){
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+      .colorAttachmentCount = 1,
+      .pColorAttachmentFormats = &s->color_format,
+      .depthAttachmentFormat = desc->depth_format,
+  };
+}
+
+bool graphics_pipeline_create(VkDevice device, VkPipelineCache cache,
+                              const graphics_pipeline_desc *desc,
+                              bool dynamic_state, VkPipeline *pipeline) {
+  graphics_pipeline_state s;
+  graphics_pipeline_state_init(desc, dynamic_state, &s);
+
+  VkResult result;
+  if ((result = vkCreateGraphicsPipelines(
+           device, cache, 1,
+           &(VkGraphicsPipelineCreateInfo){
+               .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+               .pNext = desc->render_pass == VK_NULL_HANDLE ? &s.rendering
+                                                            : NULL,
+               .layout = desc->layout,
+               .pStages =
+                   (VkPipelineShaderStageCreateInfo[]){
+                       desc->vertex_stage,
+                       desc->fragment_stage,
+                   },
+               .stageCount = 2,
+               .subpass = 0,
+               .renderPass = desc->render_pass,
+               .pDynamicState = &s.dynamic,
+               .pColorBlendState = &s.color_blend,
+               .pViewportState = &s.viewport_state,
+               .pMultisampleState = &s.multisample,
+               .pVertexInputState = &s.vertex_input,
+               .basePipelineHandle = VK_NULL_HANDLE,
+               .basePipelineIndex = -1,
+               .pDepthStencilState = &s.depth_stencil,
+               .pTessellationState = NULL,
+               .pInputAssemblyState = &s.input_assembly,
+               .pRasterizationState = &s.rasterization,
+           },
+           NULL, pipeline)) != VK_SUCCESS) {
+    LOG_ERROR("unable to create graphics pipeline: %s",
+              vk_error_to_string(result));
+    return false;
+  }
+
+  return true;
+}
+
+bool graphics_pipeline_dynamic_state_load(VkDevice device,
+                                          graphics_pipeline_dynamic_state *d) {
+#define LOAD(field, name)                                                      \
+  d->field = (PFN_##name)vkGetDeviceProcAddr(device, #name)
+  LOAD(set_cull_mode, vkCmdSetCullModeEXT);
+  LOAD(set_front_face, vkCmdSetFrontFaceEXT);
+  LOAD(set_primitive_topology, vkCmdSetPrimitiveTopologyEXT);
+  LOAD(set_depth_test_enable, vkCmdSetDepthTestEnableEXT);
+  LOAD(set_depth_write_enable, vkCmdSetDepthWriteEnableEXT);
+  LOAD(set_depth_compare_op, vkCmdSetDepthCompareOpEXT);
+#undef LOAD
+
+  if (!d->set_cull_mode || !d->set_front_face || !d->set_primitive_topology ||
+      !d->set_depth_test_enable || !d->set_depth_write_enable ||
+      !d->set_depth_compare_op) {
+    LOG_ERROR("unable to load VK_EXT_extended_dynamic_state functions");
+    return false;
+  }
+
+  return true;
+}
+
+void graphics_pipeline_cmd_set_viewport(VkCommandBuffer command_buffer,
+                                        VkExtent2D extent) {
+  vkCmdSetViewport(command_buffer, 0, 1,
+                   &(VkViewport){
+                       .x = 0,
+                       .y = 0,
+                       .width = extent.width,
+                       .height = extent.height,
+                       .minDepth = 0.0,
+                       .maxDepth = 1.0,
+                   });
+  vkCmdSetScissor(command_buffer, 0, 1,
+                  &(VkRect2D){
+                      .offset = {0, 0},
+                      .extent = extent,
+                  });
+}
+
+void graphics_pipeline_cmd_set_state(const graphics_pipeline_dynamic_state *d,
+                                     VkCommandBuffer command_buffer) {
+  d->set_cull_mode(command_buffer, cull_mode);
+  d->set_front_face(command_buffer, front_face);
+  d->set_primitive_topology(command_buffer, topology);
+  d->set_depth_test_enable(command_buffer, depth_test);
+  d->set_depth_write_enable(command_buffer, depth_write);
+  d->set_depth_compare_op(command_buffer, depth_compare_op);
+}
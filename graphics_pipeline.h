@@ -0,0 +1,72 @@
+#pragma once
+
+#include "reflect.h"
+#include "types.h"
+#include <vulkan/vulkan_core.h>
+
+// everything that differs between the graphics pipelines of the app, the
+// remaining fixed-function state is the same for all of them
+typedef struct {
+  VkPipelineLayout layout;
+  // VK_NULL_HANDLE for dynamic rendering into attachments of these formats
+  VkRenderPass render_pass;
+  VkFormat color_format;
+  VkFormat depth_format;
+  VkSampleCountFlagBits samples;
+  // vertex input is derived from the attributes
+  const shader_reflection *interface;
+  VkPipelineShaderStageCreateInfo vertex_stage;
+  VkPipelineShaderStageCreateInfo fragment_stage;
+  // hashes of the stages' spirv, identifying them in a pipeline library
+  u64 vertex_hash;
+  u64 fragment_hash;
+} graphics_pipeline_desc;
+
+// create infos of the fixed-function state, pointers point into the struct
+// itself so it must not be copied
+typedef struct {
+  VkPipelineVertexInputStateCreateInfo vertex_input;
+  VkPipelineInputAssemblyStateCreateInfo input_assembly;
+  VkPipelineViewportStateCreateInfo viewport_state;
+  VkPipelineRasterizationStateCreateInfo rasterization;
+  VkPipelineMultisampleStateCreateInfo multisample;
+  VkPipelineDepthStencilStateCreateInfo depth_stencil;
+  VkPipelineColorBlendAttachmentState blend_attachment;
+  VkPipelineColorBlendStateCreateInfo color_blend;
+  VkPipelineDynamicStateCreateInfo dynamic;
+  // chained by pipelines without a render pass
+  VkFormat color_format;
+  VkPipelineRenderingCreateInfoKHR rendering;
+} graphics_pipeline_state;
+
+// viewport and scissor are always dynamic; with dynamic_state the
+// rasterization and depth state covered by VK_EXT_extended_dynamic_state is
+// left to graphics_pipeline_cmd_set_state
+void graphics_pipeline_state_init(const graphics_pipeline_desc *desc,
+                                  bool dynamic_state,
+                                  graphics_pipeline_state *s);
+
+// creates a complete pipeline in one go, for devices without pipeline library
+// support
+bool graphics_pipeline_create(VkDevice device, VkPipelineCache cache,
+                              const graphics_pipeline_desc *desc,
+                              bool dynamic_state, VkPipeline *pipeline);
+
+typedef struct {
+  PFN_vkCmdSetCullModeEXT set_cull_mode;
+  PFN_vkCmdSetFrontFaceEXT set_front_face;
+  PFN_vkCmdSetPrimitiveTopologyEXT set_primitive_topology;
+  PFN_vkCmdSetDepthTestEnableEXT set_depth_test_enable;
+  PFN_vkCmdSetDepthWriteEnableEXT set_depth_write_enable;
+  PFN_vkCmdSetDepthCompareOpEXT set_depth_compare_op;
+} graphics_pipeline_dynamic_state;
+
+// the device must have VK_EXT_extended_dynamic_state enabled
+bool graphics_pipeline_dynamic_state_load(VkDevice device,
+                                          graphics_pipeline_dynamic_state *d);
+// covers the whole of extent, pipelines don't depend on the swapchain size
+void graphics_pipeline_cmd_set_viewport(VkCommandBuffer command_buffer,
+                                        VkExtent2D extent);
+// records the state left dynamic by pipelines created with dynamic_state
+void graphics_pipeline_cmd_set_state(const graphics_pipeline_dynamic_state *d,
+                                     VkCommandBuffer command_buffer);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "types.h"
+
+#define HASH_INIT UINT64_C(0xcbf29ce484222325)
+
+// 64-bit FNV-1a, chain calls by passing the previous result as h
+static inline u64 hash_bytes(u64 h, const void *data, usize len) {
+  const u8 *bytes = data;
+  for (usize i = 0; i < len; ++i) {
+    h ^= bytes[i];
+    h *= UINT64_C(0x100000001b3);
+  }
+
+  return h;
+}
+
+static inline u64 hash_u64(u64 h, u64 value) {
+  return hash_bytes(h, &value, sizeof(value));
+}
+
+static inline u64 hash_str(u64 h, const char *str) {
+  // include the terminator so that consecutive strings cannot alias
+  usize len = 0;
+  while (str[len]) {
+    ++len;
+  }
+
+  return hash_bytes(h, str, len + 1);
+}
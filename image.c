@@ -1,10 +1,14 @@
 #include "image.h"
 
+#include "debug_utils.h"
 #include "device.h"
+#include "log.h"
 #include "memory.h"
+#include "metrics.h"
+#include "timer.h"
+#include "trace.h"
 #include "vk_utils.h"
 #include <assert.h>
-#include <logger.h>
 #include <math.h>
 #include <stb/stb_image.h>
 #include <vulkan/vulkan_core.h>
@@ -30,6 +34,7 @@ static bool image_generate_mipmap(const transfer_context *tctx,
     LOG_ERROR("unable to begin recording command buffer: %s",
               vk_error_to_string(result));
   }
+  DEBUG_LABEL_BEGIN(m->blit_command_buffer, "generate mipmaps");
   i32 src_width = extent.width, src_height = extent.height;
   for (i32 i = 0; i < m->mip_levels - 1; ++i) {
     vkCmdPipelineBarrier(m->blit_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
@@ -136,6 +141,7 @@ static bool image_generate_mipmap(const transfer_context *tctx,
                              .dstAccessMask = VK_ACCESS_NONE,
                          });
   }
+  DEBUG_LABEL_END(m->blit_command_buffer);
 
   if ((result = vkEndCommandBuffer(m->blit_command_buffer)) != VK_SUCCESS) {
     LOG_ERROR("unable to end command buffer recording: %s",
@@ -148,20 +154,29 @@ static bool image_generate_mipmap(const transfer_context *tctx,
     return false;
   }
 
-  if ((result = vkQueueSubmit(tctx->graphics_queue, 1,
-                              &(VkSubmitInfo){
-                                  .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                                  .commandBufferCount = 1,
-                                  .pCommandBuffers = &m->blit_command_buffer,
-                              },
-                              tctx->fence)) != VK_SUCCESS) {
+  metrics_gauge_add(metric_upload_queue_depth, 1);
+  u64 submit_ns = timer_now_ns();
+  if ((result = transfer_context_queue_submit(
+           tctx, tctx->graphics_queue,
+           &(VkSubmitInfo){
+               .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+               .commandBufferCount = 1,
+               .pCommandBuffers = &m->blit_command_buffer,
+           },
+           tctx->fence)) != VK_SUCCESS) {
     LOG_ERROR("unable to submit command buffer to graphics queue: %s",
               vk_error_to_string(result));
+    metrics_gauge_add(metric_upload_queue_depth, -1);
     return false;
   }
 
-  if ((result = vkWaitForFences(tctx->device, 1, &tctx->fence, VK_FALSE,
-                                UINT64_MAX)) != VK_SUCCESS) {
+  TRACE_BEGIN("mipmap wait");
+  result = vkWaitForFences(tctx->device, 1, &tctx->fence, VK_FALSE, UINT64_MAX);
+  TRACE_END();
+  metrics_gauge_add(metric_upload_queue_depth, -1);
+  metrics_add(metric_uploads, 1);
+  metrics_observe_ns(metric_upload_time, timer_now_ns() - submit_ns);
+  if (result != VK_SUCCESS) {
     LOG_ERROR("unable to wait for command buffer to finish: %s",
               vk_error_to_string(result));
     return false;
@@ -178,7 +193,9 @@ bool image_load_from_file(VkPhysicalDevice physical_device,
                           VmaAllocation *allocation, VkImageView *image_view,
                           VkSampler *sampler) {
   int width, height, num_channels;
+  TRACE_BEGIN("image decode");
   stbi_uc *data = stbi_load(path, &width, &height, &num_channels, STBI_default);
+  TRACE_END();
   if (!data) {
     LOG_ERROR("unable to load image data from file: %s", stbi_failure_reason());
     goto fail_stbi_load;
@@ -259,6 +276,7 @@ bool image_load_from_file(VkPhysicalDevice physical_device,
     LOG_ERROR("unable to create image");
     goto fail_image;
   }
+  DEBUG_NAME(tctx->device, VK_OBJECT_TYPE_IMAGE, *image, "texture %s", path);
 
   if (!transfer_context_stage_linear_data_to_2d_image(
           tctx, *image, mipmap->mip_levels,
@@ -331,6 +349,8 @@ bool image_load_from_file(VkPhysicalDevice physical_device,
       LOG_ERROR("unable to create image view: %s", vk_error_to_string(result));
       goto fail_image_view;
     }
+    DEBUG_NAME(tctx->device, VK_OBJECT_TYPE_IMAGE_VIEW, *image_view,
+               "texture view %s", path);
   }
 
   if (sampler) {
@@ -362,6 +382,8 @@ bool image_load_from_file(VkPhysicalDevice physical_device,
                 vk_error_to_string(result));
       goto fail_sampler;
     }
+    DEBUG_NAME(tctx->device, VK_OBJECT_TYPE_SAMPLER, *sampler,
+               "texture sampler %s", path);
   }
 
   stbi_image_free(data);
@@ -455,6 +477,7 @@ bool image_init_depth_buffer(VkPhysicalDevice physical_device,
     LOG_ERROR("unable to create image: %s", vk_error_to_string(result));
     goto fail_image;
   }
+  DEBUG_NAME(tctx->device, VK_OBJECT_TYPE_IMAGE, *image, "depth image");
 
   if ((result = vkCreateImageView(
            tctx->device,
@@ -483,6 +506,7 @@ bool image_init_depth_buffer(VkPhysicalDevice physical_device,
               vk_error_to_string(result));
     goto fail_image_view;
   }
+  DEBUG_NAME(tctx->device, VK_OBJECT_TYPE_IMAGE_VIEW, *view, "depth view");
 
   if (depth_format) {
     *depth_format = format;
@@ -531,6 +555,7 @@ bool image_init_msaa_buffer(const transfer_context *tctx, VkExtent2D size,
     LOG_ERROR("unable to create image");
     goto fail_image;
   }
+  DEBUG_NAME(tctx->device, VK_OBJECT_TYPE_IMAGE, *image, "msaa color image");
 
   if ((result = vkCreateImageView(
            tctx->device,
@@ -561,6 +586,7 @@ bool image_init_msaa_buffer(const transfer_context *tctx, VkExtent2D size,
               vk_error_to_string(result));
     goto fail_image_view;
   }
+  DEBUG_NAME(tctx->device, VK_OBJECT_TYPE_IMAGE_VIEW, *view, "msaa color view");
 
   return true;
 
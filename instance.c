@@ -1,13 +1,16 @@
 #include "instance.h"
 
 #include "debug_msg.h"
+#include "log.h"
 #include "vk_utils.h"
-#include <logger.h>
 #include <stdlib.h>
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
-static const char **get_extensions(u32 *num_extensions) {
+// validation_features enables VK_EXT_validation_features, which is provided
+// by the validation layer rather than the loader
+static const char **get_extensions(bool headless, bool validation_features,
+                                   arena *out, u32 *num_extensions) {
   static const char *debug_extensions[] = {
       VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
   };
@@ -16,9 +19,9 @@ static const char **get_extensions(u32 *num_extensions) {
       sizeof(debug_extensions) / sizeof(debug_extensions[0]);
 
   VkResult result;
-  u32 num_glfw_extensions;
+  u32 num_glfw_extensions = 0;
   const char **glfw_extensions =
-      glfwGetRequiredInstanceExtensions(&num_glfw_extensions);
+      headless ? NULL : glfwGetRequiredInstanceExtensions(&num_glfw_extensions);
 
   u32 num_supported_extensions;
   result = vkEnumerateInstanceExtensionProperties(
@@ -28,8 +31,19 @@ static const char **get_extensions(u32 *num_extensions) {
               vk_error_to_string(result));
     return NULL;
   }
-  VkExtensionProperties *supported_extensions =
-      malloc(num_supported_extensions * sizeof(*supported_extensions));
+  u32 max_extensions = num_debug_extensions + num_glfw_extensions + 1;
+  const char **extensions =
+      arena_push_array(out, const char *, max_extensions);
+  if (!extensions) {
+    LOG_ERROR("unable to allocate memory for enabled extension names array");
+    return NULL;
+  }
+
+  // the supported extension list is only needed while filtering, so it lives
+  // above the returned array and is popped before returning
+  arena_marker marker = arena_mark(out);
+  VkExtensionProperties *supported_extensions = arena_push_array(
+      out, VkExtensionProperties, num_supported_extensions);
   if (!supported_extensions) {
     LOG_ERROR("unable to allocate memory for extension properties structs");
     return NULL;
@@ -40,7 +54,7 @@ static const char **get_extensions(u32 *num_extensions) {
   if (result != VK_SUCCESS) {
     LOG_ERROR("unable to query supported extensions: %s",
               vk_error_to_string(result));
-    free(supported_extensions);
+    arena_pop(out, marker);
     return NULL;
   }
 
@@ -52,50 +66,50 @@ static const char **get_extensions(u32 *num_extensions) {
               PRIvkVerArg(supported_extensions[i].specVersion));
   }
 
-  u32 max_extensions = num_debug_extensions + num_glfw_extensions;
-  const char **extensions = malloc(max_extensions * sizeof(extensions[0]));
   *num_extensions = num_glfw_extensions;
-  if (extensions) {
-    memcpy(extensions, glfw_extensions,
-           num_glfw_extensions * sizeof(glfw_extensions[0]));
-    if (debug) {
-      for (u32 i = 0; i < num_debug_extensions; ++i) {
-        const char *name = debug_extensions[i];
-        bool supported = false;
-        for (u32 j = 0; j < *num_extensions; ++j) {
-          if (strcmp(extensions[j], name) == 0) {
-            goto next;
-          }
-        }
-
-        for (u32 j = 0; j < num_supported_extensions; ++j) {
-          if (strcmp(supported_extensions[j].extensionName, name) == 0) {
-            supported = true;
-            break;
-          }
+  for (u32 i = 0; i < num_glfw_extensions; ++i) {
+    extensions[i] = glfw_extensions[i];
+  }
+  if (debug) {
+    for (u32 i = 0; i < num_debug_extensions; ++i) {
+      const char *name = debug_extensions[i];
+      bool supported = false;
+      for (u32 j = 0; j < *num_extensions; ++j) {
+        if (strcmp(extensions[j], name) == 0) {
+          goto next;
         }
+      }
 
-        if (!supported) {
-          LOG_WARN("requested extension %s not supported", name);
-          continue;
+      for (u32 j = 0; j < num_supported_extensions; ++j) {
+        if (strcmp(supported_extensions[j].extensionName, name) == 0) {
+          supported = true;
+          break;
         }
+      }
 
-        extensions[(*num_extensions)++] = name;
-      next:;
+      if (!supported) {
+        LOG_WARN("requested extension %s not supported", name);
+        continue;
       }
+
+      extensions[(*num_extensions)++] = name;
+    next:;
     }
   }
+  if (validation_features) {
+    extensions[(*num_extensions)++] = VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME;
+  }
 
   LOG_DEBUG("enabled extensions (total %" PRIu32 "):", *num_extensions);
   for (u32 i = 0; i < *num_extensions; ++i) {
     LOG_DEBUG("\t%s", extensions[i]);
   }
 
-  free(supported_extensions);
+  arena_pop(out, marker);
   return extensions;
 }
 
-const char **get_validation_layers(u32 *num_layers) {
+const char **get_validation_layers(arena *out, u32 *num_layers) {
   if(!debug) {
     *num_layers = 0;
     return NULL;
@@ -119,8 +133,16 @@ const char **get_validation_layers(u32 *num_layers) {
     return NULL;
   }
 
+  const char **layers =
+      arena_push_array(out, const char *, num_requested_layers);
+  if (!layers) {
+    LOG_ERROR("unable to allocate memory for enabled layer names array");
+    return NULL;
+  }
+
+  arena_marker marker = arena_mark(out);
   VkLayerProperties *supported_layers =
-      malloc(num_supported_layers * sizeof(*supported_layers));
+      arena_push_array(out, VkLayerProperties, num_supported_layers);
   if (!supported_layers) {
     LOG_ERROR("unable to allocate memory for supported layer properties structs");
     return NULL;
@@ -131,14 +153,7 @@ const char **get_validation_layers(u32 *num_layers) {
   if (result != VK_SUCCESS) {
     LOG_ERROR("unable to query supported layers: %s",
               vk_error_to_string(result));
-    free(supported_layers);
-    return NULL;
-  }
-
-  const char **layers = malloc(sizeof(requested_validation_layers));
-  if (!layers) {
-    LOG_ERROR("unable to allocate memory for enabled layer names array");
-    free(supported_layers);
+    arena_pop(out, marker);
     return NULL;
   }
 
@@ -166,23 +181,34 @@ const char **get_validation_layers(u32 *num_layers) {
     LOG_DEBUG("\t%s", layers[i]);
   }
 
-  free(supported_layers);
+  arena_pop(out, marker);
   return layers;
 }
 
-bool vk_instance_init(VkInstance *inst) {
+bool vk_instance_init(bool headless, bool best_practices, VkInstance *inst) {
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return false;
+  }
+
+  arena_marker marker = arena_mark(scratch);
   VkResult result;
   u32 num_extensions, num_layers = 0;
-  const char **extensions = get_extensions(&num_extensions),
-             **layers = get_validation_layers(&num_layers);
-
-  if (!extensions) {
-    LOG_ERROR("error retrieving requested extensions");
+  const char **layers = get_validation_layers(scratch, &num_layers);
+  if (!layers) {
+    LOG_ERROR("error retrieving requested layers");
     goto fail;
   }
 
-  if (!layers) {
-    LOG_ERROR("error retrieving requested layers");
+  if (best_practices && num_layers == 0) {
+    LOG_WARN("best practices validation needs the validation layer");
+    best_practices = false;
+  }
+
+  const char **extensions =
+      get_extensions(headless, best_practices, scratch, &num_extensions);
+  if (!extensions) {
+    LOG_ERROR("error retrieving requested extensions");
     goto fail;
   }
 
@@ -191,14 +217,28 @@ bool vk_instance_init(VkInstance *inst) {
     debug_msg_create_info(&debug_msg_info);
   }
 
+  // the best practices checks report through the same messenger, their
+  // warnings are counted along with the performance ones
+  VkValidationFeaturesEXT validation_features = {
+      .sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT,
+      .pNext = &debug_msg_info,
+      .enabledValidationFeatureCount = 1,
+      .pEnabledValidationFeatures =
+          &(VkValidationFeatureEnableEXT){
+              VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT},
+  };
+  const void *next = best_practices ? (const void *)&validation_features
+                     : debug        ? (const void *)&debug_msg_info
+                                    : NULL;
+
   if ((result = vkCreateInstance(
            &(VkInstanceCreateInfo){
                .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-               .pNext = debug ? &debug_msg_info : NULL,
+               .pNext = next,
                .pApplicationInfo =
                    &(VkApplicationInfo){
                        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-                       .apiVersion = VK_API_VERSION_1_0,
+                       .apiVersion = VK_API_VERSION_1_1,
                        .pEngineName = "No Engine",
                        .engineVersion = VK_MAKE_VERSION(1, 0, 0),
                        .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
@@ -213,12 +253,10 @@ bool vk_instance_init(VkInstance *inst) {
     goto fail;
   }
 
-  free(extensions);
-  free(layers);
+  arena_pop(scratch, marker);
   return true;
 fail:
-  free(extensions);
-  free(layers);
+  arena_pop(scratch, marker);
   return false;
 }
 
@@ -1,8 +1,13 @@
 #pragma once
+#include "arena.h"
 #include "types.h"
 #include <vulkan/vulkan_core.h>
 
-bool vk_instance_init(VkInstance *inst);
+// headless instances do not enable the surface extensions, GLFW need not be
+// initialized for them; best_practices enables the best practices checks of
+// the validation layer in debug builds
+bool vk_instance_init(bool headless, bool best_practices, VkInstance *inst);
 void vk_instance_free(VkInstance inst);
 
-const char** get_validation_layers(u32* num_layers);
+// the returned array is pushed onto out
+const char **get_validation_layers(arena *out, u32 *num_layers);
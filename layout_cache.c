@@ -0,0 +1,174 @@
+#include "layout_cache.h"
+#include "hash.h"
+#include "log.h"
+#include "vk_utils.h"
+
+void layout_cache_init(VkDevice device, layout_cache *c) {
+  c->device = device;
+  pthread_mutex_init(&c->mutex, NULL);
+  c->num_set_layouts = 0;
+  c->num_pipeline_layouts = 0;
+}
+
+void layout_cache_free(layout_cache *c) {
+  for (i32 i = 0; i < c->num_pipeline_layouts; ++i) {
+    vkDestroyPipelineLayout(c->device, c->pipeline_layouts[i].layout, NULL);
+  }
+  for (i32 i = 0; i < c->num_set_layouts; ++i) {
+    vkDestroyDescriptorSetLayout(c->device, c->set_layouts[i].layout, NULL);
+  }
+  pthread_mutex_destroy(&c->mutex);
+}
+
+static u64 hash_set_layout(const VkDescriptorSetLayoutBinding *bindings,
+                           i32 num_bindings) {
+  u64 h = hash_u64(HASH_INIT, num_bindings);
+  for (i32 i = 0; i < num_bindings; ++i) {
+    h = hash_u64(h, bindings[i].binding);
+    h = hash_u64(h, bindings[i].descriptorType);
+    h = hash_u64(h, bindings[i].descriptorCount);
+    h = hash_u64(h, bindings[i].stageFlags);
+  }
+
+  return h;
+}
+
+static bool set_layout_equal(const layout_cache_set_layout *e, u64 hash,
+                             const VkDescriptorSetLayoutBinding *bindings,
+                             i32 num_bindings) {
+  if (e->hash != hash || e->num_bindings != num_bindings) {
+    return false;
+  }
+
+  for (i32 i = 0; i < num_bindings; ++i) {
+    const VkDescriptorSetLayoutBinding *a = &e->bindings[i], *b = &bindings[i];
+    if (a->binding != b->binding || a->descriptorType != b->descriptorType ||
+        a->descriptorCount != b->descriptorCount ||
+        a->stageFlags != b->stageFlags) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// mutex must be held
+static VkDescriptorSetLayout
+set_layout_get(layout_cache *c, const VkDescriptorSetLayoutBinding *bindings,
+               i32 num_bindings) {
+  u64 hash = hash_set_layout(bindings, num_bindings);
+  for (i32 i = 0; i < c->num_set_layouts; ++i) {
+    if (set_layout_equal(&c->set_layouts[i], hash, bindings, num_bindings)) {
+      return c->set_layouts[i].layout;
+    }
+  }
+
+  if (c->num_set_layouts == LAYOUT_CACHE_MAX_SET_LAYOUTS ||
+      num_bindings > REFLECT_MAX_BINDINGS) {
+    LOG_ERROR("descriptor set layout cache full");
+    return VK_NULL_HANDLE;
+  }
+
+  layout_cache_set_layout *e = &c->set_layouts[c->num_set_layouts];
+  VkResult result;
+  if ((result = vkCreateDescriptorSetLayout(
+           c->device,
+           &(VkDescriptorSetLayoutCreateInfo){
+               .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+               .bindingCount = num_bindings,
+               .pBindings = bindings,
+           },
+           NULL, &e->layout)) != VK_SUCCESS) {
+    LOG_ERROR("unable to create descriptor set layout: %s",
+              vk_error_to_string(result));
+    return VK_NULL_HANDLE;
+  }
+
+  e->hash = hash;
+  e->num_bindings = num_bindings;
+  for (i32 i = 0; i < num_bindings; ++i) {
+    e->bindings[i] = bindings[i];
+  }
+  ++c->num_set_layouts;
+  return e->layout;
+}
+
+VkDescriptorSetLayout
+layout_cache_set_layout_get(layout_cache *c,
+                            const VkDescriptorSetLayoutBinding *bindings,
+                            i32 num_bindings) {
+  pthread_mutex_lock(&c->mutex);
+  VkDescriptorSetLayout layout = set_layout_get(c, bindings, num_bindings);
+  pthread_mutex_unlock(&c->mutex);
+  return layout;
+}
+
+VkPipelineLayout layout_cache_pipeline_layout_get(
+    layout_cache *c, const shader_reflection *r,
+    VkDescriptorSetLayout set_layouts[REFLECT_MAX_SETS], u32 *num_sets) {
+  pthread_mutex_lock(&c->mutex);
+  *num_sets = reflect_num_sets(r);
+  u64 hash = hash_u64(HASH_INIT, *num_sets);
+  for (u32 set = 0; set < *num_sets; ++set) {
+    VkDescriptorSetLayoutBinding bindings[REFLECT_MAX_BINDINGS];
+    i32 num_bindings = reflect_set_bindings(r, set, bindings);
+    // unused sets in between still need a (empty) layout
+    if (!(set_layouts[set] = set_layout_get(c, bindings, num_bindings))) {
+      pthread_mutex_unlock(&c->mutex);
+      return VK_NULL_HANDLE;
+    }
+    hash = hash_u64(hash, (u64)set_layouts[set]);
+  }
+  const VkPushConstantRange *push = &r->push_constants;
+  hash = hash_u64(hash, push->stageFlags);
+  hash = hash_u64(hash, push->size);
+
+  for (i32 i = 0; i < c->num_pipeline_layouts; ++i) {
+    const layout_cache_pipeline_layout *e = &c->pipeline_layouts[i];
+    bool equal = e->hash == hash && e->num_sets == *num_sets &&
+                 e->push_constants.stageFlags == push->stageFlags &&
+                 e->push_constants.size == push->size;
+    for (u32 set = 0; equal && set < *num_sets; ++set) {
+      equal = e->set_layouts[set] == set_layouts[set];
+    }
+    if (equal) {
+      pthread_mutex_unlock(&c->mutex);
+      return e->layout;
+    }
+  }
+
+  if (c->num_pipeline_layouts == LAYOUT_CACHE_MAX_PIPELINE_LAYOUTS) {
+    LOG_ERROR("pipeline layout cache full");
+    pthread_mutex_unlock(&c->mutex);
+    return VK_NULL_HANDLE;
+  }
+
+  layout_cache_pipeline_layout *e =
+      &c->pipeline_layouts[c->num_pipeline_layouts];
+  VkResult result;
+  if ((result = vkCreatePipelineLayout(
+           c->device,
+           &(VkPipelineLayoutCreateInfo){
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+               .setLayoutCount = *num_sets,
+               .pSetLayouts = set_layouts,
+               .pushConstantRangeCount = push->size > 0 ? 1 : 0,
+               .pPushConstantRanges = push->size > 0 ? push : NULL,
+           },
+           NULL, &e->layout)) != VK_SUCCESS) {
+    LOG_ERROR("unable to create pipeline layout: %s",
+              vk_error_to_string(result));
+    pthread_mutex_unlock(&c->mutex);
+    return VK_NULL_HANDLE;
+  }
+
+  e->hash = hash;
+  e->num_sets = *num_sets;
+  for (u32 set = 0; set < *num_sets; ++set) {
+    e->set_layouts[set] = set_layouts[set];
+  }
+  e->push_constants = *push;
+  ++c->num_pipeline_layouts;
+  pthread_mutex_unlock(&c->mutex);
+  return e->layout;
+}
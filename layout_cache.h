@@ -0,0 +1,53 @@
+#pragma once
+
+#include "reflect.h"
+#include "types.h"
+#include <pthread.h>
+#include <vulkan/vulkan_core.h>
+
+#define LAYOUT_CACHE_MAX_SET_LAYOUTS 32
+#define LAYOUT_CACHE_MAX_PIPELINE_LAYOUTS 32
+
+typedef struct {
+  u64 hash;
+  VkDescriptorSetLayoutBinding bindings[REFLECT_MAX_BINDINGS];
+  i32 num_bindings;
+  VkDescriptorSetLayout layout;
+} layout_cache_set_layout;
+
+typedef struct {
+  u64 hash;
+  VkDescriptorSetLayout set_layouts[REFLECT_MAX_SETS];
+  u32 num_sets;
+  VkPushConstantRange push_constants;
+  VkPipelineLayout layout;
+} layout_cache_pipeline_layout;
+
+// deduplicates descriptor set and pipeline layouts by their contents, so that
+// pipelines with the same resource interface share layout objects and can
+// keep their descriptor sets bound across pipeline switches; thread-safe
+typedef struct {
+  VkDevice device;
+  pthread_mutex_t mutex;
+  layout_cache_set_layout set_layouts[LAYOUT_CACHE_MAX_SET_LAYOUTS];
+  i32 num_set_layouts;
+  layout_cache_pipeline_layout pipeline_layouts
+      [LAYOUT_CACHE_MAX_PIPELINE_LAYOUTS];
+  i32 num_pipeline_layouts;
+} layout_cache;
+
+void layout_cache_init(VkDevice device, layout_cache *c);
+// destroys every layout handed out, the device must be idle
+void layout_cache_free(layout_cache *c);
+
+// bindings must be sorted by binding number, returns VK_NULL_HANDLE on
+// failure
+VkDescriptorSetLayout
+layout_cache_set_layout_get(layout_cache *c,
+                            const VkDescriptorSetLayoutBinding *bindings,
+                            i32 num_bindings);
+// derives the layout of every set and the push constant range from r, the
+// set layouts are written to set_layouts
+VkPipelineLayout layout_cache_pipeline_layout_get(
+    layout_cache *c, const shader_reflection *r,
+    VkDescriptorSetLayout set_layouts[REFLECT_MAX_SETS], u32 *num_sets);
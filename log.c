@@ -0,0 +1,669 @@
+#include "log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// the drain thread sleeps this long whenever every ring was empty
+#define LOG_DRAIN_INTERVAL_NS 1000000
+// longest written line, longer ones are truncated
+#define LOG_MAX_LINE 4096
+
+typedef struct {
+  // of the whole record including its arguments, a multiple of 8
+  u32 size;
+  i32 line;
+  LogLevel level;
+  // NULL for padding up to the end of the ring
+  const char *fmt;
+  const char *file;
+  u64 time_ns;
+} log_record;
+// followed by the arguments, 8 bytes each, strings as their length and their
+// characters padded to 8 bytes
+
+typedef struct {
+  // written by the owning thread only
+  alignas(64) atomic_uint_fast64_t head;
+  // written by the drain thread only
+  alignas(64) atomic_uint_fast64_t tail;
+  atomic_uint_fast64_t num_dropped;
+  pid_t tid;
+  alignas(64) u8 data[LOG_RING_SIZE];
+} log_ring;
+
+static struct {
+  atomic_bool running;
+  FILE *out;
+  pthread_t thread;
+  // dropped messages, only touched by the drain thread until it exits
+  u64 num_dropped;
+  atomic_uint num_rings;
+  log_ring *_Atomic rings[LOG_MAX_THREADS];
+} logs;
+
+static _Thread_local log_ring *local;
+// set once registering failed, so it is not retried on every message
+static _Thread_local bool local_failed;
+
+static const char *level_names[] = {
+    "TRACE", "DEBUG", "INFO ", "WARN ", "ERROR", "FATAL",
+};
+
+typedef enum {
+  arg_int,
+  arg_uint,
+  arg_char,
+  arg_double,
+  arg_pointer,
+  arg_string,
+  // the message is formatted on the calling thread instead
+  arg_unsupported,
+} arg_kind;
+
+typedef struct {
+  const char *flags;
+  i32 num_flags;
+  bool width_star;
+  const char *width;
+  i32 width_len;
+  bool has_precision;
+  bool precision_star;
+  const char *precision;
+  i32 precision_len;
+  char length[3];
+  char conversion;
+  arg_kind kind;
+} conversion_spec;
+
+static u64 realtime_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// parses the conversion specification following a '%', returns what follows
+// it
+static const char *parse_spec(const char *p, conversion_spec *s) {
+  s->flags = p;
+  while (*p && strchr("-+ #0", *p)) {
+    ++p;
+  }
+  s->num_flags = p - s->flags;
+
+  s->width_star = *p == '*';
+  s->width = p;
+  if (s->width_star) {
+    ++p;
+  }
+  while (is_digit(*p)) {
+    ++p;
+  }
+  s->width_len = p - s->width;
+
+  s->has_precision = *p == '.';
+  s->precision_star = false;
+  s->precision = p;
+  if (s->has_precision) {
+    s->precision_star = *++p == '*';
+    s->precision = p;
+    if (s->precision_star) {
+      ++p;
+    }
+    while (is_digit(*p)) {
+      ++p;
+    }
+  }
+  s->precision_len = p - s->precision;
+
+  i32 num_length = 0;
+  while (*p && strchr("hljztL", *p) && num_length < 2) {
+    s->length[num_length++] = *p++;
+  }
+  s->length[num_length] = '\0';
+
+  s->conversion = *p;
+  if (*p) {
+    ++p;
+  }
+
+  switch (s->conversion) {
+  case 'd':
+  case 'i':
+    s->kind = arg_int;
+    break;
+  case 'u':
+  case 'o':
+  case 'x':
+  case 'X':
+    s->kind = arg_uint;
+    break;
+  case 'c':
+    s->kind = num_length == 0 ? arg_char : arg_unsupported;
+    break;
+  case 'f':
+  case 'F':
+  case 'e':
+  case 'E':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':
+    s->kind = strcmp(s->length, "L") != 0 ? arg_double : arg_unsupported;
+    break;
+  case 'p':
+    s->kind = arg_pointer;
+    break;
+  case 's':
+    s->kind = num_length == 0 ? arg_string : arg_unsupported;
+    break;
+  default:
+    s->kind = arg_unsupported;
+  }
+  return p;
+}
+
+// integer arguments are promoted to 64 bits, the conversion is then done
+// with the ll modifier
+static i64 read_int(const char *length, va_list *ap) {
+  if (strcmp(length, "hh") == 0) {
+    return (signed char)va_arg(*ap, int);
+  } else if (strcmp(length, "h") == 0) {
+    return (short)va_arg(*ap, int);
+  } else if (strcmp(length, "l") == 0) {
+    return va_arg(*ap, long);
+  } else if (strcmp(length, "ll") == 0) {
+    return va_arg(*ap, long long);
+  } else if (strcmp(length, "j") == 0) {
+    return va_arg(*ap, intmax_t);
+  } else if (strcmp(length, "z") == 0) {
+    return va_arg(*ap, ssize_t);
+  } else if (strcmp(length, "t") == 0) {
+    return va_arg(*ap, ptrdiff_t);
+  }
+  return va_arg(*ap, int);
+}
+
+static u64 read_uint(const char *length, va_list *ap) {
+  if (strcmp(length, "hh") == 0) {
+    return (unsigned char)va_arg(*ap, unsigned);
+  } else if (strcmp(length, "h") == 0) {
+    return (unsigned short)va_arg(*ap, unsigned);
+  } else if (strcmp(length, "l") == 0) {
+    return va_arg(*ap, unsigned long);
+  } else if (strcmp(length, "ll") == 0) {
+    return va_arg(*ap, unsigned long long);
+  } else if (strcmp(length, "j") == 0) {
+    return va_arg(*ap, uintmax_t);
+  } else if (strcmp(length, "z") == 0) {
+    return va_arg(*ap, size_t);
+  } else if (strcmp(length, "t") == 0) {
+    return va_arg(*ap, ptrdiff_t);
+  }
+  return va_arg(*ap, unsigned);
+}
+
+static bool put_u64(u8 *buf, u32 *n, u64 value) {
+  if (*n + sizeof(value) > LOG_MAX_RECORD) {
+    return false;
+  }
+  memcpy(buf + *n, &value, sizeof(value));
+  *n += sizeof(value);
+  return true;
+}
+
+// len is truncated to what is left of the record
+static bool put_string(u8 *buf, u32 *n, const char *s, u64 len) {
+  if (*n + sizeof(u64) + 8 > LOG_MAX_RECORD) {
+    return false;
+  }
+  u64 max_len = LOG_MAX_RECORD - *n - sizeof(u64) - 1;
+  len = len < max_len ? len : max_len;
+  put_u64(buf, n, len);
+  memcpy(buf + *n, s, len);
+  buf[*n + len] = '\0';
+  *n += (len + 1 + 7) & ~7u;
+  return true;
+}
+
+// copies the arguments behind the record header, false if a conversion is
+// not supported or they do not fit
+static bool record_encode(u8 *buf, u32 *size, const char *fmt, va_list *ap) {
+  u32 n = sizeof(log_record);
+  for (const char *p = fmt; (p = strchr(p, '%'));) {
+    if (*++p == '%') {
+      ++p;
+      continue;
+    }
+
+    conversion_spec s;
+    p = parse_spec(p, &s);
+    if (s.kind == arg_unsupported) {
+      return false;
+    }
+
+    i64 precision = -1;
+    if (s.width_star && !put_u64(buf, &n, va_arg(*ap, int))) {
+      return false;
+    }
+    if (s.precision_star) {
+      precision = va_arg(*ap, int);
+      if (!put_u64(buf, &n, precision)) {
+        return false;
+      }
+    } else if (s.has_precision) {
+      precision = strtol(s.precision, NULL, 10);
+    }
+
+    bool put;
+    switch (s.kind) {
+    case arg_int:
+      put = put_u64(buf, &n, read_int(s.length, ap));
+      break;
+    case arg_uint:
+      put = put_u64(buf, &n, read_uint(s.length, ap));
+      break;
+    case arg_char:
+      put = put_u64(buf, &n, va_arg(*ap, int));
+      break;
+    case arg_double: {
+      double value = va_arg(*ap, double);
+      u64 bits;
+      memcpy(&bits, &value, sizeof(bits));
+      put = put_u64(buf, &n, bits);
+      break;
+    }
+    case arg_pointer:
+      put = put_u64(buf, &n, (uintptr_t)va_arg(*ap, void *));
+      break;
+    case arg_string: {
+      const char *value = va_arg(*ap, const char *);
+      if (!value) {
+        value = "(null)";
+      }
+      // the string need not be terminated within the precision
+      u64 len = precision >= 0 ? strnlen(value, precision) : strlen(value);
+      put = put_string(buf, &n, value, len);
+      break;
+    }
+    default:
+      put = false;
+    }
+    if (!put) {
+      return false;
+    }
+  }
+
+  *size = n;
+  return true;
+}
+
+static u64 get_u64(const u8 **args) {
+  u64 value;
+  memcpy(&value, *args, sizeof(value));
+  *args += sizeof(value);
+  return value;
+}
+
+// formats the message of the record into out, returns its length
+static i32 record_format(const log_record *r, char *out, i32 size) {
+  const u8 *args = (const u8 *)(r + 1);
+  i32 n = 0;
+  for (const char *p = r->fmt; *p && n < size;) {
+    const char *percent = strchr(p, '%');
+    i32 literal = percent ? percent - p : (i32)strlen(p);
+    n += snprintf(out + n, size - n, "%.*s", literal, p);
+    if (!percent || n >= size) {
+      break;
+    }
+
+    p = percent + 1;
+    if (*p == '%') {
+      n += snprintf(out + n, size - n, "%%");
+      ++p;
+      continue;
+    }
+
+    conversion_spec s;
+    p = parse_spec(p, &s);
+    char spec[64];
+    i32 m = snprintf(spec, sizeof(spec), "%%%.*s", s.num_flags, s.flags);
+    if (s.width_star) {
+      // a negative width is a '-' flag
+      i64 width = (i64)get_u64(&args);
+      m += snprintf(spec + m, sizeof(spec) - m, "%s%" PRIi64,
+                    width < 0 ? "-" : "", width < 0 ? -width : width);
+    } else {
+      m += snprintf(spec + m, sizeof(spec) - m, "%.*s", s.width_len, s.width);
+    }
+    if (s.precision_star) {
+      // a negative precision is taken as if it was omitted
+      i64 precision = (i64)get_u64(&args);
+      if (precision >= 0) {
+        m += snprintf(spec + m, sizeof(spec) - m, ".%" PRIi64, precision);
+      }
+    } else if (s.has_precision) {
+      m += snprintf(spec + m, sizeof(spec) - m, ".%.*s", s.precision_len,
+                    s.precision);
+    }
+
+    switch (s.kind) {
+    case arg_int:
+      snprintf(spec + m, sizeof(spec) - m, "ll%c", s.conversion);
+      n += snprintf(out + n, size - n, spec, (long long)get_u64(&args));
+      break;
+    case arg_uint:
+      snprintf(spec + m, sizeof(spec) - m, "ll%c", s.conversion);
+      n += snprintf(out + n, size - n, spec,
+                    (unsigned long long)get_u64(&args));
+      break;
+    case arg_char:
+      snprintf(spec + m, sizeof(spec) - m, "%c", s.conversion);
+      n += snprintf(out + n, size - n, spec, (int)get_u64(&args));
+      break;
+    case arg_double: {
+      u64 bits = get_u64(&args);
+      double value;
+      memcpy(&value, &bits, sizeof(value));
+      snprintf(spec + m, sizeof(spec) - m, "%c", s.conversion);
+      n += snprintf(out + n, size - n, spec, value);
+      break;
+    }
+    case arg_pointer:
+      snprintf(spec + m, sizeof(spec) - m, "p");
+      n += snprintf(out + n, size - n, spec, (void *)(uintptr_t)get_u64(&args));
+      break;
+    case arg_string: {
+      u64 len = get_u64(&args);
+      snprintf(spec + m, sizeof(spec) - m, "s");
+      n += snprintf(out + n, size - n, spec, (const char *)args);
+      args += (len + 1 + 7) & ~7u;
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  return n < size ? n : size - 1;
+}
+
+static void line_write(LogLevel level, pid_t tid, const char *file, i32 line,
+                       u64 time_ns, const log_record *r, const char *message) {
+  char out[LOG_MAX_LINE];
+  time_t seconds = time_ns / 1000000000;
+  struct tm tm;
+  localtime_r(&seconds, &tm);
+  i32 n = snprintf(out, sizeof(out),
+                   "%04d-%02d-%02d %02d:%02d:%02d.%06" PRIu64
+                   " %s %d %s:%" PRIi32 ": ",
+                   tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+                   tm.tm_min, tm.tm_sec, time_ns % 1000000000 / 1000,
+                   level_names[level], tid, file, line);
+  if (n >= LOG_MAX_LINE - 1) {
+    n = LOG_MAX_LINE - 2;
+  }
+  if (r) {
+    n += record_format(r, out + n, LOG_MAX_LINE - 1 - n);
+  } else {
+    n += snprintf(out + n, LOG_MAX_LINE - 1 - n, "%s", message);
+    n = n < LOG_MAX_LINE - 1 ? n : LOG_MAX_LINE - 2;
+  }
+  out[n++] = '\n';
+  // a single write, so lines of the drain and of writing threads do not mix
+  fwrite(out, 1, n, logs.out);
+}
+
+static void record_write(const log_record *r, pid_t tid) {
+  line_write(r->level, tid, r->file, r->line, r->time_ns, r, NULL);
+}
+
+static bool ring_push(log_ring *ring, const log_record *r) {
+  u64 head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  u64 tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  u64 offset = head & (LOG_RING_SIZE - 1);
+  u64 pad = offset + r->size > LOG_RING_SIZE ? LOG_RING_SIZE - offset : 0;
+  if (head + pad + r->size - tail > LOG_RING_SIZE) {
+    return false;
+  }
+
+  // the drain skips what is left of the ring by itself when it cannot hold a
+  // header
+  if (pad >= sizeof(log_record)) {
+    memcpy(ring->data + offset,
+           &(log_record){.size = pad, .fmt = NULL}, sizeof(log_record));
+  }
+  memcpy(ring->data + ((head + pad) & (LOG_RING_SIZE - 1)), r, r->size);
+  atomic_store_explicit(&ring->head, head + pad + r->size,
+                        memory_order_release);
+  return true;
+}
+
+// writes every record queued on the ring, false if there were none
+static bool ring_drain(log_ring *ring) {
+  u64 tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  u64 head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  bool drained = tail != head;
+  while (tail != head) {
+    u64 offset = tail & (LOG_RING_SIZE - 1);
+    if (LOG_RING_SIZE - offset < sizeof(log_record)) {
+      tail += LOG_RING_SIZE - offset;
+      continue;
+    }
+
+    const log_record *r = (const log_record *)(ring->data + offset);
+    if (r->fmt) {
+      record_write(r, ring->tid);
+    }
+    tail += r->size;
+  }
+  atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+  u64 dropped =
+      atomic_exchange_explicit(&ring->num_dropped, 0, memory_order_relaxed);
+  if (dropped > 0) {
+    char message[64];
+    snprintf(message, sizeof(message), "%" PRIu64 " message(s) dropped",
+             dropped);
+    line_write(LogLevel_WARN, ring->tid, __FILENAME__, __LINE__,
+               realtime_ns(), NULL, message);
+    logs.num_dropped += dropped;
+  }
+  return drained;
+}
+
+static bool drain_rings(void) {
+  bool drained = false;
+  u32 num_rings =
+      atomic_load_explicit(&logs.num_rings, memory_order_relaxed);
+  for (u32 i = 0; i < num_rings && i < LOG_MAX_THREADS; ++i) {
+    log_ring *ring =
+        atomic_load_explicit(&logs.rings[i], memory_order_acquire);
+    if (ring) {
+      drained |= ring_drain(ring);
+    }
+  }
+  return drained;
+}
+
+static void *drain(void *arg) {
+  (void)arg;
+  while (atomic_load_explicit(&logs.running, memory_order_acquire)) {
+    if (drain_rings()) {
+      fflush(logs.out);
+    } else {
+      nanosleep(&(struct timespec){.tv_nsec = LOG_DRAIN_INTERVAL_NS}, NULL);
+    }
+  }
+
+  drain_rings();
+  fflush(logs.out);
+  return NULL;
+}
+
+// first message of the thread, maps its ring; logger_log reports failures
+// as LOG_* would recurse
+static log_ring *ring_register(void) {
+  if (local_failed) {
+    return NULL;
+  }
+
+  u32 index =
+      atomic_fetch_add_explicit(&logs.num_rings, 1, memory_order_relaxed);
+  // mapped rather than allocated, the heap stays untouched in steady frames
+  log_ring *ring = MAP_FAILED;
+  if (index < LOG_MAX_THREADS) {
+    ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  if (ring == MAP_FAILED) {
+    logger_log(LogLevel_WARN, __FILENAME__, __LINE__,
+               "unable to map log ring, messages of this thread are written "
+               "synchronously");
+    local_failed = true;
+    return NULL;
+  }
+
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->num_dropped, 0);
+  ring->tid = syscall(SYS_gettid);
+  atomic_store_explicit(&logs.rings[index], ring, memory_order_release);
+  local = ring;
+  return ring;
+}
+
+bool log_init(const char *path) {
+  logs.out = stderr;
+  if (path && !(logs.out = fopen(path, "w"))) {
+    LOG_ERROR("unable to open log file '%s': %s", path, strerror(errno));
+    return false;
+  }
+
+  logs.num_dropped = 0;
+  atomic_store_explicit(&logs.running, true, memory_order_release);
+  i32 err = pthread_create(&logs.thread, NULL, drain, NULL);
+  if (err != 0) {
+    atomic_store_explicit(&logs.running, false, memory_order_release);
+    LOG_ERROR("unable to create log thread: %s", strerror(err));
+    if (path) {
+      fclose(logs.out);
+    }
+    return false;
+  }
+
+  return true;
+}
+
+void log_free(void) {
+  if (!atomic_exchange_explicit(&logs.running, false, memory_order_acq_rel)) {
+    return;
+  }
+
+  pthread_join(logs.thread, NULL);
+  u32 num_rings =
+      atomic_load_explicit(&logs.num_rings, memory_order_relaxed);
+  for (u32 i = 0; i < num_rings && i < LOG_MAX_THREADS; ++i) {
+    log_ring *ring = atomic_exchange_explicit(&logs.rings[i], NULL,
+                                              memory_order_relaxed);
+    if (ring) {
+      munmap(ring, sizeof(*ring));
+    }
+  }
+  atomic_store_explicit(&logs.num_rings, 0, memory_order_relaxed);
+  local = NULL;
+
+  if (logs.out != stderr) {
+    fclose(logs.out);
+  }
+  if (logs.num_dropped > 0) {
+    LOG_WARN("%" PRIu64 " log message(s) dropped, their rings were full",
+             logs.num_dropped);
+  }
+}
+
+void log_flush(void) {
+  if (!atomic_load_explicit(&logs.running, memory_order_acquire)) {
+    return;
+  }
+
+  u32 num_rings =
+      atomic_load_explicit(&logs.num_rings, memory_order_relaxed);
+  for (u32 i = 0; i < num_rings && i < LOG_MAX_THREADS; ++i) {
+    log_ring *ring =
+        atomic_load_explicit(&logs.rings[i], memory_order_acquire);
+    if (!ring) {
+      continue;
+    }
+
+    u64 head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    while (atomic_load_explicit(&ring->tail, memory_order_acquire) < head) {
+      nanosleep(&(struct timespec){.tv_nsec = LOG_DRAIN_INTERVAL_NS}, NULL);
+    }
+  }
+  fflush(logs.out);
+}
+
+void log_write(LogLevel level, const char *file, i32 line, const char *fmt,
+               ...) {
+  if (!logger_isEnabled(level)) {
+    return;
+  }
+
+  va_list ap;
+  va_start(ap, fmt);
+  if (!atomic_load_explicit(&logs.running, memory_order_acquire)) {
+    char message[LOG_MAX_LINE];
+    vsnprintf(message, sizeof(message), fmt, ap);
+    va_end(ap);
+    logger_log(level, file, line, "%s", message);
+    return;
+  }
+
+  alignas(log_record) u8 buf[LOG_MAX_RECORD];
+  log_record *r = (log_record *)buf;
+  *r = (log_record){
+      .level = level,
+      .line = line,
+      .fmt = fmt,
+      .file = file,
+      .time_ns = realtime_ns(),
+  };
+
+  va_list args;
+  va_copy(args, ap);
+  bool encoded = record_encode(buf, &r->size, fmt, &args);
+  va_end(args);
+  if (!encoded) {
+    char message[LOG_MAX_RECORD];
+    i32 len = vsnprintf(message, sizeof(message), fmt, ap);
+    u32 n = sizeof(log_record);
+    len = len < (i32)sizeof(message) ? len : (i32)sizeof(message) - 1;
+    put_string(buf, &n, message, len < 0 ? 0 : len);
+    r->size = n;
+    r->fmt = "%s";
+  }
+  va_end(ap);
+
+  log_ring *ring = local ? local : ring_register();
+  if (ring && ring_push(ring, r)) {
+    return;
+  }
+
+  // bounded: only what is at least a warning waits for the write
+  if (!ring || level >= LogLevel_WARN) {
+    record_write(r, ring ? ring->tid : (pid_t)syscall(SYS_gettid));
+  } else {
+    atomic_fetch_add_explicit(&ring->num_dropped, 1, memory_order_relaxed);
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "types.h"
+#include <logger.h>
+
+// once log_init ran, LOG_* only copy the format pointer and the arguments
+// into a ring owned by the calling thread, a background thread formats and
+// writes them; before log_init and after log_free they go through logger_log
+// as usual. the format must be a string literal, string arguments are copied
+
+// bytes per thread ring, a power of two
+#define LOG_RING_SIZE (1 << 16)
+#define LOG_MAX_THREADS 32
+// longest record, longer string arguments are truncated
+#define LOG_MAX_RECORD 2048
+
+// messages go to path, or stderr if NULL
+bool log_init(const char *path);
+// writes what is still queued; every other thread must be done logging
+void log_free(void);
+// waits until what was queued so far is written, for instance before
+// aborting
+void log_flush(void);
+
+// when a ring is full, messages below LogLevel_WARN are dropped and counted,
+// the others are written on the calling thread
+void log_write(LogLevel level, const char *file, i32 line, const char *fmt,
+               ...) __attribute__((format(printf, 4, 5)));
+
+#undef LOG_TRACE
+#undef LOG_DEBUG
+#undef LOG_INFO
+#undef LOG_WARN
+#undef LOG_ERROR
+#undef LOG_FATAL
+#define LOG_TRACE(fmt, ...)                                                    \
+  log_write(LogLevel_TRACE, __FILENAME__, __LINE__, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...)                                                    \
+  log_write(LogLevel_DEBUG, __FILENAME__, __LINE__, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)                                                     \
+  log_write(LogLevel_INFO, __FILENAME__, __LINE__, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)                                                     \
+  log_write(LogLevel_WARN, __FILENAME__, __LINE__, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...)                                                    \
+  log_write(LogLevel_ERROR, __FILENAME__, __LINE__, fmt, ##__VA_ARGS__)
+#define LOG_FATAL(fmt, ...)                                                    \
+  log_write(LogLevel_FATAL, __FILENAME__, __LINE__, fmt, ##__VA_ARGS__)
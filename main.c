@@ -1,21 +1,43 @@
+#include "arena.h"
+#include "bench.h"
+#include "churn.h"
 #include "command.h"
 #include "debug_msg.h"
+#include "debug_utils.h"
+#include "deletion_queue.h"
 #include "device.h"
+#include "dynamic_rendering.h"
+#include "flight_recorder.h"
+#include "gpu_profiler.h"
+#include "graphics_pipeline.h"
 #include "image.h"
 #include "instance.h"
+#include "layout_cache.h"
+#include "log.h"
 #include "memory.h"
+#include "mesh.h"
+#include "metrics.h"
+#include "offscreen.h"
+#include "pipeline_cache.h"
+#include "pipeline_library.h"
 #include "shader.h"
+#include "thread_pool.h"
+#include "timer.h"
+#include "trace.h"
 #include "vk_utils.h"
 #include "watch_linux.h"
 #include "window.h"
 #include <GLFW/glfw3.h>
 #include <assert.h>
-#include <logger.h>
+#include <libgen.h>
+#include <linux/limits.h>
 #include <stb/stb_image.h>
 #include <stdalign.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <vk_mem_alloc.h>
 #include <vulkan/vk_enum_string_helper.h>
@@ -27,62 +49,6 @@
 #include <cglm/mat4.h>
 #include <cglm/util.h>
 
-#include <assimp/cimport.h>
-#include <assimp/postprocess.h>
-#include <assimp/scene.h>
-
-typedef struct {
-  i32 offset_positions;
-  i32 size_positions;
-  i32 offset_texcoords;
-  i32 size_texcoords;
-  i32 vertex_buffer_size;
-  i32 index_buffer_size;
-  i32 num_indices;
-} model_layout;
-
-static model_layout mesh_layout(const struct aiMesh *mesh) {
-  model_layout l;
-  l.offset_positions = 0;
-  l.size_positions = mesh->mNumVertices * 3 * sizeof(float);
-  l.offset_texcoords = l.offset_positions + l.size_positions;
-  l.size_texcoords = mesh->mNumVertices * 2 * sizeof(float);
-  l.vertex_buffer_size = l.offset_texcoords + l.size_texcoords;
-  l.num_indices = mesh->mNumFaces * 3;
-  l.index_buffer_size = l.num_indices * sizeof(u32);
-  return l;
-}
-
-static float *texcoords_buffer(const struct aiMesh *mesh) {
-  i32 num_vs = mesh->mNumVertices;
-  assert(mesh->mNumUVComponents[0] == 2);
-  float *buffer = malloc(num_vs * 2 * sizeof(float));
-  if (!buffer) {
-    LOG_ERROR("unable to allocate texcoords buffer");
-    return NULL;
-  }
-  for (i32 i = 0; i < num_vs; ++i) {
-    memcpy(&buffer[i * 2], &mesh->mTextureCoords[0][i], 2 * sizeof(float));
-  }
-  return buffer;
-}
-
-static u32 *indices_buffer(const struct aiMesh *mesh) {
-  i32 num_faces = mesh->mNumFaces;
-  u32 *buffer = malloc(num_faces * 3 * sizeof(u32));
-  if (!buffer) {
-    LOG_ERROR("unable to allocate indices buffer");
-    return NULL;
-  }
-  for (i32 i = 0; i < num_faces; ++i) {
-    assert(mesh->mFaces[i].mNumIndices == 3);
-    buffer[i * 3] = mesh->mFaces[i].mIndices[0];
-    buffer[i * 3 + 1] = mesh->mFaces[i].mIndices[1];
-    buffer[i * 3 + 2] = mesh->mFaces[i].mIndices[2];
-  }
-  return buffer;
-}
-
 typedef struct {
   mat4 proj;
   mat4 view;
@@ -98,10 +64,138 @@ static void key_callback(GLFWwindow *w, int key, int scancode, int action,
   }
 }
 
+typedef enum {
+  pipeline_reload_idle,
+  pipeline_reload_building,
+  pipeline_reload_ready,
+  pipeline_reload_failed,
+} pipeline_reload_state;
+
+// what a graphics pipeline is compiled against, copied for a rebuild when it
+// is requested, as the render thread may recreate the swapchain meanwhile
+typedef struct {
+  VkRenderPass render_pass;
+  VkFormat color_format;
+  VkFormat depth_format;
+  VkSampleCountFlagBits samples;
+} pipeline_targets;
+
+// assets that can be hot reloaded
+typedef enum {
+  asset_model = 1 << 0,
+  asset_texture = 1 << 1,
+} asset_kind;
+
+typedef struct {
+  VkImage image;
+  VmaAllocation allocation;
+  VkImageView view;
+  VkSampler sampler;
+} texture;
+
 #define MAX_FRAMES_IN_FLIGHT 2
+#define SHADER_DIR "shaders"
+// release builds load shaders precompiled by 'make SHADER_BUNDLE=1' instead
+// of compiling them at startup
+#ifdef SHADER_BUNDLE
+#define SHADER_STORE "shaders.bundle"
+#else
+#define SHADER_STORE ".shader_cache"
+#endif
+#define MAX_CHANGED_SHADERS 8
+#define RESOURCE_DIR "resources"
+#define MODEL_PATH RESOURCE_DIR "/viking_room.obj"
+#define TEXTURE_PATH RESOURCE_DIR "/viking_room.png"
+#define SWAPCHAIN_ARENA_CAPACITY (64 << 10)
+#define HEADLESS_WIDTH 1280
+#define HEADLESS_HEIGHT 720
+#define HEADLESS_DEFAULT_FRAMES 100
+#define BENCH_DEFAULT_WARMUP_FRAMES 100
+#define BENCH_DEFAULT_FRAMES 1000
+#define BENCH_DEFAULT_TOLERANCE 0.1
+// animation time advanced per frame in bench mode
+#define BENCH_FRAME_SECONDS (1.0 / 60.0)
+#define SPIKE_DEFAULT_FACTOR 4.0
+// frames between updates of the gpu memory metrics
+#define METRICS_MEMORY_INTERVAL 60
+
+// gpu timestamp scopes of a frame
+typedef enum {
+  gpu_scope_frame,
+  gpu_scope_main_pass,
+  // from the last draw to the end of the pass, where the msaa resolve and
+  // attachment stores happen
+  gpu_scope_resolve,
+  gpu_scope_readback,
+  gpu_scope_count,
+} gpu_scope;
+
+static const char *const gpu_scope_names[gpu_scope_count] = {
+    "frame",
+    "main pass",
+    "resolve",
+    "readback",
+};
+
+// command line options, the environment variable in parentheses is used when
+// the flag is not given
+typedef struct {
+  // --headless (HEADLESS=1) renders into offscreen images without a window or
+  // surface, so it runs on devices that cannot present
+  bool headless;
+  // --frames n (HEADLESS_FRAMES), rendered before a headless run exits, or
+  // measured in bench mode
+  u32 frames;
+  // --output dir (HEADLESS_OUTPUT), headless frames are written to it as ppm
+  // files if set
+  const char *output_dir;
+  // --bench (BENCH=1) renders the same frames every run, the animation time
+  // depends only on the frame index and hot reload is off, and reports
+  // frame time percentiles once done
+  bool bench;
+  // --warmup n (BENCH_WARMUP), frames rendered before measuring or checking
+  // for churn
+  u32 warmup_frames;
+  // --bench-output path (BENCH_OUTPUT), where the results are written as json
+  const char *bench_output;
+  // --baseline path (BENCH_BASELINE), earlier results to compare against
+  const char *baseline;
+  // --tolerance f (BENCH_TOLERANCE), relative slowdown over the baseline
+  // reported as a regression
+  double tolerance;
+  // --trace path (TRACE_OUTPUT), cpu trace zones are written to it as chrome
+  // trace json on exit, debug builds only
+  const char *trace_output;
+  // --spike-ms ms (SPIKE_MS), frames slower than this are dumped with the
+  // frames around them, 0 for none
+  double spike_ms;
+  // --spike-factor f (SPIKE_FACTOR), same for frames slower than f times the
+  // rolling median, 0 for none
+  double spike_factor;
+  // --spike-dir dir (SPIKE_DIR), where spikes are dumped
+  const char *spike_dir;
+  // --churn report|assert (CHURN), reports or aborts on frames after the
+  // warmup that allocate heap memory or create vulkan objects, debug builds
+  // only
+  churn_mode churn;
+  // --log path (LOG_OUTPUT), where messages are written instead of stderr by
+  // the logging thread
+  const char *log_output;
+  // --best-practices (BEST_PRACTICES=1) enables the best practices checks of
+  // the validation layer, debug builds only
+  bool best_practices;
+  // --metrics-socket path (METRICS_SOCKET), unix socket on which runtime
+  // metrics are served in the prometheus text format
+  const char *metrics_socket;
+  // --alpha-cutoff f (ALPHA_CUTOFF), texels with a lower alpha are discarded
+  // by the ALPHA_TEST variant of the fragment shader, 0 for none
+  float alpha_cutoff;
+} app_options;
 
 typedef struct {
-  // windowing
+  app_options options;
+
+  // windowing, unused headless
   window w;
   bool recreate_swapchain;
 
@@ -110,10 +204,16 @@ typedef struct {
   VkSurfaceKHR surface;
   VkPhysicalDevice physical_device;
   VkDevice device;
+  device_features features;
+  // only loaded with extended dynamic state but without pipeline libraries
+  graphics_pipeline_dynamic_state dynamic_state;
+  // only loaded with dynamic rendering
+  dynamic_rendering rendering;
   VkQueue graphics_queue;
   VkQueue present_queue;
 
   // swapchain derived
+  arena swapchain_arena;
   VkSwapchainKHR swapchain;
   VkSampleCountFlagBits msaa_samples;
   VkSurfaceFormatKHR format;
@@ -121,6 +221,11 @@ typedef struct {
   VkImage *images;
   VkImageView *image_views;
   u32 num_images;
+  // replaces the swapchain headless, with an image per frame in flight
+  offscreen_target offscreen;
+  // the frame whose image is being read back in each frame slot, -1 if none
+  i64 readback_frame[MAX_FRAMES_IN_FLIGHT];
+  // not created with dynamic rendering
   VkFramebuffer *framebuffers;
   present_sync_objects sync_objects[MAX_FRAMES_IN_FLIGHT];
   VkBuffer uniform_buffers[MAX_FRAMES_IN_FLIGHT];
@@ -128,6 +233,9 @@ typedef struct {
   VmaAllocationInfo uniform_buffer_allocation_info[MAX_FRAMES_IN_FLIGHT];
   VkDescriptorPool descriptor_pool;
   VkDescriptorSet descriptor_sets[MAX_FRAMES_IN_FLIGHT];
+  // reflected from the shaders, -1 if they do not use the resource
+  i32 uniform_binding;
+  i32 texture_binding;
   VkDescriptorSetLayout descriptor_set_layout;
   u32 current_frame;
 
@@ -144,12 +252,80 @@ typedef struct {
 
   // shader-related
   shader_compiler shaderc;
+  shader_variant fragment_variant;
+  VkSpecializationInfo fragment_constants;
+  thread_pool workers;
   watch file_watch;
+  // files of the shader include graph whose directories are watched
+  i32 watched_shader_files;
 
   // pipeline
+  pipeline_cache pipeline_cache;
+  // owns the descriptor set and pipeline layouts
+  layout_cache layouts;
   VkPipelineLayout graphics_pipeline_layout;
+  // created for these attachments, independent of the swapchain extent; no
+  // render pass is needed with dynamic rendering
   VkRenderPass render_pass;
+  VkFormat attachment_format;
+  VkFormat attachment_depth_format;
+  VkSampleCountFlagBits attachment_samples;
   VkPipeline graphics_pipeline;
+  // compiled parts of graphics pipelines, if pipeline libraries are supported
+  pipeline_library library;
+  deletion_queue deletion_queue;
+  u64 frame_count;
+  // swapchain recreation cost
+  u64 num_recreations;
+  u64 recreate_total_ns;
+  u64 recreate_max_ns;
+  // RESIZE_STORM=n resizes the window on each of the first n frames, then
+  // reports the recreation cost and exits
+  i32 resize_storm_frames;
+  u64 storm_frame_total_ns;
+  u64 storm_frame_max_ns;
+  // when app_init started, to report the time to the first frame
+  u64 start_ns;
+  // bench mode results
+  bench bench;
+  gpu_profiler gpu_profiler;
+  flight_recorder flight_recorder;
+  churn_detector churn;
+
+  // shader hot reload, the replacement pipeline is built on a worker and
+  // swapped in at the start of a frame; with pipeline libraries a fast-linked
+  // pipeline is swapped in first and replaced once the optimized one is linked
+  pthread_mutex_t reload_mutex;
+  pthread_cond_t reload_done;
+  pipeline_reload_state reload_state;
+  // next pipeline to swap in, VK_NULL_HANDLE if none
+  VkPipeline reload_pipeline;
+  // the rebuild only relinks the current shaders with optimization
+  bool reload_optimize_only;
+  // set when shaders change while a rebuild is already running
+  bool reload_requested;
+  // set to skip the optimized link of the running rebuild
+  bool reload_cancel;
+  pipeline_targets reload_targets;
+
+  // asset hot reload, meshes and textures are imported and uploaded on a
+  // worker with a transfer context of its own and swapped in at the start of
+  // a frame, each descriptor set is rewritten once its frame slot comes around
+  transfer_context asset_transfer;
+  VkCommandPool asset_command_pool;
+  VkCommandBuffer asset_command_buffer;
+  pthread_mutex_t asset_mutex;
+  pthread_cond_t asset_done;
+  bool asset_building;
+  // asset_kind bits still to be reloaded
+  u32 asset_requested;
+  // uploaded but not swapped in yet
+  bool reloaded_model_ready;
+  mesh reloaded_model;
+  bool reloaded_texture_ready;
+  texture reloaded_texture;
+  u64 texture_generation;
+  u64 descriptor_texture_generation[MAX_FRAMES_IN_FLIGHT];
 
   // command
   VkCommandPool command_pools[MAX_FRAMES_IN_FLIGHT];
@@ -157,16 +333,11 @@ typedef struct {
 
   // memory-related
   VmaAllocator vk_allocator;
+  // workers submit to the same queues as the render loop
+  pthread_mutex_t queue_mutex;
   transfer_context transfer;
-  model_layout ml;
-  VkBuffer vertex_buffer;
-  VmaAllocation vertex_buffer_allocation;
-  VkBuffer index_buffer;
-  VmaAllocation index_buffer_allocation;
-  VkImage texture;
-  VmaAllocation texture_allocation;
-  VkImageView texture_view;
-  VkSampler texture_sampler;
+  mesh model;
+  texture texture;
 } app;
 
 static void framebuffer_resize_callback(GLFWwindow *w, int width, int height) {
@@ -176,34 +347,307 @@ static void framebuffer_resize_callback(GLFWwindow *w, int width, int height) {
   a->recreate_swapchain = true;
 }
 
-static bool create_graphics_pipeline(app *a) {
-  VkPipelineShaderStageCreateInfo stages[2] = {};
-  i32 shader_counter = 0;
-  if (!shader_compile_vk_stage(&a->shaderc, "shaders/triangle.vs.glsl",
-                               a->device, VK_SHADER_STAGE_VERTEX_BIT,
-                               &stages[shader_counter++]) ||
-      !shader_compile_vk_stage(&a->shaderc, "shaders/triangle.fs.glsl",
-                               a->device, VK_SHADER_STAGE_FRAGMENT_BIT,
-                               &stages[shader_counter++])) {
-    goto fail_shader_compilation;
+// runtime-tunable fragment shader constants, only used by variants with the
+// ALPHA_TEST keyword
+static const VkSpecializationMapEntry alpha_cutoff_entry = {
+    .constantID = 0,
+    .offset = 0,
+    .size = sizeof(float),
+};
+
+// the cutoff is a specialization constant, so changing it does not need
+// another variant
+static void init_fragment_variant(app *a) {
+  a->fragment_constants = (VkSpecializationInfo){
+      .mapEntryCount = 1,
+      .pMapEntries = &alpha_cutoff_entry,
+      .dataSize = sizeof(a->options.alpha_cutoff),
+      .pData = &a->options.alpha_cutoff,
+  };
+  a->fragment_variant = (shader_variant){
+      .num_keywords = 0,
+      .specialization = &a->fragment_constants,
+  };
+  if (a->options.alpha_cutoff > 0.0f) {
+    a->fragment_variant.keywords[a->fragment_variant.num_keywords++] =
+        "ALPHA_TEST";
+  }
+}
+
+#define NUM_GRAPHICS_SHADERS 2
+
+static void graphics_shader_requests(const app *a,
+                                     shader_build_request *requests) {
+  requests[0] = (shader_build_request){
+      .filename = SHADER_DIR "/triangle.vs.glsl",
+      .stage = VK_SHADER_STAGE_VERTEX_BIT,
+  };
+  requests[1] = (shader_build_request){
+      .filename = SHADER_DIR "/triangle.fs.glsl",
+      .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+      .variant = &a->fragment_variant,
+  };
+}
+
+// the combined resource interface of the graphics shaders, from which the
+// descriptor and pipeline layouts are derived
+static bool reflect_graphics_shaders(app *a, shader_reflection *r) {
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return false;
   }
 
-  VkResult result;
-  if ((result = vkCreatePipelineLayout(
-           a->device,
-           &(VkPipelineLayoutCreateInfo){
-               .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-               .setLayoutCount = 1,
-               .pSetLayouts = &a->descriptor_set_layout,
-               .pushConstantRangeCount = 0,
-               .pPushConstantRanges = NULL,
-           },
-           NULL, &a->graphics_pipeline_layout)) != VK_SUCCESS) {
-    LOG_ERROR("unable to create graphics pipeline layout: %s",
-              vk_error_to_string(result));
-    goto fail_pipeline_layout;
+  shader_build_request requests[NUM_GRAPHICS_SHADERS];
+  graphics_shader_requests(a, requests);
+  *r = (shader_reflection){};
+  for (i32 i = 0; i < NUM_GRAPHICS_SHADERS; ++i) {
+    arena_marker marker = arena_mark(scratch);
+    shader_binary binary;
+    if (!shader_load_binary(&a->shaderc, requests[i].filename,
+                            requests[i].variant, scratch, &binary)) {
+      arena_pop(scratch, marker);
+      return false;
+    }
+
+    shader_reflection stage;
+    bool success =
+        reflect_spirv(binary.code, binary.len, requests[i].stage, &stage) &&
+        reflect_merge(r, &stage);
+    shader_binary_release(&binary);
+    arena_pop(scratch, marker);
+    if (!success) {
+      LOG_ERROR("unable to reflect shader '%s'", requests[i].filename);
+      return false;
+    }
   }
 
+  return true;
+}
+
+// merges the resource interface of each stage as soon as it is built
+static bool merge_stage_interface(shader_build_request *request,
+                                  void *user_data) {
+  shader_reflection *interface = user_data;
+  if (!reflect_merge(interface, &request->reflection)) {
+    LOG_ERROR("unable to merge resource interface of shader '%s'",
+              request->filename);
+    return false;
+  }
+  return true;
+}
+
+// besides targets only reads state that stays constant until the pipeline is
+// recreated, so it may run on a worker while the current pipeline keeps
+// rendering; optimize requests a link-time optimized pipeline and needs
+// pipeline library support
+static bool build_graphics_pipeline(app *a, const pipeline_targets *targets,
+                                    thread_pool *pool, bool optimize,
+                                    VkPipeline *pipeline) {
+  shader_build_request requests[NUM_GRAPHICS_SHADERS];
+  graphics_shader_requests(a, requests);
+  shader_reflection interface = {};
+  TRACE_BEGIN("shader build");
+  bool success = shader_build_stages(&a->shaderc, pool, a->device,
+                                     NUM_GRAPHICS_SHADERS, requests,
+                                     merge_stage_interface, &interface);
+  TRACE_END();
+  if (!success) {
+    return false;
+  }
+
+  // descriptor sets are allocated once, so shaders may only be hot reloaded
+  // as long as their resource interface stays the same
+  VkDescriptorSetLayout set_layouts[REFLECT_MAX_SETS];
+  u32 num_sets;
+  if (layout_cache_pipeline_layout_get(&a->layouts, &interface, set_layouts,
+                                       &num_sets) !=
+      a->graphics_pipeline_layout) {
+    LOG_ERROR("shader resource interface changed, restart to apply");
+    success = false;
+  }
+
+  graphics_pipeline_desc desc = {
+      .layout = a->graphics_pipeline_layout,
+      .render_pass = targets->render_pass,
+      .color_format = targets->color_format,
+      .depth_format = targets->depth_format,
+      .samples = targets->samples,
+      .interface = &interface,
+      .vertex_stage = requests[0].stage_info,
+      .fragment_stage = requests[1].stage_info,
+      .vertex_hash = requests[0].code_hash,
+      .fragment_hash = requests[1].code_hash,
+  };
+  u64 pipeline_start_ns = timer_now_ns();
+  TRACE_BEGIN("pipeline create");
+  if (success && a->features.graphics_pipeline_library) {
+    success = pipeline_library_link(&a->library, &desc, optimize, pipeline);
+  } else if (success) {
+    success = graphics_pipeline_create(a->device, a->pipeline_cache.cache,
+                                       &desc,
+                                       a->features.extended_dynamic_state,
+                                       pipeline);
+  }
+  TRACE_END();
+
+  if (success) {
+    DEBUG_NAME(a->device, VK_OBJECT_TYPE_PIPELINE, *pipeline,
+               "graphics pipeline %s",
+               !a->features.graphics_pipeline_library ? "complete"
+               : optimize                              ? "optimized"
+                                                       : "linked");
+    pipeline_cache_mark_dirty(&a->pipeline_cache);
+    LOG_INFO("%s graphics pipeline in %.3f ms (%s pipeline cache)",
+             !a->features.graphics_pipeline_library ? "created"
+             : optimize                              ? "optimized"
+                                                     : "linked",
+             timer_ns_to_ms(timer_now_ns() - pipeline_start_ns),
+             a->pipeline_cache.warm ? "warm" : "cold");
+  }
+
+  for (i32 i = 0; i < NUM_GRAPHICS_SHADERS; ++i) {
+    shader_free_vk_stage(a->device, &requests[i].stage_info);
+  }
+  return success;
+}
+
+// replaces a pipeline built earlier by the same rebuild, which has never been
+// bound if it was not swapped in yet
+static void publish_reloaded_pipeline(app *a, VkPipeline pipeline) {
+  pthread_mutex_lock(&a->reload_mutex);
+  if (a->reload_pipeline != VK_NULL_HANDLE) {
+    vkDestroyPipeline(a->device, a->reload_pipeline, NULL);
+  }
+  a->reload_pipeline = pipeline;
+  pthread_mutex_unlock(&a->reload_mutex);
+}
+
+static void pipeline_reload_job(void *user_data) {
+  app *a = user_data;
+  pthread_mutex_lock(&a->reload_mutex);
+  pipeline_targets targets = a->reload_targets;
+  pthread_mutex_unlock(&a->reload_mutex);
+
+  u64 start_ns = timer_now_ns();
+  bool success = true;
+  // shaders are compiled inline, waiting on the pool from one of its own
+  // workers could deadlock
+  if (!a->reload_optimize_only) {
+    VkPipeline pipeline;
+    success = build_graphics_pipeline(a, &targets, NULL, false, &pipeline);
+    if (success) {
+      LOG_INFO("rebuilt graphics pipeline in %.3f ms",
+               timer_ns_to_ms(timer_now_ns() - start_ns));
+      publish_reloaded_pipeline(a, pipeline);
+    }
+    metrics_add(success ? metric_shader_reloads
+                        : metric_shader_reload_failures,
+                1);
+  }
+
+  // not worth finishing if the shaders already changed again, a failure
+  // keeps the fast-linked pipeline
+  pthread_mutex_lock(&a->reload_mutex);
+  bool optimize = success && a->features.graphics_pipeline_library &&
+                  !a->reload_requested && !a->reload_cancel;
+  pthread_mutex_unlock(&a->reload_mutex);
+  VkPipeline optimized;
+  if (optimize &&
+      build_graphics_pipeline(a, &targets, NULL, true, &optimized)) {
+    publish_reloaded_pipeline(a, optimized);
+  }
+
+  pthread_mutex_lock(&a->reload_mutex);
+  a->reload_state = success ? pipeline_reload_ready : pipeline_reload_failed;
+  pthread_cond_broadcast(&a->reload_done);
+  pthread_mutex_unlock(&a->reload_mutex);
+}
+
+// the attachments the current pipeline was created for
+static pipeline_targets current_pipeline_targets(const app *a) {
+  return (pipeline_targets){
+      .render_pass = a->render_pass,
+      .color_format = a->attachment_format,
+      .depth_format = a->attachment_depth_format,
+      .samples = a->attachment_samples,
+  };
+}
+
+// optimize_only relinks the current shaders with optimization, which is
+// subsumed by any full rebuild running or requested
+static void request_pipeline_reload(app *a, bool optimize_only) {
+  pthread_mutex_lock(&a->reload_mutex);
+  if (a->reload_state != pipeline_reload_idle) {
+    a->reload_requested = a->reload_requested || !optimize_only;
+    pthread_mutex_unlock(&a->reload_mutex);
+    return;
+  }
+
+  a->reload_state = pipeline_reload_building;
+  a->reload_requested = false;
+  a->reload_optimize_only = optimize_only;
+  a->reload_cancel = false;
+  a->reload_targets = current_pipeline_targets(a);
+  pthread_mutex_unlock(&a->reload_mutex);
+  if (!thread_pool_submit(&a->workers, pipeline_reload_job, a)) {
+    LOG_WARN("worker queue full, deferring shader reload");
+    pthread_mutex_lock(&a->reload_mutex);
+    a->reload_state = pipeline_reload_idle;
+    a->reload_requested = !optimize_only;
+    pthread_mutex_unlock(&a->reload_mutex);
+  }
+}
+
+// called at a frame boundary, the replaced pipeline is destroyed once the
+// frames still in flight have completed
+static void swap_reloaded_pipeline(app *a) {
+  pthread_mutex_lock(&a->reload_mutex);
+  if (a->reload_pipeline != VK_NULL_HANDLE) {
+    deletion_queue_push_pipeline(&a->deletion_queue, a->frame_count,
+                                 a->graphics_pipeline);
+    a->graphics_pipeline = a->reload_pipeline;
+    a->reload_pipeline = VK_NULL_HANDLE;
+  }
+  if (a->reload_state == pipeline_reload_ready) {
+    a->reload_state = pipeline_reload_idle;
+  } else if (a->reload_state == pipeline_reload_failed) {
+    LOG_WARN("shader reload failed, keeping the current pipeline");
+    a->reload_state = pipeline_reload_idle;
+  }
+  bool again = a->reload_requested && a->reload_state == pipeline_reload_idle;
+  pthread_mutex_unlock(&a->reload_mutex);
+
+  if (again) {
+    request_pipeline_reload(a, false);
+  }
+}
+
+// a rebuild compiles against the render pass, so it has to finish before that
+// is destroyed, its result is dropped in favour of a fresh pipeline
+static void wait_pipeline_reload(app *a) {
+  pthread_mutex_lock(&a->reload_mutex);
+  a->reload_cancel = true;
+  while (a->reload_state == pipeline_reload_building) {
+    pthread_cond_wait(&a->reload_done, &a->reload_mutex);
+  }
+  if (a->reload_pipeline != VK_NULL_HANDLE) {
+    vkDestroyPipeline(a->device, a->reload_pipeline, NULL);
+    a->reload_pipeline = VK_NULL_HANDLE;
+  }
+  a->reload_state = pipeline_reload_idle;
+  a->reload_requested = false;
+  pthread_mutex_unlock(&a->reload_mutex);
+}
+
+// the layout rendered images are left in, offscreen images are read back
+// instead of presented
+static VkImageLayout present_layout(const app *a) {
+  return a->options.headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+                             : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+}
+
+static bool create_render_pass(app *a) {
+  VkResult result;
   if ((result = vkCreateRenderPass(
            a->device,
            &(VkRenderPassCreateInfo){
@@ -241,7 +685,7 @@ static bool create_graphics_pipeline(app *a) {
                            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
                            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
                            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-                           .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                           .finalLayout = present_layout(a),
                        }},
                .subpassCount = 1,
                .pSubpasses =
@@ -288,200 +732,140 @@ static bool create_graphics_pipeline(app *a) {
            },
            NULL, &a->render_pass)) != VK_SUCCESS) {
     LOG_ERROR("unable to create render pass: %s", vk_error_to_string(result));
+    return false;
+  }
+  DEBUG_NAME(a->device, VK_OBJECT_TYPE_RENDER_PASS, a->render_pass,
+             "main render pass");
+
+  return true;
+}
+
+static bool create_graphics_pipeline(app *a) {
+  // with dynamic rendering the pipeline is only given the attachment formats
+  if (!a->features.dynamic_rendering && !create_render_pass(a)) {
     goto fail_render_pass;
   }
 
-  if ((result = vkCreateGraphicsPipelines(
-           a->device, VK_NULL_HANDLE, 1,
-           &(VkGraphicsPipelineCreateInfo){
-               .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-               .layout = a->graphics_pipeline_layout,
-               .pStages = stages,
-               .stageCount = sizeof(stages) / sizeof(stages[0]),
-               .subpass = 0,
-               .renderPass = a->render_pass,
-               .pDynamicState =
-                   &(VkPipelineDynamicStateCreateInfo){
-                       .sType =
-                           VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-                       .dynamicStateCount = 0,
-                       .pDynamicStates = NULL,
-                   },
-               .pColorBlendState =
-                   &(VkPipelineColorBlendStateCreateInfo){
-                       .sType =
-                           VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-                       .logicOp = VK_LOGIC_OP_COPY,
-                       .attachmentCount = 1,
-                       .pAttachments =
-                           &(VkPipelineColorBlendAttachmentState){
-                               .blendEnable = VK_TRUE,
-                               .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
-                               .dstColorBlendFactor =
-                                   VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-                               .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-                               .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-                               .colorBlendOp = VK_BLEND_OP_ADD,
-                               .alphaBlendOp = VK_BLEND_OP_ADD,
-                               .colorWriteMask = VK_COLOR_COMPONENT_R_BIT |
-                                                 VK_COLOR_COMPONENT_G_BIT |
-                                                 VK_COLOR_COMPONENT_B_BIT |
-                                                 VK_COLOR_COMPONENT_A_BIT,
-                           },
-                       .logicOpEnable = VK_FALSE,
-                       .blendConstants = {},
-                   },
-               .pViewportState =
-                   &(VkPipelineViewportStateCreateInfo){
-                       .sType =
-                           VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-                       .scissorCount = 1,
-                       .pScissors =
-                           &(VkRect2D){
-                               .offset = {0, 0},
-                               .extent = a->extent,
-                           },
-                       .viewportCount = 1,
-                       .pViewports =
-                           &(VkViewport){
-                               .x = 0,
-                               .y = 0,
-                               .width = a->extent.width,
-                               .height = a->extent.height,
-                               .minDepth = 0.0,
-                               .maxDepth = 1.0,
-                           },
-                   },
-               .pMultisampleState =
-                   &(VkPipelineMultisampleStateCreateInfo){
-                       .sType =
-                           VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-                       .pSampleMask = NULL,
-                       .minSampleShading = 1.0,
-                       .alphaToOneEnable = VK_FALSE,
-                       .alphaToCoverageEnable = VK_FALSE,
-                       .sampleShadingEnable = VK_FALSE,
-                       .rasterizationSamples = a->msaa_samples,
-                   },
-               .pVertexInputState =
-                   &(VkPipelineVertexInputStateCreateInfo){
-                       .sType =
-                           VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-                       .vertexBindingDescriptionCount = 2,
-                       .pVertexBindingDescriptions =
-                           (VkVertexInputBindingDescription[]){
-                               (VkVertexInputBindingDescription){
-                                   .binding = 0,
-                                   .stride = 3 * sizeof(float),
-                                   .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-                               },
-                               (VkVertexInputBindingDescription){
-                                   .binding = 1,
-                                   .stride = 2 * sizeof(float),
-                                   .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-                               },
-                           },
-                       .vertexAttributeDescriptionCount = 2,
-                       .pVertexAttributeDescriptions =
-                           (VkVertexInputAttributeDescription[]){
-                               (VkVertexInputAttributeDescription){
-                                   .location = 0,
-                                   .binding = 0,
-                                   .offset = 0,
-                                   .format = VK_FORMAT_R32G32B32_SFLOAT,
-                               },
-                               (VkVertexInputAttributeDescription){
-                                   .location = 1,
-                                   .binding = 1,
-                                   .offset = 0,
-                                   .format = VK_FORMAT_R32G32_SFLOAT,
-                               },
-                           },
-                   },
-               .basePipelineHandle = VK_NULL_HANDLE,
-               .basePipelineIndex = -1,
-               .pDepthStencilState =
-                   &(VkPipelineDepthStencilStateCreateInfo){
-                       .sType =
-                           VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-                       .depthTestEnable = VK_TRUE,
-                       .depthWriteEnable = VK_TRUE,
-                       .depthCompareOp = VK_COMPARE_OP_LESS,
-                       .depthBoundsTestEnable = VK_FALSE,
-                       .minDepthBounds = 0.0,
-                       .maxDepthBounds = 1.0,
-                       .stencilTestEnable = VK_FALSE,
-                   },
-               .pTessellationState = NULL,
-               .pInputAssemblyState =
-                   &(VkPipelineInputAssemblyStateCreateInfo){
-                       .sType =
-                           VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-                       .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-                       .primitiveRestartEnable = VK_FALSE,
-                   },
-               .pRasterizationState =
-                   &(VkPipelineRasterizationStateCreateInfo){
-                       .sType =
-                           VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-                       .cullMode = VK_CULL_MODE_BACK_BIT,
-                       .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
-                       .lineWidth = 1.0,
-                       .polygonMode = VK_POLYGON_MODE_FILL,
-                       .depthBiasEnable = VK_FALSE,
-                       .depthClampEnable = VK_FALSE,
-                       .depthBiasClamp = 0.0,
-                       .depthBiasSlopeFactor = 0.0,
-                       .depthBiasConstantFactor = 0.0,
-                       .rasterizerDiscardEnable = VK_FALSE,
-                   },
-           },
-           NULL, &a->graphics_pipeline)) != VK_SUCCESS) {
-    LOG_ERROR("unable to create graphics pipeline");
+  a->attachment_format = a->format.format;
+  a->attachment_depth_format = a->depth_format;
+  a->attachment_samples = a->msaa_samples;
+  pipeline_targets targets = current_pipeline_targets(a);
+  if (!build_graphics_pipeline(a, &targets, &a->workers, false,
+                               &a->graphics_pipeline)) {
     goto fail_graphics_pipeline;
   }
 
-  for (i32 i = 0; i < shader_counter; ++i) {
-    shader_free_vk_stage(a->device, &stages[i]);
+  // render with the fast-linked pipeline until the optimized one is ready
+  if (a->features.graphics_pipeline_library) {
+    request_pipeline_reload(a, true);
   }
   return true;
 
 fail_graphics_pipeline:
   vkDestroyRenderPass(a->device, a->render_pass, NULL);
 fail_render_pass:
-  vkDestroyPipelineLayout(a->device, a->graphics_pipeline_layout, NULL);
-fail_pipeline_layout:
-fail_shader_compilation:
-  for (i32 i = 0; i < shader_counter; ++i) {
-    shader_free_vk_stage(a->device, &stages[i]);
-  }
-
+  a->render_pass = VK_NULL_HANDLE;
+  a->graphics_pipeline = VK_NULL_HANDLE;
   return false;
 }
 
 static void free_graphics_pipeline(app *a) {
+  // the optimized link requested by create_graphics_pipeline may be running
+  wait_pipeline_reload(a);
   vkDestroyPipeline(a->device, a->graphics_pipeline, NULL);
+  a->graphics_pipeline = VK_NULL_HANDLE;
+  // the cached parts were compiled against the render pass or formats
+  pipeline_library_clear(&a->library);
   vkDestroyRenderPass(a->device, a->render_pass, NULL);
-  vkDestroyPipelineLayout(a->device, a->graphics_pipeline_layout, NULL);
+  a->render_pass = VK_NULL_HANDLE;
 }
 
-static bool init_swapchain_related(app *a) {
+// viewport and scissor are dynamic, so the render pass and pipeline only
+// depend on the attachment formats and sample count, not on the extent
+static bool graphics_pipeline_outdated(const app *a) {
+  return a->graphics_pipeline == VK_NULL_HANDLE ||
+         a->attachment_format != a->format.format ||
+         a->attachment_depth_format != a->depth_format ||
+         a->attachment_samples != a->msaa_samples;
+}
+
+// creates the swapchain and gets its images, headless the offscreen images
+// stand in for them
+static bool init_swapchain_images(app *a) {
+  if (a->options.headless) {
+    a->format = (VkSurfaceFormatKHR){
+        .format = VK_FORMAT_B8G8R8A8_SRGB,
+        .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+    };
+    a->extent = (VkExtent2D){HEADLESS_WIDTH, HEADLESS_HEIGHT};
+    if (!offscreen_target_init(a->vk_allocator, a->extent, a->format.format,
+                               MAX_FRAMES_IN_FLIGHT,
+                               a->options.output_dir != NULL,
+                               &a->offscreen)) {
+      LOG_ERROR("unable to create offscreen images");
+      return false;
+    }
+
+    a->images = a->offscreen.images;
+    a->num_images = a->offscreen.num_images;
+    for (u32 i = 0; i < a->num_images; ++i) {
+      DEBUG_NAME(a->device, VK_OBJECT_TYPE_IMAGE, a->images[i],
+                 "offscreen image %" PRIu32, i);
+      DEBUG_NAME(a->device, VK_OBJECT_TYPE_BUFFER, a->offscreen.buffers[i],
+                 "readback buffer %" PRIu32, i);
+    }
+    return true;
+  }
+
   VkSwapchainKHR old_swapchain = a->swapchain;
-  if (!swapchain_init(&a->w, a->physical_device, a->device, a->surface,
-                      old_swapchain, &a->swapchain, &a->format, &a->extent)) {
+  bool created =
+      swapchain_init(&a->w, a->physical_device, a->device, a->surface,
+                     old_swapchain, &a->swapchain, &a->format, &a->extent);
+  // the old swapchain is retired even if creation failed, but frames in
+  // flight may still present its images
+  if (old_swapchain != VK_NULL_HANDLE) {
+    deletion_queue_push_swapchain(&a->deletion_queue, a->frame_count,
+                                  old_swapchain);
+  }
+  if (!created) {
     LOG_ERROR("unable to create vulkan swapchain");
-    goto fail_vk_swapchain;
+    return false;
   }
 
-  if (!(a->images =
-            swapchain_get_images(a->device, a->swapchain, &a->num_images))) {
+  if (!(a->images = swapchain_get_images(a->device, a->swapchain,
+                                         &a->swapchain_arena,
+                                         &a->num_images))) {
     LOG_ERROR("unable to get vulkan swapchain images");
-    goto fail_vk_swapchain_images;
+    swapchain_free(a->device, a->swapchain);
+    return false;
+  }
+
+  DEBUG_NAME(a->device, VK_OBJECT_TYPE_SWAPCHAIN_KHR, a->swapchain,
+             "swapchain");
+  for (u32 i = 0; i < a->num_images; ++i) {
+    DEBUG_NAME(a->device, VK_OBJECT_TYPE_IMAGE, a->images[i],
+               "swapchain image %" PRIu32, i);
+  }
+  return true;
+}
+
+static void free_swapchain_images(app *a) {
+  if (a->options.headless) {
+    offscreen_target_free(&a->offscreen);
+  } else {
+    swapchain_free(a->device, a->swapchain);
+  }
+}
+
+static bool init_swapchain_related(app *a) {
+  arena_reset(&a->swapchain_arena);
+  if (!init_swapchain_images(a)) {
+    goto fail_swapchain_images;
   }
 
-  a->image_views = NULL;
   if (!swapchain_image_views_init(a->device, a->images, a->num_images,
-                                  a->format.format, &a->image_views)) {
+                                  a->format.format, &a->swapchain_arena,
+                                  &a->image_views)) {
     LOG_ERROR("unable to create image views for swapchain images");
     goto fail_vk_swapchain_image_views;
   }
@@ -501,23 +885,34 @@ static bool init_swapchain_related(app *a) {
     goto fail_depth_buffer;
   }
 
-  if (!create_graphics_pipeline(a)) {
-    LOG_ERROR("unable to initialize graphics pipeline for app");
-    goto fail_graphics_pipeline;
+  if (graphics_pipeline_outdated(a)) {
+    // rare enough to simply wait for the frames using the pipeline
+    if (a->graphics_pipeline != VK_NULL_HANDLE) {
+      LOG_INFO("attachment formats changed, recreating graphics pipeline");
+      pthread_mutex_lock(&a->queue_mutex);
+      vkDeviceWaitIdle(a->device);
+      pthread_mutex_unlock(&a->queue_mutex);
+      free_graphics_pipeline(a);
+    }
+    if (!create_graphics_pipeline(a)) {
+      LOG_ERROR("unable to initialize graphics pipeline for app");
+      goto fail_graphics_pipeline;
+    }
   }
 
-  if (!framebuffers_init(a->device, a->num_images, a->image_views, &a->extent,
-                         a->render_pass, &a->framebuffers, a->color_image_view,
-                         a->depth_image_view)) {
+  if (!a->features.dynamic_rendering &&
+      !framebuffers_init(a->device, a->num_images, a->image_views, &a->extent,
+                         a->render_pass, a->color_image_view,
+                         a->depth_image_view, &a->swapchain_arena,
+                         &a->framebuffers)) {
     LOG_ERROR("unable to initialize present framebuffers");
     goto fail_framebuffers;
   }
 
   return true;
 
-  framebuffers_free(a->device, a->num_images, a->framebuffers);
 fail_framebuffers:
-  free_graphics_pipeline(a);
+  // the pipeline outlives the swapchain, it is freed with the app
 fail_graphics_pipeline:
   image_free(&a->transfer, a->depth_image, a->depth_image_allocation,
              a->depth_image_view, VK_NULL_HANDLE);
@@ -527,25 +922,44 @@ fail_depth_buffer:
 fail_msaa_color_buffer:
   swapchain_image_views_destroy(a->device, a->image_views, a->num_images);
 fail_vk_swapchain_image_views:
-  free(a->images);
-fail_vk_swapchain_images:
-  swapchain_free(a->device, a->swapchain);
-fail_vk_swapchain:
+  free_swapchain_images(a);
+fail_swapchain_images:
   return false;
 }
 
 static void free_swapchain_related(app *a) {
-  framebuffers_free(a->device, a->num_images, a->framebuffers);
-  free_graphics_pipeline(a);
+  if (!a->features.dynamic_rendering) {
+    framebuffers_free(a->device, a->num_images, a->framebuffers);
+  }
   image_free(&a->transfer, a->depth_image, a->depth_image_allocation,
              a->depth_image_view, VK_NULL_HANDLE);
   image_free(&a->transfer, a->color_image, a->color_image_allocation,
              a->color_image_view, VK_NULL_HANDLE);
   swapchain_image_views_destroy(a->device, a->image_views, a->num_images);
-  free(a->images);
-  swapchain_free(a->device, a->swapchain);
+  free_swapchain_images(a);
+}
+
+// hands the framebuffers, views and attachments to the deletion queue, which
+// destroys them once the frames using them have retired; the swapchain itself
+// is kept to be passed as oldSwapchain
+static void retire_swapchain_related(app *a) {
+  deletion_queue *q = &a->deletion_queue;
+  u64 frame = a->frame_count;
+  for (u32 i = 0; i < a->num_images; ++i) {
+    if (!a->features.dynamic_rendering) {
+      deletion_queue_push_framebuffer(q, frame, a->framebuffers[i]);
+    }
+    deletion_queue_push_image_view(q, frame, a->image_views[i]);
+  }
+  deletion_queue_push_image(q, frame, a->vk_allocator, a->depth_image,
+                            a->depth_image_allocation, a->depth_image_view,
+                            VK_NULL_HANDLE);
+  deletion_queue_push_image(q, frame, a->vk_allocator, a->color_image,
+                            a->color_image_allocation, a->color_image_view,
+                            VK_NULL_HANDLE);
 }
 
+// called at a frame boundary, does not wait for the device
 static bool recreate_swapchain_related(app *a) {
   int width, height;
   glfwGetFramebufferSize(a->w.window, &width, &height);
@@ -554,25 +968,205 @@ static bool recreate_swapchain_related(app *a) {
     glfwWaitEvents();
   }
 
-  vkDeviceWaitIdle(a->device);
-  free_swapchain_related(a);
-  a->swapchain = NULL;
-  return init_swapchain_related(a);
+  u64 heap_allocations = churn_num_allocs();
+  u64 start_ns = timer_now_ns();
+  retire_swapchain_related(a);
+  bool success = init_swapchain_related(a);
+  u64 elapsed_ns = timer_now_ns() - start_ns;
+  ++a->num_recreations;
+  metrics_add(metric_swapchain_recreations, 1);
+  metrics_observe_ns(metric_swapchain_recreation_time, elapsed_ns);
+  a->recreate_total_ns += elapsed_ns;
+  if (elapsed_ns > a->recreate_max_ns) {
+    a->recreate_max_ns = elapsed_ns;
+  }
+  // the swapchain arrays live on the swapchain arena, what is left are the
+  // driver's own allocations for the new objects
+  LOG_DEBUG("swapchain recreated in %.3fms, %" PRIu64 " heap allocation(s)",
+            timer_ns_to_ms(elapsed_ns), churn_num_allocs() - heap_allocations);
+  return success;
 }
 
-static bool app_init(app *a) {
-  if (!window_init(&a->w, 1280, 720, "vulkan")) {
-    LOG_ERROR("error: unable to open window");
-    return false;
+static bool texture_load(app *a, const transfer_context *tctx,
+                         VkCommandPool blit_pool, VkCommandBuffer blit_buffer,
+                         texture *t) {
+  return image_load_from_file(
+      a->physical_device, tctx, TEXTURE_PATH, VK_IMAGE_USAGE_SAMPLED_BIT,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      &(mipmap_context){
+          .mip_levels = INT32_MAX,
+          .blit_command_pool = blit_pool,
+          .blit_command_buffer = blit_buffer,
+      },
+      &t->image, &t->allocation, &t->view, &t->sampler);
+}
+
+static void texture_free(const transfer_context *tctx, const texture *t) {
+  image_free(tctx, t->image, t->allocation, t->view, t->sampler);
+}
+
+// the set must not be in use by a pending frame
+static void write_texture_descriptor(app *a, u32 frame_index) {
+  a->descriptor_texture_generation[frame_index] = a->texture_generation;
+  if (a->texture_binding == -1) {
+    return;
+  }
+
+  vkUpdateDescriptorSets(
+      a->device, 1,
+      &(VkWriteDescriptorSet){
+          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+          .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          .descriptorCount = 1,
+          .dstSet = a->descriptor_sets[frame_index],
+          .dstBinding = a->texture_binding,
+          .pImageInfo =
+              &(VkDescriptorImageInfo){
+                  .sampler = a->texture.sampler,
+                  .imageView = a->texture.view,
+                  .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+              },
+      },
+      0, NULL);
+}
+
+static void asset_reload_job(void *user_data) {
+  app *a = user_data;
+  pthread_mutex_lock(&a->asset_mutex);
+  u32 assets = a->asset_requested;
+  a->asset_requested = 0;
+  pthread_mutex_unlock(&a->asset_mutex);
+
+  u64 start_ns = timer_now_ns();
+  mesh model;
+  bool model_loaded =
+      (assets & asset_model) &&
+      mesh_load_from_file(&a->asset_transfer, MODEL_PATH, &model);
+  if ((assets & asset_model) && !model_loaded) {
+    LOG_WARN("unable to reload '%s', keeping the current mesh", MODEL_PATH);
+  }
+  texture tex;
+  bool texture_loaded =
+      (assets & asset_texture) &&
+      texture_load(a, &a->asset_transfer, a->asset_command_pool,
+                   a->asset_command_buffer, &tex);
+  if ((assets & asset_texture) && !texture_loaded) {
+    LOG_WARN("unable to reload '%s', keeping the current texture",
+             TEXTURE_PATH);
+  }
+  if (model_loaded || texture_loaded) {
+    LOG_INFO("reloaded assets in %.3f ms",
+             timer_ns_to_ms(timer_now_ns() - start_ns));
+  }
+
+  // results which have not been swapped in yet were never bound
+  pthread_mutex_lock(&a->asset_mutex);
+  if (model_loaded) {
+    if (a->reloaded_model_ready) {
+      mesh_free(a->vk_allocator, &a->reloaded_model);
+    }
+    a->reloaded_model = model;
+    a->reloaded_model_ready = true;
+  }
+  if (texture_loaded) {
+    if (a->reloaded_texture_ready) {
+      texture_free(&a->asset_transfer, &a->reloaded_texture);
+    }
+    a->reloaded_texture = tex;
+    a->reloaded_texture_ready = true;
+  }
+  a->asset_building = false;
+  pthread_cond_broadcast(&a->asset_done);
+  pthread_mutex_unlock(&a->asset_mutex);
+}
+
+// assets changing while a reload runs are picked up by the next one
+static void request_asset_reload(app *a, u32 assets) {
+  pthread_mutex_lock(&a->asset_mutex);
+  a->asset_requested |= assets;
+  bool start = !a->asset_building && a->asset_requested != 0;
+  a->asset_building = a->asset_building || start;
+  pthread_mutex_unlock(&a->asset_mutex);
+  if (start && !thread_pool_submit(&a->workers, asset_reload_job, a)) {
+    LOG_WARN("worker queue full, deferring asset reload");
+    pthread_mutex_lock(&a->asset_mutex);
+    a->asset_building = false;
+    pthread_mutex_unlock(&a->asset_mutex);
+  }
+}
+
+// called at a frame boundary, the replaced buffers and image are destroyed
+// once the frames still in flight have completed; by then every frame slot
+// has rewritten its descriptor set
+static void swap_reloaded_assets(app *a) {
+  pthread_mutex_lock(&a->asset_mutex);
+  if (a->reloaded_model_ready) {
+    deletion_queue_push_buffer(&a->deletion_queue, a->frame_count,
+                               a->vk_allocator, a->model.vertex_buffer,
+                               a->model.vertex_buffer_allocation);
+    deletion_queue_push_buffer(&a->deletion_queue, a->frame_count,
+                               a->vk_allocator, a->model.index_buffer,
+                               a->model.index_buffer_allocation);
+    a->model = a->reloaded_model;
+    a->reloaded_model_ready = false;
+  }
+  if (a->reloaded_texture_ready) {
+    deletion_queue_push_image(&a->deletion_queue, a->frame_count,
+                              a->vk_allocator, a->texture.image,
+                              a->texture.allocation, a->texture.view,
+                              a->texture.sampler);
+    a->texture = a->reloaded_texture;
+    a->reloaded_texture_ready = false;
+    ++a->texture_generation;
   }
+  bool again = a->asset_requested != 0 && !a->asset_building;
+  pthread_mutex_unlock(&a->asset_mutex);
 
-  glfwSetWindowUserPointer(a->w.window, a);
+  if (again) {
+    request_asset_reload(a, 0);
+  }
+}
+
+static void wait_asset_reload(app *a) {
+  pthread_mutex_lock(&a->asset_mutex);
+  while (a->asset_building) {
+    pthread_cond_wait(&a->asset_done, &a->asset_mutex);
+  }
+  if (a->reloaded_model_ready) {
+    mesh_free(a->vk_allocator, &a->reloaded_model);
+    a->reloaded_model_ready = false;
+  }
+  if (a->reloaded_texture_ready) {
+    texture_free(&a->asset_transfer, &a->reloaded_texture);
+    a->reloaded_texture_ready = false;
+  }
+  a->asset_requested = 0;
+  pthread_mutex_unlock(&a->asset_mutex);
+}
+
+static bool app_init(app *a) {
+  a->start_ns = timer_now_ns();
+  init_fragment_variant(a);
+  bool headless = a->options.headless;
+  if (!headless) {
+    if (!window_init(&a->w, 1280, 720, "vulkan")) {
+      LOG_ERROR("error: unable to open window");
+      return false;
+    }
+
+    glfwSetWindowUserPointer(a->w.window, a);
+    glfwSetKeyCallback(a->w.window, key_callback);
+    glfwSetFramebufferSizeCallback(a->w.window, framebuffer_resize_callback);
+  }
   a->recreate_swapchain = false;
 
-  glfwSetKeyCallback(a->w.window, key_callback);
-  glfwSetFramebufferSizeCallback(a->w.window, framebuffer_resize_callback);
+  if (!arena_init(&a->swapchain_arena, SWAPCHAIN_ARENA_CAPACITY)) {
+    LOG_ERROR("unable to initialize swapchain arena");
+    goto fail_swapchain_arena;
+  }
 
-  if (!vk_instance_init(&a->instance)) {
+  if (!vk_instance_init(headless, a->options.best_practices,
+                        &a->instance)) {
     LOG_ERROR("unable to initialize vulkan instance");
     goto fail_vk_instance;
   }
@@ -580,8 +1174,10 @@ static bool app_init(app *a) {
   if (!debug_msg_init(a->instance, &a->debug_msg)) {
     LOG_WARN("unable to initialize debug messenger");
   }
+  debug_utils_init(a->instance);
 
-  if (!surface_init(&a->w, a->instance, &a->surface)) {
+  a->surface = VK_NULL_HANDLE;
+  if (!headless && !surface_init(&a->w, a->instance, &a->surface)) {
     LOG_ERROR("unable to initialize window surface");
     goto fail_vk_surface;
   }
@@ -597,11 +1193,23 @@ static bool app_init(app *a) {
     a->msaa_samples = VK_SAMPLE_COUNT_16_BIT;
   }
 
-  if (!device_init(a->physical_device, a->surface, &a->device)) {
+  if (!device_init(a->physical_device, a->surface, &a->features,
+                   &a->device)) {
     LOG_ERROR("unable to create vulkan device");
     goto fail_vk_device;
   }
 
+  if (a->features.extended_dynamic_state &&
+      !a->features.graphics_pipeline_library &&
+      !graphics_pipeline_dynamic_state_load(a->device, &a->dynamic_state)) {
+    a->features.extended_dynamic_state = false;
+  }
+
+  if (a->features.dynamic_rendering &&
+      !dynamic_rendering_load(a->device, &a->rendering)) {
+    a->features.dynamic_rendering = false;
+  }
+
   queue_family_indices indices;
   if (!find_queue_families(a->physical_device, a->surface, &indices)) {
     LOG_ERROR("unable to find queue family indices");
@@ -611,11 +1219,25 @@ static bool app_init(app *a) {
   vkGetDeviceQueue(a->device, indices.graphics, 0, &a->graphics_queue);
   vkGetDeviceQueue(a->device, indices.present, 0, &a->present_queue);
 
-  if (!shader_compiler_init(&a->shaderc)) {
+  if (!shader_compiler_init(&a->shaderc, SHADER_STORE)) {
     LOG_ERROR("unable to initialize shader compiler");
     goto fail_shaderc;
   }
 
+  if (!pipeline_cache_init(a->physical_device, a->device, ".pipeline_cache",
+                           &a->pipeline_cache)) {
+    LOG_ERROR("unable to initialize pipeline cache");
+    goto fail_pipeline_cache;
+  }
+
+  if (!thread_pool_init(&a->workers, 0)) {
+    LOG_ERROR("unable to initialize worker thread pool");
+    goto fail_workers;
+  }
+  flight_recorder_init(&a->workers, a->options.spike_dir, a->options.spike_ms,
+                       a->options.spike_factor, &a->flight_recorder);
+  churn_init(a->options.churn, &a->churn);
+
   VkResult result;
   if (!vma_create(a->instance, a->physical_device, a->device,
                   &a->vk_allocator)) {
@@ -623,12 +1245,19 @@ static bool app_init(app *a) {
     goto fail_vma;
   }
 
+  pthread_mutex_init(&a->queue_mutex, NULL);
   if (!transfer_context_init(a->device, a->vk_allocator, &indices,
-                             &a->transfer)) {
+                             &a->queue_mutex, &a->transfer)) {
     LOG_ERROR("unable to create vulkan memory transfer context");
     goto fail_transfer;
   }
 
+  if (!transfer_context_init(a->device, a->vk_allocator, &indices,
+                             &a->queue_mutex, &a->asset_transfer)) {
+    LOG_ERROR("unable to create asset transfer context");
+    goto fail_asset_transfer;
+  }
+
   i32 num_unique_indices;
   VkSharingMode sharing_mode;
   u32 *unique_queue_indices = remove_duplicate_and_invalid_indices(
@@ -636,98 +1265,11 @@ static bool app_init(app *a) {
       &sharing_mode);
   assert(num_unique_indices > 0);
 
-  const struct aiScene *scene =
-      aiImportFile("resources/viking_room.obj",
-                   aiProcess_Triangulate | aiProcess_JoinIdenticalVertices |
-                       aiProcess_ImproveCacheLocality | aiProcess_GenUVCoords |
-                       aiProcess_OptimizeMeshes | aiProcess_OptimizeGraph |
-                       aiProcess_FlipUVs);
-  if (scene == NULL) {
-    LOG_ERROR("unable to import scene from file: %s", aiGetErrorString());
+  if (!mesh_load_from_file(&a->transfer, MODEL_PATH, &a->model)) {
+    LOG_ERROR("unable to load model");
     goto fail_model;
   }
 
-  assert(scene->mNumMeshes == 1);
-  const struct aiMesh *mesh = scene->mMeshes[0];
-  a->ml = mesh_layout(mesh);
-
-  float *texcoords = texcoords_buffer(mesh);
-  u32 *model_indices = indices_buffer(mesh);
-  if (!texcoords || !model_indices) {
-    LOG_ERROR("unable to extract texcoords and indices data from model");
-    goto fail_model_buffers;
-  }
-
-  if ((result =
-           vmaCreateBuffer(a->vk_allocator,
-                           &(VkBufferCreateInfo){
-                               .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-                               .size = a->ml.vertex_buffer_size,
-                               .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-                                        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                               .pQueueFamilyIndices = unique_queue_indices,
-                               .queueFamilyIndexCount = num_unique_indices,
-                               .sharingMode = sharing_mode,
-                           },
-                           &(VmaAllocationCreateInfo){
-                               .usage = VMA_MEMORY_USAGE_AUTO,
-                           },
-                           &a->vertex_buffer, &a->vertex_buffer_allocation,
-                           NULL)) != VK_SUCCESS) {
-    LOG_ERROR("unable to allocate vertex buffer: %s",
-              vk_error_to_string(result));
-    goto fail_vertex_buffer;
-  }
-
-  if (!transfer_context_stage_to_buffer(
-          &a->transfer, a->vertex_buffer, a->ml.size_positions,
-          a->ml.offset_positions, mesh->mVertices)) {
-    LOG_ERROR("unable to stage vertex data to vertex buffer");
-    goto fail_stage_vertex_buffer;
-  }
-
-  if (!transfer_context_stage_to_buffer(&a->transfer, a->vertex_buffer,
-                                        a->ml.size_texcoords,
-                                        a->ml.offset_texcoords, texcoords)) {
-    LOG_ERROR("unable to stage vertex data to vertex buffer");
-    goto fail_stage_vertex_buffer;
-  }
-
-  if ((result =
-           vmaCreateBuffer(a->vk_allocator,
-                           &(VkBufferCreateInfo){
-                               .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-                               .size = a->ml.index_buffer_size,
-                               .usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
-                                        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                               .sharingMode = sharing_mode,
-                               .queueFamilyIndexCount = num_unique_indices,
-                               .pQueueFamilyIndices = unique_queue_indices,
-                           },
-                           &(VmaAllocationCreateInfo){
-                               .usage = VMA_MEMORY_USAGE_AUTO,
-                           },
-                           &a->index_buffer, &a->index_buffer_allocation,
-                           NULL)) != VK_SUCCESS) {
-    LOG_ERROR("unable to allocate index buffer: %s",
-              vk_error_to_string(result));
-    goto fail_index_buffer;
-  }
-
-  if (!transfer_context_stage_to_buffer(&a->transfer, a->index_buffer,
-                                        a->ml.index_buffer_size, 0,
-                                        model_indices)) {
-    LOG_ERROR("unable to stage index data to index buffer");
-    goto fail_stage_index_buffer;
-  }
-
-  free(texcoords);
-  texcoords = NULL;
-  free(model_indices);
-  model_indices = NULL;
-  aiReleaseImport(scene);
-  scene = NULL;
-
   i32 num_uniform_buffers = 0;
   while (num_uniform_buffers < MAX_FRAMES_IN_FLIGHT) {
     if ((result = vmaCreateBuffer(
@@ -755,25 +1297,61 @@ static bool app_init(app *a) {
                 num_uniform_buffers + 1, vk_error_to_string(result));
       goto fail_uniform_buffers;
     }
+    DEBUG_NAME(a->device, VK_OBJECT_TYPE_BUFFER,
+               a->uniform_buffers[num_uniform_buffers],
+               "uniform buffer %" PRIi32, num_uniform_buffers);
 
     ++num_uniform_buffers;
   }
 
-  if ((result = vkCreateDescriptorPool(
+  layout_cache_init(a->device, &a->layouts);
+  shader_reflection interface;
+  if (!reflect_graphics_shaders(a, &interface)) {
+    LOG_ERROR("unable to reflect graphics shaders");
+    goto fail_layouts;
+  }
+
+  VkDescriptorSetLayout set_layouts[REFLECT_MAX_SETS];
+  u32 num_sets;
+  if (!(a->graphics_pipeline_layout = layout_cache_pipeline_layout_get(
+            &a->layouts, &interface, set_layouts, &num_sets))) {
+    LOG_ERROR("unable to create graphics pipeline layout");
+    goto fail_layouts;
+  }
+  if (num_sets > 1) {
+    LOG_ERROR("graphics shaders use %" PRIu32 " descriptor sets, expected at "
+              "most 1",
+              num_sets);
+    goto fail_layouts;
+  }
+  a->descriptor_set_layout = num_sets > 0 ? set_layouts[0] : VK_NULL_HANDLE;
+  a->uniform_binding = reflect_find_binding(&interface, 0,
+                                            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+  a->texture_binding = reflect_find_binding(
+      &interface, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+  DEBUG_NAME(a->device, VK_OBJECT_TYPE_PIPELINE_LAYOUT,
+             a->graphics_pipeline_layout, "graphics pipeline layout");
+  DEBUG_NAME(a->device, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+             a->descriptor_set_layout, "graphics descriptor set layout");
+
+  // a pool without any sizes is invalid, so shaders without resources get
+  // neither a pool nor descriptor sets
+  a->descriptor_pool = VK_NULL_HANDLE;
+  VkDescriptorPoolSize pool_sizes[REFLECT_MAX_BINDINGS];
+  for (i32 i = 0; i < interface.num_bindings; ++i) {
+    pool_sizes[i] = (VkDescriptorPoolSize){
+        .type = interface.bindings[i].binding.descriptorType,
+        .descriptorCount = interface.bindings[i].binding.descriptorCount *
+                           MAX_FRAMES_IN_FLIGHT,
+    };
+  }
+  if (interface.num_bindings > 0 &&
+      (result = vkCreateDescriptorPool(
            a->device,
            &(VkDescriptorPoolCreateInfo){
                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-               .poolSizeCount = 2,
-               .pPoolSizes =
-                   (VkDescriptorPoolSize[]){
-                       (VkDescriptorPoolSize){
-                           .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                           .descriptorCount = MAX_FRAMES_IN_FLIGHT,
-                       },
-                       (VkDescriptorPoolSize){
-                           .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                           .descriptorCount = MAX_FRAMES_IN_FLIGHT,
-                       }},
+               .poolSizeCount = interface.num_bindings,
+               .pPoolSizes = pool_sizes,
                .maxSets = MAX_FRAMES_IN_FLIGHT,
            },
            NULL, &a->descriptor_pool)) != VK_SUCCESS) {
@@ -781,40 +1359,15 @@ static bool app_init(app *a) {
               vk_error_to_string(result));
     goto fail_descriptor_pool;
   }
-
-  if ((result = vkCreateDescriptorSetLayout(
-           a->device,
-           &(VkDescriptorSetLayoutCreateInfo){
-               .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-               .bindingCount = 2,
-               .pBindings =
-                   (VkDescriptorSetLayoutBinding[]){
-                       {
-                           .binding = 0,
-                           .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                           .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-                           .descriptorCount = 1,
-                           .pImmutableSamplers = NULL,
-                       },
-                       (VkDescriptorSetLayoutBinding){
-                           .binding = 1,
-                           .descriptorType =
-                               VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                           .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-                           .descriptorCount = 1,
-                           .pImmutableSamplers = NULL,
-                       }}},
-           NULL, &a->descriptor_set_layout)) != VK_SUCCESS) {
-    LOG_ERROR("unable to create descriptor set layout: %s",
-              vk_error_to_string(result));
-    goto fail_descriptor_layout;
-  }
+  DEBUG_NAME(a->device, VK_OBJECT_TYPE_DESCRIPTOR_POOL, a->descriptor_pool,
+             "descriptor pool");
 
   VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
   for (i32 i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
     layouts[i] = a->descriptor_set_layout;
   }
-  if ((result = vkAllocateDescriptorSets(
+  if (a->descriptor_pool &&
+      (result = vkAllocateDescriptorSets(
            a->device,
            &(VkDescriptorSetAllocateInfo){
                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
@@ -826,6 +1379,10 @@ static bool app_init(app *a) {
     LOG_ERROR("unable to allocate descriptor sets from descriptor pool");
     goto fail_descriptor_sets;
   }
+  for (i32 i = 0; a->descriptor_pool && i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    DEBUG_NAME(a->device, VK_OBJECT_TYPE_DESCRIPTOR_SET, a->descriptor_sets[i],
+               "descriptor set %" PRIi32, i);
+  }
 
   i32 num_command_pools = 0;
   while (num_command_pools < MAX_FRAMES_IN_FLIGHT) {
@@ -844,62 +1401,93 @@ static bool app_init(app *a) {
                 num_command_pools + 1);
       goto fail_command_pools;
     }
+    DEBUG_NAME(a->device, VK_OBJECT_TYPE_COMMAND_POOL,
+               a->command_pools[num_command_pools], "command pool %" PRIi32,
+               num_command_pools);
+    DEBUG_NAME(a->device, VK_OBJECT_TYPE_COMMAND_BUFFER,
+               a->command_buffers[num_command_pools],
+               "command buffer %" PRIi32, num_command_pools);
 
     ++num_command_pools;
   }
 
-  if (!image_load_from_file(
-          a->physical_device, &a->transfer, "resources/viking_room.png",
-          VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-          &(mipmap_context){
-              .mip_levels = INT32_MAX,
-              .blit_command_pool = a->command_pools[0],
-              .blit_command_buffer = a->command_buffers[0],
-          },
-          &a->texture, &a->texture_allocation, &a->texture_view,
-          &a->texture_sampler)) {
+  if (!command_pool_create(a->device, indices.graphics,
+                           &a->asset_command_pool)) {
+    LOG_ERROR("unable to create asset command pool");
+    goto fail_asset_command_pool;
+  }
+
+  if (!command_buffer_allocate(a->device, a->asset_command_pool,
+                               VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1,
+                               &a->asset_command_buffer)) {
+    LOG_ERROR("unable to allocate asset command buffer");
+    goto fail_asset_command_buffer;
+  }
+  DEBUG_NAME(a->device, VK_OBJECT_TYPE_COMMAND_POOL, a->asset_command_pool,
+             "asset command pool");
+  DEBUG_NAME(a->device, VK_OBJECT_TYPE_COMMAND_BUFFER, a->asset_command_buffer,
+             "asset command buffer");
+
+  if (!texture_load(a, &a->transfer, a->command_pools[0],
+                    a->command_buffers[0], &a->texture)) {
     LOG_ERROR("unable to load texture");
     goto fail_image_load;
   }
 
-  for (i32 i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-    vkUpdateDescriptorSets(
-        a->device, 2,
-        (VkWriteDescriptorSet[]){
-            (VkWriteDescriptorSet){
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                .descriptorCount = 1,
-                .dstSet = a->descriptor_sets[i],
-                .dstBinding = 0,
-                .pImageInfo = NULL,
-                .pBufferInfo =
-                    &(VkDescriptorBufferInfo){
-                        .offset = 0,
-                        .range = sizeof(uniform_matrices),
-                        .buffer = a->uniform_buffers[i],
-                    },
-                .dstArrayElement = 0,
-                .pTexelBufferView = NULL,
-            },
-            (VkWriteDescriptorSet){
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                .descriptorCount = 1,
-                .dstSet = a->descriptor_sets[i],
-                .dstBinding = 1,
-                .pImageInfo =
-                    &(VkDescriptorImageInfo){
-                        .sampler = a->texture_sampler,
-                        .imageView = a->texture_view,
-                        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                    },
-            },
-        },
-        0, NULL);
+  a->texture_generation = 0;
+  for (i32 i = 0; a->descriptor_pool && i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    if (a->uniform_binding != -1) {
+      vkUpdateDescriptorSets(
+          a->device, 1,
+          &(VkWriteDescriptorSet){
+              .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+              .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+              .descriptorCount = 1,
+              .dstSet = a->descriptor_sets[i],
+              .dstBinding = a->uniform_binding,
+              .pBufferInfo =
+                  &(VkDescriptorBufferInfo){
+                      .offset = 0,
+                      .range = sizeof(uniform_matrices),
+                      .buffer = a->uniform_buffers[i],
+                  },
+          },
+          0, NULL);
+    }
+    write_texture_descriptor(a, i);
   }
 
+  deletion_queue_init(a->device, &a->queue_mutex, MAX_FRAMES_IN_FLIGHT,
+                      &a->deletion_queue);
+  pipeline_library_init(a->device, a->pipeline_cache.cache, &a->library);
+  a->frame_count = 0;
+  pthread_mutex_init(&a->reload_mutex, NULL);
+  pthread_cond_init(&a->reload_done, NULL);
+  a->reload_state = pipeline_reload_idle;
+  a->reload_pipeline = VK_NULL_HANDLE;
+  a->reload_requested = false;
+  a->reload_cancel = false;
+  pthread_mutex_init(&a->asset_mutex, NULL);
+  pthread_cond_init(&a->asset_done, NULL);
+  a->asset_building = false;
+  a->asset_requested = 0;
+  a->reloaded_model_ready = false;
+  a->reloaded_texture_ready = false;
+
   a->swapchain = VK_NULL_HANDLE;
+  a->render_pass = VK_NULL_HANDLE;
+  a->graphics_pipeline = VK_NULL_HANDLE;
+  a->num_recreations = 0;
+  a->recreate_total_ns = 0;
+  a->recreate_max_ns = 0;
+  a->storm_frame_total_ns = 0;
+  a->storm_frame_max_ns = 0;
+  for (i32 i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    a->readback_frame[i] = -1;
+  }
+  // resizing needs a window
+  const char *resize_storm = getenv("RESIZE_STORM");
+  a->resize_storm_frames = resize_storm && !headless ? atoi(resize_storm) : 0;
   if (!init_swapchain_related(a)) {
     LOG_ERROR("unable to initialize swapchain-dependent vulkan objects");
     goto fail_vk_swapchain;
@@ -913,78 +1501,143 @@ static bool app_init(app *a) {
                 num_sync_objects);
       goto fail_present_sync_objects;
     }
+    const present_sync_objects *o = &a->sync_objects[num_sync_objects - 1];
+    DEBUG_NAME(a->device, VK_OBJECT_TYPE_SEMAPHORE, o->image_available,
+               "image available %" PRIu32, num_sync_objects - 1);
+    DEBUG_NAME(a->device, VK_OBJECT_TYPE_SEMAPHORE, o->render_finished,
+               "render finished %" PRIu32, num_sync_objects - 1);
+    DEBUG_NAME(a->device, VK_OBJECT_TYPE_FENCE, o->in_flight,
+               "in flight %" PRIu32, num_sync_objects - 1);
+  }
+
+  if (!gpu_profiler_init(a->physical_device, a->device, indices.graphics,
+                         MAX_FRAMES_IN_FLIGHT, gpu_scope_names,
+                         gpu_scope_count,
+                         a->features.pipeline_statistics_query,
+                         &a->gpu_profiler)) {
+    LOG_ERROR("unable to initialize gpu profiler");
+    goto fail_gpu_profiler;
   }
 
   a->current_frame = 0;
 
   if (!watch_init(&a->file_watch)) {
-    LOG_WARN("unable to initialize shader file watch");
+    LOG_WARN("unable to initialize file watch");
     goto fail_file_watch;
   }
 
-  watch_add(&a->file_watch, "shaders/");
+  a->watched_shader_files = 0;
+  if (!watch_add_recursive(&a->file_watch, SHADER_DIR)) {
+    LOG_WARN("unable to watch all of " SHADER_DIR ", some shaders will not "
+             "be hot reloaded");
+  }
+  if (!watch_add_recursive(&a->file_watch, RESOURCE_DIR)) {
+    LOG_WARN("unable to watch all of " RESOURCE_DIR ", some assets will not "
+             "be hot reloaded");
+  }
 
   return true;
 
-  watch_free(&a->file_watch);
 fail_file_watch:
+  gpu_profiler_free(&a->gpu_profiler);
+fail_gpu_profiler:
 fail_present_sync_objects:
   for (u32 i = 0; i < num_sync_objects; ++i) {
     present_sync_objects_free(a->device, &a->sync_objects[i]);
   }
   free_swapchain_related(a);
 fail_vk_swapchain:
-  image_free(&a->transfer, a->texture, a->texture_allocation, a->texture_view,
-             a->texture_sampler);
+  if (a->graphics_pipeline != VK_NULL_HANDLE) {
+    free_graphics_pipeline(a);
+  }
+  pipeline_library_free(&a->library);
+  pthread_cond_destroy(&a->asset_done);
+  pthread_mutex_destroy(&a->asset_mutex);
+  pthread_cond_destroy(&a->reload_done);
+  pthread_mutex_destroy(&a->reload_mutex);
+  deletion_queue_free(&a->deletion_queue);
+  texture_free(&a->transfer, &a->texture);
 fail_image_load:
+fail_asset_command_buffer:
+  command_pool_free(a->device, a->asset_command_pool);
+fail_asset_command_pool:
   for (i32 i = 0; i < num_command_pools; ++i) {
     command_pool_free(a->device, a->command_pools[i]);
   }
 fail_command_pools:
 fail_descriptor_sets:
-  vkDestroyDescriptorSetLayout(a->device, a->descriptor_set_layout, NULL);
-fail_descriptor_layout:
   vkDestroyDescriptorPool(a->device, a->descriptor_pool, NULL);
 fail_descriptor_pool:
+fail_layouts:
+  layout_cache_free(&a->layouts);
 fail_uniform_buffers:
   for (i32 i = 0; i < num_uniform_buffers; ++i) {
     vmaDestroyBuffer(a->vk_allocator, a->uniform_buffers[i],
                      a->uniform_buffer_allocation[i]);
   }
-fail_stage_index_buffer:
-  vmaDestroyBuffer(a->vk_allocator, a->index_buffer,
-                   a->index_buffer_allocation);
-fail_index_buffer:
-fail_stage_vertex_buffer:
-  vmaDestroyBuffer(a->vk_allocator, a->vertex_buffer,
-                   a->vertex_buffer_allocation);
-fail_vertex_buffer:
-fail_model_buffers:
-  free(texcoords);
-  free(model_indices);
-  aiReleaseImport(scene);
+  mesh_free(a->vk_allocator, &a->model);
 fail_model:
+  transfer_context_free(&a->asset_transfer);
+fail_asset_transfer:
   transfer_context_free(&a->transfer);
 fail_transfer:
+  pthread_mutex_destroy(&a->queue_mutex);
   vma_destroy(a->vk_allocator);
 fail_vma:
+  thread_pool_free(&a->workers);
+fail_workers:
+  pipeline_cache_free(&a->pipeline_cache);
+fail_pipeline_cache:
   shader_compiler_free(&a->shaderc);
 fail_shaderc:
   device_free(a->device);
 fail_queue_indices:
 fail_vk_device:
 fail_vk_physical_device:
-  surface_free(a->instance, a->surface);
+  if (!headless) {
+    surface_free(a->instance, a->surface);
+  }
 fail_vk_surface:
   debug_msg_free(a->instance, a->debug_msg);
 fail_vk_instance:
-  window_free(&a->w);
+  arena_free(&a->swapchain_arena);
+fail_swapchain_arena:
+  if (!headless) {
+    window_free(&a->w);
+  }
   return false;
 }
 
+// writes the image read back by the frame that last used the frame slot, whose
+// fence must have signaled
+static void write_readback(app *a, u32 frame_index) {
+  if (a->readback_frame[frame_index] < 0) {
+    return;
+  }
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/frame_%05" PRIi64 ".ppm",
+           a->options.output_dir, a->readback_frame[frame_index]);
+  if (!offscreen_target_write_ppm(&a->offscreen, frame_index, path)) {
+    LOG_WARN("unable to write frame to '%s'", path);
+  }
+  a->readback_frame[frame_index] = -1;
+}
+
 static void app_free(app *a) {
+  wait_pipeline_reload(a);
+  wait_asset_reload(a);
   vkDeviceWaitIdle(a->device);
+  for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    write_readback(a, i);
+  }
+  for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    gpu_profiler_collect(&a->gpu_profiler, i);
+  }
+  gpu_profiler_log(&a->gpu_profiler);
+  gpu_profiler_free(&a->gpu_profiler);
   watch_free(&a->file_watch);
+  deletion_queue_free(&a->deletion_queue);
 
   for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
     present_sync_objects_free(a->device, &a->sync_objects[i]);
@@ -992,91 +1645,337 @@ static void app_free(app *a) {
   for (i32 i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
     command_pool_free(a->device, a->command_pools[i]);
   }
+  command_pool_free(a->device, a->asset_command_pool);
   free_swapchain_related(a);
-  image_free(&a->transfer, a->texture, a->texture_allocation, a->texture_view,
-             a->texture_sampler);
-  vkDestroyDescriptorSetLayout(a->device, a->descriptor_set_layout, NULL);
+  if (a->graphics_pipeline != VK_NULL_HANDLE) {
+    free_graphics_pipeline(a);
+  }
+  pipeline_library_free(&a->library);
+  pthread_cond_destroy(&a->asset_done);
+  pthread_mutex_destroy(&a->asset_mutex);
+  // only now, free_graphics_pipeline waits for a running reload
+  pthread_cond_destroy(&a->reload_done);
+  pthread_mutex_destroy(&a->reload_mutex);
+  texture_free(&a->transfer, &a->texture);
   vkDestroyDescriptorPool(a->device, a->descriptor_pool, NULL);
+  layout_cache_free(&a->layouts);
   for (i32 i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
     vmaDestroyBuffer(a->vk_allocator, a->uniform_buffers[i],
                      a->uniform_buffer_allocation[i]);
   }
-  vmaDestroyBuffer(a->vk_allocator, a->index_buffer,
-                   a->index_buffer_allocation);
-  vmaDestroyBuffer(a->vk_allocator, a->vertex_buffer,
-                   a->vertex_buffer_allocation);
+  mesh_free(a->vk_allocator, &a->model);
+  transfer_context_free(&a->asset_transfer);
   transfer_context_free(&a->transfer);
+  pthread_mutex_destroy(&a->queue_mutex);
   vmaDestroyAllocator(a->vk_allocator);
+  // drains a pending periodic save before the cache is written and destroyed
+  thread_pool_free(&a->workers);
+  flight_recorder_free(&a->flight_recorder);
+  churn_log(&a->churn);
+  pipeline_cache_free(&a->pipeline_cache);
   shader_compiler_free(&a->shaderc);
   device_free(a->device);
-  surface_free(a->instance, a->surface);
+  if (!a->options.headless) {
+    surface_free(a->instance, a->surface);
+  }
   debug_msg_free(a->instance, a->debug_msg);
   vk_instance_free(a->instance);
-  window_free(&a->w);
+  arena_free(&a->swapchain_arena);
+  if (!a->options.headless) {
+    window_free(&a->w);
+  }
+  scratch_arena_free();
 }
 
-const char *watch_shader_files[] = {"triangle.vs.glsl", "triangle.fs.glsl"};
+// compares startup cost of the runtime-compiled and bundled shader builds
+static void log_startup_stats(const app *a) {
+#ifdef SHADER_BUNDLE
+  const char *shaders = "bundled";
+#else
+  const char *shaders = "runtime compiled";
+#endif
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  LOG_INFO("startup: %.3fms to first frame, peak rss %ld KiB (%s shaders)",
+           timer_ns_to_ms(timer_now_ns() - a->start_ns), usage.ru_maxrss,
+           shaders);
+}
 
-static void app_loop(app *a) {
-  while (!window_should_close(&a->w)) {
-    window_poll_events();
-
-    watch_event e;
-    bool reload = false;
-    while (watch_poll(&a->file_watch, &e)) {
-      if (!a->recreate_swapchain) {
-        for (i32 i = 0; i < (i32)(sizeof(watch_shader_files) /
-                                  sizeof(watch_shader_files[0]));
-             ++i) {
-          if (strcmp(e.name, watch_shader_files[i]) == 0) {
-            reload = true;
-          }
-        }
+// alternates between two window sizes so that every frame recreates the
+// swapchain, then reports what the recreations cost
+static void resize_storm_step(app *a) {
+  if (a->frame_count < (u64)a->resize_storm_frames) {
+    bool small = a->frame_count % 2 == 0;
+    glfwSetWindowSize(a->w.window, small ? 960 : 1280, small ? 540 : 720);
+    return;
+  }
+
+  double mean_ms =
+      a->num_recreations > 0
+          ? timer_ns_to_ms(a->recreate_total_ns) / a->num_recreations
+          : 0.0;
+  LOG_INFO("resize storm: %" PRIu64 " swapchain recreations in %" PRIi32
+           " frames, %.3fms mean, %.3fms max",
+           a->num_recreations, a->resize_storm_frames, mean_ms,
+           timer_ns_to_ms(a->recreate_max_ns));
+  LOG_INFO("resize storm: frame time %.3fms mean, %.3fms max",
+           timer_ns_to_ms(a->storm_frame_total_ns) / a->resize_storm_frames,
+           timer_ns_to_ms(a->storm_frame_max_ns));
+  a->resize_storm_frames = 0;
+  glfwSetWindowShouldClose(a->w.window, true);
+}
+
+static dynamic_rendering_targets rendering_targets(const app *a,
+                                                   u32 image_index) {
+  return (dynamic_rendering_targets){
+      .extent = a->extent,
+      .samples = a->msaa_samples,
+      .color_image = a->color_image,
+      .color_view = a->color_image_view,
+      .depth_image = a->depth_image,
+      .depth_view = a->depth_image_view,
+      .depth_format = a->depth_format,
+      .present_image = a->images[image_index],
+      .present_view = a->image_views[image_index],
+      .present_layout = present_layout(a),
+      .clear_color = {.float32 = {0, 0, 0, 1}},
+  };
+}
+
+// begins rendering to the swapchain image with all attachments cleared
+static void cmd_begin_rendering(const app *a, VkCommandBuffer command_buffer,
+                                u32 image_index) {
+  if (a->features.dynamic_rendering) {
+    dynamic_rendering_targets targets = rendering_targets(a, image_index);
+    dynamic_rendering_cmd_begin(&a->rendering, command_buffer, &targets);
+    return;
+  }
+
+  vkCmdBeginRenderPass(
+      command_buffer,
+      &(VkRenderPassBeginInfo){
+          .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+          .renderPass = a->render_pass,
+          .renderArea =
+              {
+                  .offset = {0, 0},
+                  .extent = a->extent,
+              },
+          .framebuffer = a->framebuffers[image_index],
+          .clearValueCount = 2,
+          .pClearValues =
+              (VkClearValue[]){
+                  (VkClearValue){
+                      .color =
+                          {
+                              .float32 = {0, 0, 0, 1},
+                          },
+                  },
+                  (VkClearValue){
+                      .depthStencil =
+                          {
+                              .depth = 1.0,
+                              .stencil = 0,
+                          },
+                  },
+              },
+      },
+      VK_SUBPASS_CONTENTS_INLINE);
+}
+
+static void cmd_end_rendering(const app *a, VkCommandBuffer command_buffer,
+                              u32 image_index) {
+  if (a->features.dynamic_rendering) {
+    dynamic_rendering_targets targets = rendering_targets(a, image_index);
+    dynamic_rendering_cmd_end(&a->rendering, command_buffer, &targets);
+    return;
+  }
+
+  vkCmdEndRenderPass(command_buffer);
+}
+
+// in bench mode --frames counts the measured frames, after the warmup
+static bool app_should_close(app *a) {
+  u64 last_frame = a->options.frames;
+  if (a->options.bench) {
+    last_frame += a->options.warmup_frames;
+  }
+
+  if (a->options.headless) {
+    return a->frame_count >= last_frame;
+  }
+  return (a->options.bench && a->frame_count >= last_frame) ||
+         window_should_close(&a->w);
+}
+
+// includes may live in subdirectories or outside SHADER_DIR altogether
+static void watch_shader_file_dir(const char *path, void *user_data) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", path);
+  if (!watch_add_recursive(user_data, dirname(dir))) {
+    LOG_WARN("unable to watch the directory of '%s', changes to it will not "
+             "trigger rebuilds",
+             path);
+  }
+}
+
+// hot reload is off in bench mode, a rebuild would show up in the timings
+static void poll_file_watch(app *a) {
+  shader_compiler_new_files(&a->shaderc, &a->watched_shader_files,
+                            watch_shader_file_dir, &a->file_watch);
+
+  watch_event e;
+  bool reload = false;
+  u32 assets = 0;
+  while (watch_poll(&a->file_watch, &e)) {
+    const char *path = e.path;
+    // assets are only read once fully written, a half-written file would
+    // fail to import
+    if (e.event_type & (watch_event_written | watch_event_moved_to)) {
+      if (strcmp(path, MODEL_PATH) == 0) {
+        assets |= asset_model;
+      } else if (strcmp(path, TEXTURE_PATH) == 0) {
+        assets |= asset_texture;
       }
+    }
 
-      watch_event_free(&a->file_watch, &e);
+    // only shaders including the changed file, possibly indirectly, are
+    // recompiled, the others come out of the spirv cache
+    const char *roots[MAX_CHANGED_SHADERS];
+    i32 num_roots = shader_compiler_invalidate(&a->shaderc, path, roots,
+                                               MAX_CHANGED_SHADERS);
+    for (i32 i = 0; i < num_roots && i < MAX_CHANGED_SHADERS; ++i) {
+      LOG_DEBUG("'%s' changed, rebuilding '%s'", path, roots[i]);
     }
+    reload = reload || num_roots > 0;
+  }
+
+  if (reload) {
+    LOG_INFO("reloading shaders");
+    request_pipeline_reload(a, false);
+  }
+  if (assets) {
+    LOG_INFO("reloading assets");
+    request_asset_reload(a, assets);
+  }
+}
 
-    if (reload) {
-      LOG_INFO("reloading shaders");
-      a->recreate_swapchain = reload;
+// estimated from the heap sizes when VK_EXT_memory_budget is not enabled
+static void update_memory_metrics(const app *a) {
+  const VkPhysicalDeviceMemoryProperties *properties;
+  vmaGetMemoryProperties(a->vk_allocator, &properties);
+  VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+  vmaGetHeapBudgets(a->vk_allocator, budgets);
+  for (u32 i = 0; i < properties->memoryHeapCount; ++i) {
+    metrics_set_gpu_memory(i, budgets[i].budget, budgets[i].usage);
+  }
+}
+
+static void app_loop(app *a) {
+  while (!app_should_close(a)) {
+    TRACE_BEGIN("frame");
+    u64 frame_start_ns = timer_now_ns();
+    if (a->resize_storm_frames > 0) {
+      resize_storm_step(a);
+    }
+    if (!a->options.headless) {
+      window_poll_events();
+    }
+    churn_frame_begin(&a->churn);
+    // objects retired by a reload or swapchain recreation are destroyed
+    // frames later, steady frames have none of either
+    bool steady = a->frame_count >= a->options.warmup_frames &&
+                  a->deletion_queue.num_entries == 0 &&
+                  !(a->options.headless && a->options.output_dir);
+    frame_timings timings = {0};
+    u64 stage_start_ns = timer_now_ns();
+    if (!a->options.bench) {
+      TRACE_BEGIN("watch poll");
+      poll_file_watch(a);
+      TRACE_END();
     }
+    timings.ns[frame_stage_reload] = timer_now_ns() - stage_start_ns;
 
+    stage_start_ns = timer_now_ns();
     u32 frame_index = a->current_frame;
     present_sync_objects *sync_obj = &a->sync_objects[frame_index];
-    VkResult result;
-    if ((result = vkWaitForFences(a->device, 1, &sync_obj->in_flight, VK_TRUE,
-                                  UINT64_MAX)) != VK_SUCCESS) {
+    TRACE_BEGIN("fence wait");
+    VkResult result = vkWaitForFences(a->device, 1, &sync_obj->in_flight,
+                                      VK_TRUE, UINT64_MAX);
+    TRACE_END();
+    timings.ns[frame_stage_fence_wait] = timer_now_ns() - stage_start_ns;
+    if (result != VK_SUCCESS) {
       LOG_ERROR("unable to wait for and/or reset in flight fence for frame "
                 "index %" PRIu32 ": %s",
                 frame_index, vk_error_to_string(result));
       return;
     }
-    u32 image_index;
-    ;
-    if ((result = vkAcquireNextImageKHR(
-             a->device, a->swapchain, UINT64_MAX, sync_obj->image_available,
-             VK_NULL_HANDLE, &image_index)) != VK_SUCCESS) {
+    write_readback(a, frame_index);
+    gpu_profiler_collect(&a->gpu_profiler, frame_index);
+    deletion_queue_collect(&a->deletion_queue, a->frame_count);
+    stage_start_ns = timer_now_ns();
+    swap_reloaded_pipeline(a);
+    swap_reloaded_assets(a);
+    // resize events and out of date results only set the flag, so a burst of
+    // them recreates the swapchain at most once per frame
+    if (a->recreate_swapchain) {
+      a->recreate_swapchain = false;
+      TRACE_BEGIN("swapchain recreate");
+      bool recreated = recreate_swapchain_related(a);
+      TRACE_END();
+      if (!recreated) {
+        LOG_ERROR("unable to recreate swapchain");
+        return;
+      }
+    }
+    if (a->descriptor_pool &&
+        a->descriptor_texture_generation[frame_index] != a->texture_generation) {
+      write_texture_descriptor(a, frame_index);
+    }
+    timings.ns[frame_stage_reload] += timer_now_ns() - stage_start_ns;
+
+    // headless, each frame slot has an image of its own
+    u32 image_index = frame_index;
+    TRACE_BEGIN("acquire");
+    stage_start_ns = timer_now_ns();
+    if (!a->options.headless) {
+      result = vkAcquireNextImageKHR(a->device, a->swapchain, UINT64_MAX,
+                                     sync_obj->image_available, VK_NULL_HANDLE,
+                                     &image_index);
+    }
+    timings.ns[frame_stage_acquire] = timer_now_ns() - stage_start_ns;
+    TRACE_END();
+    if (result != VK_SUCCESS) {
       if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        if (!recreate_swapchain_related(a)) {
-          LOG_ERROR("unable to recreate swapchain");
-          return;
-        }
-      } else if (result != VK_SUBOPTIMAL_KHR) {
+        // nothing was acquired, start over with a new swapchain
+        a->recreate_swapchain = true;
+        metrics_add(metric_dropped_frames, 1);
+        TRACE_END();
+        continue;
+      } else if (result == VK_SUBOPTIMAL_KHR) {
+        a->recreate_swapchain = true;
+      } else {
         LOG_ERROR("unable to acquire presentation image: %s",
                   vk_error_to_string(result));
         return;
       }
     }
 
+    stage_start_ns = timer_now_ns();
     // update uniform buffers
+    TRACE_BEGIN("uniform update");
     {
       uniform_matrices mat;
       glm_mat4_identity(mat.proj);
       glm_mat4_identity(mat.view);
       glm_mat4_identity(mat.model);
 
-      double time = glfwGetTime() * 0.0001;
+      // glfw is not initialized headless, and bench runs must render the same
+      // frames every time
+      double seconds = a->options.bench
+                           ? a->frame_count * BENCH_FRAME_SECONDS
+                           : (timer_now_ns() - a->start_ns) / 1e9;
+      double time = seconds * 0.0001;
       glm_perspective(glm_rad(45.0), (float)a->extent.width / a->extent.height,
                       0.1, 10.0, mat.proj);
       mat.proj[1][1] *= -1;
@@ -1086,7 +1985,10 @@ static void app_loop(app *a) {
       memcpy(a->uniform_buffer_allocation_info[frame_index].pMappedData, &mat,
              sizeof(mat));
     }
+    TRACE_END();
+    timings.ns[frame_stage_upload] = timer_now_ns() - stage_start_ns;
 
+    stage_start_ns = timer_now_ns();
     if ((result = vkResetFences(a->device, 1,
                                 &a->sync_objects[frame_index].in_flight)) !=
         VK_SUCCESS) {
@@ -1104,6 +2006,7 @@ static void app_loop(app *a) {
     }
     VkCommandBuffer command_buffer = a->command_buffers[frame_index];
     // record command buffer
+    TRACE_BEGIN("record");
     {
       if ((result = vkBeginCommandBuffer(
                command_buffer,
@@ -1114,120 +2017,401 @@ static void app_loop(app *a) {
         return;
       }
 
-      vkCmdBeginRenderPass(
-          command_buffer,
-          &(VkRenderPassBeginInfo){
-              .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-              .renderPass = a->render_pass,
-              .renderArea =
-                  {
-                      .offset = {0, 0},
-                      .extent = a->extent,
-                  },
-              .framebuffer = a->framebuffers[image_index],
-              .clearValueCount = 2,
-              .pClearValues =
-                  (VkClearValue[]){
-                      (VkClearValue){
-                          .color =
-                              {
-                                  .float32 = {0, 0, 0, 1},
-                              },
-                      },
-                      (VkClearValue){
-                          .depthStencil =
-                              {
-                                  .depth = 1.0,
-                                  .stencil = 0,
-                              },
-                      },
-                  },
-          },
-          VK_SUBPASS_CONTENTS_INLINE);
+      gpu_profiler *profiler = &a->gpu_profiler;
+      gpu_profiler_cmd_reset(profiler, command_buffer, frame_index);
+      DEBUG_LABEL_BEGIN(command_buffer, "frame");
+      gpu_profiler_cmd_begin_scope(profiler, command_buffer, frame_index,
+                                   gpu_scope_frame);
+      DEBUG_LABEL_BEGIN(command_buffer, "main pass");
+      gpu_profiler_cmd_begin_scope(profiler, command_buffer, frame_index,
+                                   gpu_scope_main_pass);
+      cmd_begin_rendering(a, command_buffer, image_index);
       {
         vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                           a->graphics_pipeline);
-        vkCmdBindVertexBuffers(command_buffer, 0, 1, &a->vertex_buffer,
-                               (VkDeviceSize[]){a->ml.offset_positions});
-        vkCmdBindVertexBuffers(command_buffer, 1, 1, &a->vertex_buffer,
-                               (VkDeviceSize[]){a->ml.offset_texcoords});
-        vkCmdBindIndexBuffer(command_buffer, a->index_buffer, 0,
+        if (a->features.extended_dynamic_state &&
+            !a->features.graphics_pipeline_library) {
+          graphics_pipeline_cmd_set_state(&a->dynamic_state, command_buffer);
+        }
+        graphics_pipeline_cmd_set_viewport(command_buffer, a->extent);
+        vkCmdBindVertexBuffers(
+            command_buffer, 0, 1, &a->model.vertex_buffer,
+            (VkDeviceSize[]){a->model.layout.offset_positions});
+        vkCmdBindVertexBuffers(
+            command_buffer, 1, 1, &a->model.vertex_buffer,
+            (VkDeviceSize[]){a->model.layout.offset_texcoords});
+        vkCmdBindIndexBuffer(command_buffer, a->model.index_buffer, 0,
                              VK_INDEX_TYPE_UINT32);
-        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                a->graphics_pipeline_layout, 0, 1,
-                                &a->descriptor_sets[frame_index], 0, NULL);
-        vkCmdDrawIndexed(command_buffer, a->ml.num_indices, 1, 0, 0, 0);
+        if (a->descriptor_pool) {
+          vkCmdBindDescriptorSets(
+              command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+              a->graphics_pipeline_layout, 0, 1,
+              &a->descriptor_sets[frame_index], 0, NULL);
+        }
+        gpu_profiler_cmd_begin_statistics(profiler, command_buffer,
+                                          frame_index);
+        vkCmdDrawIndexed(command_buffer, a->model.layout.num_indices, 1, 0, 0,
+                         0);
+        gpu_profiler_cmd_end_statistics(profiler, command_buffer, frame_index);
       }
 
-      vkCmdEndRenderPass(command_buffer);
+      DEBUG_LABEL_BEGIN(command_buffer, "resolve");
+      gpu_profiler_cmd_begin_scope(profiler, command_buffer, frame_index,
+                                   gpu_scope_resolve);
+      cmd_end_rendering(a, command_buffer, image_index);
+      gpu_profiler_cmd_end_scope(profiler, command_buffer, frame_index,
+                                 gpu_scope_resolve);
+      DEBUG_LABEL_END(command_buffer);
+      gpu_profiler_cmd_end_scope(profiler, command_buffer, frame_index,
+                                 gpu_scope_main_pass);
+      DEBUG_LABEL_END(command_buffer);
+      if (a->options.headless && a->options.output_dir) {
+        DEBUG_LABEL_BEGIN(command_buffer, "readback");
+        gpu_profiler_cmd_begin_scope(profiler, command_buffer, frame_index,
+                                     gpu_scope_readback);
+        offscreen_target_cmd_readback(&a->offscreen, command_buffer,
+                                      image_index);
+        gpu_profiler_cmd_end_scope(profiler, command_buffer, frame_index,
+                                   gpu_scope_readback);
+        DEBUG_LABEL_END(command_buffer);
+        a->readback_frame[frame_index] = a->frame_count;
+      }
+      gpu_profiler_cmd_end_scope(profiler, command_buffer, frame_index,
+                                 gpu_scope_frame);
+      DEBUG_LABEL_END(command_buffer);
 
       vkEndCommandBuffer(command_buffer);
     }
+    TRACE_END();
+    timings.ns[frame_stage_record] = timer_now_ns() - stage_start_ns;
 
     // submit queue
     {
-      if ((vkQueueSubmit(
-              a->graphics_queue, 1,
-              &(VkSubmitInfo){
-                  .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                  .commandBufferCount = 1,
-                  .pCommandBuffers = &command_buffer,
-                  .waitSemaphoreCount = 1,
-                  .pWaitSemaphores = (VkSemaphore[]){sync_obj->image_available},
-                  .signalSemaphoreCount = 1,
-                  .pSignalSemaphores =
-                      (VkSemaphore[]){sync_obj->render_finished},
-                  .pWaitDstStageMask =
-                      (VkPipelineStageFlags[]){
-                          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT},
-              },
-              sync_obj->in_flight)) != VK_SUCCESS) {
+      // asset uploads on workers submit to the same queues; headless there
+      // is no image to wait for and nothing to present
+      u32 num_semaphores = a->options.headless ? 0 : 1;
+      TRACE_BEGIN("submit");
+      stage_start_ns = timer_now_ns();
+      pthread_mutex_lock(&a->queue_mutex);
+      if ((result = vkQueueSubmit(
+               a->graphics_queue, 1,
+               &(VkSubmitInfo){
+                   .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                   .commandBufferCount = 1,
+                   .pCommandBuffers = &command_buffer,
+                   .waitSemaphoreCount = num_semaphores,
+                   .pWaitSemaphores =
+                       (VkSemaphore[]){sync_obj->image_available},
+                   .signalSemaphoreCount = num_semaphores,
+                   .pSignalSemaphores =
+                       (VkSemaphore[]){sync_obj->render_finished},
+                   .pWaitDstStageMask =
+                       (VkPipelineStageFlags[]){
+                           VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT},
+               },
+               sync_obj->in_flight)) != VK_SUCCESS) {
+        pthread_mutex_unlock(&a->queue_mutex);
         LOG_ERROR("unable to submit draw command buffer: %s",
                   vk_error_to_string(result));
         return;
       }
-
-      if ((result = vkQueuePresentKHR(
-               a->present_queue,
-               &(VkPresentInfoKHR){
-                   .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-                   .swapchainCount = 1,
-                   .pSwapchains = &a->swapchain,
-                   .pImageIndices = &image_index,
-                   .waitSemaphoreCount = 1,
-                   .pWaitSemaphores =
-                       (VkSemaphore[]){sync_obj->render_finished},
-               })) != VK_SUCCESS ||
-          a->recreate_swapchain) {
-        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
-            a->recreate_swapchain) {
-          if (!recreate_swapchain_related(a)) {
-            LOG_ERROR("unable to recreate swapchain");
-            return;
-          }
-          a->recreate_swapchain = false;
-        } else {
-          LOG_ERROR("unable to present rendered result: %s",
-                    vk_error_to_string(result));
-          return;
-        }
+      timings.ns[frame_stage_submit] = timer_now_ns() - stage_start_ns;
+      TRACE_END();
+
+      TRACE_BEGIN("present");
+      stage_start_ns = timer_now_ns();
+      if (!a->options.headless) {
+        result = vkQueuePresentKHR(
+            a->present_queue,
+            &(VkPresentInfoKHR){
+                .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+                .swapchainCount = 1,
+                .pSwapchains = &a->swapchain,
+                .pImageIndices = &image_index,
+                .waitSemaphoreCount = 1,
+                .pWaitSemaphores = (VkSemaphore[]){sync_obj->render_finished},
+            });
+      }
+      pthread_mutex_unlock(&a->queue_mutex);
+      timings.ns[frame_stage_present] = timer_now_ns() - stage_start_ns;
+      TRACE_END();
+      if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        a->recreate_swapchain = true;
+        metrics_add(metric_dropped_frames, 1);
+      } else if (result == VK_SUBOPTIMAL_KHR) {
+        a->recreate_swapchain = true;
+      } else if (result != VK_SUCCESS) {
+        LOG_ERROR("unable to present rendered result: %s",
+                  vk_error_to_string(result));
+        return;
       }
     }
 
+    u64 frame_ns = timer_now_ns() - frame_start_ns;
+    churn_frame_end(&a->churn, a->frame_count,
+                    steady && a->deletion_queue.num_entries == 0);
+    debug_msg_frame_end(a->frame_count);
+    timings.ns[frame_stage_total] = frame_ns;
+    metrics_observe_ns(metric_frame_time, frame_ns);
+    if (a->frame_count % METRICS_MEMORY_INTERVAL == 0) {
+      update_memory_metrics(a);
+    }
+    flight_recorder_record(&a->flight_recorder, a->frame_count,
+                           frame_start_ns, &timings);
+    if (a->options.bench) {
+      bench_record(&a->bench, a->frame_count, &timings);
+    }
+    if (a->resize_storm_frames > 0) {
+      a->storm_frame_total_ns += frame_ns;
+      if (frame_ns > a->storm_frame_max_ns) {
+        a->storm_frame_max_ns = frame_ns;
+      }
+    }
+    if (a->frame_count == 0) {
+      log_startup_stats(a);
+    }
+    pipeline_cache_save_periodic(&a->pipeline_cache, &a->workers);
     a->current_frame = (frame_index + 1) % MAX_FRAMES_IN_FLIGHT;
+    ++a->frame_count;
+    TRACE_END();
+  }
+}
+
+static bool parse_churn_mode(const char *s, churn_mode *mode) {
+  if (strcmp(s, "report") == 0) {
+    *mode = churn_mode_report;
+  } else if (strcmp(s, "assert") == 0) {
+    *mode = churn_mode_assert;
+  } else if (strcmp(s, "off") == 0 || strcmp(s, "0") == 0) {
+    *mode = churn_mode_off;
+  } else {
+    LOG_ERROR("unknown churn mode '%s', expected report or assert", s);
+    return false;
+  }
+
+  return true;
+}
+
+static bool parse_options(int argc, char **argv, app_options *o) {
+  const char *headless = getenv("HEADLESS");
+  const char *frames = getenv("HEADLESS_FRAMES");
+  const char *bench = getenv("BENCH");
+  const char *warmup = getenv("BENCH_WARMUP");
+  const char *tolerance = getenv("BENCH_TOLERANCE");
+  const char *bench_output = getenv("BENCH_OUTPUT");
+  const char *spike_ms = getenv("SPIKE_MS");
+  const char *spike_factor = getenv("SPIKE_FACTOR");
+  const char *spike_dir = getenv("SPIKE_DIR");
+  const char *churn = getenv("CHURN");
+  const char *best_practices = getenv("BEST_PRACTICES");
+  const char *alpha_cutoff = getenv("ALPHA_CUTOFF");
+  *o = (app_options){
+      .headless = headless && strcmp(headless, "0") != 0,
+      // 0 until given, the default depends on the mode
+      .frames = frames ? strtoul(frames, NULL, 10) : 0,
+      .output_dir = getenv("HEADLESS_OUTPUT"),
+      .bench = bench && strcmp(bench, "0") != 0,
+      .warmup_frames =
+          warmup ? strtoul(warmup, NULL, 10) : BENCH_DEFAULT_WARMUP_FRAMES,
+      .bench_output = bench_output ? bench_output : "bench.json",
+      .baseline = getenv("BENCH_BASELINE"),
+      .tolerance =
+          tolerance ? strtod(tolerance, NULL) : BENCH_DEFAULT_TOLERANCE,
+      .trace_output = getenv("TRACE_OUTPUT"),
+      .spike_ms = spike_ms ? strtod(spike_ms, NULL) : 0.0,
+      .spike_factor =
+          spike_factor ? strtod(spike_factor, NULL) : SPIKE_DEFAULT_FACTOR,
+      .spike_dir = spike_dir ? spike_dir : ".",
+      .log_output = getenv("LOG_OUTPUT"),
+      .best_practices = best_practices && strcmp(best_practices, "0") != 0,
+      .metrics_socket = getenv("METRICS_SOCKET"),
+      .alpha_cutoff = alpha_cutoff ? strtof(alpha_cutoff, NULL) : 0.0f,
+  };
+  if (churn && !parse_churn_mode(churn, &o->churn)) {
+    return false;
+  }
+
+  for (i32 i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--headless") == 0) {
+      o->headless = true;
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      o->frames = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      o->output_dir = argv[++i];
+    } else if (strcmp(argv[i], "--bench") == 0) {
+      o->bench = true;
+    } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+      o->warmup_frames = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--bench-output") == 0 && i + 1 < argc) {
+      o->bench_output = argv[++i];
+    } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+      o->baseline = argv[++i];
+    } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      o->tolerance = strtod(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      o->trace_output = argv[++i];
+    } else if (strcmp(argv[i], "--spike-ms") == 0 && i + 1 < argc) {
+      o->spike_ms = strtod(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--spike-factor") == 0 && i + 1 < argc) {
+      o->spike_factor = strtod(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--spike-dir") == 0 && i + 1 < argc) {
+      o->spike_dir = argv[++i];
+    } else if (strcmp(argv[i], "--churn") == 0 && i + 1 < argc) {
+      if (!parse_churn_mode(argv[++i], &o->churn)) {
+        return false;
+      }
+    } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+      o->log_output = argv[++i];
+    } else if (strcmp(argv[i], "--best-practices") == 0) {
+      o->best_practices = true;
+    } else if (strcmp(argv[i], "--metrics-socket") == 0 && i + 1 < argc) {
+      o->metrics_socket = argv[++i];
+    } else if (strcmp(argv[i], "--alpha-cutoff") == 0 && i + 1 < argc) {
+      o->alpha_cutoff = strtof(argv[++i], NULL);
+    } else {
+      LOG_ERROR("unknown or incomplete option '%s'", argv[i]);
+      LOG_ERROR("usage: %s [--headless] [--frames n] [--output dir] [--bench] "
+                "[--warmup n] [--bench-output path] [--baseline path] "
+                "[--tolerance f] [--trace path] [--spike-ms ms] "
+                "[--spike-factor f] [--spike-dir dir] [--churn report|assert] "
+                "[--log path] [--best-practices] [--metrics-socket path] "
+                "[--alpha-cutoff f]",
+                argv[0]);
+      return false;
+    }
+  }
+
+  if (o->frames == 0) {
+    o->frames = o->bench ? BENCH_DEFAULT_FRAMES : HEADLESS_DEFAULT_FRAMES;
+  }
+  return true;
+}
+
+// api call counts, validation performance message counts and gpu averages;
+// the latter are weighted towards the last frames of the run, which are all
+// measured ones;
+// added before app_free destroys the profiler
+static void add_bench_metrics(app *a) {
+  char name[BENCH_METRIC_NAME_LEN];
+  for (i32 i = 0; i < churn_call_count; ++i) {
+    snprintf(name, sizeof(name), "%s per frame", churn_call_names[i]);
+    bench_set_metric(&a->bench, name, churn_calls_per_frame(&a->churn, i));
+  }
+  if (a->options.churn != churn_mode_off) {
+    bench_set_metric(&a->bench, "churn frames", a->churn.num_churn_frames);
+  }
+
+  // counted over the whole run, a message that only shows up during loading
+  // is an anti-pattern all the same
+  if (debug) {
+    debug_msg_perf_count perf[DEBUG_MSG_MAX_PERF_IDS];
+    i32 num_perf = debug_msg_perf_counts(perf, DEBUG_MSG_MAX_PERF_IDS);
+    u64 total = 0;
+    for (i32 i = 0; i < num_perf && i < DEBUG_MSG_MAX_PERF_IDS; ++i) {
+      total += perf[i].count;
+      snprintf(name, sizeof(name), "vk %.58s", perf[i].name);
+      bench_set_metric(&a->bench, name, perf[i].count);
+    }
+    bench_set_metric(&a->bench, "vk performance messages", total);
+  }
+
+  const gpu_profiler *p = &a->gpu_profiler;
+  for (u32 i = 0; i < gpu_scope_count; ++i) {
+    if (p->scope_samples[i] == 0) {
+      continue;
+    }
+    snprintf(name, sizeof(name), "gpu %s ms", gpu_scope_names[i]);
+    bench_set_metric(&a->bench, name, p->scope_ms[i]);
+  }
+  for (i32 i = 0; i < gpu_stat_count && p->stat_samples > 0; ++i) {
+    snprintf(name, sizeof(name), "gpu %s", gpu_stat_names[i]);
+    bench_set_metric(&a->bench, name, p->stats[i]);
   }
 }
 
-int main() {
+// reports the results of a bench mode run, false if it was cut short or
+// regressed against the baseline
+static bool finish_bench(const app *a) {
+  if (!bench_complete(&a->bench)) {
+    LOG_ERROR("benchmark interrupted after %" PRIu32 " of %" PRIu32
+              " measured frames",
+              a->bench.num_recorded, a->bench.measured_frames);
+    return false;
+  }
+
+  bench_log(&a->bench);
+  if (!bench_write_json(&a->bench, a->options.bench_output)) {
+    return false;
+  }
+
+  return !a->options.baseline ||
+         bench_compare(&a->bench, a->options.baseline, a->options.tolerance);
+}
+
+int main(int argc, char **argv) {
   logger_initConsoleLogger(stderr);
   logger_setLevel(LogLevel_TRACE);
 
   app a;
-  if (!app_init(&a)) {
+  if (!parse_options(argc, argv, &a.options)) {
+    return 1;
+  }
+
+  // LOG_* only queue their message from here on
+  if (!log_init(a.options.log_output)) {
+    return 1;
+  }
+
+  if (!trace_init(a.options.trace_output)) {
+    log_free();
+    return 1;
+  }
+  TRACE_THREAD_NAME("render");
+
+  if (!metrics_init(a.options.metrics_socket)) {
+    trace_free();
+    log_free();
+    return 1;
+  }
+
+  if (a.options.bench &&
+      !bench_init(a.options.warmup_frames, a.options.frames, &a.bench)) {
+    metrics_free();
+    trace_free();
+    log_free();
+    return 1;
+  }
+
+  TRACE_BEGIN("app_init");
+  bool initialized = app_init(&a);
+  TRACE_END();
+  if (!initialized) {
     LOG_ERROR("error: unable to initialize app");
+    if (a.options.bench) {
+      bench_free(&a.bench);
+    }
+    metrics_free();
+    trace_free();
+    log_free();
     return 1;
   }
 
   app_loop(&a);
+  if (a.options.bench) {
+    add_bench_metrics(&a);
+  }
+  TRACE_BEGIN("app_free");
   app_free(&a);
+  TRACE_END();
+  metrics_free();
+  // the workers have exited with app_free
+  trace_free();
+
+  bool success = true;
+  if (a.options.bench) {
+    success = finish_bench(&a);
+    bench_free(&a.bench);
+  }
+  log_free();
+  return success ? 0 : 1;
 }
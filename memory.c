@@ -1,9 +1,13 @@
 #include "memory.h"
 #include "command.h"
+#include "debug_utils.h"
 #include "device.h"
+#include "log.h"
+#include "metrics.h"
+#include "timer.h"
+#include "trace.h"
 #include "vk_utils.h"
 #include <assert.h>
-#include <logger.h>
 #include <vk_mem_alloc.h>
 // see
 // https://stackoverflow.com/questions/62374711/c-inline-function-generates-undefined-symbols-error
@@ -33,10 +37,11 @@ void vma_destroy(VmaAllocator allocator) { vmaDestroyAllocator(allocator); }
 
 bool transfer_context_init(VkDevice device, VmaAllocator allocator,
                            const queue_family_indices *indices,
-                           transfer_context *c) {
+                           pthread_mutex_t *queue_mutex, transfer_context *c) {
   c->device = device;
   c->vma = allocator;
   c->indices = *indices;
+  c->queue_mutex = queue_mutex;
 
   u32 transfer_queue_index = indices->graphics;
   vkGetDeviceQueue(device, indices->graphics, 0, &c->graphics_queue);
@@ -70,6 +75,12 @@ bool transfer_context_init(VkDevice device, VmaAllocator allocator,
     goto fail_fence;
   }
 
+  DEBUG_NAME(device, VK_OBJECT_TYPE_COMMAND_POOL, c->command_pool,
+             "transfer command pool");
+  DEBUG_NAME(device, VK_OBJECT_TYPE_COMMAND_BUFFER, c->command_buffer,
+             "transfer command buffer");
+  DEBUG_NAME(device, VK_OBJECT_TYPE_FENCE, c->fence, "transfer fence");
+
   return true;
 
 fail_fence:
@@ -84,6 +95,20 @@ void transfer_context_free(transfer_context *c) {
   vkDestroyFence(c->device, c->fence, NULL);
 }
 
+VkResult transfer_context_queue_submit(const transfer_context *c,
+                                       VkQueue queue,
+                                       const VkSubmitInfo *submit_info,
+                                       VkFence fence) {
+  if (c->queue_mutex) {
+    pthread_mutex_lock(c->queue_mutex);
+  }
+  VkResult result = vkQueueSubmit(queue, 1, submit_info, fence);
+  if (c->queue_mutex) {
+    pthread_mutex_unlock(c->queue_mutex);
+  }
+  return result;
+}
+
 static bool transfer_context_begin_command_buffer(const transfer_context *c) {
   VkResult result;
   if ((result = vkResetCommandPool(c->device, c->command_pool, 0)) !=
@@ -150,20 +175,30 @@ transfer_context_end_exec_command_buffer(const transfer_context *c) {
     return false;
   }
 
-  if ((result = vkQueueSubmit(c->transfer_queue, 1,
-                              &(VkSubmitInfo){
-                                  .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                                  .commandBufferCount = 1,
-                                  .pCommandBuffers = &c->command_buffer,
-                              },
-                              c->fence)) != VK_SUCCESS) {
+  // counted from before the queue mutex, other uploads may hold it
+  metrics_gauge_add(metric_upload_queue_depth, 1);
+  u64 submit_ns = timer_now_ns();
+  if ((result = transfer_context_queue_submit(
+           c, c->transfer_queue,
+           &(VkSubmitInfo){
+               .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+               .commandBufferCount = 1,
+               .pCommandBuffers = &c->command_buffer,
+           },
+           c->fence)) != VK_SUCCESS) {
     LOG_ERROR("unable to submit copy work to transfer queue: %s",
               vk_error_to_string(result));
+    metrics_gauge_add(metric_upload_queue_depth, -1);
     return false;
   }
 
-  if ((result = vkWaitForFences(c->device, 1, &c->fence, VK_TRUE,
-                                UINT64_MAX)) != VK_SUCCESS) {
+  TRACE_BEGIN("transfer wait");
+  result = vkWaitForFences(c->device, 1, &c->fence, VK_TRUE, UINT64_MAX);
+  TRACE_END();
+  metrics_gauge_add(metric_upload_queue_depth, -1);
+  metrics_add(metric_uploads, 1);
+  metrics_observe_ns(metric_upload_time, timer_now_ns() - submit_ns);
+  if (result != VK_SUCCESS) {
     LOG_ERROR("unable to wait for transfer fence: %s",
               vk_error_to_string(result));
     return false;
@@ -192,12 +227,14 @@ bool transfer_context_stage_to_buffer(const transfer_context *c,
     goto fail_begin_command_buffer;
   }
 
+  DEBUG_LABEL_BEGIN(c->command_buffer, "upload buffer");
   vkCmdCopyBuffer(c->command_buffer, staging_buffer, buffer, 1,
                   (VkBufferCopy[]){(VkBufferCopy){
                       .srcOffset = 0,
                       .dstOffset = offset,
                       .size = size,
                   }});
+  DEBUG_LABEL_END(c->command_buffer);
 
   if (!transfer_context_end_exec_command_buffer(c)) {
     LOG_ERROR("unable to execute command buffer");
@@ -205,6 +242,7 @@ bool transfer_context_stage_to_buffer(const transfer_context *c,
   }
 
   vmaDestroyBuffer(c->vma, staging_buffer, allocation);
+  metrics_add(metric_upload_bytes, size);
   return true;
 
 fail_exec:
@@ -238,6 +276,7 @@ bool transfer_context_stage_linear_data_to_2d_image(
     goto fail_begin_command_buffer;
   }
 
+  DEBUG_LABEL_BEGIN(c->command_buffer, "upload image");
   vkCmdPipelineBarrier(c->command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
                        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
                        &(VkImageMemoryBarrier){
@@ -309,6 +348,7 @@ bool transfer_context_stage_linear_data_to_2d_image(
                              .dstAccessMask = VK_ACCESS_NONE,
                          });
   }
+  DEBUG_LABEL_END(c->command_buffer);
 
   if (!transfer_context_end_exec_command_buffer(c)) {
     LOG_ERROR("unable to execute command buffer");
@@ -316,6 +356,7 @@ bool transfer_context_stage_linear_data_to_2d_image(
   }
 
   vmaDestroyBuffer(c->vma, staging_buffer, allocation);
+  metrics_add(metric_upload_bytes, buffer_size);
   return true;
 
 fail_exec:
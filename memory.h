@@ -2,6 +2,7 @@
 
 #include "device.h"
 #include "types.h"
+#include <pthread.h>
 #include <vk_mem_alloc.h>
 #include <vulkan/vulkan_core.h>
 
@@ -18,11 +19,19 @@ typedef struct {
   VkCommandPool command_pool;
   VkCommandBuffer command_buffer;
   VkFence fence;
+  // held around queue submissions, as other threads submit to the same
+  // queues, may be NULL
+  pthread_mutex_t *queue_mutex;
 } transfer_context;
 
 bool transfer_context_init(VkDevice device, VmaAllocator allocator,
                            const queue_family_indices *indices,
-                           transfer_context *c);
+                           pthread_mutex_t *queue_mutex, transfer_context *c);
+// submits to the transfer context's queue, holding its queue mutex
+VkResult transfer_context_queue_submit(const transfer_context *c,
+                                       VkQueue queue,
+                                       const VkSubmitInfo *submit_info,
+                                       VkFence fence);
 void transfer_context_free(transfer_context *c);
 bool transfer_context_stage_to_buffer(const transfer_context *c,
                                       VkBuffer buffer, i32 size, i32 offset,
@@ -0,0 +1,185 @@
+#include "mesh.h"
+#include "debug_utils.h"
+#include "device.h"
+#include "log.h"
+#include "trace.h"
+#include "vk_utils.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <assimp/cimport.h>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+static model_layout mesh_layout(const struct aiMesh *mesh) {
+  model_layout l;
+  l.offset_positions = 0;
+  l.size_positions = mesh->mNumVertices * 3 * sizeof(float);
+  l.offset_texcoords = l.offset_positions + l.size_positions;
+  l.size_texcoords = mesh->mNumVertices * 2 * sizeof(float);
+  l.vertex_buffer_size = l.offset_texcoords + l.size_texcoords;
+  l.num_indices = mesh->mNumFaces * 3;
+  l.index_buffer_size = l.num_indices * sizeof(u32);
+  return l;
+}
+
+static float *texcoords_buffer(const struct aiMesh *mesh) {
+  i32 num_vs = mesh->mNumVertices;
+  float *buffer = malloc(num_vs * 2 * sizeof(float));
+  if (!buffer) {
+    LOG_ERROR("unable to allocate texcoords buffer");
+    return NULL;
+  }
+  for (i32 i = 0; i < num_vs; ++i) {
+    memcpy(&buffer[i * 2], &mesh->mTextureCoords[0][i], 2 * sizeof(float));
+  }
+  return buffer;
+}
+
+static u32 *indices_buffer(const struct aiMesh *mesh) {
+  i32 num_faces = mesh->mNumFaces;
+  u32 *buffer = malloc(num_faces * 3 * sizeof(u32));
+  if (!buffer) {
+    LOG_ERROR("unable to allocate indices buffer");
+    return NULL;
+  }
+  for (i32 i = 0; i < num_faces; ++i) {
+    // triangulation leaves point and line primitives as they are
+    if (mesh->mFaces[i].mNumIndices != 3) {
+      LOG_ERROR("face %" PRIi32 " has %u indices, expected a triangle", i,
+                mesh->mFaces[i].mNumIndices);
+      free(buffer);
+      return NULL;
+    }
+    buffer[i * 3] = mesh->mFaces[i].mIndices[0];
+    buffer[i * 3 + 1] = mesh->mFaces[i].mIndices[1];
+    buffer[i * 3 + 2] = mesh->mFaces[i].mIndices[2];
+  }
+  return buffer;
+}
+
+static bool mesh_create_buffer(const transfer_context *tctx, i32 size,
+                               VkBufferUsageFlags usage, VkBuffer *buffer,
+                               VmaAllocation *allocation) {
+  i32 num_unique_indices;
+  VkSharingMode sharing_mode;
+  u32 *unique_queue_indices = remove_duplicate_and_invalid_indices(
+      (u32[]){tctx->indices.transfer, tctx->indices.graphics}, 2,
+      &num_unique_indices, &sharing_mode);
+  assert(num_unique_indices > 0);
+
+  VkResult result;
+  if ((result = vmaCreateBuffer(
+           tctx->vma,
+           &(VkBufferCreateInfo){
+               .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+               .size = size,
+               .usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+               .sharingMode = sharing_mode,
+               .queueFamilyIndexCount = num_unique_indices,
+               .pQueueFamilyIndices = unique_queue_indices,
+           },
+           &(VmaAllocationCreateInfo){
+               .usage = VMA_MEMORY_USAGE_AUTO,
+           },
+           buffer, allocation, NULL)) != VK_SUCCESS) {
+    LOG_ERROR("unable to allocate buffer: %s", vk_error_to_string(result));
+    return false;
+  }
+
+  return true;
+}
+
+bool mesh_load_from_file(const transfer_context *tctx, const char *path,
+                         mesh *m) {
+  TRACE_BEGIN("mesh import");
+  const struct aiScene *scene =
+      aiImportFile(path, aiProcess_Triangulate |
+                             aiProcess_JoinIdenticalVertices |
+                             aiProcess_ImproveCacheLocality |
+                             aiProcess_GenUVCoords | aiProcess_OptimizeMeshes |
+                             aiProcess_OptimizeGraph | aiProcess_FlipUVs);
+  TRACE_END();
+  if (scene == NULL) {
+    LOG_ERROR("unable to import scene from file: %s", aiGetErrorString());
+    goto fail_import;
+  }
+
+  // files are edited while the app runs, so malformed ones are an error
+  // rather than an assertion
+  if (scene->mNumMeshes != 1 ||
+      scene->mMeshes[0]->mNumUVComponents[0] != 2) {
+    LOG_ERROR("'%s' must contain exactly one mesh with 2d texcoords", path);
+    goto fail_mesh;
+  }
+
+  const struct aiMesh *mesh = scene->mMeshes[0];
+  m->layout = mesh_layout(mesh);
+
+  float *texcoords = texcoords_buffer(mesh);
+  u32 *indices = indices_buffer(mesh);
+  if (!texcoords || !indices) {
+    LOG_ERROR("unable to extract texcoords and indices data from model");
+    goto fail_buffers;
+  }
+
+  if (!mesh_create_buffer(tctx, m->layout.vertex_buffer_size,
+                          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                          &m->vertex_buffer, &m->vertex_buffer_allocation)) {
+    LOG_ERROR("unable to create vertex buffer");
+    goto fail_vertex_buffer;
+  }
+  DEBUG_NAME(tctx->device, VK_OBJECT_TYPE_BUFFER, m->vertex_buffer,
+             "vertex buffer %s", path);
+
+  if (!transfer_context_stage_to_buffer(
+          tctx, m->vertex_buffer, m->layout.size_positions,
+          m->layout.offset_positions, mesh->mVertices) ||
+      !transfer_context_stage_to_buffer(
+          tctx, m->vertex_buffer, m->layout.size_texcoords,
+          m->layout.offset_texcoords, texcoords)) {
+    LOG_ERROR("unable to stage vertex data to vertex buffer");
+    goto fail_stage_vertex_buffer;
+  }
+
+  if (!mesh_create_buffer(tctx, m->layout.index_buffer_size,
+                          VK_BUFFER_USAGE_INDEX_BUFFER_BIT, &m->index_buffer,
+                          &m->index_buffer_allocation)) {
+    LOG_ERROR("unable to create index buffer");
+    goto fail_index_buffer;
+  }
+  DEBUG_NAME(tctx->device, VK_OBJECT_TYPE_BUFFER, m->index_buffer,
+             "index buffer %s", path);
+
+  if (!transfer_context_stage_to_buffer(tctx, m->index_buffer,
+                                        m->layout.index_buffer_size, 0,
+                                        indices)) {
+    LOG_ERROR("unable to stage index data to index buffer");
+    goto fail_stage_index_buffer;
+  }
+
+  free(texcoords);
+  free(indices);
+  aiReleaseImport(scene);
+  return true;
+
+fail_stage_index_buffer:
+  vmaDestroyBuffer(tctx->vma, m->index_buffer, m->index_buffer_allocation);
+fail_index_buffer:
+fail_stage_vertex_buffer:
+  vmaDestroyBuffer(tctx->vma, m->vertex_buffer, m->vertex_buffer_allocation);
+fail_vertex_buffer:
+fail_buffers:
+  free(texcoords);
+  free(indices);
+fail_mesh:
+  aiReleaseImport(scene);
+fail_import:
+  return false;
+}
+
+void mesh_free(VmaAllocator vma, const mesh *m) {
+  vmaDestroyBuffer(vma, m->index_buffer, m->index_buffer_allocation);
+  vmaDestroyBuffer(vma, m->vertex_buffer, m->vertex_buffer_allocation);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "memory.h"
+#include "types.h"
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan_core.h>
+
+typedef struct {
+  i32 offset_positions;
+  i32 size_positions;
+  i32 offset_texcoords;
+  i32 size_texcoords;
+  i32 vertex_buffer_size;
+  i32 index_buffer_size;
+  i32 num_indices;
+} model_layout;
+
+// a single mesh with positions and texcoords in one vertex buffer and u32
+// indices
+typedef struct {
+  model_layout layout;
+  VkBuffer vertex_buffer;
+  VmaAllocation vertex_buffer_allocation;
+  VkBuffer index_buffer;
+  VmaAllocation index_buffer_allocation;
+} mesh;
+
+// imports the file and uploads it into new buffers, safe to call from a
+// worker given a transfer context of its own
+bool mesh_load_from_file(const transfer_context *tctx, const char *path,
+                         mesh *m);
+void mesh_free(VmaAllocator vma, const mesh *m);
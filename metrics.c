@@ -0,0 +1,373 @@
+// accept4 and pipe2
+#define _GNU_SOURCE
+#include "metrics.h"
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// longest served text, the rest is cut off
+#define METRICS_MAX_TEXT (1 << 16)
+// how long a client is given to send a request before the metrics are written
+// without an http header, as for a plain unix socket client
+#define METRICS_REQUEST_TIMEOUT_MS 100
+// a client not reading its response is dropped after this long
+#define METRICS_SEND_TIMEOUT_S 1
+
+typedef struct {
+  const char *name;
+  const char *help;
+} metric_info;
+
+static const metric_info counter_infos[metric_counter_count] = {
+    [metric_dropped_frames] = {"renderer_dropped_frames_total",
+                               "Frames not presented as the swapchain was "
+                               "out of date."},
+    [metric_shader_reloads] = {"renderer_shader_reloads_total",
+                               "Graphics pipelines rebuilt after a shader "
+                               "changed."},
+    [metric_shader_reload_failures] = {"renderer_shader_reload_failures_total",
+                                       "Shader reloads that failed, keeping "
+                                       "the current pipeline."},
+    [metric_swapchain_recreations] = {"renderer_swapchain_recreations_total",
+                                      "Swapchain recreations."},
+    [metric_uploads] = {"renderer_uploads_total",
+                        "Upload submissions, staging copies and mipmap "
+                        "generation."},
+    [metric_upload_bytes] = {"renderer_upload_bytes_total",
+                             "Bytes staged to buffers and images."},
+};
+
+static const metric_info gauge_infos[metric_gauge_count] = {
+    [metric_upload_queue_depth] = {"renderer_upload_queue_depth",
+                                   "Uploads submitted or waiting for the "
+                                   "queue, not yet completed."},
+};
+
+static const metric_info histogram_infos[metric_histogram_count] = {
+    [metric_frame_time] = {"renderer_frame_seconds",
+                           "Render thread time per frame."},
+    [metric_upload_time] = {"renderer_upload_seconds",
+                            "Upload time from submission to completion."},
+    [metric_swapchain_recreation_time] = {
+        "renderer_swapchain_recreation_seconds",
+        "Time to recreate the swapchain and what depends on it."},
+};
+
+static const struct {
+  u64 ns;
+  const char *le;
+} buckets[METRICS_NUM_BUCKETS] = {
+    {250000, "0.00025"},   {500000, "0.0005"},      {1000000, "0.001"},
+    {2000000, "0.002"},    {4000000, "0.004"},      {8000000, "0.008"},
+    {16000000, "0.016"},   {33000000, "0.033"},     {66000000, "0.066"},
+    {133000000, "0.133"},  {250000000, "0.25"},     {1000000000, "1"},
+    {UINT64_MAX, "+Inf"},
+};
+
+static struct {
+  atomic_uint_fast64_t counters[metric_counter_count];
+  atomic_int_fast64_t gauges[metric_gauge_count];
+  // observations per bucket, not cumulative
+  atomic_uint_fast64_t buckets[metric_histogram_count][METRICS_NUM_BUCKETS];
+  atomic_uint_fast64_t sums_ns[metric_histogram_count];
+  atomic_uint_fast64_t heap_budgets[METRICS_MAX_HEAPS];
+  atomic_uint_fast64_t heap_usages[METRICS_MAX_HEAPS];
+  atomic_uint num_heaps;
+
+  bool serving;
+  pthread_t thread;
+  i32 listen_fd;
+  // written to once to stop the server thread
+  i32 stop_fds[2];
+  struct sockaddr_un addr;
+  // only touched by the server thread
+  char text[METRICS_MAX_TEXT];
+} metrics;
+
+void metrics_add(metric_counter c, u64 n) {
+  atomic_fetch_add_explicit(&metrics.counters[c], n, memory_order_relaxed);
+}
+
+void metrics_gauge_add(metric_gauge g, i64 n) {
+  atomic_fetch_add_explicit(&metrics.gauges[g], n, memory_order_relaxed);
+}
+
+void metrics_observe_ns(metric_histogram h, u64 ns) {
+  i32 bucket = 0;
+  while (ns > buckets[bucket].ns) {
+    ++bucket;
+  }
+  atomic_fetch_add_explicit(&metrics.buckets[h][bucket], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&metrics.sums_ns[h], ns, memory_order_relaxed);
+}
+
+void metrics_set_gpu_memory(u32 heap, u64 budget, u64 usage) {
+  if (heap >= METRICS_MAX_HEAPS) {
+    return;
+  }
+
+  atomic_store_explicit(&metrics.heap_budgets[heap], budget,
+                        memory_order_relaxed);
+  atomic_store_explicit(&metrics.heap_usages[heap], usage,
+                        memory_order_relaxed);
+  u32 num_heaps =
+      atomic_load_explicit(&metrics.num_heaps, memory_order_relaxed);
+  while (heap >= num_heaps &&
+         !atomic_compare_exchange_weak_explicit(&metrics.num_heaps, &num_heaps,
+                                                heap + 1, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+}
+
+// returns the new length of the text, which is cut off once full
+__attribute__((format(printf, 2, 3))) static u32 append(u32 len,
+                                                        const char *fmt, ...) {
+  if (len >= sizeof(metrics.text) - 1) {
+    return len;
+  }
+
+  va_list args;
+  va_start(args, fmt);
+  i32 n = vsnprintf(metrics.text + len, sizeof(metrics.text) - len, fmt, args);
+  va_end(args);
+  if (n < 0) {
+    return len;
+  }
+  return len + n < sizeof(metrics.text) ? len + n : sizeof(metrics.text) - 1;
+}
+
+static u32 append_header(u32 len, const metric_info *info, const char *type) {
+  len = append(len, "# HELP %s %s\n", info->name, info->help);
+  return append(len, "# TYPE %s %s\n", info->name, type);
+}
+
+// the values are read one at a time, a scrape racing with updates may see
+// some of them before and some after
+static u32 format_metrics(void) {
+  u32 len = 0;
+  for (i32 i = 0; i < metric_counter_count; ++i) {
+    const metric_info *info = &counter_infos[i];
+    len = append_header(len, info, "counter");
+    len = append(len, "%s %" PRIu64 "\n", info->name,
+                 (u64)atomic_load_explicit(&metrics.counters[i],
+                                           memory_order_relaxed));
+  }
+
+  for (i32 i = 0; i < metric_gauge_count; ++i) {
+    const metric_info *info = &gauge_infos[i];
+    len = append_header(len, info, "gauge");
+    len = append(len, "%s %" PRIi64 "\n", info->name,
+                 (i64)atomic_load_explicit(&metrics.gauges[i],
+                                           memory_order_relaxed));
+  }
+
+  static const metric_info budget_info = {
+      "renderer_gpu_memory_budget_bytes",
+      "Memory the process can use per heap."};
+  static const metric_info usage_info = {
+      "renderer_gpu_memory_usage_bytes",
+      "Memory the process uses per heap."};
+  u32 num_heaps =
+      atomic_load_explicit(&metrics.num_heaps, memory_order_relaxed);
+  len = append_header(len, &budget_info, "gauge");
+  for (u32 i = 0; i < num_heaps; ++i) {
+    len = append(len, "%s{heap=\"%" PRIu32 "\"} %" PRIu64 "\n",
+                 budget_info.name, i,
+                 (u64)atomic_load_explicit(&metrics.heap_budgets[i],
+                                           memory_order_relaxed));
+  }
+  len = append_header(len, &usage_info, "gauge");
+  for (u32 i = 0; i < num_heaps; ++i) {
+    len = append(len, "%s{heap=\"%" PRIu32 "\"} %" PRIu64 "\n",
+                 usage_info.name, i,
+                 (u64)atomic_load_explicit(&metrics.heap_usages[i],
+                                           memory_order_relaxed));
+  }
+
+  for (i32 i = 0; i < metric_histogram_count; ++i) {
+    const metric_info *info = &histogram_infos[i];
+    len = append_header(len, info, "histogram");
+    u64 count = 0;
+    for (i32 j = 0; j < METRICS_NUM_BUCKETS; ++j) {
+      count += atomic_load_explicit(&metrics.buckets[i][j],
+                                    memory_order_relaxed);
+      len = append(len, "%s_bucket{le=\"%s\"} %" PRIu64 "\n", info->name,
+                   buckets[j].le, count);
+    }
+    u64 sum_ns =
+        atomic_load_explicit(&metrics.sums_ns[i], memory_order_relaxed);
+    len = append(len, "%s_sum %.9f\n", info->name, sum_ns / 1e9);
+    len = append(len, "%s_count %" PRIu64 "\n", info->name, count);
+  }
+
+  return len;
+}
+
+static bool send_all(i32 fd, const char *data, u32 size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// http clients are answered once their request line arrived, others get the
+// text on its own after a short wait
+static void serve_client(i32 fd) {
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO,
+             &(struct timeval){.tv_sec = METRICS_SEND_TIMEOUT_S},
+             sizeof(struct timeval));
+
+  char request[256];
+  ssize_t request_size = 0;
+  if (poll(&(struct pollfd){.fd = fd, .events = POLLIN}, 1,
+           METRICS_REQUEST_TIMEOUT_MS) > 0) {
+    request_size = recv(fd, request, sizeof(request), 0);
+  }
+  bool http = request_size >= 4 && memcmp(request, "GET ", 4) == 0;
+
+  u32 len = format_metrics();
+  if (http) {
+    char header[256];
+    i32 header_len =
+        snprintf(header, sizeof(header),
+                 "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %" PRIu32 "\r\n"
+                 "Connection: close\r\n\r\n",
+                 len);
+    if (!send_all(fd, header, header_len)) {
+      return;
+    }
+  }
+  send_all(fd, metrics.text, len);
+}
+
+static void *serve(void *arg) {
+  (void)arg;
+  for (;;) {
+    struct pollfd fds[] = {
+        {.fd = metrics.listen_fd, .events = POLLIN},
+        {.fd = metrics.stop_fds[0], .events = POLLIN},
+    };
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_ERROR("unable to poll metrics socket: %s", strerror(errno));
+      return NULL;
+    }
+    if (fds[1].revents) {
+      return NULL;
+    }
+    if (!(fds[0].revents & POLLIN)) {
+      continue;
+    }
+
+    i32 fd = accept4(metrics.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        LOG_WARN("unable to accept metrics client: %s", strerror(errno));
+      }
+      continue;
+    }
+    serve_client(fd);
+    close(fd);
+  }
+}
+
+bool metrics_init(const char *path) {
+  metrics.serving = false;
+  if (!path) {
+    return true;
+  }
+
+  metrics.addr = (struct sockaddr_un){.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(metrics.addr.sun_path)) {
+    LOG_ERROR("metrics socket path '%s' is too long", path);
+    goto fail_path;
+  }
+  strcpy(metrics.addr.sun_path, path);
+
+  // only a socket is replaced, a regular file at path is an error
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+
+  if ((metrics.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) <
+      0) {
+    LOG_ERROR("unable to create metrics socket: %s", strerror(errno));
+    goto fail_socket;
+  }
+  if (bind(metrics.listen_fd, (const struct sockaddr *)&metrics.addr,
+           sizeof(metrics.addr)) != 0) {
+    LOG_ERROR("unable to bind metrics socket to '%s': %s", path,
+              strerror(errno));
+    goto fail_bind;
+  }
+  if (listen(metrics.listen_fd, 8) != 0) {
+    LOG_ERROR("unable to listen on metrics socket: %s", strerror(errno));
+    goto fail_listen;
+  }
+
+  if (pipe2(metrics.stop_fds, O_CLOEXEC) != 0) {
+    LOG_ERROR("unable to create metrics stop pipe: %s", strerror(errno));
+    goto fail_pipe;
+  }
+
+  i32 err = pthread_create(&metrics.thread, NULL, serve, NULL);
+  if (err != 0) {
+    LOG_ERROR("unable to create metrics thread: %s", strerror(err));
+    goto fail_thread;
+  }
+
+  metrics.serving = true;
+  LOG_INFO("serving metrics on '%s'", path);
+  return true;
+
+fail_thread:
+  close(metrics.stop_fds[0]);
+  close(metrics.stop_fds[1]);
+fail_pipe:
+fail_listen:
+  unlink(path);
+fail_bind:
+  close(metrics.listen_fd);
+fail_socket:
+fail_path:
+  return false;
+}
+
+void metrics_free(void) {
+  if (!metrics.serving) {
+    return;
+  }
+
+  while (write(metrics.stop_fds[1], "", 1) < 0 && errno == EINTR) {
+  }
+  pthread_join(metrics.thread, NULL);
+  close(metrics.stop_fds[0]);
+  close(metrics.stop_fds[1]);
+  close(metrics.listen_fd);
+  unlink(metrics.addr.sun_path);
+  metrics.serving = false;
+}
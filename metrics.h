@@ -0,0 +1,51 @@
+#pragma once
+
+#include "types.h"
+
+// counters, gauges and histograms are atomics updated with relaxed ordering,
+// so any thread may update them without ever blocking; once metrics_init ran
+// with a path, a background thread serves them in the prometheus text format
+// on a unix socket, plainly or as an http response to a GET request, e.g.
+//   curl --unix-socket path http://localhost/metrics
+
+#define METRICS_MAX_HEAPS 16
+// histogram buckets, the last one is +Inf
+#define METRICS_NUM_BUCKETS 13
+
+typedef enum {
+  // frames not presented, as the swapchain was out of date at acquire or
+  // present
+  metric_dropped_frames,
+  metric_shader_reloads,
+  metric_shader_reload_failures,
+  metric_swapchain_recreations,
+  // submissions of the transfer contexts, staging and mipmap generation
+  metric_uploads,
+  metric_upload_bytes,
+  metric_counter_count,
+} metric_counter;
+
+typedef enum {
+  // uploads submitted or waiting for the queue, not yet completed
+  metric_upload_queue_depth,
+  metric_gauge_count,
+} metric_gauge;
+
+typedef enum {
+  metric_frame_time,
+  // from submission until the upload completed
+  metric_upload_time,
+  metric_swapchain_recreation_time,
+  metric_histogram_count,
+} metric_histogram;
+
+// metrics are counted either way, they are only served if path is not NULL;
+// a stale socket left at path is replaced
+bool metrics_init(const char *path);
+// stops serving and removes the socket
+void metrics_free(void);
+
+void metrics_add(metric_counter c, u64 n);
+void metrics_gauge_add(metric_gauge g, i64 n);
+void metrics_observe_ns(metric_histogram h, u64 ns);
+void metrics_set_gpu_memory(u32 heap, u64 budget, u64 usage);
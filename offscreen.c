@@ -0,0 +1,178 @@
+#include "offscreen.h"
+#include "file.h"
+#include "log.h"
+#include "vk_utils.h"
+#include <assert.h>
+#include <stdio.h>
+
+#define BYTES_PER_TEXEL 4
+
+bool offscreen_target_init(VmaAllocator allocator, VkExtent2D extent,
+                           VkFormat format, u32 num_images, bool readback,
+                           offscreen_target *t) {
+  assert(num_images <= OFFSCREEN_MAX_IMAGES);
+  t->vma = allocator;
+  t->format = format;
+  t->extent = extent;
+  t->num_images = 0;
+  t->readback = readback;
+
+  VkResult result;
+  while (t->num_images < num_images) {
+    u32 i = t->num_images;
+    if ((result = vmaCreateImage(
+             allocator,
+             &(VkImageCreateInfo){
+                 .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                 .imageType = VK_IMAGE_TYPE_2D,
+                 .format = format,
+                 .extent = {extent.width, extent.height, 1},
+                 .mipLevels = 1,
+                 .arrayLayers = 1,
+                 .samples = VK_SAMPLE_COUNT_1_BIT,
+                 .tiling = VK_IMAGE_TILING_OPTIMAL,
+                 .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                          VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                 .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+                 .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+             },
+             &(VmaAllocationCreateInfo){
+                 .usage = VMA_MEMORY_USAGE_AUTO,
+             },
+             &t->images[i], &t->allocations[i], NULL)) != VK_SUCCESS) {
+      LOG_ERROR("unable to create %" PRIu32 "-th offscreen image: %s", i + 1,
+                vk_error_to_string(result));
+      goto fail;
+    }
+
+    if (readback &&
+        (result = vmaCreateBuffer(
+             allocator,
+             &(VkBufferCreateInfo){
+                 .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                 .size = (VkDeviceSize)extent.width * extent.height *
+                         BYTES_PER_TEXEL,
+                 .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+             },
+             &(VmaAllocationCreateInfo){
+                 .usage = VMA_MEMORY_USAGE_AUTO,
+                 .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT |
+                          VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT,
+             },
+             &t->buffers[i], &t->buffer_allocations[i],
+             &t->buffer_infos[i])) != VK_SUCCESS) {
+      LOG_ERROR("unable to create %" PRIu32 "-th readback buffer: %s", i + 1,
+                vk_error_to_string(result));
+      vmaDestroyImage(allocator, t->images[i], t->allocations[i]);
+      goto fail;
+    }
+
+    ++t->num_images;
+  }
+
+  return true;
+fail:
+  offscreen_target_free(t);
+  return false;
+}
+
+void offscreen_target_free(const offscreen_target *t) {
+  for (u32 i = 0; i < t->num_images; ++i) {
+    if (t->readback) {
+      vmaDestroyBuffer(t->vma, t->buffers[i], t->buffer_allocations[i]);
+    }
+    vmaDestroyImage(t->vma, t->images[i], t->allocations[i]);
+  }
+}
+
+void offscreen_target_cmd_readback(const offscreen_target *t,
+                                   VkCommandBuffer command_buffer,
+                                   u32 image_index) {
+  assert(t->readback);
+  VkImageSubresourceRange range = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .levelCount = 1,
+      .layerCount = 1,
+  };
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
+      &(VkImageMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+          .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = t->images[image_index],
+          .subresourceRange = range,
+      });
+
+  vkCmdCopyImageToBuffer(
+      command_buffer, t->images[image_index],
+      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, t->buffers[image_index], 1,
+      &(VkBufferImageCopy){
+          .bufferOffset = 0,
+          .bufferRowLength = 0,
+          .bufferImageHeight = 0,
+          .imageSubresource =
+              {
+                  .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                  .mipLevel = 0,
+                  .baseArrayLayer = 0,
+                  .layerCount = 1,
+              },
+          .imageOffset = {0, 0, 0},
+          .imageExtent = {t->extent.width, t->extent.height, 1},
+      });
+
+  // the fence wait alone does not make the copy visible to the host
+  vkCmdPipelineBarrier(
+      command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1,
+      &(VkBufferMemoryBarrier){
+          .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .buffer = t->buffers[image_index],
+          .offset = 0,
+          .size = VK_WHOLE_SIZE,
+      },
+      0, NULL);
+}
+
+bool offscreen_target_write_ppm(const offscreen_target *t, u32 image_index,
+                                const char *path) {
+  assert(t->readback);
+  VkResult result;
+  if ((result = vmaInvalidateAllocation(t->vma,
+                                        t->buffer_allocations[image_index], 0,
+                                        VK_WHOLE_SIZE)) != VK_SUCCESS) {
+    LOG_ERROR("unable to invalidate readback buffer: %s",
+              vk_error_to_string(result));
+    return false;
+  }
+
+  // packs the bgra texels into rgb in place, each write lands at or behind
+  // the texel being read
+  u8 *pixels = t->buffer_infos[image_index].pMappedData;
+  usize num_texels = (usize)t->extent.width * t->extent.height;
+  for (usize i = 0; i < num_texels; ++i) {
+    u8 b = pixels[i * BYTES_PER_TEXEL + 0];
+    u8 g = pixels[i * BYTES_PER_TEXEL + 1];
+    u8 r = pixels[i * BYTES_PER_TEXEL + 2];
+    pixels[i * 3 + 0] = r;
+    pixels[i * 3 + 1] = g;
+    pixels[i * 3 + 2] = b;
+  }
+
+  char header[64];
+  i32 header_len =
+      snprintf(header, sizeof(header), "P6\n%" PRIu32 " %" PRIu32 "\n255\n",
+               t->extent.width, t->extent.height);
+  return file_write_atomic(path, header, header_len, pixels, num_texels * 3);
+}
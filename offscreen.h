@@ -0,0 +1,39 @@
+#pragma once
+
+#include "types.h"
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan_core.h>
+
+#define OFFSCREEN_MAX_IMAGES 4
+
+// stands in for the swapchain when rendering without a surface, the images
+// are rendered to like swapchain images and left in
+// VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; with readback each image has a
+// host visible buffer it can be copied into
+typedef struct {
+  VmaAllocator vma;
+  VkFormat format;
+  VkExtent2D extent;
+  u32 num_images;
+  bool readback;
+  VkImage images[OFFSCREEN_MAX_IMAGES];
+  VmaAllocation allocations[OFFSCREEN_MAX_IMAGES];
+  VkBuffer buffers[OFFSCREEN_MAX_IMAGES];
+  VmaAllocation buffer_allocations[OFFSCREEN_MAX_IMAGES];
+  VmaAllocationInfo buffer_infos[OFFSCREEN_MAX_IMAGES];
+} offscreen_target;
+
+// format must have 4 bytes per texel in BGRA order to be written out
+bool offscreen_target_init(VmaAllocator allocator, VkExtent2D extent,
+                           VkFormat format, u32 num_images, bool readback,
+                           offscreen_target *t);
+void offscreen_target_free(const offscreen_target *t);
+
+// records copying the rendered image into its buffer, to be read once the
+// command buffer has completed
+void offscreen_target_cmd_readback(const offscreen_target *t,
+                                   VkCommandBuffer command_buffer,
+                                   u32 image_index);
+// writes the last copy of the image as a binary ppm, overwriting the copy
+bool offscreen_target_write_ppm(const offscreen_target *t, u32 image_index,
+                                const char *path);
@@ -0,0 +1,160 @@
+#include "pipeline_cache.h"
+#include "arena.h"
+#include "file.h"
+#include "log.h"
+#include "timer.h"
+#include "vk_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vulkan/vulkan_core.h>
+
+static bool pipeline_cache_data_valid(VkPhysicalDevice physical_device,
+                                      const char *data, i32 len) {
+  VkPipelineCacheHeaderVersionOne header;
+  if (len < (i32)sizeof(header)) {
+    LOG_DEBUG("pipeline cache data too short (%" PRIi32 " bytes)", len);
+    return false;
+  }
+
+  memcpy(&header, data, sizeof(header));
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  if (header.headerSize < sizeof(header) || header.headerSize > (u32)len ||
+      header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+    LOG_DEBUG("pipeline cache header malformed");
+    return false;
+  }
+  if (header.vendorID != properties.vendorID ||
+      header.deviceID != properties.deviceID ||
+      memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+             VK_UUID_SIZE) != 0) {
+    LOG_DEBUG("pipeline cache was created by a different device or driver");
+    return false;
+  }
+
+  return true;
+}
+
+bool pipeline_cache_init(VkPhysicalDevice physical_device, VkDevice device,
+                         const char *path, pipeline_cache *c) {
+  c->device = device;
+  c->path = path;
+  c->warm = false;
+  c->last_save_ns = timer_now_ns();
+  atomic_init(&c->dirty, false);
+  atomic_init(&c->saving, false);
+
+  // driver caches easily outgrow the scratch arena, so the file is read into
+  // an arena sized to fit it
+  arena file = {};
+  struct stat st;
+  if (stat(path, &st) == 0 && st.st_size > 0) {
+    arena_init(&file, st.st_size);
+  }
+
+  i32 len = 0;
+  char *data = file.base ? file_read(&file, path, &len) : NULL;
+  if (data && pipeline_cache_data_valid(physical_device, data, len)) {
+    c->warm = true;
+  } else if (data) {
+    LOG_INFO("discarding incompatible pipeline cache '%s'", path);
+  }
+
+  VkResult result;
+  if ((result = vkCreatePipelineCache(
+           device,
+           &(VkPipelineCacheCreateInfo){
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+               .initialDataSize = c->warm ? len : 0,
+               .pInitialData = c->warm ? data : NULL,
+           },
+           NULL, &c->cache)) != VK_SUCCESS) {
+    LOG_ERROR("unable to create pipeline cache: %s",
+              vk_error_to_string(result));
+    arena_free(&file);
+    return false;
+  }
+
+  LOG_INFO("pipeline cache %s (%" PRIi32 " bytes loaded from '%s')",
+           c->warm ? "warm" : "cold", c->warm ? len : 0, path);
+  arena_free(&file);
+  return true;
+}
+
+void pipeline_cache_free(pipeline_cache *c) {
+  if (atomic_load(&c->dirty)) {
+    pipeline_cache_save(c);
+  }
+
+  vkDestroyPipelineCache(c->device, c->cache, NULL);
+}
+
+void pipeline_cache_mark_dirty(pipeline_cache *c) {
+  atomic_store(&c->dirty, true);
+}
+
+bool pipeline_cache_save(pipeline_cache *c) {
+  // cleared before reading so that pipelines created while saving mark the
+  // cache dirty again
+  atomic_store(&c->dirty, false);
+  VkResult result;
+  usize len;
+  if ((result = vkGetPipelineCacheData(c->device, c->cache, &len, NULL)) !=
+      VK_SUCCESS) {
+    LOG_ERROR("unable to query pipeline cache size: %s",
+              vk_error_to_string(result));
+    goto fail_query;
+  }
+
+  // driver caches easily outgrow the scratch arena
+  void *data = malloc(len);
+  if (!data) {
+    LOG_ERROR("unable to allocate %zu bytes for pipeline cache", len);
+    goto fail_query;
+  }
+
+  if ((result = vkGetPipelineCacheData(c->device, c->cache, &len, data)) !=
+      VK_SUCCESS) {
+    LOG_ERROR("unable to retrieve pipeline cache data: %s",
+              vk_error_to_string(result));
+    goto fail_data;
+  }
+
+  if (!file_write_atomic(c->path, NULL, 0, data, len)) {
+    goto fail_data;
+  }
+
+  LOG_DEBUG("saved %zu bytes of pipeline cache to '%s'", len, c->path);
+  free(data);
+  return true;
+
+fail_data:
+  free(data);
+fail_query:
+  atomic_store(&c->dirty, true);
+  return false;
+}
+
+static void pipeline_cache_save_job(void *user_data) {
+  pipeline_cache *c = user_data;
+  pipeline_cache_save(c);
+  atomic_store(&c->saving, false);
+}
+
+void pipeline_cache_save_periodic(pipeline_cache *c, thread_pool *pool) {
+  if (!atomic_load_explicit(&c->dirty, memory_order_relaxed)) {
+    return;
+  }
+
+  u64 now = timer_now_ns();
+  if (now - c->last_save_ns < PIPELINE_CACHE_SAVE_INTERVAL_NS ||
+      atomic_exchange(&c->saving, true)) {
+    return;
+  }
+
+  c->last_save_ns = now;
+  if (!thread_pool_submit(pool, pipeline_cache_save_job, c)) {
+    atomic_store(&c->saving, false);
+  }
+}
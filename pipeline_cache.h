@@ -0,0 +1,33 @@
+#pragma once
+
+#include "thread_pool.h"
+#include "types.h"
+#include <stdatomic.h>
+#include <vulkan/vulkan_core.h>
+
+// how often a modified pipeline cache is written back while running
+#define PIPELINE_CACHE_SAVE_INTERVAL_NS (30ull * 1000000000)
+
+typedef struct {
+  VkDevice device;
+  VkPipelineCache cache;
+  const char *path;
+  // whether the cache was seeded with valid data from disk
+  bool warm;
+  atomic_bool dirty;
+  atomic_bool saving;
+  u64 last_save_ns;
+} pipeline_cache;
+
+// a missing, truncated or foreign (different vendor, device or driver uuid)
+// cache file is ignored and an empty cache is created instead
+bool pipeline_cache_init(VkPhysicalDevice physical_device, VkDevice device,
+                         const char *path, pipeline_cache *c);
+// writes the cache back to disk before destroying it
+void pipeline_cache_free(pipeline_cache *c);
+
+// call after creating pipelines through the cache
+void pipeline_cache_mark_dirty(pipeline_cache *c);
+bool pipeline_cache_save(pipeline_cache *c);
+// saves on pool if the cache is dirty and the save interval has elapsed
+void pipeline_cache_save_periodic(pipeline_cache *c, thread_pool *pool);
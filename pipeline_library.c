@@ -0,0 +1,280 @@
+#include "pipeline_library.h"
+#include "hash.h"
+#include "log.h"
+#include "timer.h"
+#include "vk_utils.h"
+
+typedef enum {
+  pipeline_part_vertex_input,
+  pipeline_part_pre_rasterization,
+  pipeline_part_fragment_shader,
+  pipeline_part_fragment_output,
+  pipeline_part_count,
+} pipeline_part_type;
+
+static const VkGraphicsPipelineLibraryFlagsEXT part_flags[] = {
+    VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+    VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+    VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+    VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+};
+
+static const char *part_names[] = {
+    "vertex input",
+    "pre-rasterization",
+    "fragment shader",
+    "fragment output",
+};
+
+void pipeline_library_init(VkDevice device, VkPipelineCache cache,
+                           pipeline_library *l) {
+  l->device = device;
+  l->cache = cache;
+  pthread_mutex_init(&l->mutex, NULL);
+  l->num_parts = 0;
+  l->clock = 0;
+  l->hits = 0;
+  l->misses = 0;
+}
+
+void pipeline_library_free(pipeline_library *l) {
+  LOG_INFO("pipeline library: %" PRIu64 " part(s) compiled, %" PRIu64
+           " reused",
+           l->misses, l->hits);
+  pipeline_library_clear(l);
+  pthread_mutex_destroy(&l->mutex);
+}
+
+void pipeline_library_clear(pipeline_library *l) {
+  pthread_mutex_lock(&l->mutex);
+  for (i32 i = 0; i < l->num_parts; ++i) {
+    vkDestroyPipeline(l->device, l->parts[i].pipeline, NULL);
+  }
+  l->num_parts = 0;
+  pthread_mutex_unlock(&l->mutex);
+}
+
+static u64 hash_specialization(u64 h, const VkSpecializationInfo *info) {
+  if (!info) {
+    return hash_u64(h, 0);
+  }
+
+  h = hash_u64(h, info->mapEntryCount);
+  for (u32 i = 0; i < info->mapEntryCount; ++i) {
+    h = hash_u64(h, info->pMapEntries[i].constantID);
+    h = hash_u64(h, info->pMapEntries[i].offset);
+    h = hash_u64(h, info->pMapEntries[i].size);
+  }
+  h = hash_u64(h, info->dataSize);
+  return hash_bytes(h, info->pData, info->dataSize);
+}
+
+// covers exactly the inputs that end up in the given part, handles are
+// hashed by value which is why the library is cleared when they are destroyed
+static u64 part_key(pipeline_part_type type,
+                    const graphics_pipeline_desc *desc) {
+  u64 h = hash_u64(HASH_INIT, type);
+  switch (type) {
+  case pipeline_part_vertex_input: {
+    const shader_reflection *r = desc->interface;
+    h = hash_u64(h, r->num_attributes);
+    for (i32 i = 0; i < r->num_attributes; ++i) {
+      h = hash_u64(h, r->attributes[i].location);
+      h = hash_u64(h, r->attributes[i].binding);
+      h = hash_u64(h, r->attributes[i].format);
+      h = hash_u64(h, r->attributes[i].offset);
+      h = hash_u64(h, r->vertex_bindings[i].binding);
+      h = hash_u64(h, r->vertex_bindings[i].stride);
+      h = hash_u64(h, r->vertex_bindings[i].inputRate);
+    }
+    break;
+  }
+  case pipeline_part_pre_rasterization:
+    h = hash_u64(h, desc->vertex_hash);
+    h = hash_specialization(h, desc->vertex_stage.pSpecializationInfo);
+    h = hash_u64(h, (u64)desc->layout);
+    h = hash_u64(h, (u64)desc->render_pass);
+    h = hash_u64(h, desc->color_format);
+    h = hash_u64(h, desc->depth_format);
+    break;
+  case pipeline_part_fragment_shader:
+    h = hash_u64(h, desc->fragment_hash);
+    h = hash_specialization(h, desc->fragment_stage.pSpecializationInfo);
+    h = hash_u64(h, (u64)desc->layout);
+    h = hash_u64(h, (u64)desc->render_pass);
+    h = hash_u64(h, desc->color_format);
+    h = hash_u64(h, desc->depth_format);
+    h = hash_u64(h, desc->samples);
+    break;
+  case pipeline_part_fragment_output:
+    h = hash_u64(h, (u64)desc->render_pass);
+    h = hash_u64(h, desc->color_format);
+    h = hash_u64(h, desc->depth_format);
+    h = hash_u64(h, desc->samples);
+    break;
+  case pipeline_part_count:
+    break;
+  }
+
+  return h;
+}
+
+static bool part_create(pipeline_library *l, pipeline_part_type type,
+                        const graphics_pipeline_desc *desc,
+                        const graphics_pipeline_state *s,
+                        VkPipeline *pipeline) {
+  // every part but the vertex input one needs the attachment formats when
+  // there is no render pass
+  bool rendering = desc->render_pass == VK_NULL_HANDLE &&
+                   type != pipeline_part_vertex_input;
+  VkGraphicsPipelineCreateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+      .pNext =
+          &(VkGraphicsPipelineLibraryCreateInfoEXT){
+              .sType =
+                  VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT,
+              // pNext is not const in older headers
+              .pNext = rendering ? (void *)&s->rendering : NULL,
+              .flags = part_flags[type],
+          },
+      // keep what the optimized link needs to optimize across parts
+      .flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR |
+               VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT,
+      .pDynamicState = &s->dynamic,
+      .subpass = 0,
+      .basePipelineHandle = VK_NULL_HANDLE,
+      .basePipelineIndex = -1,
+  };
+  switch (type) {
+  case pipeline_part_vertex_input:
+    info.pVertexInputState = &s->vertex_input;
+    info.pInputAssemblyState = &s->input_assembly;
+    break;
+  case pipeline_part_pre_rasterization:
+    info.stageCount = 1;
+    info.pStages = &desc->vertex_stage;
+    info.layout = desc->layout;
+    info.renderPass = desc->render_pass;
+    info.pViewportState = &s->viewport_state;
+    info.pRasterizationState = &s->rasterization;
+    break;
+  case pipeline_part_fragment_shader:
+    info.stageCount = 1;
+    info.pStages = &desc->fragment_stage;
+    info.layout = desc->layout;
+    info.renderPass = desc->render_pass;
+    info.pMultisampleState = &s->multisample;
+    info.pDepthStencilState = &s->depth_stencil;
+    break;
+  case pipeline_part_fragment_output:
+    info.renderPass = desc->render_pass;
+    info.pMultisampleState = &s->multisample;
+    info.pColorBlendState = &s->color_blend;
+    break;
+  case pipeline_part_count:
+    break;
+  }
+
+  VkResult result;
+  if ((result = vkCreateGraphicsPipelines(l->device, l->cache, 1, &info, NULL,
+                                          pipeline)) != VK_SUCCESS) {
+    LOG_ERROR("unable to create %s pipeline library: %s", part_names[type],
+              vk_error_to_string(result));
+    return false;
+  }
+
+  return true;
+}
+
+// mutex must be held; the least recently linked part is evicted when full,
+// which is never one of the parts of the current link
+static VkPipeline part_get(pipeline_library *l, pipeline_part_type type,
+                           const graphics_pipeline_desc *desc,
+                           const graphics_pipeline_state *s) {
+  u64 key = part_key(type, desc);
+  for (i32 i = 0; i < l->num_parts; ++i) {
+    if (l->parts[i].key == key) {
+      l->parts[i].last_used = l->clock;
+      ++l->hits;
+      return l->parts[i].pipeline;
+    }
+  }
+
+  u64 start = timer_now_ns();
+  VkPipeline pipeline;
+  if (!part_create(l, type, desc, s, &pipeline)) {
+    return VK_NULL_HANDLE;
+  }
+  ++l->misses;
+  LOG_DEBUG("compiled %s pipeline library in %.3fms", part_names[type],
+            timer_ns_to_ms(timer_now_ns() - start));
+
+  i32 index = l->num_parts;
+  if (index == PIPELINE_LIBRARY_CAPACITY) {
+    index = 0;
+    for (i32 i = 1; i < l->num_parts; ++i) {
+      if (l->parts[i].last_used < l->parts[index].last_used) {
+        index = i;
+      }
+    }
+    vkDestroyPipeline(l->device, l->parts[index].pipeline, NULL);
+  } else {
+    ++l->num_parts;
+  }
+
+  l->parts[index] = (pipeline_library_part){
+      .key = key,
+      .pipeline = pipeline,
+      .last_used = l->clock,
+  };
+  return pipeline;
+}
+
+bool pipeline_library_link(pipeline_library *l,
+                           const graphics_pipeline_desc *desc, bool optimize,
+                           VkPipeline *pipeline) {
+  // libraries must declare the same dynamic state the linked pipeline uses,
+  // none is needed as every part is cached on its own anyway
+  graphics_pipeline_state s;
+  graphics_pipeline_state_init(desc, false, &s);
+
+  pthread_mutex_lock(&l->mutex);
+  ++l->clock;
+  VkPipeline parts[pipeline_part_count];
+  for (i32 i = 0; i < pipeline_part_count; ++i) {
+    if ((parts[i] = part_get(l, i, desc, &s)) == VK_NULL_HANDLE) {
+      pthread_mutex_unlock(&l->mutex);
+      return false;
+    }
+  }
+
+  u64 start = timer_now_ns();
+  VkResult result = vkCreateGraphicsPipelines(
+      l->device, l->cache, 1,
+      &(VkGraphicsPipelineCreateInfo){
+          .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+          .pNext =
+              &(VkPipelineLibraryCreateInfoKHR){
+                  .sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR,
+                  .libraryCount = pipeline_part_count,
+                  .pLibraries = parts,
+              },
+          .flags =
+              optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0,
+          .layout = desc->layout,
+          .basePipelineHandle = VK_NULL_HANDLE,
+          .basePipelineIndex = -1,
+      },
+      NULL, pipeline);
+  pthread_mutex_unlock(&l->mutex);
+  if (result != VK_SUCCESS) {
+    LOG_ERROR("unable to link graphics pipeline: %s",
+              vk_error_to_string(result));
+    return false;
+  }
+
+  LOG_DEBUG("linked graphics pipeline (%s) in %.3fms",
+            optimize ? "optimized" : "fast",
+            timer_ns_to_ms(timer_now_ns() - start));
+  return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "graphics_pipeline.h"
+#include "types.h"
+#include <pthread.h>
+#include <vulkan/vulkan_core.h>
+
+#define PIPELINE_LIBRARY_CAPACITY 64
+
+typedef struct {
+  // hash of everything the part was compiled from
+  u64 key;
+  VkPipeline pipeline;
+  // pipeline_library.clock when the part was last linked, for eviction
+  u64 last_used;
+} pipeline_library_part;
+
+// caches the vertex input, pre-rasterization, fragment shader and fragment
+// output parts of graphics pipelines (VK_EXT_graphics_pipeline_library), so
+// that a changed shader only recompiles the part it is used in and the rest
+// is reused when linking; thread-safe, but links are serialized
+typedef struct {
+  VkDevice device;
+  VkPipelineCache cache;
+  pthread_mutex_t mutex;
+  pipeline_library_part parts[PIPELINE_LIBRARY_CAPACITY];
+  i32 num_parts;
+  u64 clock;
+  u64 hits;
+  u64 misses;
+} pipeline_library;
+
+void pipeline_library_init(VkDevice device, VkPipelineCache cache,
+                           pipeline_library *l);
+void pipeline_library_free(pipeline_library *l);
+// destroys every cached part, must be called before a render pass or pipeline
+// layout the parts were compiled against is destroyed
+void pipeline_library_clear(pipeline_library *l);
+
+// compiles the parts of desc missing from the library and links them into a
+// complete pipeline; a fast link only takes a fraction of the time of a
+// monolithic pipeline, while an optimized one is as slow to create but as
+// fast to execute
+bool pipeline_library_link(pipeline_library *l,
+                           const graphics_pipeline_desc *desc, bool optimize,
+                           VkPipeline *pipeline);
@@ -0,0 +1,542 @@
+#include "reflect.h"
+#include "arena.h"
+#include "log.h"
+#include <string.h>
+
+#define SPIRV_MAGIC 0x07230203
+#define SPIRV_HEADER_WORDS 5
+
+// the subset of the spirv specification needed to recover the resource
+// interface of a module
+enum {
+  op_type_bool = 20,
+  op_type_int = 21,
+  op_type_float = 22,
+  op_type_vector = 23,
+  op_type_matrix = 24,
+  op_type_image = 25,
+  op_type_sampler = 26,
+  op_type_sampled_image = 27,
+  op_type_array = 28,
+  op_type_runtime_array = 29,
+  op_type_struct = 30,
+  op_type_pointer = 32,
+  op_constant = 43,
+  op_variable = 59,
+  op_decorate = 71,
+  op_member_decorate = 72,
+};
+
+enum {
+  decoration_block = 2,
+  decoration_buffer_block = 3,
+  decoration_array_stride = 6,
+  decoration_matrix_stride = 7,
+  decoration_builtin = 11,
+  decoration_location = 30,
+  decoration_binding = 33,
+  decoration_descriptor_set = 34,
+  decoration_offset = 35,
+};
+
+enum {
+  storage_uniform_constant = 0,
+  storage_input = 1,
+  storage_uniform = 2,
+  storage_push_constant = 9,
+  storage_storage_buffer = 12,
+};
+
+enum {
+  dim_buffer = 5,
+  dim_subpass_data = 6,
+};
+
+typedef struct {
+  u32 opcode;
+  // operands of the defining instruction, past the result id
+  const u32 *operands;
+  u32 num_operands;
+
+  u32 set;
+  u32 binding;
+  u32 location;
+  u32 array_stride;
+  bool has_binding;
+  bool has_location;
+  bool builtin;
+  bool block;
+  bool buffer_block;
+} spirv_id;
+
+typedef struct {
+  u32 id;
+  u32 member;
+  u32 decoration;
+  u32 value;
+} spirv_member_decoration;
+
+typedef struct {
+  spirv_id *ids;
+  u32 bound;
+  const spirv_member_decoration *member_decorations;
+  i32 num_member_decorations;
+} spirv_module;
+
+static const spirv_id *spirv_get(const spirv_module *m, u32 id) {
+  return id < m->bound ? &m->ids[id] : NULL;
+}
+
+static bool spirv_member_decoration_value(const spirv_module *m, u32 id,
+                                          u32 member, u32 decoration,
+                                          u32 *value) {
+  for (i32 i = 0; i < m->num_member_decorations; ++i) {
+    const spirv_member_decoration *d = &m->member_decorations[i];
+    if (d->id == id && d->member == member && d->decoration == decoration) {
+      *value = d->value;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static u32 spirv_constant_value(const spirv_module *m, u32 id) {
+  const spirv_id *c = spirv_get(m, id);
+  // operands: result type, result id, literal
+  return c && c->opcode == op_constant ? c->operands[2] : 0;
+}
+
+// size in bytes of a type laid out with explicit offsets and strides, as
+// used for push constant blocks
+static u32 spirv_type_size(const spirv_module *m, u32 type, u32 matrix_stride) {
+  const spirv_id *t = spirv_get(m, type);
+  if (!t) {
+    return 0;
+  }
+
+  switch (t->opcode) {
+  case op_type_bool:
+    return 4;
+  case op_type_int:
+  case op_type_float:
+    return t->operands[0] / 8;
+  case op_type_vector:
+    return t->operands[1] * spirv_type_size(m, t->operands[0], 0);
+  case op_type_matrix:
+    return t->operands[1] * (matrix_stride ? matrix_stride
+                                           : spirv_type_size(
+                                                 m, t->operands[0], 0));
+  case op_type_array:
+    return spirv_constant_value(m, t->operands[1]) *
+           (t->array_stride ? t->array_stride
+                            : spirv_type_size(m, t->operands[0], 0));
+  case op_type_struct: {
+    u32 size = 0;
+    for (u32 i = 0; i < t->num_operands; ++i) {
+      u32 offset = 0, stride = 0;
+      spirv_member_decoration_value(m, type, i, decoration_offset, &offset);
+      spirv_member_decoration_value(m, type, i, decoration_matrix_stride,
+                                    &stride);
+      u32 end = offset + spirv_type_size(m, t->operands[i], stride);
+      size = end > size ? end : size;
+    }
+    return size;
+  }
+  default:
+    return 0;
+  }
+}
+
+static bool spirv_descriptor_type(const spirv_module *m, u32 storage_class,
+                                  const spirv_id *type,
+                                  VkDescriptorType *descriptor_type) {
+  switch (storage_class) {
+  case storage_uniform:
+    if (type->block || type->buffer_block) {
+      *descriptor_type = type->block ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+                                     : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      return true;
+    }
+    return false;
+  case storage_storage_buffer:
+    *descriptor_type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    return true;
+  case storage_uniform_constant:
+    break;
+  default:
+    return false;
+  }
+
+  switch (type->opcode) {
+  case op_type_sampler:
+    *descriptor_type = VK_DESCRIPTOR_TYPE_SAMPLER;
+    return true;
+  case op_type_sampled_image: {
+    const spirv_id *image = spirv_get(m, type->operands[0]);
+    *descriptor_type = image && image->operands[1] == dim_buffer
+                           ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER
+                           : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    return true;
+  }
+  case op_type_image: {
+    // operands: sampled type, dim, depth, arrayed, ms, sampled, format
+    u32 dim = type->operands[1], sampled = type->operands[5];
+    if (dim == dim_subpass_data) {
+      *descriptor_type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    } else if (dim == dim_buffer) {
+      *descriptor_type = sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER
+                                      : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+    } else {
+      *descriptor_type = sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                                      : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    }
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+static VkFormat spirv_vertex_format(const spirv_module *m, u32 type) {
+  static const VkFormat formats[3][4] = {
+      {VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT,
+       VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT},
+      {VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT,
+       VK_FORMAT_R32G32B32A32_SINT},
+      {VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT,
+       VK_FORMAT_R32G32B32A32_UINT},
+  };
+
+  const spirv_id *t = spirv_get(m, type);
+  u32 components = 1;
+  if (t && t->opcode == op_type_vector) {
+    components = t->operands[1];
+    t = spirv_get(m, t->operands[0]);
+  }
+
+  if (!t || components < 1 || components > 4 || t->operands[0] != 32) {
+    return VK_FORMAT_UNDEFINED;
+  }
+
+  if (t->opcode == op_type_float) {
+    return formats[0][components - 1];
+  } else if (t->opcode == op_type_int) {
+    // operands: width, signedness
+    return formats[t->operands[1] ? 1 : 2][components - 1];
+  }
+
+  return VK_FORMAT_UNDEFINED;
+}
+
+static bool reflect_variable(const spirv_module *m, const spirv_id *var,
+                             VkShaderStageFlagBits stage,
+                             shader_reflection *r) {
+  // operands: result type, result id, storage class
+  u32 storage_class = var->operands[2];
+  const spirv_id *pointer = spirv_get(m, var->operands[0]);
+  if (!pointer || pointer->opcode != op_type_pointer) {
+    return false;
+  }
+  const spirv_id *type = spirv_get(m, pointer->operands[1]);
+  if (!type) {
+    return false;
+  }
+
+  if (storage_class == storage_push_constant) {
+    r->push_constants = (VkPushConstantRange){
+        .stageFlags = stage,
+        .offset = 0,
+        .size = spirv_type_size(m, pointer->operands[1], 0),
+    };
+    return true;
+  }
+
+  if (storage_class == storage_input) {
+    if (stage != VK_SHADER_STAGE_VERTEX_BIT || var->builtin ||
+        !var->has_location) {
+      return true;
+    }
+
+    VkFormat format = spirv_vertex_format(m, pointer->operands[1]);
+    if (format == VK_FORMAT_UNDEFINED) {
+      LOG_ERROR("unsupported type for vertex input at location %" PRIu32,
+                var->location);
+      return false;
+    }
+    if (r->num_attributes == REFLECT_MAX_VERTEX_INPUTS) {
+      LOG_ERROR("too many vertex inputs");
+      return false;
+    }
+
+    i32 i = r->num_attributes++;
+    r->attributes[i] = (VkVertexInputAttributeDescription){
+        .location = var->location,
+        .binding = var->location,
+        .format = format,
+        .offset = 0,
+    };
+    r->vertex_bindings[i] = (VkVertexInputBindingDescription){
+        .binding = var->location,
+        .stride = spirv_type_size(m, pointer->operands[1], 0),
+        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+    };
+    return true;
+  }
+
+  u32 count = 1;
+  if (type->opcode == op_type_array) {
+    count = spirv_constant_value(m, type->operands[1]);
+    type = spirv_get(m, type->operands[0]);
+  } else if (type->opcode == op_type_runtime_array) {
+    LOG_ERROR("runtime descriptor arrays are not supported");
+    return false;
+  }
+
+  VkDescriptorType descriptor_type;
+  if (!type || !spirv_descriptor_type(m, storage_class, type,
+                                      &descriptor_type)) {
+    return true;
+  }
+
+  if (!var->has_binding) {
+    LOG_ERROR("descriptor without binding decoration");
+    return false;
+  }
+  if (r->num_bindings == REFLECT_MAX_BINDINGS) {
+    LOG_ERROR("too many descriptor bindings");
+    return false;
+  }
+  if (var->set >= REFLECT_MAX_SETS) {
+    LOG_ERROR("descriptor set %" PRIu32 " out of range", var->set);
+    return false;
+  }
+
+  r->bindings[r->num_bindings++] = (reflect_binding){
+      .set = var->set,
+      .binding =
+          {
+              .binding = var->binding,
+              .descriptorType = descriptor_type,
+              .descriptorCount = count,
+              .stageFlags = stage,
+              .pImmutableSamplers = NULL,
+          },
+  };
+  return true;
+}
+
+bool reflect_spirv(const u32 *code, u32 len, VkShaderStageFlagBits stage,
+                   shader_reflection *r) {
+  u32 num_words = len / sizeof(u32);
+  if (num_words < SPIRV_HEADER_WORDS || code[0] != SPIRV_MAGIC) {
+    LOG_ERROR("invalid spirv module");
+    return false;
+  }
+
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return false;
+  }
+
+  arena_marker marker = arena_mark(scratch);
+  spirv_module m = {.bound = code[3]};
+  // member decorations are bounded by the instruction count
+  spirv_member_decoration *member_decorations =
+      arena_push_array(scratch, spirv_member_decoration, num_words / 4 + 1);
+  m.ids = arena_push_zero(scratch, sizeof(spirv_id) * m.bound,
+                          alignof(spirv_id));
+  if (!m.ids || !member_decorations) {
+    arena_pop(scratch, marker);
+    return false;
+  }
+  m.member_decorations = member_decorations;
+
+  for (u32 i = SPIRV_HEADER_WORDS; i < num_words;) {
+    u32 opcode = code[i] & 0xffff, word_count = code[i] >> 16;
+    if (word_count == 0 || i + word_count > num_words) {
+      LOG_ERROR("malformed spirv instruction at word %" PRIu32, i);
+      arena_pop(scratch, marker);
+      return false;
+    }
+
+    const u32 *ops = &code[i + 1];
+    u32 num_ops = word_count - 1;
+    switch (opcode) {
+    case op_type_bool:
+    case op_type_int:
+    case op_type_float:
+    case op_type_vector:
+    case op_type_matrix:
+    case op_type_image:
+    case op_type_sampler:
+    case op_type_sampled_image:
+    case op_type_array:
+    case op_type_runtime_array:
+    case op_type_struct:
+    case op_type_pointer:
+      if (num_ops >= 1 && ops[0] < m.bound) {
+        m.ids[ops[0]].opcode = opcode;
+        m.ids[ops[0]].operands = &ops[1];
+        m.ids[ops[0]].num_operands = num_ops - 1;
+      }
+      break;
+    case op_constant:
+    case op_variable:
+      // the result type comes before the result id, operands keep both
+      if (num_ops >= 3 && ops[1] < m.bound) {
+        m.ids[ops[1]].opcode = opcode;
+        m.ids[ops[1]].operands = ops;
+        m.ids[ops[1]].num_operands = num_ops;
+      }
+      break;
+    case op_decorate:
+      if (num_ops >= 2 && ops[0] < m.bound) {
+        spirv_id *id = &m.ids[ops[0]];
+        u32 value = num_ops >= 3 ? ops[2] : 0;
+        switch (ops[1]) {
+        case decoration_block:
+          id->block = true;
+          break;
+        case decoration_buffer_block:
+          id->buffer_block = true;
+          break;
+        case decoration_array_stride:
+          id->array_stride = value;
+          break;
+        case decoration_builtin:
+          id->builtin = true;
+          break;
+        case decoration_location:
+          id->location = value;
+          id->has_location = true;
+          break;
+        case decoration_binding:
+          id->binding = value;
+          id->has_binding = true;
+          break;
+        case decoration_descriptor_set:
+          id->set = value;
+          break;
+        }
+      }
+      break;
+    case op_member_decorate:
+      if (num_ops >= 3) {
+        member_decorations[m.num_member_decorations++] =
+            (spirv_member_decoration){
+                .id = ops[0],
+                .member = ops[1],
+                .decoration = ops[2],
+                .value = num_ops >= 4 ? ops[3] : 0,
+            };
+      }
+      break;
+    }
+
+    i += word_count;
+  }
+
+  *r = (shader_reflection){.stages = stage};
+  bool success = true;
+  for (u32 id = 0; id < m.bound && success; ++id) {
+    if (m.ids[id].opcode == op_variable) {
+      success = reflect_variable(&m, &m.ids[id], stage, r);
+    }
+  }
+
+  arena_pop(scratch, marker);
+  return success;
+}
+
+bool reflect_merge(shader_reflection *dst, const shader_reflection *src) {
+  dst->stages |= src->stages;
+  for (i32 i = 0; i < src->num_bindings; ++i) {
+    const reflect_binding *b = &src->bindings[i];
+    reflect_binding *existing = NULL;
+    for (i32 j = 0; j < dst->num_bindings && !existing; ++j) {
+      if (dst->bindings[j].set == b->set &&
+          dst->bindings[j].binding.binding == b->binding.binding) {
+        existing = &dst->bindings[j];
+      }
+    }
+
+    if (existing) {
+      if (existing->binding.descriptorType != b->binding.descriptorType ||
+          existing->binding.descriptorCount != b->binding.descriptorCount) {
+        LOG_ERROR("stages disagree on set %" PRIu32 " binding %" PRIu32,
+                  b->set, b->binding.binding);
+        return false;
+      }
+
+      existing->binding.stageFlags |= b->binding.stageFlags;
+    } else if (dst->num_bindings == REFLECT_MAX_BINDINGS) {
+      LOG_ERROR("too many descriptor bindings");
+      return false;
+    } else {
+      dst->bindings[dst->num_bindings++] = *b;
+    }
+  }
+
+  if (src->push_constants.size > 0) {
+    VkPushConstantRange *p = &dst->push_constants;
+    p->stageFlags |= src->push_constants.stageFlags;
+    p->size = src->push_constants.size > p->size ? src->push_constants.size
+                                                 : p->size;
+  }
+
+  if (src->num_attributes > 0) {
+    memcpy(dst->attributes, src->attributes,
+           sizeof(src->attributes[0]) * src->num_attributes);
+    memcpy(dst->vertex_bindings, src->vertex_bindings,
+           sizeof(src->vertex_bindings[0]) * src->num_attributes);
+    dst->num_attributes = src->num_attributes;
+  }
+
+  return true;
+}
+
+i32 reflect_set_bindings(const shader_reflection *r, u32 set,
+                         VkDescriptorSetLayoutBinding *bindings) {
+  i32 num_bindings = 0;
+  for (i32 i = 0; i < r->num_bindings; ++i) {
+    if (r->bindings[i].set != set) {
+      continue;
+    }
+
+    // insertion sort, there are only a handful of bindings per set
+    i32 j = num_bindings++;
+    while (j > 0 && bindings[j - 1].binding > r->bindings[i].binding.binding) {
+      bindings[j] = bindings[j - 1];
+      --j;
+    }
+    bindings[j] = r->bindings[i].binding;
+  }
+
+  return num_bindings;
+}
+
+u32 reflect_num_sets(const shader_reflection *r) {
+  u32 num_sets = 0;
+  for (i32 i = 0; i < r->num_bindings; ++i) {
+    if (r->bindings[i].set + 1 > num_sets) {
+      num_sets = r->bindings[i].set + 1;
+    }
+  }
+
+  return num_sets;
+}
+
+i32 reflect_find_binding(const shader_reflection *r, u32 set,
+                         VkDescriptorType type) {
+  i32 binding = -1;
+  for (i32 i = 0; i < r->num_bindings; ++i) {
+    const reflect_binding *b = &r->bindings[i];
+    if (b->set == set && b->binding.descriptorType == type &&
+        (binding == -1 || (i32)b->binding.binding < binding)) {
+      binding = b->binding.binding;
+    }
+  }
+
+  return binding;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "types.h"
+#include <vulkan/vulkan_core.h>
+
+#define REFLECT_MAX_SETS 4
+#define REFLECT_MAX_BINDINGS 16
+#define REFLECT_MAX_VERTEX_INPUTS 16
+
+typedef struct {
+  u32 set;
+  VkDescriptorSetLayoutBinding binding;
+} reflect_binding;
+
+// resource interface of one or more shader stages, as declared in spirv
+typedef struct {
+  VkShaderStageFlags stages;
+  reflect_binding bindings[REFLECT_MAX_BINDINGS];
+  i32 num_bindings;
+  // size is 0 if no stage declares push constants
+  VkPushConstantRange push_constants;
+  // vertex stage inputs, every attribute is expected to come from its own
+  // tightly packed vertex buffer binding numbered after its location
+  VkVertexInputAttributeDescription attributes[REFLECT_MAX_VERTEX_INPUTS];
+  VkVertexInputBindingDescription vertex_bindings[REFLECT_MAX_VERTEX_INPUTS];
+  i32 num_attributes;
+} shader_reflection;
+
+bool reflect_spirv(const u32 *code, u32 len, VkShaderStageFlagBits stage,
+                   shader_reflection *r);
+// folds src into dst, bindings declared by several stages have their stage
+// flags combined and must agree on type and count
+bool reflect_merge(shader_reflection *dst, const shader_reflection *src);
+
+// bindings of one descriptor set sorted by binding number, returns the count
+i32 reflect_set_bindings(const shader_reflection *r, u32 set,
+                         VkDescriptorSetLayoutBinding *bindings);
+// number of descriptor sets, i.e. the highest set index in use plus one
+u32 reflect_num_sets(const shader_reflection *r);
+// lowest numbered binding of type in set, -1 if there is none
+i32 reflect_find_binding(const shader_reflection *r, u32 set,
+                         VkDescriptorType type);
@@ -1,31 +1,101 @@
 #include "shader.h"
+#include "arena.h"
+#include "file.h"
+#include "hash.h"
+#include "log.h"
+#include "timer.h"
+#include "trace.h"
 #include "vk_utils.h"
 #include <assert.h>
-#include <logger.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifndef SHADER_BUNDLE
 #include <shaderc/shaderc.h>
+#endif
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vulkan/vulkan_core.h>
 #ifndef __USE_MISC
 #define __USE_MISC
 #endif
 #include <stdlib.h>
 
+static void shader_variant_stats_init(shader_variant_stats *stats) {
+  pthread_mutex_init(&stats->mutex, NULL);
+  stats->num_variants = 0;
+}
+
+static void shader_variant_stats_free(shader_variant_stats *stats) {
+  u64 compile_ns = 0, spirv_bytes = 0;
+  for (i32 i = 0; i < stats->num_variants; ++i) {
+    compile_ns += stats->variants[i].compile_ns;
+    spirv_bytes += stats->variants[i].spirv_bytes;
+  }
+  LOG_INFO("shader variants: %" PRIi32 " built, %.3fms of compilation, %" PRIu64
+           " bytes of spirv",
+           stats->num_variants, timer_ns_to_ms(compile_ns), spirv_bytes);
+  pthread_mutex_destroy(&stats->mutex);
+}
+
+static int compare_keywords(const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+i32 shader_variant_sorted_keywords(const shader_variant *variant,
+                                   const char **sorted) {
+  i32 num_keywords = variant ? variant->num_keywords : 0;
+  for (i32 i = 0; i < num_keywords; ++i) {
+    sorted[i] = variant->keywords[i];
+  }
+  qsort(sorted, num_keywords, sizeof(*sorted), compare_keywords);
+  return num_keywords;
+}
+
+static void shader_variant_record(shader_compiler *compiler, u64 key,
+                                  u64 compile_ns, u32 spirv_bytes) {
+  shader_variant_stats *stats = &compiler->variant_stats;
+  pthread_mutex_lock(&stats->mutex);
+  shader_variant_info *info = NULL;
+  for (i32 i = 0; i < stats->num_variants && !info; ++i) {
+    if (stats->variants[i].key == key) {
+      info = &stats->variants[i];
+    }
+  }
+
+  if (!info && stats->num_variants < SHADER_MAX_VARIANTS) {
+    info = &stats->variants[stats->num_variants++];
+  }
+  if (info) {
+    *info = (shader_variant_info){
+        .key = key,
+        .compile_ns = compile_ns,
+        .spirv_bytes = spirv_bytes,
+    };
+  }
+  pthread_mutex_unlock(&stats->mutex);
+}
+
+#ifndef SHADER_BUNDLE
 #ifdef __unix__
 #include <libgen.h>
+#include <limits.h>
 #include <string.h>
 
-static char *concat_path(const char *a, const char *b) {
+static char *concat_path(arena *out, const char *a, const char *b) {
   i32 len_a = strlen(a), len_b = strlen(b);
   assert(len_a > 0);
   bool needs_slash = a[len_a - 1] != '/';
 
-  char *p = calloc(len_a + needs_slash + len_b + 1, 1);
+  char *p = arena_push_zero(out, len_a + needs_slash + len_b + 1, 1);
   if (!p) {
     return NULL;
   }
 
+  memcpy(p, a, len_a);
   if (needs_slash) {
-    memcpy(p, a, len_a);
     p[len_a] = '/';
     ++len_a;
   }
@@ -35,102 +105,415 @@ static char *concat_path(const char *a, const char *b) {
   return p;
 }
 
-static char *resolve_sibling(const char *a, const char *b) {
-  char *dir = malloc(strlen(a) + 1);
+// joins requested onto the directory containing the requesting file
+static char *resolve_sibling(arena *out, const char *requesting,
+                             const char *requested) {
+  arena_marker marker = arena_mark(out);
+  char *dir = arena_strdup(out, requesting);
   if (!dir) {
     return NULL;
   }
 
-  strcpy(dir, a);
-  char *path = concat_path(dir, b);
-  free(dir);
+  char *path = concat_path(out, dirname(dir), requested);
+  if (!path) {
+    arena_pop(out, marker);
+  }
 
   return path;
 }
-#else
-#warning shaderc include support disabled. Please implement your own file path functions for non-unix platforms
-#endif
 
-static char *read_file(const char *path, i32 *len) {
-  FILE *file = fopen(path, "rb");
-  if (!file) {
-    goto fail_fopen;
+// like realpath, but also resolves files that have just been deleted
+static bool canonical_path(const char *path, char *resolved) {
+  if (realpath(path, resolved)) {
+    return true;
   }
 
-  fseek(file, 0, SEEK_END);
-  long s_len = ftell(file);
-  assert(s_len >= 0);
-  *len = s_len;
-  fseek(file, 0, SEEK_SET);
-
-  char *buf = malloc(*len);
-  if (!buf) {
-    LOG_ERROR("unable to allocate buffer for file");
-    goto fail_malloc;
+  char dir[PATH_MAX], base[PATH_MAX], real_dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", path);
+  snprintf(base, sizeof(base), "%s", path);
+  if (!realpath(dirname(dir), real_dir)) {
+    return false;
   }
 
-  fread(buf, *len, 1, file);
-  assert(!ferror(file));
-  assert(fgetc(file) == EOF && feof(file));
+  const char *name = basename(base);
+  if (strlen(real_dir) + 1 + strlen(name) >= PATH_MAX) {
+    return false;
+  }
 
-  fclose(file);
-  return buf;
+  stpcpy(stpcpy(stpcpy(resolved, real_dir), "/"), name);
+  return true;
+}
+#else
+#warning shaderc include support disabled. Please implement your own file path functions for non-unix platforms
+#endif
 
-  free(buf);
-fail_malloc:
-  fclose(file);
-fail_fopen:
-  return NULL;
+static void release_compile_options(void *opts) {
+  shaderc_compile_options_release(opts);
 }
 
-bool shader_compiler_init(shader_compiler *compiler) {
+bool shader_compiler_init(shader_compiler *compiler, const char *cache_dir) {
   compiler->compiler = shaderc_compiler_initialize();
   if (!compiler->compiler) {
     LOG_ERROR("unable to initialize shaderc shader compiler");
-    return false;
+    goto fail_compiler;
+  }
+
+  int error;
+  if ((error = pthread_key_create(&compiler->options_key,
+                                  release_compile_options)) != 0) {
+    LOG_ERROR("unable to create compile options thread-local key: %s",
+              strerror(error));
+    goto fail_options_key;
+  }
+
+  pthread_mutex_init(&compiler->graph.mutex, NULL);
+  compiler->graph.num_files = 0;
+  shader_variant_stats_init(&compiler->variant_stats);
+  compiler->cache_dir = cache_dir;
+  atomic_init(&compiler->cache_stats.hits, 0);
+  atomic_init(&compiler->cache_stats.misses, 0);
+  atomic_init(&compiler->cache_stats.saved_ns, 0);
+  if (cache_dir && mkdir(cache_dir, 0755) == -1 && errno != EEXIST) {
+    LOG_WARN("unable to create shader cache directory '%s': %s, spirv "
+             "caching will be disabled",
+             cache_dir, strerror(errno));
+    compiler->cache_dir = NULL;
   }
 
   return true;
+
+fail_options_key:
+  shaderc_compiler_release(compiler->compiler);
+fail_compiler:
+  return false;
 }
 
 void shader_compiler_free(shader_compiler *compiler) {
+  if (compiler->cache_dir) {
+    shader_cache_stats *stats = &compiler->cache_stats;
+    LOG_INFO("shader cache: %" PRIu64 " hit(s), %" PRIu64
+             " miss(es), %.3fms of compilation saved",
+             (u64)atomic_load(&stats->hits), (u64)atomic_load(&stats->misses),
+             timer_ns_to_ms(atomic_load(&stats->saved_ns)));
+  }
+
+  shader_variant_stats_free(&compiler->variant_stats);
+
+  // key destructors only run for exiting threads, not the current one
+  shaderc_compile_options_t opts = pthread_getspecific(compiler->options_key);
+  if (opts) {
+    shaderc_compile_options_release(opts);
+  }
+  pthread_key_delete(compiler->options_key);
   shaderc_compiler_release(compiler->compiler);
+
+  shader_graph *g = &compiler->graph;
+  for (i32 i = 0; i < g->num_files; ++i) {
+    free(g->files[i].path);
+    free(g->files[i].root_name);
+    free(g->files[i].content);
+  }
+  pthread_mutex_destroy(&g->mutex);
 }
 
+static shaderc_compile_options_t
+thread_compile_options(shader_compiler *compiler) {
+  shaderc_compile_options_t opts = pthread_getspecific(compiler->options_key);
+  if (!opts) {
+    if (!(opts = shaderc_compile_options_initialize())) {
+      LOG_ERROR("unable to initialize shaderc compile options");
+      return NULL;
+    }
+
+    shaderc_compile_options_set_optimization_level(
+        opts, shaderc_optimization_level_performance);
+    pthread_setspecific(compiler->options_key, opts);
+  }
+
+  return opts;
+}
+
+// all shader_graph_* helpers except shader_graph_read expect the graph mutex
+// to be held
+static i32 shader_graph_find(const shader_graph *g, const char *path) {
+  for (i32 i = 0; i < g->num_files; ++i) {
+    if (strcmp(g->files[i].path, path) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static i32 shader_graph_insert(shader_graph *g, const char *path) {
+  i32 i = shader_graph_find(g, path);
+  if (i != -1) {
+    return i;
+  }
+
+  if (g->num_files == SHADER_GRAPH_MAX_FILES) {
+    LOG_WARN("shader include graph full, changes to '%s' will not trigger "
+             "rebuilds",
+             path);
+    return -1;
+  }
+
+  char *copy = strdup(path);
+  if (!copy) {
+    LOG_ERROR("unable to allocate shader include graph path");
+    return -1;
+  }
+
+  g->files[g->num_files] = (shader_graph_file){.path = copy};
+  return g->num_files++;
+}
+
+static void shader_graph_add_include(shader_graph *g, i32 file, i32 include) {
+  shader_graph_file *f = &g->files[file];
+  for (i32 i = 0; i < f->num_includes; ++i) {
+    if (f->includes[i] == include) {
+      return;
+    }
+  }
+
+  if (f->num_includes == SHADER_GRAPH_MAX_INCLUDES) {
+    LOG_WARN("'%s' has too many includes to track", f->path);
+    return;
+  }
+
+  f->includes[f->num_includes++] = include;
+}
+
+// reads the file at a canonical path through the content cache, the returned
+// copy is pushed onto out
+static char *shader_graph_read(shader_graph *g, const char *path, arena *out,
+                               i32 *len) {
+  pthread_mutex_lock(&g->mutex);
+  i32 i = shader_graph_insert(g, path);
+  u32 generation = 0;
+  if (i != -1) {
+    const shader_graph_file *f = &g->files[i];
+    if (f->content) {
+      char *copy = arena_push(out, f->content_len, 1);
+      if (copy) {
+        memcpy(copy, f->content, f->content_len);
+        *len = f->content_len;
+      }
+
+      pthread_mutex_unlock(&g->mutex);
+      return copy;
+    }
+
+    generation = f->generation;
+  }
+  pthread_mutex_unlock(&g->mutex);
+
+  char *content = file_read(out, path, len);
+  if (!content || i == -1) {
+    return content;
+  }
+
+  char *cached = malloc(*len + 1);
+  if (!cached) {
+    return content;
+  }
+
+  memcpy(cached, content, *len);
+  pthread_mutex_lock(&g->mutex);
+  shader_graph_file *f = &g->files[i];
+  // the file may have changed again while it was being read
+  if (!f->content && f->generation == generation) {
+    f->content = cached;
+    f->content_len = *len;
+    cached = NULL;
+  }
+  pthread_mutex_unlock(&g->mutex);
+
+  free(cached);
+  return content;
+}
+
+typedef struct shader_include shader_include;
+struct shader_include {
+  // canonical paths of the included and including file
+  const char *path;
+  const char *includer;
+  const char *content;
+  usize content_len;
+  shader_include *next;
+};
+
+// collects every include resolved during one compilation, in resolution
+// order, so that cache keys can cover the transitive include closure
+typedef struct {
+  shader_graph *graph;
+  shader_include *first;
+  shader_include *last;
+} shader_include_recorder;
+
+static shader_include *shader_include_record(arena *out,
+                                             shader_include_recorder *recorder,
+                                             const char *path,
+                                             const char *includer) {
+  shader_include *include =
+      arena_push(out, sizeof(*include), alignof(shader_include));
+  if (!include) {
+    return NULL;
+  }
+
+  *include = (shader_include){.path = path, .includer = includer};
+  if (recorder->last) {
+    recorder->last->next = include;
+  } else {
+    recorder->first = include;
+  }
+  recorder->last = include;
+  return include;
+}
+
+// replaces the include edges of root and of every file it pulled in with the
+// ones seen while loading root
+static void shader_graph_record(shader_graph *g, const char *root_path,
+                                const char *root_name,
+                                const shader_include_recorder *recorder) {
+  pthread_mutex_lock(&g->mutex);
+  i32 root = shader_graph_insert(g, root_path);
+  if (root != -1) {
+    shader_graph_file *f = &g->files[root];
+    if (!f->root_name && !(f->root_name = strdup(root_name))) {
+      LOG_ERROR("unable to allocate shader name");
+    }
+    f->num_includes = 0;
+  }
+
+  for (shader_include *i = recorder->first; i; i = i->next) {
+    i32 file = shader_graph_insert(g, i->path);
+    if (file != -1) {
+      g->files[file].num_includes = 0;
+    }
+  }
+
+  for (shader_include *i = recorder->first; i; i = i->next) {
+    i32 includer = shader_graph_insert(g, i->includer);
+    i32 file = shader_graph_insert(g, i->path);
+    if (includer != -1 && file != -1) {
+      shader_graph_add_include(g, includer, file);
+    }
+  }
+  pthread_mutex_unlock(&g->mutex);
+}
+
+i32 shader_compiler_invalidate(shader_compiler *compiler, const char *path,
+                               const char **roots, i32 max_roots) {
+  char canonical[PATH_MAX];
+  if (!canonical_path(path, canonical)) {
+    return 0;
+  }
+
+  shader_graph *g = &compiler->graph;
+  pthread_mutex_lock(&g->mutex);
+  i32 changed = shader_graph_find(g, canonical);
+  if (changed == -1) {
+    pthread_mutex_unlock(&g->mutex);
+    return 0;
+  }
+
+  shader_graph_file *f = &g->files[changed];
+  free(f->content);
+  f->content = NULL;
+  ++f->generation;
+
+  // follow include edges backwards until no new dependents show up
+  bool dependent[SHADER_GRAPH_MAX_FILES] = {};
+  dependent[changed] = true;
+  for (bool grew = true; grew;) {
+    grew = false;
+    for (i32 i = 0; i < g->num_files; ++i) {
+      for (i32 j = 0; !dependent[i] && j < g->files[i].num_includes; ++j) {
+        if (dependent[g->files[i].includes[j]]) {
+          dependent[i] = grew = true;
+        }
+      }
+    }
+  }
+
+  i32 num_roots = 0;
+  for (i32 i = 0; i < g->num_files; ++i) {
+    if (dependent[i] && g->files[i].root_name) {
+      if (num_roots < max_roots) {
+        roots[num_roots] = g->files[i].root_name;
+      }
+      ++num_roots;
+    }
+  }
+  pthread_mutex_unlock(&g->mutex);
+
+  return num_roots;
+}
+
+void shader_compiler_new_files(shader_compiler *compiler, i32 *num_seen,
+                               void (*visit)(const char *path, void *user_data),
+                               void *user_data) {
+  shader_graph *g = &compiler->graph;
+  pthread_mutex_lock(&g->mutex);
+  for (; *num_seen < g->num_files; ++*num_seen) {
+    visit(g->files[*num_seen].path, user_data);
+  }
+  pthread_mutex_unlock(&g->mutex);
+}
+
+// include results live on the compiling thread's scratch arena, which
+// shader_compile_file pops once compilation finishes
 static shaderc_include_result *
 shader_resolver(void *user_data, const char *requested_source, int type,
                 const char *requesting_source, usize include_depth) {
-  (void)user_data;
+  shader_include_recorder *recorder = user_data;
   (void)include_depth;
-  shaderc_include_result *result = malloc(sizeof(*result));
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return NULL;
+  }
+
+  arena_marker marker = arena_mark(scratch);
+  shaderc_include_result *result =
+      arena_push(scratch, sizeof(*result), alignof(shaderc_include_result));
   if (!result) {
     return NULL;
   }
 
   if (type == shaderc_include_type_relative) {
-    char *relative = resolve_sibling(requested_source, requesting_source);
-    if (relative) {
+    char *relative =
+        resolve_sibling(scratch, requesting_source, requested_source);
+    char *source_name = arena_push(scratch, PATH_MAX, 1);
+    char *includer = arena_push(scratch, PATH_MAX, 1);
+    if (relative && source_name && includer &&
+        realpath(relative, source_name) &&
+        realpath(requesting_source, includer)) {
       i32 length;
-      result->content = read_file(relative, &length);
-      result->content_length = length;
-      if (result->content) {
-        result->source_name = realpath(relative, NULL);
+      result->content =
+          shader_graph_read(recorder->graph, source_name, scratch, &length);
+      shader_include *include =
+          result->content
+              ? shader_include_record(scratch, recorder, source_name, includer)
+              : NULL;
+      if (include) {
+        result->content_length = length;
+        result->source_name = source_name;
         result->source_name_length = strlen(result->source_name);
+        include->content = result->content;
+        include->content_len = length;
         return result;
       }
-
-      free(relative);
     }
   }
 
-  free(result);
+  arena_pop(scratch, marker);
   return NULL;
 }
 
 static void shader_releaser(void *user_data, shaderc_include_result *result) {
   (void)user_data;
-  free((void *)result->content);
-  free((void *)result->source_name);
+  (void)result;
 }
 
 static const char *shader_status_to_string(shaderc_compilation_status status) {
@@ -151,38 +534,60 @@ static const char *shader_status_to_string(shaderc_compilation_status status) {
   return "shader_compilation_status_unknown";
 }
 
-u32 *shader_compile_file(shader_compiler *compiler, const char *filename,
-                         u32 *bytes_len) {
-  i32 len;
-  char *buf = read_file(filename, &len);
-  if (!buf) {
-    LOG_ERROR("unable to read file at path '%s'", filename);
-    goto fail_read_file;
+// include results are pushed onto the scratch arena, the caller must keep them
+// alive until it is done with the recorder
+static shaderc_compilation_result_t
+compile_spirv(shader_compiler *compiler, const char *filename,
+              const shader_variant *variant, const char *source,
+              i32 source_len, shader_include_recorder *recorder) {
+  shaderc_compile_options_t base = thread_compile_options(compiler);
+  if (!base) {
+    return NULL;
   }
 
-  shaderc_compile_options_t opts = shaderc_compile_options_initialize();
+  // macros are added to a copy so the per-thread options stay keyword-free
+  shaderc_compile_options_t opts = base;
+  if (variant && variant->num_keywords > 0) {
+    if (!(opts = shaderc_compile_options_clone(base))) {
+      LOG_ERROR("unable to clone shaderc compile options");
+      return NULL;
+    }
+
+    for (i32 i = 0; i < variant->num_keywords; ++i) {
+      const char *keyword = variant->keywords[i];
+      const char *value = strchr(keyword, '=');
+      usize name_len = value ? (usize)(value - keyword) : strlen(keyword);
+      value = value ? value + 1 : "1";
+      shaderc_compile_options_add_macro_definition(opts, keyword, name_len,
+                                                   value, strlen(value));
+    }
+  }
+
+  // the recorder differs per compilation, everything else is shared
   shaderc_compile_options_set_include_callbacks(opts, shader_resolver,
-                                                shader_releaser, NULL);
+                                                shader_releaser, recorder);
+  TRACE_BEGIN("shader compile");
   shaderc_compilation_result_t result = shaderc_compile_into_spv(
-      compiler->compiler, buf, len, shaderc_glsl_infer_from_source, filename,
-      "main", opts);
-  free(buf);
+      compiler->compiler, source, source_len, shaderc_glsl_infer_from_source,
+      filename, "main", opts);
+  TRACE_END();
+  if (opts != base) {
+    shaderc_compile_options_release(opts);
+  }
 
   shaderc_compilation_status status =
       shaderc_result_get_compilation_status(result);
   if (status != shaderc_compilation_status_success) {
     LOG_ERROR("error compiling shader: %s", shader_status_to_string(status));
-    LOG_ERROR("shader compilation log (%" PRIi32 " error(s), %" PRIi32
+    LOG_ERROR("shader compilation log (%zu error(s), %zu"
               " warning(s)):",
               shaderc_result_get_num_errors(result),
               shaderc_result_get_num_warnings(result));
     LOG_ERROR("\t%s", shaderc_result_get_error_message(result));
-    goto fail_compilation;
+    shaderc_result_release(result);
+    return NULL;
   }
 
-  *bytes_len = shaderc_result_get_length(result);
-  shaderc_compile_options_release(opts);
-
   i32 num_errors = shaderc_result_get_num_errors(result),
       num_warnings = shaderc_result_get_num_warnings(result);
   const char *log = shaderc_result_get_error_message(result);
@@ -193,56 +598,493 @@ u32 *shader_compile_file(shader_compiler *compiler, const char *filename,
     LOG_DEBUG("\t%s", shaderc_result_get_error_message(result));
   }
 
-  char *bytes = malloc(*bytes_len);
+  return result;
+}
+
+// copies the bytecode out of result and releases it
+static u32 *copy_spirv(shaderc_compilation_result_t result, arena *out,
+                       u32 *bytes_len) {
+  *bytes_len = shaderc_result_get_length(result);
+  u32 *bytes = arena_push(out, *bytes_len, alignof(u32));
   if (!bytes) {
     LOG_ERROR("unable to allocate spirv bytecode buffer");
-    goto fail_malloc;
+  } else {
+    memcpy(bytes, shaderc_result_get_bytes(result), *bytes_len);
   }
 
-  memcpy(bytes, shaderc_result_get_bytes(result), *bytes_len);
   shaderc_result_release(result);
-  return (u32 *)bytes;
-fail_malloc:
-fail_compilation:
-  shaderc_result_release(result);
-  shaderc_compile_options_release(opts);
-fail_read_file:
-  return NULL;
+  return bytes;
 }
 
-bool shader_compile_vk_module(shader_compiler *compiler, const char *filename,
-                              VkDevice device, VkShaderModule *module) {
-  u32 len;
-  u32 *code = shader_compile_file(compiler, filename, &len);
-  if (!code) {
+u32 *shader_compile_file(shader_compiler *compiler, const char *filename,
+                         const shader_variant *variant, arena *out,
+                         u32 *bytes_len) {
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return NULL;
+  }
+
+  arena_marker marker = arena_mark(scratch);
+  i32 len;
+  char *buf = file_read(scratch, filename, &len);
+  if (!buf) {
+    LOG_ERROR("unable to read file at path '%s'", filename);
+    return NULL;
+  }
+
+  shader_include_recorder recorder = {.graph = &compiler->graph};
+  shaderc_compilation_result_t result =
+      compile_spirv(compiler, filename, variant, buf, len, &recorder);
+  arena_pop(scratch, marker);
+  if (!result) {
+    return NULL;
+  }
+
+  return copy_spirv(result, out, bytes_len);
+}
+
+// bump whenever the cache file layout or key derivation changes
+#define SHADER_CACHE_VERSION 2
+#define SHADER_CACHE_MAGIC 0x56504b43 // "CKPV"
+#define SHADER_MANIFEST_HEADER "cvk-shader-deps 1\n"
+
+typedef struct {
+  u32 magic;
+  u32 code_len;
+  u64 compile_ns;
+} shader_cache_header;
+
+// covers everything besides the sources that affects the produced bytecode:
+// the cache format, compile options, variant keywords and the spirv version
+// shaderc targets
+static u64 shader_options_hash(const shader_variant *variant) {
+  unsigned int spv_version, spv_revision;
+  shaderc_get_spv_version(&spv_version, &spv_revision);
+
+  u64 h = hash_u64(HASH_INIT, SHADER_CACHE_VERSION);
+  h = hash_u64(h, spv_version);
+  h = hash_u64(h, spv_revision);
+  h = hash_str(h, "stage=infer;entry=main;opt=performance");
+  const char *keywords[SHADER_MAX_KEYWORDS];
+  i32 num_keywords = shader_variant_sorted_keywords(variant, keywords);
+  h = hash_u64(h, num_keywords);
+  for (i32 i = 0; i < num_keywords; ++i) {
+    h = hash_str(h, keywords[i]);
+  }
+  return h;
+}
+
+static u64 shader_key_begin(const shader_variant *variant, const char *source,
+                            i32 source_len) {
+  u64 h = shader_options_hash(variant);
+  h = hash_u64(h, source_len);
+  return hash_bytes(h, source, source_len);
+}
+
+static u64 shader_key_include(u64 h, const char *path, const char *content,
+                              usize content_len) {
+  h = hash_str(h, path);
+  h = hash_u64(h, content_len);
+  return hash_bytes(h, content, content_len);
+}
+
+static void shader_cache_path(const shader_compiler *compiler, u64 key,
+                              const char *extension, char *path) {
+  snprintf(path, PATH_MAX, "%s/%016" PRIx64 ".%s", compiler->cache_dir, key,
+           extension);
+}
+
+static u64 shader_variant_key(const shader_variant *variant,
+                              const char *filename) {
+  return hash_str(shader_options_hash(variant), filename);
+}
+
+static void shader_manifest_path(const shader_compiler *compiler,
+                                 const shader_variant *variant,
+                                 const char *filename, char *path) {
+  shader_cache_path(compiler, shader_variant_key(variant, filename), "dep",
+                    path);
+}
+
+// checks that keyword (NAME or NAME=VALUE) is listed on one of the
+// '#pragma keywords' lines of source
+static bool shader_declares_keyword(const char *source, i32 source_len,
+                                    const char *keyword) {
+  const char *value = strchr(keyword, '=');
+  usize name_len = value ? (usize)(value - keyword) : strlen(keyword);
+  const char *directive = "#pragma keywords";
+  usize directive_len = strlen(directive);
+  const char *line = source, *end = &source[source_len];
+  while (line < end) {
+    const char *line_end = memchr(line, '\n', end - line);
+    line_end = line_end ? line_end : end;
+    if ((usize)(line_end - line) > directive_len &&
+        memcmp(line, directive, directive_len) == 0) {
+      const char *token = &line[directive_len];
+      while (token < line_end) {
+        while (token < line_end && (*token == ' ' || *token == '\t')) {
+          ++token;
+        }
+
+        const char *token_end = token;
+        while (token_end < line_end && *token_end != ' ' &&
+               *token_end != '\t' && *token_end != '\r') {
+          ++token_end;
+        }
+
+        if ((usize)(token_end - token) == name_len &&
+            memcmp(token, keyword, name_len) == 0) {
+          return true;
+        }
+        token = token_end;
+      }
+    }
+
+    line = line_end + 1;
+  }
+
+  return false;
+}
+
+// returns false on any cache miss: missing manifest, an include that can no
+// longer be read, or a missing/corrupt bytecode blob
+static bool shader_cache_lookup(shader_compiler *compiler, const char *filename,
+                                const shader_variant *variant,
+                                const char *root_path, const char *source,
+                                i32 source_len, shader_binary *binary) {
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return false;
+  }
+
+  char path[PATH_MAX];
+  shader_manifest_path(compiler, variant, filename, path);
+
+  arena_marker marker = arena_mark(scratch);
+  i32 manifest_len;
+  char *manifest = file_read(scratch, path, &manifest_len);
+  usize header_len = strlen(SHADER_MANIFEST_HEADER);
+  if (!manifest || manifest_len < (i32)header_len ||
+      memcmp(manifest, SHADER_MANIFEST_HEADER, header_len) != 0) {
+    goto miss;
+  }
+
+  // the manifest only lists the flattened include closure, so on a hit the
+  // graph records every include as coming directly from the root
+  shader_include_recorder recorder = {.graph = &compiler->graph};
+  u64 key = shader_key_begin(variant, source, source_len);
+  char *line = &manifest[header_len];
+  char *end = &manifest[manifest_len];
+  while (line < end) {
+    char *newline = memchr(line, '\n', end - line);
+    if (!newline) {
+      break;
+    }
+
+    *newline = '\0';
+    if (!shader_include_record(scratch, &recorder, line, root_path)) {
+      goto miss;
+    }
+
+    arena_marker include_marker = arena_mark(scratch);
+    i32 include_len;
+    char *include =
+        shader_graph_read(&compiler->graph, line, scratch, &include_len);
+    if (!include) {
+      goto miss;
+    }
+
+    key = shader_key_include(key, line, include, include_len);
+    arena_pop(scratch, include_marker);
+    line = newline + 1;
+  }
+
+  shader_cache_path(compiler, key, "spv", path);
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    goto miss;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(shader_cache_header)) {
+    close(fd);
+    goto miss;
+  }
+
+  void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    LOG_WARN("unable to map shader cache entry '%s': %s", path,
+             strerror(errno));
+    goto miss;
+  }
+
+  const shader_cache_header *header = mapping;
+  if (header->magic != SHADER_CACHE_MAGIC ||
+      header->code_len != st.st_size - sizeof(shader_cache_header)) {
+    LOG_WARN("corrupt shader cache entry '%s', ignoring", path);
+    munmap(mapping, st.st_size);
+    goto miss;
+  }
+
+  binary->code = (const u32 *)&header[1];
+  binary->len = header->code_len;
+  binary->mapping = mapping;
+  binary->mapping_len = st.st_size;
+
+  shader_graph_record(&compiler->graph, root_path, filename, &recorder);
+  shader_variant_record(compiler, shader_variant_key(variant, filename),
+                        header->compile_ns, header->code_len);
+  arena_pop(scratch, marker);
+  atomic_fetch_add(&compiler->cache_stats.hits, 1);
+  atomic_fetch_add(&compiler->cache_stats.saved_ns, header->compile_ns);
+  LOG_DEBUG("shader cache hit for '%s' (saved %.3fms)", filename,
+            timer_ns_to_ms(header->compile_ns));
+  return true;
+
+miss:
+  arena_pop(scratch, marker);
+  return false;
+}
+
+static void shader_cache_store(shader_compiler *compiler, const char *filename,
+                               const shader_variant *variant,
+                               const char *source, i32 source_len,
+                               const shader_include_recorder *recorder,
+                               shaderc_compilation_result_t result,
+                               u64 compile_ns) {
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return;
+  }
+
+  arena_marker marker = arena_mark(scratch);
+
+  u64 key = shader_key_begin(variant, source, source_len);
+  usize manifest_len = strlen(SHADER_MANIFEST_HEADER);
+  for (shader_include *i = recorder->first; i; i = i->next) {
+    key = shader_key_include(key, i->path, i->content, i->content_len);
+    manifest_len += strlen(i->path) + 1;
+  }
+
+  char *manifest = arena_push(scratch, manifest_len + 1, 1);
+  if (!manifest) {
+    return;
+  }
+
+  char *cursor = stpcpy(manifest, SHADER_MANIFEST_HEADER);
+  for (shader_include *i = recorder->first; i; i = i->next) {
+    cursor = stpcpy(cursor, i->path);
+    *cursor++ = '\n';
+  }
+
+  char path[PATH_MAX];
+  shader_cache_header header = {
+      .magic = SHADER_CACHE_MAGIC,
+      .code_len = shaderc_result_get_length(result),
+      .compile_ns = compile_ns,
+  };
+  shader_cache_path(compiler, key, "spv", path);
+  // the blob goes first, a manifest pointing at a missing blob is only a miss
+  if (file_write_atomic(path, &header, sizeof(header),
+                        shaderc_result_get_bytes(result), header.code_len)) {
+    shader_manifest_path(compiler, variant, filename, path);
+    file_write_atomic(path, NULL, 0, manifest, manifest_len);
+  }
+
+  arena_pop(scratch, marker);
+}
+
+bool shader_load_binary(shader_compiler *compiler, const char *filename,
+                        const shader_variant *variant, arena *out,
+                        shader_binary *binary) {
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return false;
+  }
+
+  char root_path[PATH_MAX];
+  if (!realpath(filename, root_path)) {
+    LOG_ERROR("unable to resolve shader path '%s': %s", filename,
+              strerror(errno));
+    return false;
+  }
+
+  arena_marker marker = arena_mark(scratch);
+  i32 len;
+  char *source = shader_graph_read(&compiler->graph, root_path, scratch, &len);
+  if (!source) {
+    LOG_ERROR("unable to read file at path '%s'", filename);
+    return false;
+  }
+
+  // an undeclared keyword would only fragment the cache with identical
+  // variants, or silently do nothing if misspelled
+  for (i32 i = 0; variant && i < variant->num_keywords; ++i) {
+    if (!shader_declares_keyword(source, len, variant->keywords[i])) {
+      LOG_ERROR("shader '%s' does not declare keyword '%s'", filename,
+                variant->keywords[i]);
+      arena_pop(scratch, marker);
+      return false;
+    }
+  }
+
+  if (compiler->cache_dir &&
+      shader_cache_lookup(compiler, filename, variant, root_path, source, len,
+                          binary)) {
+    arena_pop(scratch, marker);
+    return true;
+  }
+
+  u64 start = timer_now_ns();
+  shader_include_recorder recorder = {.graph = &compiler->graph};
+  shaderc_compilation_result_t result =
+      compile_spirv(compiler, filename, variant, source, len, &recorder);
+  if (!result) {
+    arena_pop(scratch, marker);
+    return false;
+  }
+
+  u64 compile_ns = timer_now_ns() - start;
+  LOG_DEBUG("compiled shader '%s' in %.3fms", filename,
+            timer_ns_to_ms(compile_ns));
+  shader_graph_record(&compiler->graph, root_path, filename, &recorder);
+  shader_variant_record(compiler, shader_variant_key(variant, filename),
+                        compile_ns, shaderc_result_get_length(result));
+  if (compiler->cache_dir) {
+    atomic_fetch_add(&compiler->cache_stats.misses, 1);
+    shader_cache_store(compiler, filename, variant, source, len, &recorder,
+                       result, compile_ns);
+  }
+  arena_pop(scratch, marker);
+
+  u32 *code = copy_spirv(result, out, &binary->len);
+  binary->code = code;
+  binary->mapping = NULL;
+  binary->mapping_len = 0;
+  return code != NULL;
+}
+
+#else
+bool shader_compiler_init(shader_compiler *compiler, const char *store) {
+  if (!shader_bundle_open(store, &compiler->bundle)) {
+    return false;
+  }
+
+  shader_variant_stats_init(&compiler->variant_stats);
+  return true;
+}
+
+void shader_compiler_free(shader_compiler *compiler) {
+  shader_variant_stats_free(&compiler->variant_stats);
+  shader_bundle_close(&compiler->bundle);
+}
+
+i32 shader_compiler_invalidate(shader_compiler *compiler, const char *path,
+                               const char **roots, i32 max_roots) {
+  (void)compiler, (void)path, (void)roots, (void)max_roots;
+  return 0;
+}
+
+void shader_compiler_new_files(shader_compiler *compiler, i32 *num_seen,
+                               void (*visit)(const char *path, void *user_data),
+                               void *user_data) {
+  (void)compiler, (void)num_seen, (void)visit, (void)user_data;
+}
+
+bool shader_load_binary(shader_compiler *compiler, const char *filename,
+                        const shader_variant *variant, arena *out,
+                        shader_binary *binary) {
+  (void)out;
+  const char *keywords[SHADER_MAX_KEYWORDS];
+  i32 num_keywords = shader_variant_sorted_keywords(variant, keywords);
+  u64 key = shader_bundle_key(filename, keywords, num_keywords);
+  if (!shader_bundle_find(&compiler->bundle, key, &binary->code,
+                          &binary->len)) {
+    LOG_ERROR("shader '%s' with %" PRIi32 " keyword(s) is not in the bundle",
+              filename, variant ? variant->num_keywords : 0);
+    return false;
+  }
+
+  binary->mapping = NULL;
+  binary->mapping_len = 0;
+  // nothing was compiled at runtime
+  shader_variant_record(compiler, key, 0, binary->len);
+  return true;
+}
+#endif
+
+void shader_binary_release(shader_binary *binary) {
+  if (binary->mapping) {
+    munmap(binary->mapping, binary->mapping_len);
+  }
+}
+
+static bool create_vk_module(shader_compiler *compiler, const char *filename,
+                             const shader_variant *variant, VkDevice device,
+                             VkShaderStageFlagBits stage,
+                             shader_reflection *reflection, u64 *code_hash,
+                             VkShaderModule *module) {
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return false;
+  }
+
+  arena_marker marker = arena_mark(scratch);
+  shader_binary binary;
+  if (!shader_load_binary(compiler, filename, variant, scratch, &binary)) {
+    return false;
+  }
+
+  if (reflection &&
+      !reflect_spirv(binary.code, binary.len, stage, reflection)) {
+    LOG_ERROR("unable to reflect shader '%s'", filename);
+    shader_binary_release(&binary);
+    arena_pop(scratch, marker);
     return false;
   }
+  if (code_hash) {
+    *code_hash = hash_bytes(HASH_INIT, binary.code, binary.len);
+  }
 
   VkResult result;
   if ((result = vkCreateShaderModule(
            device,
            &(VkShaderModuleCreateInfo){
                .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-               .pCode = code,
-               .codeSize = len,
+               .pCode = binary.code,
+               .codeSize = binary.len,
            },
            NULL, module)) != VK_SUCCESS) {
     LOG_ERROR("unable to create shader module: %s", vk_error_to_string(result));
   }
 
-  free(code);
+  shader_binary_release(&binary);
+  arena_pop(scratch, marker);
   return result == VK_SUCCESS;
 }
 
+bool shader_compile_vk_module(shader_compiler *compiler, const char *filename,
+                              const shader_variant *variant, VkDevice device,
+                              VkShaderStageFlagBits stage,
+                              shader_reflection *reflection,
+                              VkShaderModule *module) {
+  return create_vk_module(compiler, filename, variant, device, stage,
+                          reflection, NULL, module);
+}
+
 void shader_free_vk_module(VkDevice device, VkShaderModule module) {
   vkDestroyShaderModule(device, module, NULL);
 }
 
-bool shader_compile_vk_stage(shader_compiler *compiler, const char *filename,
-                             VkDevice device, VkShaderStageFlagBits shader_type,
-                             VkPipelineShaderStageCreateInfo *stage) {
+static bool create_vk_stage(shader_compiler *compiler, const char *filename,
+                            const shader_variant *variant, VkDevice device,
+                            VkShaderStageFlagBits shader_type,
+                            shader_reflection *reflection, u64 *code_hash,
+                            VkPipelineShaderStageCreateInfo *stage) {
   VkShaderModule module;
-  if (!shader_compile_vk_module(compiler, filename, device, &module)) {
+  if (!create_vk_module(compiler, filename, variant, device, shader_type,
+                        reflection, code_hash, &module)) {
     LOG_ERROR("unable to compile shader into module");
     return false;
   }
@@ -251,11 +1093,130 @@ bool shader_compile_vk_stage(shader_compiler *compiler, const char *filename,
   stage->stage = shader_type;
   stage->module = module;
   stage->pName = "main";
-  stage->pSpecializationInfo = NULL;
+  stage->pSpecializationInfo = variant ? variant->specialization : NULL;
   return true;
 }
 
+bool shader_compile_vk_stage(shader_compiler *compiler, const char *filename,
+                             const shader_variant *variant, VkDevice device,
+                             VkShaderStageFlagBits shader_type,
+                             shader_reflection *reflection,
+                             VkPipelineShaderStageCreateInfo *stage) {
+  return create_vk_stage(compiler, filename, variant, device, shader_type,
+                         reflection, NULL, stage);
+}
+
 void shader_free_vk_stage(VkDevice device,
                           VkPipelineShaderStageCreateInfo *stage) {
   shader_free_vk_module(device, stage->module);
 }
+
+typedef struct {
+  shader_compiler *compiler;
+  VkDevice device;
+  shader_build_request *requests;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t completed;
+  i32 *completion_order;
+  i32 num_completed;
+} shader_build_queue;
+
+typedef struct {
+  shader_build_queue *queue;
+  i32 index;
+} shader_build_job;
+
+static void shader_build_job_run(void *user_data) {
+  shader_build_job *job = user_data;
+  shader_build_queue *q = job->queue;
+  shader_build_request *r = &q->requests[job->index];
+
+  u64 start = timer_now_ns();
+  r->success = create_vk_stage(q->compiler, r->filename, r->variant,
+                               q->device, r->stage, &r->reflection,
+                               &r->code_hash, &r->stage_info);
+  r->compile_ns = timer_now_ns() - start;
+
+  pthread_mutex_lock(&q->mutex);
+  q->completion_order[q->num_completed++] = job->index;
+  pthread_cond_signal(&q->completed);
+  pthread_mutex_unlock(&q->mutex);
+}
+
+bool shader_build_stages(shader_compiler *compiler, thread_pool *pool,
+                         VkDevice device, i32 num_requests,
+                         shader_build_request *requests,
+                         shader_build_callback built, void *user_data) {
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    return false;
+  }
+
+  arena_marker marker = arena_mark(scratch);
+  shader_build_queue q = {
+      .compiler = compiler,
+      .device = device,
+      .requests = requests,
+      .completion_order = arena_push_array(scratch, i32, num_requests),
+      .num_completed = 0,
+  };
+  shader_build_job *jobs =
+      arena_push_array(scratch, shader_build_job, num_requests);
+  if (!q.completion_order || !jobs) {
+    arena_pop(scratch, marker);
+    return false;
+  }
+
+  pthread_mutex_init(&q.mutex, NULL);
+  pthread_cond_init(&q.completed, NULL);
+
+  u64 start = timer_now_ns();
+  for (i32 i = 0; i < num_requests; ++i) {
+    jobs[i] = (shader_build_job){.queue = &q, .index = i};
+    if (!pool || !thread_pool_submit(pool, shader_build_job_run, &jobs[i])) {
+      shader_build_job_run(&jobs[i]);
+    }
+  }
+
+  bool success = true;
+  for (i32 i = 0; i < num_requests; ++i) {
+    pthread_mutex_lock(&q.mutex);
+    while (q.num_completed <= i) {
+      pthread_cond_wait(&q.completed, &q.mutex);
+    }
+    i32 index = q.completion_order[i];
+    pthread_mutex_unlock(&q.mutex);
+
+    // consumed while the remaining stages are still compiling
+    shader_build_request *r = &requests[index];
+    if (!r->success) {
+      LOG_ERROR("unable to build shader '%s'", r->filename);
+      success = false;
+      continue;
+    }
+
+    LOG_DEBUG("shader '%s' built in %.3fms", r->filename,
+              timer_ns_to_ms(r->compile_ns));
+    if (success && built && !built(r, user_data)) {
+      success = false;
+    }
+  }
+
+  LOG_DEBUG("built %" PRIi32 " shader(s) in %.3fms", num_requests,
+            timer_ns_to_ms(timer_now_ns() - start));
+
+  if (!success) {
+    for (i32 i = 0; i < num_requests; ++i) {
+      if (requests[i].success) {
+        shader_free_vk_stage(device, &requests[i].stage_info);
+        requests[i].success = false;
+      }
+    }
+  }
+
+  pthread_cond_destroy(&q.completed);
+  pthread_mutex_destroy(&q.mutex);
+  arena_pop(scratch, marker);
+  return success;
+}
@@ -1,24 +1,186 @@
 #pragma once
 
+#include "arena.h"
+#include "reflect.h"
+#include "thread_pool.h"
 #include "types.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#ifdef SHADER_BUNDLE
+#include "shader_bundle.h"
+#else
 #include <shaderc/shaderc.h>
+#endif
 #include <vulkan/vulkan_core.h>
 
 typedef struct {
+  atomic_uint_fast64_t hits;
+  atomic_uint_fast64_t misses;
+  atomic_uint_fast64_t saved_ns;
+} shader_cache_stats;
+
+#define SHADER_MAX_VARIANTS 64
+
+typedef struct {
+  // hash of the filename, keywords and compile options
+  u64 key;
+  // time it took to compile, also for variants loaded from the cache
+  u64 compile_ns;
+  u32 spirv_bytes;
+} shader_variant_info;
+
+// every distinct variant loaded so far, reported when the compiler is freed
+typedef struct {
+  pthread_mutex_t mutex;
+  shader_variant_info variants[SHADER_MAX_VARIANTS];
+  i32 num_variants;
+} shader_variant_stats;
+
+#define SHADER_MAX_KEYWORDS 8
+
+// selects one permutation of a shader; keywords are either NAME or
+// NAME=VALUE and become preprocessor macros, each one must be declared by the
+// shader on a '#pragma keywords' line
+typedef struct {
+  const char *keywords[SHADER_MAX_KEYWORDS];
+  i32 num_keywords;
+  // runtime-tunable constants, which unlike keywords do not require another
+  // compilation; must stay alive until the pipeline has been created
+  const VkSpecializationInfo *specialization;
+} shader_variant;
+
+// copies the keywords of variant, which may be NULL, into sorted in strcmp
+// order, so that variants only differing in keyword order share their cache
+// and bundle keys; returns the number of keywords
+i32 shader_variant_sorted_keywords(const shader_variant *variant,
+                                   const char **sorted);
+
+#define SHADER_GRAPH_MAX_FILES 128
+#define SHADER_GRAPH_MAX_INCLUDES 32
+
+typedef struct {
+  // canonical (realpath) path
+  char *path;
+  // name the file was compiled under as a shader, NULL if only ever included
+  char *root_name;
+  // cached file contents, NULL until read or after invalidation
+  char *content;
+  i32 content_len;
+  // bumped on invalidation so reads racing with a change are not cached
+  u32 generation;
+  // files included directly, as indices into shader_graph.files
+  i32 includes[SHADER_GRAPH_MAX_INCLUDES];
+  i32 num_includes;
+} shader_graph_file;
+
+// include graph of every shader loaded so far, plus a cache of the contents
+// of all files in it
+typedef struct {
+  pthread_mutex_t mutex;
+  shader_graph_file files[SHADER_GRAPH_MAX_FILES];
+  i32 num_files;
+} shader_graph;
+
+// safe to share between threads, each thread lazily creates its own compile
+// options object which is reused across compilations; release builds with
+// SHADER_BUNDLE defined only look shaders up in a precompiled bundle instead
+typedef struct {
+#ifdef SHADER_BUNDLE
+  shader_bundle bundle;
+#else
   shaderc_compiler_t compiler;
+  pthread_key_t options_key;
+  // directory of the content-addressed spirv cache, NULL if disabled
+  const char *cache_dir;
+  shader_cache_stats cache_stats;
+  shader_graph graph;
+#endif
+  shader_variant_stats variant_stats;
 } shader_compiler;
 
-bool shader_compiler_init(shader_compiler *compiler);
+// store is the spirv cache directory (may be NULL), or the bundle file if
+// SHADER_BUNDLE is defined
+bool shader_compiler_init(shader_compiler *compiler, const char *store);
+// threads that compiled shaders must have exited before this is called
 void shader_compiler_free(shader_compiler *compiler);
 
+// drops the cached contents of path and collects the root names of all loaded
+// shaders depending on it, directly or through includes, into roots; returns
+// the number of dependents, which may exceed max_roots; bundled shaders never
+// change, so this always returns 0 with SHADER_BUNDLE
+i32 shader_compiler_invalidate(shader_compiler *compiler, const char *path,
+                               const char **roots, i32 max_roots);
+// calls visit with the canonical path of every file loaded since *num_seen
+// and advances *num_seen past them, so each file is reported once; bundled
+// shaders never change, so nothing is reported with SHADER_BUNDLE
+void shader_compiler_new_files(shader_compiler *compiler, i32 *num_seen,
+                               void (*visit)(const char *path, void *user_data),
+                               void *user_data);
+
+#ifndef SHADER_BUNDLE
+// the spirv bytecode is pushed onto out, variant may be NULL for the shader
+// without any keywords
 u32 *shader_compile_file(shader_compiler *compiler, const char *filename,
+                         const shader_variant *variant, arena *out,
                          u32 *bytes_len);
+#endif
+
+typedef struct {
+  const u32 *code;
+  u32 len;
+  // non-NULL if code points into a memory-mapped cache entry, bundled code
+  // is owned by the bundle and leaves this NULL
+  void *mapping;
+  usize mapping_len;
+} shader_binary;
+
+// loads spirv for filename from the on-disk cache if the source, its
+// transitive includes, the variant keywords and the compile options are
+// unchanged, otherwise compiles it and stores the result; fresh bytecode is
+// pushed onto out. with SHADER_BUNDLE the variant must have been bundled
+bool shader_load_binary(shader_compiler *compiler, const char *filename,
+                        const shader_variant *variant, arena *out,
+                        shader_binary *binary);
+void shader_binary_release(shader_binary *binary);
 
+// reflection may be NULL, otherwise it receives the interface of the module
 bool shader_compile_vk_module(shader_compiler *compiler, const char *filename,
-                              VkDevice device, VkShaderModule *module);
+                              const shader_variant *variant, VkDevice device,
+                              VkShaderStageFlagBits stage,
+                              shader_reflection *reflection,
+                              VkShaderModule *module);
 void shader_free_vk_module(VkDevice device, VkShaderModule module);
 bool shader_compile_vk_stage(shader_compiler *compiler, const char *filename,
-                             VkDevice device, VkShaderStageFlagBits shader_type,
+                             const shader_variant *variant, VkDevice device,
+                             VkShaderStageFlagBits shader_type,
+                             shader_reflection *reflection,
                              VkPipelineShaderStageCreateInfo *stage);
 void shader_free_vk_stage(VkDevice device,
                           VkPipelineShaderStageCreateInfo *stage);
+
+typedef struct {
+  const char *filename;
+  VkShaderStageFlagBits stage;
+  // may be NULL
+  const shader_variant *variant;
+  // outputs
+  VkPipelineShaderStageCreateInfo stage_info;
+  shader_reflection reflection;
+  // hash of the spirv, identifies the code independently of the module
+  u64 code_hash;
+  u64 compile_ns;
+  bool success;
+} shader_build_request;
+
+// called on the building thread for each successfully built request, in
+// completion order and while later requests may still be compiling; returning
+// false fails the build
+typedef bool (*shader_build_callback)(shader_build_request *request,
+                                      void *user_data);
+
+// compiles all requests concurrently on pool and passes each one to built, if
+// not NULL, as soon as it is done; on failure no stage is left allocated
+bool shader_build_stages(shader_compiler *compiler, thread_pool *pool,
+                         VkDevice device, i32 num_requests,
+                         shader_build_request *requests,
+                         shader_build_callback built, void *user_data);
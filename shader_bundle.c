@@ -0,0 +1,115 @@
+#include "shader_bundle.h"
+#include "hash.h"
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool shader_bundle_valid(const u8 *data, usize len) {
+  shader_bundle_header header;
+  if (len < sizeof(header)) {
+    return false;
+  }
+
+  memcpy(&header, data, sizeof(header));
+  usize max_entries = (len - sizeof(header)) / sizeof(shader_bundle_entry);
+  if (header.magic != SHADER_BUNDLE_MAGIC ||
+      header.version != SHADER_BUNDLE_VERSION ||
+      header.num_entries > max_entries) {
+    return false;
+  }
+
+  const shader_bundle_entry *entries =
+      (const shader_bundle_entry *)&data[sizeof(header)];
+  for (u32 i = 0; i < header.num_entries; ++i) {
+    if (entries[i].offset % sizeof(u32) != 0 || entries[i].offset > len ||
+        entries[i].len > len - entries[i].offset ||
+        (i > 0 && entries[i - 1].key >= entries[i].key)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool shader_bundle_open(const char *path, shader_bundle *b) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    LOG_ERROR("unable to open shader bundle '%s': %s", path, strerror(errno));
+    goto fail_open;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    LOG_ERROR("unable to stat shader bundle '%s': %s", path, strerror(errno));
+    goto fail_stat;
+  }
+
+  b->mapping_len = st.st_size;
+  b->mapping = mmap(NULL, b->mapping_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (b->mapping == MAP_FAILED) {
+    LOG_ERROR("unable to map shader bundle '%s': %s", path, strerror(errno));
+    goto fail_stat;
+  }
+  close(fd);
+
+  if (!shader_bundle_valid(b->mapping, b->mapping_len)) {
+    LOG_ERROR("shader bundle '%s' is corrupt or from an incompatible build",
+              path);
+    goto fail_valid;
+  }
+
+  const u8 *data = b->mapping;
+  b->num_entries = ((const shader_bundle_header *)data)->num_entries;
+  b->entries = (const shader_bundle_entry *)&data[sizeof(shader_bundle_header)];
+  LOG_INFO("loaded %" PRIu32 " shader(s) from bundle '%s'", b->num_entries,
+           path);
+  return true;
+
+fail_valid:
+  munmap(b->mapping, b->mapping_len);
+  return false;
+fail_stat:
+  close(fd);
+fail_open:
+  return false;
+}
+
+void shader_bundle_close(shader_bundle *b) {
+  munmap(b->mapping, b->mapping_len);
+}
+
+u64 shader_bundle_key(const char *filename, const char *const *keywords,
+                      i32 num_keywords) {
+  u64 h = hash_u64(HASH_INIT, SHADER_BUNDLE_VERSION);
+  h = hash_str(h, filename);
+  h = hash_u64(h, num_keywords);
+  for (i32 i = 0; i < num_keywords; ++i) {
+    h = hash_str(h, keywords[i]);
+  }
+  return h;
+}
+
+bool shader_bundle_find(const shader_bundle *b, u64 key, const u32 **code,
+                        u32 *len) {
+  u32 lo = 0, hi = b->num_entries;
+  while (lo < hi) {
+    u32 mid = lo + (hi - lo) / 2;
+    if (b->entries[mid].key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo == b->num_entries || b->entries[lo].key != key) {
+    return false;
+  }
+
+  *code = (const u32 *)&((const u8 *)b->mapping)[b->entries[lo].offset];
+  *len = b->entries[lo].len;
+  return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "types.h"
+
+#define SHADER_BUNDLE_MAGIC 0x4c444e42 // "BNDL"
+#define SHADER_BUNDLE_VERSION 2
+
+// on-disk layout: header, entries sorted by key, then the spirv blobs, each
+// aligned to 4 bytes
+typedef struct {
+  u32 magic;
+  u32 version;
+  u32 num_entries;
+  u32 reserved;
+} shader_bundle_header;
+
+typedef struct {
+  u64 key;
+  // relative to the start of the bundle
+  u32 offset;
+  u32 len;
+} shader_bundle_entry;
+
+// read-only view of a memory-mapped bundle of precompiled shaders
+typedef struct {
+  void *mapping;
+  usize mapping_len;
+  const shader_bundle_entry *entries;
+  u32 num_entries;
+} shader_bundle;
+
+bool shader_bundle_open(const char *path, shader_bundle *b);
+void shader_bundle_close(shader_bundle *b);
+
+// identifies a variant by the filename it was bundled under and its keywords,
+// as sorted by shader_variant_sorted_keywords
+u64 shader_bundle_key(const char *filename, const char *const *keywords,
+                      i32 num_keywords);
+// code points into the mapping and stays valid until the bundle is closed
+bool shader_bundle_find(const shader_bundle *b, u64 key, const u32 **code,
+                        u32 *len);
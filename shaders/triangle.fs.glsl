@@ -1,5 +1,6 @@
 #version 450
 #pragma shader_stage(fragment)
+#pragma keywords ALPHA_TEST
 
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec2 tex_coords;
@@ -22,6 +23,14 @@ float noise(vec2 p){
 
 layout(binding = 1) uniform sampler2D tex;
 
+layout(constant_id = 0) const float alpha_cutoff = 0.5;
+
 void main() {
-  out_color = vec4(texture(tex, tex_coords).rgb, 1.0);
+  vec4 color = texture(tex, tex_coords);
+#ifdef ALPHA_TEST
+  if (color.a < alpha_cutoff) {
+    discard;
+  }
+#endif
+  out_color = vec4(color.rgb, 1.0);
 }
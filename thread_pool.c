@@ -0,0 +1,113 @@
+#include "thread_pool.h"
+#include "arena.h"
+#include "log.h"
+#include "trace.h"
+#include <string.h>
+#include <unistd.h>
+
+static void *thread_pool_worker(void *user_data) {
+  thread_pool *p = user_data;
+  TRACE_THREAD_NAME("worker");
+  pthread_mutex_lock(&p->mutex);
+  for (;;) {
+    while (p->num_jobs == 0 && !p->stopping) {
+      pthread_cond_wait(&p->job_available, &p->mutex);
+    }
+
+    if (p->num_jobs == 0) {
+      break;
+    }
+
+    thread_pool_job job = p->jobs[p->first_job];
+    p->first_job = (p->first_job + 1) % THREAD_POOL_MAX_JOBS;
+    --p->num_jobs;
+    pthread_mutex_unlock(&p->mutex);
+
+    TRACE_BEGIN("job");
+    job.fn(job.user_data);
+    TRACE_END();
+
+    pthread_mutex_lock(&p->mutex);
+  }
+  pthread_mutex_unlock(&p->mutex);
+
+  scratch_arena_free();
+  return NULL;
+}
+
+bool thread_pool_init(thread_pool *p, i32 num_threads) {
+  if (num_threads <= 0) {
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = num_cores > 1 ? num_cores - 1 : 1;
+  }
+  if (num_threads > THREAD_POOL_MAX_THREADS) {
+    num_threads = THREAD_POOL_MAX_THREADS;
+  }
+
+  p->num_threads = 0;
+  p->first_job = 0;
+  p->num_jobs = 0;
+  p->stopping = false;
+
+  int error;
+  if ((error = pthread_mutex_init(&p->mutex, NULL)) != 0) {
+    LOG_ERROR("unable to initialize thread pool mutex: %s", strerror(error));
+    goto fail_mutex;
+  }
+  if ((error = pthread_cond_init(&p->job_available, NULL)) != 0) {
+    LOG_ERROR("unable to initialize thread pool condition variable: %s",
+              strerror(error));
+    goto fail_cond;
+  }
+
+  while (p->num_threads < num_threads) {
+    if ((error = pthread_create(&p->threads[p->num_threads], NULL,
+                                thread_pool_worker, p)) != 0) {
+      LOG_ERROR("unable to create %" PRIi32 "-th worker thread: %s",
+                p->num_threads + 1, strerror(error));
+      goto fail_threads;
+    }
+
+    ++p->num_threads;
+  }
+
+  LOG_DEBUG("thread pool started with %" PRIi32 " worker(s)", p->num_threads);
+  return true;
+
+fail_threads:
+  thread_pool_free(p);
+  return false;
+fail_cond:
+  pthread_mutex_destroy(&p->mutex);
+fail_mutex:
+  return false;
+}
+
+void thread_pool_free(thread_pool *p) {
+  pthread_mutex_lock(&p->mutex);
+  p->stopping = true;
+  pthread_cond_broadcast(&p->job_available);
+  pthread_mutex_unlock(&p->mutex);
+
+  for (i32 i = 0; i < p->num_threads; ++i) {
+    pthread_join(p->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&p->job_available);
+  pthread_mutex_destroy(&p->mutex);
+}
+
+bool thread_pool_submit(thread_pool *p, thread_pool_fn fn, void *user_data) {
+  pthread_mutex_lock(&p->mutex);
+  if (p->num_jobs == THREAD_POOL_MAX_JOBS) {
+    pthread_mutex_unlock(&p->mutex);
+    return false;
+  }
+
+  i32 index = (p->first_job + p->num_jobs) % THREAD_POOL_MAX_JOBS;
+  p->jobs[index] = (thread_pool_job){.fn = fn, .user_data = user_data};
+  ++p->num_jobs;
+  pthread_cond_signal(&p->job_available);
+  pthread_mutex_unlock(&p->mutex);
+  return true;
+}
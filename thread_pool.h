@@ -0,0 +1,35 @@
+#pragma once
+
+#include "types.h"
+#include <pthread.h>
+
+#define THREAD_POOL_MAX_THREADS 16
+#define THREAD_POOL_MAX_JOBS 256
+
+typedef void (*thread_pool_fn)(void *user_data);
+
+typedef struct {
+  thread_pool_fn fn;
+  void *user_data;
+} thread_pool_job;
+
+typedef struct {
+  pthread_t threads[THREAD_POOL_MAX_THREADS];
+  i32 num_threads;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t job_available;
+  thread_pool_job jobs[THREAD_POOL_MAX_JOBS];
+  i32 first_job;
+  i32 num_jobs;
+  bool stopping;
+} thread_pool;
+
+// num_threads <= 0 picks one worker per online core, leaving one core for the
+// render thread
+bool thread_pool_init(thread_pool *p, i32 num_threads);
+// pending jobs are drained before the workers exit
+void thread_pool_free(thread_pool *p);
+
+// returns false if the job queue is full
+bool thread_pool_submit(thread_pool *p, thread_pool_fn fn, void *user_data);
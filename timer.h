@@ -0,0 +1,12 @@
+#pragma once
+
+#include "types.h"
+#include <time.h>
+
+static inline u64 timer_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline double timer_ns_to_ms(u64 ns) { return ns / 1e6; }
@@ -0,0 +1,252 @@
+#include "trace.h"
+#include "log.h"
+#include "timer.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if TRACE_ENABLED
+
+#ifdef __x86_64__
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+// zones kept per thread, a power of two
+#define TRACE_RING_CAPACITY (1 << 14)
+#define TRACE_MAX_THREADS 64
+// deeper zones are not recorded but still nest correctly
+#define TRACE_MAX_DEPTH 32
+
+// times are in ticks of trace_now, converted to ns when written
+typedef struct {
+  const char *name;
+  u64 start;
+  u64 duration;
+} trace_zone;
+
+typedef struct {
+  const char *name;
+  u32 depth;
+  struct {
+    const char *name;
+    u64 start;
+  } open[TRACE_MAX_DEPTH];
+  // zones recorded so far, only written by the owning thread; the ring is
+  // read once that thread is done
+  atomic_uint_fast64_t head;
+  trace_zone zones[TRACE_RING_CAPACITY];
+} trace_thread;
+
+static struct {
+  atomic_bool enabled;
+  // read the tsc instead of CLOCK_MONOTONIC, set before zones are recorded
+  bool tsc;
+  const char *path;
+  // trace_now and timer_now_ns read together, ticks are converted to ns by
+  // interpolating between the readings of trace_init and trace_free
+  u64 start_ticks;
+  u64 start_ns;
+  atomic_uint num_threads;
+  trace_thread *_Atomic threads[TRACE_MAX_THREADS];
+} trace;
+
+// an invariant tsc ticks at a constant rate across cores and power states
+static bool has_invariant_tsc(void) {
+#ifdef __x86_64__
+  unsigned eax, ebx, ecx, edx;
+  return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+#else
+  return false;
+#endif
+}
+
+// reading the tsc takes a few ns, clock_gettime several times as long
+static inline u64 trace_now(void) {
+#ifdef __x86_64__
+  if (trace.tsc) {
+    return __rdtsc();
+  }
+#endif
+  return timer_now_ns();
+}
+
+static _Thread_local trace_thread *local;
+// set once registering failed, so it is not retried on every zone
+static _Thread_local bool local_failed;
+
+bool trace_init(const char *path) {
+  if (!path) {
+    return true;
+  }
+
+  trace.path = path;
+  trace.tsc = has_invariant_tsc();
+  trace.start_ticks = trace_now();
+  trace.start_ns = timer_now_ns();
+  atomic_store_explicit(&trace.enabled, true, memory_order_release);
+  LOG_INFO("tracing to '%s' (%s clock)", path,
+           trace.tsc ? "tsc" : "monotonic");
+  return true;
+}
+
+// first zone of the thread, allocates its ring
+static trace_thread *thread_register(void) {
+  if (local_failed) {
+    return NULL;
+  }
+
+  u32 index = atomic_fetch_add_explicit(&trace.num_threads, 1,
+                                        memory_order_relaxed);
+  trace_thread *t = index < TRACE_MAX_THREADS ? calloc(1, sizeof(*t)) : NULL;
+  if (!t) {
+    LOG_WARN("unable to allocate trace ring, zones of this thread are dropped");
+    local_failed = true;
+    return NULL;
+  }
+
+  atomic_init(&t->head, 0);
+  atomic_store_explicit(&trace.threads[index], t, memory_order_release);
+  local = t;
+  return t;
+}
+
+void trace_begin(const char *name) {
+  if (!atomic_load_explicit(&trace.enabled, memory_order_relaxed)) {
+    return;
+  }
+
+  trace_thread *t = local ? local : thread_register();
+  if (!t) {
+    return;
+  }
+
+  if (t->depth < TRACE_MAX_DEPTH) {
+    t->open[t->depth].name = name;
+    t->open[t->depth].start = trace_now();
+  }
+  ++t->depth;
+}
+
+void trace_end(void) {
+  trace_thread *t = local;
+  if (!t || t->depth == 0 ||
+      !atomic_load_explicit(&trace.enabled, memory_order_relaxed)) {
+    return;
+  }
+
+  if (--t->depth < TRACE_MAX_DEPTH) {
+    u64 head = atomic_load_explicit(&t->head, memory_order_relaxed);
+    t->zones[head & (TRACE_RING_CAPACITY - 1)] = (trace_zone){
+        .name = t->open[t->depth].name,
+        .start = t->open[t->depth].start,
+        .duration = trace_now() - t->open[t->depth].start,
+    };
+    atomic_store_explicit(&t->head, head + 1, memory_order_release);
+  }
+}
+
+void trace_thread_name(const char *name) {
+  if (!atomic_load_explicit(&trace.enabled, memory_order_relaxed)) {
+    return;
+  }
+
+  trace_thread *t = local ? local : thread_register();
+  if (t) {
+    t->name = name;
+  }
+}
+
+static void write_thread(FILE *file, u32 tid, const trace_thread *t,
+                         double ns_per_tick, bool *first, u64 *num_dropped) {
+  if (t->name) {
+    fprintf(file,
+            "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%" PRIu32 ",\"args\":{\"name\":\"%s\"}}",
+            *first ? "" : ",", tid, t->name);
+    *first = false;
+  }
+
+  u64 head = atomic_load_explicit(&t->head, memory_order_acquire);
+  u64 begin = head > TRACE_RING_CAPACITY ? head - TRACE_RING_CAPACITY : 0;
+  *num_dropped += begin;
+  for (u64 i = begin; i < head; ++i) {
+    const trace_zone *z = &t->zones[i & (TRACE_RING_CAPACITY - 1)];
+    fprintf(file,
+            "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%" PRIu32
+            ",\"ts\":%.3f,\"dur\":%.3f}",
+            *first ? "" : ",", z->name, tid,
+            (z->start - trace.start_ticks) * ns_per_tick / 1e3,
+            z->duration * ns_per_tick / 1e3);
+    *first = false;
+  }
+}
+
+void trace_free(void) {
+  if (!atomic_load_explicit(&trace.enabled, memory_order_relaxed)) {
+    return;
+  }
+  atomic_store_explicit(&trace.enabled, false, memory_order_relaxed);
+  u64 ticks = trace_now() - trace.start_ticks;
+  u64 ns = timer_now_ns() - trace.start_ns;
+  double ns_per_tick = ticks > 0 ? (double)ns / ticks : 1.0;
+
+  u32 num_threads =
+      atomic_load_explicit(&trace.num_threads, memory_order_acquire);
+  if (num_threads > TRACE_MAX_THREADS) {
+    num_threads = TRACE_MAX_THREADS;
+  }
+
+  FILE *file = fopen(trace.path, "w");
+  if (!file) {
+    LOG_ERROR("unable to open '%s' for writing: %s", trace.path,
+              strerror(errno));
+  } else {
+    bool first = true;
+    u64 num_dropped = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (u32 i = 0; i < num_threads; ++i) {
+      const trace_thread *t =
+          atomic_load_explicit(&trace.threads[i], memory_order_acquire);
+      if (t) {
+        write_thread(file, i, t, ns_per_tick, &first, &num_dropped);
+      }
+    }
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0) {
+      LOG_ERROR("unable to write '%s': %s", trace.path, strerror(errno));
+    } else {
+      LOG_INFO("trace written to '%s', %" PRIu64 " older zone(s) dropped",
+               trace.path, num_dropped);
+    }
+  }
+
+  for (u32 i = 0; i < num_threads; ++i) {
+    free(atomic_exchange(&trace.threads[i], NULL));
+  }
+  atomic_store_explicit(&trace.num_threads, 0, memory_order_relaxed);
+  local = NULL;
+}
+
+#else
+
+bool trace_init(const char *path) {
+  if (path) {
+    LOG_WARN("tracing is compiled out of release builds, '%s' not written",
+             path);
+  }
+  return true;
+}
+
+void trace_free(void) {}
+
+void trace_begin(const char *name) { (void)name; }
+
+void trace_end(void) {}
+
+void trace_thread_name(const char *name) { (void)name; }
+
+#endif
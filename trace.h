@@ -0,0 +1,34 @@
+#pragma once
+
+#include "types.h"
+
+// zones are compiled out of release builds entirely
+#ifdef NDEBUG
+#define TRACE_ENABLED 0
+#else
+#define TRACE_ENABLED 1
+#endif
+
+#if TRACE_ENABLED
+// name must be a string literal; zones nest and are ended on the thread that
+// began them
+#define TRACE_BEGIN(name) trace_begin(name)
+#define TRACE_END() trace_end()
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+#else
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END() ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
+
+// zones are only recorded if path is not NULL, into a ring per thread which
+// keeps the latest TRACE_RING_CAPACITY zones; trace_free writes them to path
+// as chrome trace event json, which perfetto loads as well
+bool trace_init(const char *path);
+// every other thread that recorded zones must have exited or be done
+void trace_free(void);
+
+void trace_begin(const char *name);
+void trace_end(void);
+// name must be a string literal
+void trace_thread_name(const char *name);
@@ -1,72 +1,329 @@
 #include "watch_linux.h"
+#include "log.h"
+#include "timer.h"
 #include "types.h"
+#include <dirent.h>
 #include <errno.h>
-#include <logger.h>
+#include <poll.h>
+#include <stdalign.h>
 #include <stddef.h>
-#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
 #include <unistd.h>
 
-bool watch_init(watch *w) {
-  w->fd = inotify_init1(IN_NONBLOCK);
-  if (w->fd == -1) {
-    LOG_ERROR("inotify initialization failed with error: %s", strerror(errno));
+#define WATCH_EVENTS                                                           \
+  (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO)
+#define WATCH_READ_BUFFER_SIZE 4096
+
+static void watch_push(watch *w, const watch_event *event) {
+  u32 tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+  u32 head = atomic_load_explicit(&w->head, memory_order_acquire);
+  if (tail - head == WATCH_QUEUE_CAPACITY) {
+    if (atomic_fetch_add_explicit(&w->dropped, 1, memory_order_relaxed) == 0) {
+      LOG_WARN("file watch queue full, dropping events");
+    }
+    return;
+  }
+
+  w->queue[tail & (WATCH_QUEUE_CAPACITY - 1)] = *event;
+  atomic_store_explicit(&w->tail, tail + 1, memory_order_release);
+}
+
+bool watch_poll(watch *w, watch_event *event) {
+  u32 head = atomic_load_explicit(&w->head, memory_order_relaxed);
+  u32 tail = atomic_load_explicit(&w->tail, memory_order_acquire);
+  if (head == tail) {
     return false;
   }
 
-  w->buf_len = 0;
-  w->buf_cap = sizeof(struct inotify_event) + PATH_MAX + 1;
-  w->buf = calloc(w->buf_cap, 1);
-  if (!w->buf) {
-    LOG_ERROR("unable to allocate inotify read buffer");
-    if (close(w->fd) == -1) {
-      LOG_WARN("closing inotify fd failed with error: %s", strerror(errno));
+  *event = w->queue[head & (WATCH_QUEUE_CAPACITY - 1)];
+  atomic_store_explicit(&w->head, head + 1, memory_order_release);
+  return true;
+}
+
+// hands over every pending event whose debounce window has passed
+static void watch_flush(watch *w, u64 now_ns) {
+  for (i32 i = 0; i < w->num_pending;) {
+    if (w->pending[i].deadline_ns > now_ns) {
+      ++i;
+      continue;
+    }
+
+    watch_push(w, &w->pending[i].event);
+    w->pending[i] = w->pending[--w->num_pending];
+  }
+}
+
+static void watch_coalesce(watch *w, const char *path, u32 mask, u64 now_ns) {
+  for (i32 i = 0; i < w->num_pending; ++i) {
+    watch_pending_event *p = &w->pending[i];
+    if (strcmp(p->event.path, path) == 0) {
+      p->event.event_type |= mask;
+      p->deadline_ns = now_ns + WATCH_DEBOUNCE_NS;
+      return;
     }
   }
 
-  return true;
+  if (w->num_pending == WATCH_MAX_PENDING) {
+    // report the oldest event early rather than losing one
+    i32 oldest = 0;
+    for (i32 i = 1; i < w->num_pending; ++i) {
+      if (w->pending[i].deadline_ns < w->pending[oldest].deadline_ns) {
+        oldest = i;
+      }
+    }
+    watch_push(w, &w->pending[oldest].event);
+    w->pending[oldest] = w->pending[--w->num_pending];
+  }
+
+  watch_pending_event *p = &w->pending[w->num_pending++];
+  snprintf(p->event.path, sizeof(p->event.path), "%s", path);
+  p->event.event_type = mask;
+  p->deadline_ns = now_ns + WATCH_DEBOUNCE_NS;
 }
 
-void watch_free(watch *w) {
-  free(w->buf);
-  if (close(w->fd) == -1) {
-    LOG_WARN("closing inotify fd failed with error: %s", strerror(errno));
+static bool watch_dir_path(watch *w, int handle, const char *name, char *path,
+                           bool *recursive) {
+  bool found = false;
+  pthread_mutex_lock(&w->dirs_mutex);
+  for (i32 i = 0; i < w->num_dirs && !found; ++i) {
+    if (w->dirs[i].handle == handle) {
+      const char *dir = w->dirs[i].path;
+      usize dir_len = strlen(dir);
+      bool needs_slash = dir_len > 0 && dir[dir_len - 1] != '/';
+      found = snprintf(path, WATCH_MAX_PATH, "%s%s%s", dir,
+                       needs_slash ? "/" : "", name) < WATCH_MAX_PATH;
+      *recursive = w->dirs[i].recursive;
+    }
   }
+  pthread_mutex_unlock(&w->dirs_mutex);
+  return found;
 }
 
-int watch_add(watch *w, const char *path) {
-  int handle =
-      inotify_add_watch(w->fd, path, IN_CREATE | IN_DELETE | IN_MODIFY);
+// dirs_mutex must be held
+static int watch_add_dir(watch *w, const char *path, bool recursive) {
+  if (w->num_dirs == WATCH_MAX_DIRS || strlen(path) >= WATCH_MAX_PATH) {
+    LOG_WARN("unable to watch '%s', too many directories or path too long",
+             path);
+    return -1;
+  }
+
+  int handle = inotify_add_watch(w->fd, path, WATCH_EVENTS);
   if (handle == -1) {
     LOG_WARN("adding file to inotify failed with error: %s", strerror(errno));
+    return -1;
   }
 
+  // watching a directory twice returns the existing handle
+  for (i32 i = 0; i < w->num_dirs; ++i) {
+    if (w->dirs[i].handle == handle) {
+      w->dirs[i].recursive = w->dirs[i].recursive || recursive;
+      return handle;
+    }
+  }
+
+  watch_dir *dir = &w->dirs[w->num_dirs++];
+  dir->handle = handle;
+  dir->recursive = recursive;
+  snprintf(dir->path, sizeof(dir->path), "%s", path);
   return handle;
 }
 
-void watch_remove(watch *w, int handle) { inotify_rm_watch(w->fd, handle); }
+// dirs_mutex must be held
+static bool watch_add_tree(watch *w, const char *path) {
+  if (watch_add_dir(w, path, true) == -1) {
+    return false;
+  }
+
+  DIR *dir = opendir(path);
+  if (!dir) {
+    LOG_WARN("unable to open directory '%s': %s", path, strerror(errno));
+    return false;
+  }
 
-bool watch_poll(watch *w, watch_event *event) {
-  ssize_t r;
-  struct inotify_event *e = (struct inotify_event *)w->buf;
-  while (w->buf_len < (i32)sizeof(struct inotify_event) ||
-         w->buf_len < (i32)(sizeof(struct inotify_event) + e->len)) {
-    if ((r = read(w->fd, w->buf, w->buf_cap)) == -1) {
-      return false;
+  bool success = true;
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    if (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0 ||
+        strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    char child[WATCH_MAX_PATH];
+    const char *sep = path[strlen(path) - 1] == '/' ? "" : "/";
+    if (snprintf(child, sizeof(child), "%s%s%s", path, sep, entry->d_name) >=
+        ssizeof(child)) {
+      LOG_WARN("path of '%s' in '%s' too long to watch", entry->d_name, path);
+      success = false;
+      continue;
+    }
+    success = watch_add_tree(w, child) && success;
+  }
+
+  closedir(dir);
+  return success;
+}
+
+static void watch_forget_dir(watch *w, int handle) {
+  pthread_mutex_lock(&w->dirs_mutex);
+  for (i32 i = 0; i < w->num_dirs; ++i) {
+    if (w->dirs[i].handle == handle) {
+      w->dirs[i] = w->dirs[--w->num_dirs];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&w->dirs_mutex);
+}
+
+// reads and coalesces everything queued on the inotify fd in one pass
+static void watch_drain(watch *w, char *buf) {
+  u64 now_ns = timer_now_ns();
+  ssize_t len;
+  while ((len = read(w->fd, buf, WATCH_READ_BUFFER_SIZE)) > 0) {
+    for (char *p = buf; p < &buf[len];) {
+      const struct inotify_event *e = (const struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + e->len;
+      if (e->mask & IN_Q_OVERFLOW) {
+        LOG_WARN("inotify queue overflowed, file events were lost");
+        continue;
+      }
+      // the directory was removed or unwatched
+      if (e->mask & IN_IGNORED) {
+        watch_forget_dir(w, e->wd);
+        continue;
+      }
+
+      char path[WATCH_MAX_PATH];
+      bool recursive;
+      if (e->len == 0 || !watch_dir_path(w, e->wd, e->name, path, &recursive)) {
+        continue;
+      }
+
+      if (e->mask & IN_ISDIR) {
+        if (recursive && (e->mask & (IN_CREATE | IN_MOVED_TO))) {
+          pthread_mutex_lock(&w->dirs_mutex);
+          watch_add_tree(w, path);
+          pthread_mutex_unlock(&w->dirs_mutex);
+        }
+        continue;
+      }
+      watch_coalesce(w, path, e->mask & WATCH_EVENTS, now_ns);
+    }
+  }
+
+  if (len == -1 && errno != EAGAIN && errno != EINTR) {
+    LOG_WARN("reading inotify events failed with error: %s", strerror(errno));
+  }
+}
+
+static void *watch_thread(void *user_data) {
+  watch *w = user_data;
+  alignas(struct inotify_event) char buf[WATCH_READ_BUFFER_SIZE];
+  for (;;) {
+    // sleep until an event arrives or the earliest debounce window closes
+    int timeout_ms = -1;
+    if (w->num_pending > 0) {
+      u64 now_ns = timer_now_ns(), deadline_ns = w->pending[0].deadline_ns;
+      for (i32 i = 1; i < w->num_pending; ++i) {
+        if (w->pending[i].deadline_ns < deadline_ns) {
+          deadline_ns = w->pending[i].deadline_ns;
+        }
+      }
+      timeout_ms =
+          deadline_ns > now_ns ? (deadline_ns - now_ns + 999999) / 1000000 : 0;
+    }
+
+    struct pollfd fds[2] = {
+        {.fd = w->fd, .events = POLLIN},
+        {.fd = w->wake_fd, .events = POLLIN},
+    };
+    if (poll(fds, 2, timeout_ms) == -1 && errno != EINTR) {
+      LOG_ERROR("polling inotify fd failed with error: %s", strerror(errno));
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      watch_drain(w, buf);
     }
+    watch_flush(w, timer_now_ns());
+  }
+
+  return NULL;
+}
+
+bool watch_init(watch *w) {
+  w->num_dirs = 0;
+  w->num_pending = 0;
+  atomic_init(&w->head, 0);
+  atomic_init(&w->tail, 0);
+  atomic_init(&w->dropped, 0);
 
-    w->buf_len += r;
+  w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (w->fd == -1) {
+    LOG_ERROR("inotify initialization failed with error: %s", strerror(errno));
+    goto fail_inotify;
+  }
+
+  w->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (w->wake_fd == -1) {
+    LOG_ERROR("unable to create watch wake fd: %s", strerror(errno));
+    goto fail_eventfd;
+  }
+
+  pthread_mutex_init(&w->dirs_mutex, NULL);
+  int error;
+  if ((error = pthread_create(&w->thread, NULL, watch_thread, w)) != 0) {
+    LOG_ERROR("unable to create watch thread: %s", strerror(error));
+    goto fail_thread;
   }
 
-  event->name = e->name;
-  event->event_type = e->mask;
-  w->event_len = e->len;
   return true;
+
+fail_thread:
+  pthread_mutex_destroy(&w->dirs_mutex);
+  close(w->wake_fd);
+fail_eventfd:
+  close(w->fd);
+fail_inotify:
+  return false;
+}
+
+void watch_free(watch *w) {
+  if (eventfd_write(w->wake_fd, 1) == -1) {
+    LOG_WARN("unable to wake watch thread: %s", strerror(errno));
+  }
+  pthread_join(w->thread, NULL);
+
+  u32 dropped = atomic_load(&w->dropped);
+  if (dropped > 0) {
+    LOG_WARN("%" PRIu32 " file event(s) dropped", dropped);
+  }
+  pthread_mutex_destroy(&w->dirs_mutex);
+  close(w->wake_fd);
+  if (close(w->fd) == -1) {
+    LOG_WARN("closing inotify fd failed with error: %s", strerror(errno));
+  }
+}
+
+int watch_add(watch *w, const char *path) {
+  pthread_mutex_lock(&w->dirs_mutex);
+  int handle = watch_add_dir(w, path, false);
+  pthread_mutex_unlock(&w->dirs_mutex);
+  return handle;
+}
+
+bool watch_add_recursive(watch *w, const char *path) {
+  pthread_mutex_lock(&w->dirs_mutex);
+  bool success = watch_add_tree(w, path);
+  pthread_mutex_unlock(&w->dirs_mutex);
+  return success;
 }
 
-void watch_event_free(watch *w, watch_event *event) {
-  (void)event;
-  i32 offset = sizeof(struct inotify_event) + w->event_len;
-  memmove(w->buf, &w->buf[offset], w->buf_cap - offset);
-  w->buf_len -= offset;
+void watch_remove(watch *w, int handle) {
+  watch_forget_dir(w, handle);
+  inotify_rm_watch(w->fd, handle);
 }
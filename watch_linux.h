@@ -1,31 +1,78 @@
 #pragma once
 
 #include "types.h"
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/inotify.h>
 #include <linux/limits.h>
 
-typedef struct {
-  int fd;
-  char* buf;
-  i32 buf_len;
-  i32 buf_cap;
-  i32 event_len;
-} watch;
+#define WATCH_MAX_DIRS 64
+#define WATCH_MAX_PATH 256
+#define WATCH_MAX_PENDING 32
+// must be a power of two
+#define WATCH_QUEUE_CAPACITY 32
+// editors tend to produce several events per save, all events for a path
+// within this window of each other are reported as one
+#define WATCH_DEBOUNCE_NS (50 * 1000 * 1000)
 
 typedef enum {
   watch_event_create = IN_CREATE,
   watch_event_delete = IN_DELETE,
   watch_event_modified = IN_MODIFY,
+  watch_event_written = IN_CLOSE_WRITE,
+  watch_event_moved_to = IN_MOVED_TO,
 } watch_event_type;
 
 typedef struct {
-  char *name;
+  // watched directory joined with the name of the file within it
+  char path[WATCH_MAX_PATH];
+  // all coalesced watch_event_type bits
   u32 event_type;
 } watch_event;
 
+typedef struct {
+  int handle;
+  // directories created inside are watched as well
+  bool recursive;
+  char path[WATCH_MAX_PATH];
+} watch_dir;
+
+typedef struct {
+  watch_event event;
+  u64 deadline_ns;
+} watch_pending_event;
+
+// inotify is read on a dedicated thread, which coalesces events and hands
+// them over through a single-producer single-consumer ring, so polling an
+// idle watch costs two atomic loads and no syscall
+typedef struct {
+  int fd;
+  // signalled to stop the watch thread
+  int wake_fd;
+  pthread_t thread;
+
+  pthread_mutex_t dirs_mutex;
+  watch_dir dirs[WATCH_MAX_DIRS];
+  i32 num_dirs;
+
+  // only touched by the watch thread
+  watch_pending_event pending[WATCH_MAX_PENDING];
+  i32 num_pending;
+
+  watch_event queue[WATCH_QUEUE_CAPACITY];
+  atomic_uint_fast32_t head;
+  atomic_uint_fast32_t tail;
+  atomic_uint_fast32_t dropped;
+} watch;
+
 bool watch_init(watch *w);
 void watch_free(watch *w);
+// path is a directory, the events of the files directly inside it are
+// reported
 int watch_add(watch *w, const char *path);
+// watches path and all directories below it, including those created later,
+// returns false if any of them could not be watched
+bool watch_add_recursive(watch *w, const char *path);
 void watch_remove(watch *w, int handle);
+// only a single thread may poll
 bool watch_poll(watch *w, watch_event *event);
-void watch_event_free(watch* w, watch_event *event);
@@ -1,9 +1,10 @@
 #include "window.h"
+#include "debug_utils.h"
 #include "device.h"
+#include "log.h"
 #include "vk_utils.h"
 #include <GLFW/glfw3.h>
 #include <assert.h>
-#include <logger.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -65,8 +66,14 @@ bool swapchain_init(window *w, VkPhysicalDevice physical_device,
                     VkDevice device, VkSurfaceKHR surface,
                     VkSwapchainKHR old_swapchain, VkSwapchainKHR *swapchain,
                     VkSurfaceFormatKHR *format, VkExtent2D *extent) {
+  arena *scratch = scratch_arena();
+  if (!scratch) {
+    goto fail_details;
+  }
+
+  arena_marker marker = arena_mark(scratch);
   swap_chain_support_details details;
-  if (!query_swap_chain_support(physical_device, surface, &details)) {
+  if (!query_swap_chain_support(physical_device, surface, scratch, &details)) {
     LOG_ERROR("error querying swapchain support details");
     goto fail_details;
   }
@@ -152,10 +159,10 @@ bool swapchain_init(window *w, VkPhysicalDevice physical_device,
     LOG_ERROR("unable to create swapchain: %s", vk_error_to_string(result));
   }
 
-  swap_chain_support_details_free(&details);
+  arena_pop(scratch, marker);
   return true;
 fail_indices:
-  swap_chain_support_details_free(&details);
+  arena_pop(scratch, marker);
 fail_details:
   return false;
 }
@@ -164,7 +171,7 @@ void swapchain_free(VkDevice device, VkSwapchainKHR swapchain) {
   vkDestroySwapchainKHR(device, swapchain, NULL);
 }
 VkImage *swapchain_get_images(VkDevice device, VkSwapchainKHR swapchain,
-                              u32 *num_images) {
+                              arena *out, u32 *num_images) {
   VkResult result;
   result = vkGetSwapchainImagesKHR(device, swapchain, num_images, NULL);
   if (result != VK_SUCCESS) {
@@ -172,7 +179,8 @@ VkImage *swapchain_get_images(VkDevice device, VkSwapchainKHR swapchain,
               vk_error_to_string(result));
     return NULL;
   }
-  VkImage *images = malloc(*num_images * sizeof(VkImage));
+  arena_marker marker = arena_mark(out);
+  VkImage *images = arena_push_array(out, VkImage, *num_images);
   if (!images) {
     LOG_ERROR("unable to allocate memory for swapchain image handles");
     return NULL;
@@ -182,7 +190,7 @@ VkImage *swapchain_get_images(VkDevice device, VkSwapchainKHR swapchain,
   if (result != VK_SUCCESS) {
     LOG_ERROR("unable to retrieve swapchain images: %s",
               vk_error_to_string(result));
-    free(images);
+    arena_pop(out, marker);
     return NULL;
   }
 
@@ -190,17 +198,13 @@ VkImage *swapchain_get_images(VkDevice device, VkSwapchainKHR swapchain,
 }
 
 bool swapchain_image_views_init(VkDevice device, VkImage *images,
-                                u32 num_images, VkFormat format,
+                                u32 num_images, VkFormat format, arena *out,
                                 VkImageView **views) {
-  bool allocated = false;
+  arena_marker marker = arena_mark(out);
+  *views = arena_push_array(out, VkImageView, num_images);
   if (!*views) {
-    *views = malloc(num_images * sizeof(VkImageView));
-    if (!*views) {
-      LOG_ERROR("unable to allocate memory for image views");
-      return false;
-    }
-
-    allocated = true;
+    LOG_ERROR("unable to allocate memory for image views");
+    return false;
   }
 
   u32 initialized_views = 0;
@@ -235,11 +239,11 @@ bool swapchain_image_views_init(VkDevice device, VkImage *images,
         vkDestroyImageView(device, (*views)[i], NULL);
       }
 
-      if (allocated) {
-        free(*views);
-      }
+      arena_pop(out, marker);
       return false;
     }
+    DEBUG_NAME(device, VK_OBJECT_TYPE_IMAGE_VIEW, (*views)[initialized_views],
+               "swapchain view %" PRIu32, initialized_views);
     ++initialized_views;
   }
 
@@ -250,16 +254,15 @@ void swapchain_image_views_destroy(VkDevice device, VkImageView *views,
   for (u32 i = 0; i < num_images; ++i) {
     vkDestroyImageView(device, views[i], NULL);
   }
-
-  free(views);
 }
 
 bool framebuffers_init(VkDevice device, u32 num_images,
                        VkImageView *image_views, const VkExtent2D *extent,
-                       VkRenderPass render_pass, VkFramebuffer **framebuffers,
-                       VkImageView color_image_view,
-                       VkImageView depth_image_view) {
-  *framebuffers = malloc(num_images * sizeof(VkFramebuffer));
+                       VkRenderPass render_pass, VkImageView color_image_view,
+                       VkImageView depth_image_view, arena *out,
+                       VkFramebuffer **framebuffers) {
+  arena_marker marker = arena_mark(out);
+  *framebuffers = arena_push_array(out, VkFramebuffer, num_images);
   if (!*framebuffers) {
     LOG_ERROR("unable to allocate framebuffer handle array");
     return false;
@@ -289,6 +292,8 @@ bool framebuffers_init(VkDevice device, u32 num_images,
                 vk_error_to_string(result));
       goto fail;
     }
+    DEBUG_NAME(device, VK_OBJECT_TYPE_FRAMEBUFFER, (*framebuffers)[counter],
+               "framebuffer %" PRIu32, counter);
 
     ++counter;
   }
@@ -299,7 +304,7 @@ fail:
     vkDestroyFramebuffer(device, (*framebuffers)[i], NULL);
   }
 
-  free(*framebuffers);
+  arena_pop(out, marker);
   return false;
 }
 
@@ -308,8 +313,6 @@ void framebuffers_free(VkDevice device, u32 num_images,
   for (u32 i = 0; i < num_images; ++i) {
     vkDestroyFramebuffer(device, framebuffers[i], NULL);
   }
-
-  free(framebuffers);
 }
 
 bool present_sync_objects_init(VkDevice device, present_sync_objects *o) {
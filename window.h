@@ -1,3 +1,4 @@
+#include "arena.h"
 #include "types.h"
 #include <stdbool.h>
 
@@ -23,19 +24,20 @@ bool swapchain_init(window *w, VkPhysicalDevice physical_device,
                     VkSurfaceFormatKHR *format, VkExtent2D *extent);
 void swapchain_free(VkDevice device, VkSwapchainKHR swapchain);
 
+// the image, view and framebuffer handle arrays are pushed onto out
 VkImage *swapchain_get_images(VkDevice device, VkSwapchainKHR swapchain,
-                              u32 *num_images);
+                              arena *out, u32 *num_images);
 bool swapchain_image_views_init(VkDevice device, VkImage *images,
-                                u32 num_images, VkFormat format,
+                                u32 num_images, VkFormat format, arena *out,
                                 VkImageView **views);
 void swapchain_image_views_destroy(VkDevice device, VkImageView *views,
                                    u32 num_images);
 
 bool framebuffers_init(VkDevice device, u32 num_images,
                        VkImageView *image_views, const VkExtent2D *extent,
-                       VkRenderPass render_pass, VkFramebuffer **framebuffers,
-                       VkImageView color_image_view,
-                       VkImageView depth_image_view);
+                       VkRenderPass render_pass, VkImageView color_image_view,
+                       VkImageView depth_image_view, arena *out,
+                       VkFramebuffer **framebuffers);
 void framebuffers_free(VkDevice device, u32 num_images,
                        VkFramebuffer *framebuffers);
 